@@ -0,0 +1,33 @@
+#ifndef BATCH_DELETE_H
+#define BATCH_DELETE_H
+#include <stdint.h>
+#include <stddef.h>
+#include "heapfile.h"
+#include "cursor.h"
+
+// Set-oriented delete.
+// The victims are radix-sorted by (block, slot) so every affected block is
+// fetched and rewritten exactly once, then the index entries are removed in a
+// single pass over the part of btree.db whose key range overlaps the batch.
+// If an affected block had no validity bitmap its records moved, and the index
+// is rebuilt instead.
+
+typedef struct {
+    size_t   requested;
+    size_t   deleted;
+    uint32_t blocks_touched;
+    uint32_t index_removed;
+    int      index_rebuilt;    // 1 = an older block was compacted, btree.db rebuilt
+    double   sort_ms, heap_ms, index_ms, flush_ms;
+} BatchDeleteStats;
+
+// ascending (block, slot) order, LSD radix sort with 16-bit digits
+int  rid_radix_sort(RecordLocation* locs, size_t n);
+
+// locs is reordered (and duplicates dropped) in place
+int  batch_delete(HeapFile* hf, RecordLocation* locs, size_t n, BatchDeleteStats* st);
+// the same with the index of hf in btree_path instead of btree.db
+int  batch_delete_at(HeapFile* hf, const char* btree_path, RecordLocation* locs, size_t n, BatchDeleteStats* st);
+void batch_delete_print(const BatchDeleteStats* st);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include <stdint.h>
+
+// Micro benchmarks run from the CLI. Each prints its own report.
+
+double bench_now_ms(void);   // monotonic wall clock in milliseconds
+
+// per-row decode vs batch kernels for FT_PCT_home > min_key over every block
+int bench_scan(const char *db_filename, float min_key, int iters);
+
+// the same filter / SUM / filter+SUM kernels over NSM, PAX and compressed copies of the data
+int bench_layout(const char *db_filename, float min_key, int iters);
+
+// parallel scan throughput for 1, 2, 4, ... threads up to the --threads setting
+int bench_pscan(const char *db_filename, float min_key, int iters);
+
+// games.txt-shaped rows with random values, for tables larger than the real data
+int bench_gen_csv(const char *csv_path, uint64_t rows, uint64_t seed);
+
+// batch delete of the top 1%..90% of FT_PCT_home, each on a fresh copy of the table.
+// rebuilds btree.db for db_filename when done
+int bench_delete(const char *db_filename, const double *pcts, int n_pcts);
+
+// CSV load throughput in MB/s: the serial loader, then the parallel one with
+// 1, 2, 4, ... threads up to the --threads setting, each checked against the serial file
+int bench_load(const char *csv_path);
+
+// rows parsed per second from a CSV file held in memory: copy + strtok +
+// atof as in hf_load_csv, then the zero-copy scanner with and without SIMD
+int bench_parse(const char *csv_path, int iters);
+
+// reloading a table: serial and parallel CSV loads against importing a binary
+// dump of the same table (dump.h), which has to give the same file
+int bench_import(const char *csv_path);
+
+// durable single-row inserts per second: a block flush or fsync per insert
+// against commits to the write-ahead log, waited for one by one or in groups,
+// then log-only commits from 1..16 threads sharing fsyncs (group commit)
+int bench_commit(const char *csv_path, uint32_t rows);
+
+// restart time against log length: rows from csv_path are inserted into a copy
+// of db_filename under the log, with scattered deletes, first without
+// checkpoints and then with fuzzy checkpoints every 2/3, 2/9 and 2/33 of the
+// log that run left; the process dies and the copy is opened (recovered) again
+int bench_recovery(const char *db_filename, const char *csv_path, uint32_t rows);
+
+// lookups and inserts on btree.db loaded into memory, from 1..16 threads: one
+// mutex or a reader-writer lock around the tree against optimistic lock
+// coupling (bptree_olc.h), for each share of inserts in write_pcts
+int bench_olc(uint32_t ops, const int *write_pcts, int n_pcts);
+
+// readers querying a table through btree.db while it goes through a series of
+// batch deletes: done in place, then as snapshot swaps (snapshot.h). counts
+// the queries that saw an index entry without its record, and their latency
+int bench_snapshot(const char *db_filename, int readers);
+
+// the same queries as separate cold opens (what each CLI call does) and
+// against a query server (server.h) started on the table, from 1..clients
+// connections: queries per second and latency
+int bench_serve(const char *db_filename, int clients, uint32_t requests);
+
+#endif
@@ -1,10 +1,24 @@
 #ifndef BLOCK_H
 #define BLOCK_H
 #include <stdint.h>
+#include "schema.h"
 
 #define BLOCK_SIZE 4096
 #define BLOCK_HDR_SIZE 4  
 
+// block header: bytes 0-1 used count, byte 2 layout, byte 3 flags
+#define BLOCK_FMT_NSM 0   // rows stored one after another (n-ary storage)
+#define BLOCK_FMT_PAX 1   // one minipage per field, all values of a field together
+#define BLOCK_FMT_PACKED 2 // per-field compressed columns, see compress.h
+
+// with BLOCK_FLAG_VALIDITY the last bytes of the block hold one bit per slot
+// (1 = live). a delete only clears the bit, so every other record keeps its
+// slot and the index entries pointing at it stay valid. the used count is then
+// the number of slots handed out, dead ones included, until a vacuum compacts
+// the block. blocks without the flag are compacted on every delete instead.
+#define BLOCK_FLAG_VALIDITY 0x01
+#define BLOCK_FLAG_HAS_DEAD 0x02   // at least one slot is dead
+
 typedef struct {
     uint8_t bytes[BLOCK_SIZE];
 } Block;
@@ -16,9 +30,58 @@ static inline void block_set_used_count(Block* b, uint16_t v) {
     b->bytes[0] = (uint8_t)(v & 0xFF);
     b->bytes[1] = (uint8_t)((v >> 8) & 0xFF);
 }
+static inline uint8_t block_format(const Block* b) {
+    return b->bytes[2];
+}
+static inline void block_set_format(Block* b, uint8_t fmt) {
+    b->bytes[2] = fmt;
+}
+static inline uint8_t block_flags(const Block* b) {
+    return b->bytes[3];
+}
+static inline void block_set_flags(Block* b, uint8_t flags) {
+    b->bytes[3] = flags;
+}
 
-int  block_capacity_records(uint16_t record_size);
+int  block_capacity_records(uint16_t record_size);          // without a validity bitmap
+int  block_capacity_with_bitmap(uint16_t record_size);      // room left after the bitmap
 int  block_write_record(Block* b, uint16_t record_size, int slot, const uint8_t* rec);
 int  block_read_record (const Block* b, uint16_t record_size, int slot, uint8_t* out);
 
+// layout-aware access: rec/out are always the packed (NSM) record bytes.
+// compressed blocks are built whole, block_put_record fails on them
+int  block_put_record(Block* b, const Schema* s, int slot, const uint8_t* rec);
+int  block_get_record(const Block* b, const Schema* s, int slot, uint8_t* out);
+int  block_capacity(const Block* b, const Schema* s);   // max records this block can hold
+
+// empty block of the given layout, with a validity bitmap for NSM/PAX
+void block_init(Block* b, uint8_t fmt);
+
+// validity: a slot is live if it is below the used count and not deleted
+int  block_slot_live(const Block* b, const Schema* s, int slot);
+int  block_kill_slot(Block* b, const Schema* s, int slot);     // -1 if the block has no bitmap
+void block_mark_live(Block* b, const Schema* s, int slot);
+int  block_live_count(const Block* b, const Schema* s);
+int  block_live_slots(const Block* b, const Schema* s, uint16_t* sel);  // all live slots, in order
+int  block_sel_live(const Block* b, const Schema* s, uint16_t* sel, int n); // drops dead slots from sel
+
+// slots an insert can still use: dead ones and the unused tail (0 for compressed blocks)
+int  block_free_slots(const Block* b, const Schema* s);
+// stores rec in the first dead slot, else after the last one. returns the slot, -1 if full
+int  block_insert_record(Block* b, const Schema* s, const uint8_t* rec);
+
+// takes out the live record with the highest slot, the used count shrinks past
+// any dead slots at the end. returns the slot, -1 if there is none (or compressed)
+int  block_pop_record(Block* b, const Schema* s, uint8_t* out);
+
+// removes one record, the records after it move down one slot
+int  block_remove_record(Block* b, const Schema* s, int slot);
+// removes several records in one pass, slots sorted ascending without duplicates
+int  block_remove_records(Block* b, const Schema* s, const uint16_t* slots, int n);
+
+// where the values of one field live: value of slot i is at
+// BLOCK_HDR_SIZE + offset + i * stride. -1 if the field is not stored as
+// fixed-width values (an encoded column of a compressed block)
+int  block_column(const Block* b, const Schema* s, int field, uint16_t* offset, uint16_t* stride);
+
 #endif
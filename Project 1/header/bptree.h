@@ -18,6 +18,28 @@ Header for nodes -> 11B
 - uint8 node_id -> 4B (the id of the node)
 - uint16_t key_count -> 2B (the number of keys in the node)
 - float lower_bound key -> 4B (the lower bound that can be accessed from that node)
+
+
+
+Augmented internal nodes
+
+Every child pointer of an internal node also carries the aggregate of the
+subtree below it, so COUNT/SUM/AVG over a key range and rank/percentile
+queries only need one root-to-leaf path instead of walking the leaves.
+
+- uint32_t count -> 4B (number of leaf entries in the child subtree)
+- double sum -> 8B (sum of the keys in the child subtree)
+
+The aggregates are stored as an array after the key/pointer area, indexed by
+child position (child 0 is the pointer in front of the first key).
+
+Leaves are chained both ways: the last 4B of a leaf hold the next leaf id and
+the 4B before that hold the previous leaf id, so descending scans can start
+at the rightmost leaf and walk left.
+
+Node 0 of the index file is a meta page (level 0) holding the root id and
+height, so the root is found with a single read. The whole-tree aggregate is
+not stored there; it is computed from the root node.
 */
 
 #ifndef BPTREE_H
@@ -30,13 +52,21 @@ Header for nodes -> 11B
 #define KEY_SIZE 4
 #define RECORD_POINTER_SIZE 8
 #define NODE_POINTER_SIZE 8
+#define CHILD_AGG_SIZE 12
 
-#define MAX_INTERNAL_KEYS (((NODE_SIZE - NODE_HDR_SIZE) / (KEY_SIZE + NODE_POINTER_SIZE)) - 1)
+#define MAX_INTERNAL_KEYS (((NODE_SIZE - NODE_HDR_SIZE) / (KEY_SIZE + NODE_POINTER_SIZE + CHILD_AGG_SIZE)) - 1)
 #define MAX_LEAF_KEYS     (((NODE_SIZE - NODE_HDR_SIZE) / (KEY_SIZE + RECORD_POINTER_SIZE)) - 1)
 #define MIN_INTERNAL_KEYS ((MAX_INTERNAL_KEYS) / 2)
 #define MIN_LEAF_KEYS     ((MAX_LEAF_KEYS + 1) / 2)
 #define MAX_INT_CHILDREN (MAX_INTERNAL_KEYS + 1)
 
+// offset of the per-child aggregate array inside an internal node
+#define INT_AGG_OFFSET (NODE_POINTER_SIZE + MAX_INTERNAL_KEYS * (KEY_SIZE + NODE_POINTER_SIZE))
+
+#define BTREE_META_LEVEL 0
+#define BTREE_META_NODE_ID 0
+#define BTREE_NO_NODE UINT32_MAX
+
 
 typedef struct  {
     uint16_t key_count;
@@ -50,8 +80,27 @@ int node_init(Node* n, uint8_t node_type, uint32_t node_id);
 int node_write_record_key(Node *n, float key, uint32_t block_id, int slot);
 void set_int_node_lb(Node *n, float lower_bound);
 int link_leaf_node(Node *left, uint32_t next_node_id);
+int link_leaf_prev(Node *right, uint32_t prev_node_id);
+int node_set_first_child(Node *n, uint32_t node_id);
 int node_write_node_key(Node *n, float key, uint32_t node_id);
 int encode_node(const Node *n, uint8_t *dst);
 int decode_node(const uint8_t* src, Node* n);
 
+// leaf accessors
+float    leaf_get_key(const Node *n, int i);
+void     leaf_get_record(const Node *n, int i, uint32_t *block_id, uint16_t *slot_id);
+void     leaf_set_record(Node *n, int i, uint32_t block_id, uint16_t slot_id);
+uint32_t leaf_get_next(const Node *n);
+uint32_t leaf_get_prev(const Node *n);
+int      leaf_insert_at(Node *n, int pos, float key, uint32_t block_id, int slot);
+int      leaf_remove_at(Node *n, int pos);
+
+// internal node accessors (child i, i = 0..key_count)
+float    int_get_key(const Node *n, int i);      // separator in front of child i+1
+uint32_t int_get_child(const Node *n, int i);
+void     int_get_child_agg(const Node *n, int i, uint32_t *count, double *sum);
+void     int_set_child_agg(Node *n, int i, uint32_t count, double sum);
+int      int_insert_child(Node *n, int pos, float key, uint32_t node_id, uint32_t count, double sum);
+void     int_total_agg(const Node *n, uint32_t *count, double *sum);
+
 #endif
@@ -0,0 +1,56 @@
+#ifndef BPTREE_OLC_H
+#define BPTREE_OLC_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "bptree.h"
+#include "file_manager_btree.h"
+
+// B+ tree in memory for many threads at once, with optimistic lock coupling.
+// The nodes of btree.db are loaded into one array, in the same format (Node),
+// and stay addressed by their node id.
+//
+// Every node has a version word: bit 1 = write-locked, the bits above count
+// the writes. A reader notes the version of a node, reads what it needs (a
+// child id, a key) and checks the version again before it uses what it read;
+// if the node was locked or has changed, the operation starts over from the
+// root. Readers write nothing to shared memory, so lookups on many cores do not
+// fight over the cache lines of the upper levels.
+// A writer descends the same way and only locks the leaf it changes, by
+// turning the version it read into a locked one. A full node is split on the
+// way down: the writer locks its parent and the node, splits, and starts over.
+// The parent always has room, so a split never climbs back up holding locks.
+//
+// The per-child aggregates of internal nodes are not maintained here (every
+// insert would have to lock the root); olc_save recomputes them.
+
+typedef struct {
+    _Atomic uint64_t version;
+    Node node;
+} OlcNode;
+
+typedef struct {
+    OlcNode*         nodes;     // by node id, 0 = meta page (unused)
+    uint32_t         cap;
+    _Atomic uint32_t next_id;   // next node to allocate
+    _Atomic uint32_t root;      // BTREE_NO_NODE = empty tree
+    _Atomic uint64_t restarts;  // operations that had to start over
+    uint64_t         generation;  // of the loaded file, kept by olc_save
+} OlcTree;
+
+// loads btree.db (through fm) with room for extra_nodes new nodes
+int  olc_load(OlcTree* t, BtreeFileManager* fm, uint32_t extra_nodes);
+void olc_free(OlcTree* t);
+
+// safe from any number of threads at the same time
+int  olc_insert(OlcTree* t, float key, uint32_t block_id, uint16_t slot_id);
+// 1 and the first entry with key if there is one, 0 if not
+int  olc_lookup(OlcTree* t, float key, uint32_t* block_id, uint16_t* slot_id);
+
+// single-threaded, no operation may run meanwhile.
+// entries in leaf order, -1 if a leaf or the chain is out of key order
+int  olc_count(OlcTree* t, uint64_t* entries);
+// writes every node back with fresh aggregates, and the meta page
+int  olc_save(OlcTree* t, BtreeFileManager* fm);
+
+#endif
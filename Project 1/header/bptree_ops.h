@@ -0,0 +1,31 @@
+#ifndef BPTREE_OPS_H
+#define BPTREE_OPS_H
+
+#include <stdint.h>
+#include "bptree.h"
+#include "file_manager_btree.h"
+#include "cursor.h"
+
+// Result of an aggregate query over the augmented tree
+typedef struct {
+    uint32_t count;
+    double   sum;
+    uint32_t nodes_accessed;   // index pages read to answer the query
+} RangeAggregate;
+
+// incremental maintenance: keeps the per-child aggregates on the root-to-leaf path up to date
+int bptree_insert(BtreeFileManager *fm, float key, uint32_t block_id, uint16_t slot_id);
+// removes the entries of all the given records in one pass: only the nodes whose key
+// range overlaps the batch are visited, each is read and written once. locs in any order
+int bptree_delete_batch(BtreeFileManager *fm, const RecordLocation *locs, size_t n, uint32_t *removed);
+// inserts the entries of all the given records, in key order (locs is sorted in place)
+int bptree_insert_batch(BtreeFileManager *fm, RecordLocation *locs, size_t n, uint32_t *inserted);
+
+// aggregate queries, O(height) page reads
+// bounds are inclusive when the matching flag is set; pass -INFINITY / INFINITY for open ends
+int bptree_range_aggregate(BtreeFileManager *fm, float lo, int lo_inclusive, float hi, int hi_inclusive, RangeAggregate *out);
+int bptree_rank(BtreeFileManager *fm, float key, uint32_t *rank);        // entries with key < given key
+int bptree_select(BtreeFileManager *fm, uint32_t k, float *key);         // k-th smallest key (0-based)
+int bptree_percentile(BtreeFileManager *fm, double p, float *key);       // p in [0, 1]
+
+#endif // BPTREE_OPS_H
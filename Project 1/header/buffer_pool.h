@@ -5,12 +5,17 @@
 #include "block.h"
 #include "file_manager.h"
 
+struct Wal;
+struct WalDirty;
+
 typedef struct {
     bool     valid;
     bool     dirty;
     uint32_t block_id;
     Block    block;
     uint64_t tick; // last access time
+    uint64_t lsn;  // end of the last log record for this block, 0 = not logged
+    uint64_t rec_lsn; // first record since the block was last written
 } Frame;
 
 typedef struct {
@@ -18,12 +23,22 @@ typedef struct {
     Frame*   frames;
     int      capacity;
     uint64_t clock_tick;
+    struct Wal* wal;  // with a log, a block is only written after its records are
 } BufferPool;
 
 int  bp_init(BufferPool* bp, FileManager* fm, int capacity);
 void bp_destroy(BufferPool* bp);
 Block* bp_fetch(BufferPool* bp, uint32_t block_id); 
 void   bp_mark_dirty(BufferPool* bp, uint32_t block_id);
+// dirty, and changed by the log record from rec_lsn to lsn
+void   bp_mark_logged(BufferPool* bp, uint32_t block_id, uint64_t rec_lsn, uint64_t lsn);
 int    bp_flush_all(BufferPool* bp);
+// the checkpoint's flusher: writes the dirty blocks first changed before lsn
+// (rec_lsn 0, dirty without a log record, counts as before any lsn)
+int    bp_flush_older(BufferPool* bp, uint64_t lsn, uint32_t* written);
+// the dirty blocks with their rec_lsn, out has room for every frame
+uint32_t bp_dirty_table(BufferPool* bp, struct WalDirty* out);
+// drops the frames of block first_block and later without writing them (file truncated)
+void   bp_discard_from(BufferPool* bp, uint32_t first_block);
 
 #endif
@@ -7,12 +7,15 @@
 
 typedef struct
 {
-    float key;
+    float key;          // lower bound of the child
     uint32_t node_id;
+    uint32_t count;     // entries in the child subtree
+    double sum;         // sum of keys in the child subtree
 } ChildListEntry;
 
-int scan_db(HeapFile *hf);
-int bulkload(float *lower_bound_array, int child_count, BtreeFileManager *fm, int *total_nodes);
-int pack_internals(ChildListEntry *child_list, int node_count, int level, int total_nodes, int *parent_count, ChildListEntry *parent_list, BtreeFileManager *fm);
+int scan_db(HeapFile *hf);                           // into btree.db
+int scan_db_into(HeapFile *hf, const char *path);
+int bulkload(ChildListEntry *child_list, int child_count, BtreeFileManager *fm, BtreeMeta *meta);
+int pack_internals(ChildListEntry *child_list, int node_count, int level, uint32_t first_id, int *parent_count, ChildListEntry *parent_list, BtreeFileManager *fm);
 
-#endif // BUILD_BPLUS_H
\ No newline at end of file
+#endif // BUILD_BPLUS_H
@@ -0,0 +1,31 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+#include <stdint.h>
+#include <stddef.h>
+#include "heapfile.h"
+
+// CLUSTER: rewrite the heap file sorted on one column.
+// Live records are read block by block into runs of at most mem_bytes, each
+// run is sorted in memory and, if more than one is needed, spilled to
+// "<dbfile>.run<i>". The runs are then merged with a min-heap straight into a
+// new heap file of the same layout, which replaces the old one. Records with
+// equal keys keep their old order. btree.db is rebuilt afterwards because
+// every record has a new (block, slot).
+
+typedef struct {
+    uint64_t records;
+    uint32_t runs;              // 1 = sorted in memory, no run files
+    uint32_t blocks_before;
+    uint32_t blocks_after;
+    double   sort_ms, merge_ms, index_ms;
+} ClusterStats;
+
+int  hf_cluster(const char* db_path, int field, size_t mem_bytes, ClusterStats* st);
+void cluster_print(const ClusterStats* st);
+
+// blocks read by the FT_PCT_home > lo query: by a heap scan with zone maps,
+// and the distinct blocks the index range points into
+int  cluster_range_blocks(HeapFile* hf, const char* btree_filename, float lo,
+                          uint32_t* scan_blocks, uint32_t* index_blocks);
+
+#endif
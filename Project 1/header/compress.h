@@ -0,0 +1,69 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+#include <stdint.h>
+#include "block.h"
+#include "schema.h"
+
+// Compressed block format (BLOCK_FMT_PACKED).
+// After the 4-byte block header comes a directory with one entry per field,
+// then the data of each field, one field after another:
+//
+//   PLAIN  raw fixed-width values, like a PAX minipage
+//   DICT   distinct raw values, then one bit-packed code per row
+//   FOR    frame of reference: int32/bool stored as bit-packed (value - base)
+//   DEC    decimal floats: round(value * 10^decimals) - base, bit-packed
+//
+// The encoding of each field is picked per block when the block is built: the
+// smallest one that can represent every value exactly wins. Rows keep their
+// slot numbers, so (block, slot) addresses work as in the other layouts.
+//
+// Blocks are written whole through a CBlockBuilder. Single records can be read
+// or removed, but not overwritten in place. The validity bitmap (block.h) sits
+// in the last (rows + 7) / 8 bytes of the block.
+
+#define CBLOCK_MAX_ROWS 1024     // never more rows than a selection vector holds
+#define CBLOCK_DICT_MAX 256      // larger dictionaries are not worth it in 4 KB
+#define CBLOCK_DIR_ENTRY 12
+#define CBLOCK_SLACK 8           // bit unpacking reads 8 bytes at a time
+
+enum { CENC_PLAIN = 0, CENC_DICT = 1, CENC_FOR = 2, CENC_DEC = 3 };
+
+// running statistics of one field over the rows staged so far
+typedef struct {
+    int64_t  imin, imax;         // integer fields
+    double   fmin, fmax;         // float fields
+    int      decimals;           // digits needed so far, > 4 = not a short decimal
+    uint16_t n_dict;
+    int      dict_ok;            // 0 once there are more than CBLOCK_DICT_MAX values
+    uint8_t* dict;               // n_dict raw values of the field's width
+} CFieldStats;
+
+typedef struct {
+    const Schema* s;
+    uint8_t*      rows;          // staged packed records
+    int           n_rows;
+    CFieldStats   f[MAX_FIELDS];
+} CBlockBuilder;
+
+int  cblock_builder_init(CBlockBuilder* cb, const Schema* s);
+void cblock_builder_free(CBlockBuilder* cb);
+// 0 = row staged, 1 = the block is full (row not staged, finish and retry)
+int  cblock_builder_add(CBlockBuilder* cb, const uint8_t* rec);
+// encodes the staged rows into out and empties the builder
+void cblock_builder_finish(CBlockBuilder* cb, Block* out);
+
+int  cblock_get_record(const Block* b, const Schema* s, int slot, uint8_t* out);
+int  cblock_remove_record(Block* b, const Schema* s, int slot);
+// re-encodes the block with its live rows only. new_slot[i] = new slot of row i, -1 if it was dead
+int  cblock_compact(Block* b, const Schema* s, int16_t* new_slot);
+int  cblock_field_encoding(const Block* b, int field);
+int  cblock_plain_column(const Block* b, const Schema* s, int field, uint16_t* offset, uint16_t* stride);
+
+// scan kernels that work on the encoded values. predicates are evaluated on the
+// codes (a code range for FOR/DEC, a pass table for DICT) so rows are never decoded
+int    cblock_select_float(const Block* b, const Schema* s, int field, float lo, float hi, uint16_t* sel);
+int    cblock_select_int32(const Block* b, const Schema* s, int field, int32_t lo, int32_t hi, uint16_t* sel);
+double cblock_sum_float(const Block* b, const Schema* s, int field, const uint16_t* sel, int n);
+float  cblock_value_float(const Block* b, const Schema* s, int field, int slot);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef CSV_LOADER_H
+#define CSV_LOADER_H
+#include <stdint.h>
+#include <stddef.h>
+#include "heapfile.h"
+
+// Parallel CSV load.
+// The input is mapped into memory and cut into chunks of about
+// CSV_CHUNK_BYTES that end on a newline. Worker threads take the next chunk,
+// parse its lines into rows with the zero-copy scanner (csv_parse.h) and hand
+// the rows back. The calling thread is the only writer: it takes the parsed
+// chunks in file order and appends their rows through the same appender as
+// hf_load_csv, so the file it builds is the same byte for byte. At most
+// CSV_WINDOW_PER_THREAD chunks per worker are parsed ahead of the writer,
+// which bounds the memory to a few chunks.
+
+#define CSV_CHUNK_BYTES (4u << 20)
+#define CSV_WINDOW_PER_THREAD 2
+
+typedef struct {
+    uint64_t bytes;             // size of the input file
+    uint64_t rows;              // rows appended
+    uint64_t skipped;           // lines that did not parse
+    uint32_t chunks;
+    int      threads;           // parser threads
+    double   parse_ms;          // summed over the parser threads
+    double   write_ms;          // appending rows, not counting waits for the parsers
+    double   total_ms;
+    uint32_t first_block;       // the loaded rows start at (first_block, first_slot)
+    uint16_t first_slot;
+} CsvLoadStats;
+
+// threads = 0 uses pscan_default_threads()
+int  hf_load_csv_parallel(HeapFile* hf, const char* csv_path, int threads, CsvLoadStats* st);
+void csv_load_print(const CsvLoadStats* st);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef CSV_PARSE_H
+#define CSV_PARSE_H
+#include <stdint.h>
+#include <stddef.h>
+#include "schema.h"
+
+// Zero-copy CSV row parser.
+// The scanner walks a buffer in 64-byte windows. For each window it builds a
+// bitmask of the separator bytes (',', '\t', '\n') with SSE2 compares, or AVX2
+// when the build enables it, and a byte loop otherwise. Cells are cut at the
+// set bits, so the bytes between separators are never looked at one by one.
+// Integers and short decimals are parsed by dedicated routines, other numbers
+// fall back to strtod. The rows are the same as those of parse_row_by_index,
+// including its strtok behaviour of merging runs of separators.
+// The scanner never reads outside [begin, end).
+
+#define CSV_SCAN_MAX_COLS 64
+
+typedef struct {
+    const char* pos;        // start of the next line
+    const char* end;
+    const char* base;       // start of the current 64-byte window
+    uint64_t    mask;       // separators in the window
+    int         simd;       // 0 = byte loop only (for comparison)
+    const CsvIdx* idx;      // header mapping slot_of was built for
+    int8_t      slot_of[CSV_SCAN_MAX_COLS];
+    int         want;       // last column that is needed
+} CsvScan;
+
+void csv_scan_init(CsvScan* s, const char* begin, const char* end, int simd);
+// parses the line at the cursor and moves past its newline.
+// 1 = row parsed, 0 = line skipped (missing columns), -1 = no lines left
+int  csv_scan_row(CsvScan* s, const CsvIdx* idx, Row* out);
+
+// one line without its newline, same result as parse_row_by_index
+int  parse_row_span(const char* line, size_t len, const CsvIdx* idx, Row* out);
+
+// name of the separator kernel compiled in ("AVX2", "SSE2" or "scalar")
+const char* csv_scan_kernel(void);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef CURSOR_H
+#define CURSOR_H
+
+#include <stdint.h>
+#include "bptree.h"
+#include "file_manager_btree.h"
+#include "heapfile.h"
+#include "scan_kernel.h"
+
+// Location of one record in the heap file
+typedef struct {
+    uint32_t block_id;    // Which data block contains this record
+    uint16_t slot_id;     // Which slot within that block
+    float key_value;      // The FT_PCT_home value for this record
+} RecordLocation;
+
+// Key range on FT_PCT_home. Use -INFINITY / INFINITY for open ends.
+typedef struct {
+    float lo;
+    float hi;
+    int   lo_inclusive;
+    int   hi_inclusive;
+} KeyRange;
+
+int key_in_range(const KeyRange *r, float key);
+
+// Index range cursor: walks the leaf chain and only ever holds one leaf in memory.
+// A reverse cursor starts at the rightmost qualifying leaf and returns keys in
+// descending order by following the prev pointers.
+typedef struct {
+    BtreeFileManager fm;
+    Node      leaf;
+    int       pos;                    // next entry in leaf
+    int       reverse;
+    KeyRange  range;
+    uint64_t  limit;                  // 0 = no limit
+    uint64_t  returned;
+    int       done;
+    int       borrowed;               // fm was opened by the caller, close leaves it open
+    uint32_t  index_nodes_accessed;
+    uint32_t  leaf_nodes_accessed;
+} IndexCursor;
+
+int  idx_cursor_open(IndexCursor *c, const char *btree_filename, const KeyRange *range, uint64_t limit);
+int  idx_cursor_open_reverse(IndexCursor *c, const char *btree_filename, const KeyRange *range, uint64_t limit);
+// either direction over an index that is already open, e.g. the one of a snapshot
+int  idx_cursor_open_on(IndexCursor *c, BtreeFileManager *fm, const KeyRange *range, uint64_t limit, int reverse);
+int  idx_cursor_next(IndexCursor *c, RecordLocation *out);     // 1 = row, 0 = end, -1 = error
+void idx_cursor_close(IndexCursor *c);
+
+// Heap scan cursor: copies one block at a time out of the buffer pool.
+// Blocks whose zone map range cannot overlap the key range are skipped unread.
+// Each loaded block is filtered in one batch into a selection vector and only
+// the selected records are decoded.
+typedef struct {
+    HeapFile *hf;
+    Block     blk;
+    uint32_t  block_id;               // block currently held in blk
+    uint16_t  sel[SEL_MAX];           // qualifying slots of blk
+    int       n_sel;
+    int       sel_pos;                // next entry in sel
+    float     klo, khi;               // range as inclusive float bounds
+    KeyRange  range;
+    uint64_t  limit;                  // 0 = no limit
+    uint64_t  returned;
+    int       done;
+    uint32_t  blocks_accessed;
+    uint32_t  blocks_pruned;          // skipped thanks to the zone map
+} HeapCursor;
+
+int  heap_cursor_open(HeapCursor *c, HeapFile *hf, const KeyRange *range, uint64_t limit);
+int  heap_cursor_next(HeapCursor *c, RecordLocation *loc, Row *row); // 1 = row, 0 = end, -1 = error
+void heap_cursor_close(HeapCursor *c);
+
+#endif // CURSOR_H
@@ -0,0 +1,39 @@
+#ifndef DUMP_H
+#define DUMP_H
+#include <stdint.h>
+#include "heapfile.h"
+
+// Binary dump of a table, for reloads without CSV parsing.
+//
+//   header  "GDMP", version (2B), n_fields (2B), record_size (2B), pad (2B),
+//           then per field name (32B), type (1B), pad (1B), width (2B)
+//   chunks  rows in the chunk (4B), then one column after another:
+//           rows * width bytes of raw field values, as stored in a record
+//   end     a chunk of 0 rows, then the total row count (8B)
+//
+// The values are the encoded record bytes, so an import copies them into
+// records with memcpy and nothing is parsed. The schema in the header has to
+// match the schema of the table it is imported into.
+
+#define DUMP_MAGIC "GDMP"
+#define DUMP_VERSION 1
+#define DUMP_CHUNK_ROWS 4096
+
+typedef struct {
+    uint64_t rows;
+    uint64_t bytes;         // size of the file written or read
+    uint32_t chunks;
+    double   ms;
+    uint32_t first_block;   // import: the rows start at (first_block, first_slot)
+    uint16_t first_slot;
+} DumpStats;
+
+// live records of hf, in heap order
+int  hf_export_bin(HeapFile* hf, const char* path, DumpStats* st);
+// the same as a tab-separated CSV file that load reads back to the same values
+int  hf_export_csv(HeapFile* hf, const char* path, DumpStats* st);
+// appends the rows of a binary dump to hf through the bulk appender
+int  hf_import_bin(HeapFile* hf, const char* path, DumpStats* st);
+void dump_print(const char* what, const DumpStats* st);
+
+#endif
@@ -4,9 +4,15 @@
 #include <stdio.h>
 #include "block.h"
 
+// files written by newer versions start with a header page (see heapfile.h),
+// recognised by its magic; data block b is then page b + 1 of the file
+#define FM_HEADER_MAGIC "HEAP"
+
 typedef struct {
     FILE* fp;
     const char* path;
+    uint32_t base;      // pages in front of block 0: 1 with a header page, else 0
+    int      lazy;      // 1 = writes are not flushed one by one (a log makes them durable)
 
     // data_reads and data_writes is for I/O count
     uint64_t data_reads;
@@ -17,6 +23,15 @@ int  fm_open(FileManager* fm, const char* path, const char* mode);
 void fm_close(FileManager* fm);
 int  fm_read_block(FileManager* fm, uint32_t block_id, Block* out);
 int  fm_write_block(FileManager* fm, uint32_t block_id, const Block* in);
+// n consecutive blocks from first on with a single write, counted as n block writes
+int  fm_write_blocks(FileManager* fm, uint32_t first, uint32_t n, const Block* in);
 uint32_t fm_alloc_block(FileManager* fm, Block* zeroed); 
+int  fm_truncate(FileManager* fm, uint32_t n_blocks);   // keep blocks [0, n_blocks)
+uint32_t fm_block_count(FileManager* fm);               // data blocks in the file
+int  fm_sync(FileManager* fm);                          // everything written so far on disk
+
+// the header page; -1 if the file has none. writing one is only possible while the file is empty
+int  fm_read_header(FileManager* fm, Block* out);
+int  fm_write_header(FileManager* fm, const Block* in);
 
 #endif
@@ -10,11 +10,37 @@
 extern "C" {
 #endif
 
+struct Wal;
+struct WalDirty;
+
+// node pages changed under a write-ahead log that are not in the file yet
+#define BTFM_CACHE_SLOTS 1024
+
+typedef struct BtfmCached {
+    uint32_t node_id;    // BTREE_NO_NODE = free slot
+    uint8_t *page;
+    uint64_t rec_lsn;    // first log record since the page was last written
+} BtfmCached;
+
 typedef struct BtreeFileManager {
     FILE   *fp;
     size_t  page_size;   // must equal NODE_SIZE
+    struct Wal *wal;     // NULL = nodes are written to the file right away
+    BtfmCached *cache;   // with a log: logged pages, written back in groups
+    uint32_t cache_n;
 } BtreeFileManager;
 
+// Contents of the meta page (node 0).
+typedef struct BtreeMeta {
+    uint32_t root_id;     // BTREE_NO_NODE when the tree is empty
+    uint32_t first_leaf;  // head of the leaf chain
+    uint32_t last_leaf;   // tail of the leaf chain, start of descending scans
+    uint32_t node_count;  // tree nodes, excluding the meta page
+    uint32_t leaf_count;
+    uint8_t  height;      // 1 = root is a leaf
+    uint64_t generation;  // of the heap file the tree indexes (snapshot.h), 0 in older files
+} BtreeMeta;
+
 // Open (create if missing). page_size must be NODE_SIZE.
 int  btfm_open(BtreeFileManager *fm, const char *path, size_t page_size);
 
@@ -24,6 +50,20 @@ int  btfm_close(BtreeFileManager *fm);
 // fsync/flush buffers.
 int  btfm_sync(BtreeFileManager *fm);
 
+// from now on every node write is logged in the active transaction of wal
+// and the page is kept in memory until a write-back. the log's checkpoint
+// writes the pages back too
+int  btfm_use_wal(BtreeFileManager *fm, struct Wal *wal);
+// forces the log, writes every cached page and syncs the file
+int  btfm_writeback(BtreeFileManager *fm);
+// the same for the cached pages first changed before lsn (a checkpoint)
+int  btfm_writeback_older(BtreeFileManager *fm, uint64_t lsn, uint32_t *written);
+// the cached pages with their rec_lsn, out has room for BTFM_CACHE_SLOTS
+uint32_t btfm_dirty_table(BtreeFileManager *fm, struct WalDirty *out);
+
+// Number of pages in the file, the meta page included.
+int  btfm_page_count(BtreeFileManager *fm, uint32_t *out_pages);
+
 // Allocate a new page for a node at EOF and return its node_id.
 int  btfm_alloc_node(BtreeFileManager *fm, uint32_t *out_node_id);
 
@@ -33,6 +73,10 @@ int  btfm_write_node(BtreeFileManager *fm, const Node *n);
 // Read node by node_id into *out.
 int  btfm_read_node(BtreeFileManager *fm, uint32_t node_id, Node *out);
 
+// Read / write the meta page. read returns -1 if the file has no meta page.
+int  btfm_read_meta(BtreeFileManager *fm, BtreeMeta *out);
+int  btfm_write_meta(BtreeFileManager *fm, const BtreeMeta *meta);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
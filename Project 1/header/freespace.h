@@ -0,0 +1,39 @@
+#ifndef FREESPACE_H
+#define FREESPACE_H
+#include <stdint.h>
+
+// Free-space map = free slots of every data block, kept in "<dbfile>.fsm".
+// On disk it is one byte per block (free slots, capped at 255). In memory the
+// blocks with room are also chained into FSM_BUCKETS lists by how many slots
+// they have free, so an insert finds a block in O(1) and moving a block to
+// another bucket after an insert or delete is O(1) too.
+
+#define FSM_PATH_MAX 512
+#define FSM_BUCKETS 8            // bucket 0 = full, bucket k holds 2^(k-1) .. 2^k - 1 free slots
+#define FSM_NONE UINT32_MAX
+
+typedef struct {
+    char      path[FSM_PATH_MAX];
+    uint8_t*  free;              // free slots per block
+    uint32_t* next;              // bucket lists, FSM_NONE terminated
+    uint32_t* prev;
+    uint32_t  head[FSM_BUCKETS];
+    uint32_t  n_blocks;
+    uint32_t  capacity;
+    int       valid;             // 0 = no map, rebuilt from the blocks before the first insert
+    int       dirty;
+} FreeSpaceMap;
+
+int  fsm_init(FreeSpaceMap* fsm, const char* db_path);     // empty map
+int  fsm_load(FreeSpaceMap* fsm, const char* db_path);     // -1 if missing
+int  fsm_save(FreeSpaceMap* fsm);
+void fsm_free(FreeSpaceMap* fsm);
+
+// records the free slot count of a block, blocks past the end are added
+int      fsm_set(FreeSpaceMap* fsm, uint32_t block_id, int free_slots);
+// a block with at least one free slot, the fullest such block first; FSM_NONE if there is none
+uint32_t fsm_find(const FreeSpaceMap* fsm);
+// free slots over all blocks
+uint64_t fsm_total_free(const FreeSpaceMap* fsm);
+
+#endif
@@ -3,29 +3,134 @@
 #include <stdint.h>
 #include "schema.h"
 #include "buffer_pool.h"
+#include "zonemap.h"
+#include "freespace.h"
+#include "compress.h"
+#include "wal.h"
+
+// Header page (page 0 of files created by hf_create):
+//   "HEAP", format version (2B), layout (1B), pad (1B), n_blocks (4B),
+//   live records (8B), n_fields (2B), record_size (2B), then per field
+//   name (32B), type (1B), pad (1B), width (2B), and after the room for
+//   MAX_FIELDS fields the snapshot generation (8B, see snapshot.h)
+// It is kept in memory while the file is open, counts are updated by every
+// load, insert and delete, and the page is written back with the zone map.
+// Files without it (older versions) still open: the schema is the default one,
+// the block count comes from the file size and counting records takes a scan.
+#define HF_FORMAT_VERSION 1
 
 typedef struct {
     Schema      schema;
     FileManager fm;
     BufferPool  bp;
     uint32_t    n_blocks;   // data blocks
+    uint8_t     layout;     // BLOCK_FMT_* used for newly written blocks
+    ZoneMap     zm;         // per-block min/max, zm.valid = 0 if the .zm file is missing
+    FreeSpaceMap fsm;       // per-block free slots, rebuilt on the first insert if the .fsm file is missing
+    int         has_header; // 0 = file written before header pages existed
+    uint16_t    version;
+    uint64_t    n_records;  // live records, valid with a header
+    uint64_t    generation; // bumped by each swap and each change in place
+    int         header_dirty;
+    Wal*        wal;        // NULL = no log, every block write is flushed on its own
+    int         read_only;  // another process writes the file through its log: nothing is written
+    WalRecoveryStats recovery;  // what hf_open replayed
 } HeapFile;
 
 // for db
 int  hf_create(HeapFile* hf, const char* path, const Schema* s, int buf_frames);
+// a non-empty "<path>.wal" is recovered first (see wal.h), also into btree.db.
+// if a running writer holds the log, the file is opened read-only instead:
+// the log is not touched and neither blocks, header nor maps are written.
+// with the default log on (hf_set_default_wal) that open fails
 int  hf_open  (HeapFile* hf, const char* path, int buf_frames);
 void hf_close (HeapFile* hf);
 
+// write-ahead logging. with it, inserts and deletes log what they change in
+// the heap blocks (and the index, through btfm_use_wal) and the blocks are
+// written back lazily. a transaction is what happens between begin and
+// commit; commit with wait = 0 leaves the log write to group commit.
+// bulk loads and vacuum are not logged, they start with a checkpoint and sync
+// the file when done. set_default makes hf_create/hf_open turn the log on
+void hf_set_default_wal(int on, uint32_t group_commits);
+// log written between two automatic fuzzy checkpoints, 0 = none
+void hf_set_checkpoint_bytes(uint64_t bytes);
+int  hf_enable_wal(HeapFile* hf);
+uint64_t hf_begin(HeapFile* hf);            // 0 without a log
+// also takes a fuzzy checkpoint when one is due
+int  hf_commit(HeapFile* hf, int wait);
+// writes every dirty block and index page, syncs them and empties the log
+int  hf_checkpoint(HeapFile* hf);
+// writes only the pages dirty since before the last checkpoint, logs the
+// dirty page table and drops the log that recovery no longer needs
+int  hf_fuzzy_checkpoint(HeapFile* hf);
+
 // // loading from txt
 int  hf_load_csv(HeapFile* hf, const char* csv_path);
 
+// sequential writer behind the loader: rows go to the end of the file in the
+// order they come, in the file's layout. They first fill the room left in the
+// last block (unless it is compressed), then new blocks. The blocks are built in a
+// private batch of HF_APPEND_BATCH pages, not in the buffer pool, and each full
+// batch goes to the file with one write, so every block is written once and
+// never read back. end writes the last batch and saves the zone map,
+// free-space map and header page
+#define HF_NO_BLOCK UINT32_MAX
+#define HF_APPEND_BATCH 64
+typedef struct {
+    uint32_t      block_id;     // row block being filled
+    int           slot, cap;
+    CBlockBuilder cb;           // compressed layout: rows staged for the next block
+    uint64_t      rows;
+    Block*        batch;        // pages not yet written, the last one is block_id
+    uint32_t      batch_first;  // block id of batch[0]
+    uint32_t      batch_n;
+    uint32_t      first_block;  // where the appended rows start
+    int           first_slot;
+} HfAppender;
+
+int  hf_append_begin(HeapFile* hf, HfAppender* ap);
+int  hf_append_row  (HeapFile* hf, HfAppender* ap, const Row* r);
+// the same for a record that is already encoded (schema record_size bytes)
+int  hf_append_record(HeapFile* hf, HfAppender* ap, const uint8_t* rec);
+int  hf_append_end  (HeapFile* hf, HfAppender* ap);
+
+// writes the header page, zone map and free-space map if they changed
+int  hf_sync_meta(HeapFile* hf);
+
+// a change in place starts (vacuum, insert_bplus, appending loads, ingest):
+// the header gets a new generation at once, so snapshots see that their
+// version is gone and no longer trust the index, whose generation is now
+// behind. hf_stamp_index writes the heap out and gives index_path the new
+// generation once it is updated, if it had the old one. both do nothing for
+// files without a header
+int  hf_new_generation(HeapFile* hf);
+int  hf_stamp_index(HeapFile* hf, const char* index_path);
+
 // stats and printing
 uint32_t hf_count_records(HeapFile* hf);
 int  hf_records_per_block(const HeapFile* hf);
 void hf_print_stats(HeapFile* hf);
 int  hf_scan_print_firstN(HeapFile* hf, int limit);
 
+// rebuild the zone map from the blocks on disk
+int  hf_build_zonemap(HeapFile* hf);
+// rebuild the free-space map from the blocks on disk
+int  hf_build_fsm(HeapFile* hf);
+
+// stores one row in a free slot found through the free-space map, or in a new
+// block when no block has room. returns the location the row was given
+int  hf_insert(HeapFile* hf, const Row* r, uint32_t* block_id, uint16_t* slot_id);
+
+// fetch and decode one record by its location
+int  hf_read_row(HeapFile* hf, uint32_t block_id, uint16_t slot_id, Row* out);
+
 // minhwan: Record deletion functionality
 int hf_delete_record(HeapFile* hf, uint32_t block_id, uint16_t slot_id);
 
+// deletes a group of records of one block with a single fetch. slots sorted
+// ascending without duplicates. returns the number deleted, *compacted is set
+// when the block had no validity bitmap and the surviving records moved
+int hf_delete_slots(HeapFile* hf, uint32_t block_id, const uint16_t* slots, int n, int* compacted);
+
 #endif
@@ -0,0 +1,45 @@
+#ifndef INGEST_H
+#define INGEST_H
+#include <stdint.h>
+#include "heapfile.h"
+#include "file_manager_btree.h"
+
+// Streaming ingest.
+// Lines come from a stream (stdin or a FIFO) and keep coming: the first one is
+// a CSV header as in load, every other one a row. Rows are collected into a
+// micro-batch until it holds batch_rows rows or its first row has waited
+// batch_ms. A batch is committed with one appender run, so its blocks, the zone
+// map, the free-space map and the header page are written once per batch. Then
+// its index entries go into the tree with one flush of btree.db.
+
+#define INGEST_BATCH_ROWS 10000
+#define INGEST_BATCH_MS 200
+#define INGEST_READ_BUF (1u << 20)   // longest line that can be read
+
+typedef struct {
+    uint32_t batch_rows;
+    uint32_t batch_ms;
+    BtreeFileManager* index;    // NULL = heap only
+    int      verbose;           // one line per batch
+} IngestOpts;
+
+typedef struct {
+    uint64_t rows;
+    uint64_t skipped;           // lines that did not parse
+    uint64_t bytes;
+    uint32_t batches;
+    uint64_t index_entries;
+    double   total_ms;          // first byte read to the last commit
+    double   commit_ms;         // summed over the batches
+    double   lat_p50, lat_p99, lat_max;  // first row of a batch read -> batch committed
+} IngestStats;
+
+int  hf_ingest(HeapFile* hf, int fd, const IngestOpts* o, IngestStats* st);
+void ingest_print(const IngestStats* st);
+
+// index entries for the live rows from (first_block, first_slot) to the end of
+// the heap, inserted in key order. rows is how many there are (a capacity hint)
+int  hf_index_rows(HeapFile* hf, BtreeFileManager* btfm, uint32_t first_block, uint16_t first_slot,
+                   uint64_t rows, uint32_t* inserted);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef PARALLEL_SCAN_H
+#define PARALLEL_SCAN_H
+#include <stdint.h>
+#include <stddef.h>
+#include "heapfile.h"
+#include "cursor.h"
+
+// Parallel heap scan.
+// [0, n_blocks) is cut into morsels of a few blocks. Every worker thread starts
+// with an equal share of the morsels in its own queue and takes them from the
+// front. A worker whose queue is empty steals from the back of another queue,
+// so a slow thread does not hold up the scan. Each worker reads through its own
+// file handle and keeps its own partial result. The calling thread merges the
+// partials in morsel order, so the output is the same for any thread count.
+
+#define PSCAN_MORSEL_BLOCKS 16
+#define PSCAN_MAX_THREADS 64
+
+typedef struct {
+    KeyRange range;            // predicate on FT_PCT_home
+    int      filter;           // 0 = every record matches (no predicate)
+    int      collect;          // also return the location of every match
+    int      threads;          // 0 = pscan_default_threads()
+    uint32_t morsel_blocks;    // 0 = PSCAN_MORSEL_BLOCKS
+} ParallelScanSpec;
+
+typedef struct {
+    uint64_t records;          // live records in the blocks that were read
+    uint64_t matches;
+    double   sum;              // SUM(FT_PCT_home) of the matches
+    uint32_t blocks_read;
+    uint32_t blocks_pruned;    // skipped thanks to the zone map
+    uint32_t morsels_stolen;
+    int      threads;
+    RecordLocation* locs;      // matches in (block, slot) order when collect is set
+    size_t   n_locs;
+} ScanResult;
+
+// thread count used when a spec leaves it at 0 (starts at the number of cores)
+void pscan_set_default_threads(int n);
+int  pscan_default_threads(void);
+
+// dirty pages of hf are flushed first, the workers read the file directly.
+// free out->locs when done
+int  pscan_run(HeapFile* hf, const ParallelScanSpec* spec, ScanResult* out);
+
+#endif
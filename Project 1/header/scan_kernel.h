@@ -0,0 +1,41 @@
+#ifndef SCAN_KERNEL_H
+#define SCAN_KERNEL_H
+#include <stdint.h>
+#include "block.h"
+#include "schema.h"
+
+// Batch predicate kernels over one block.
+// They test a single column directly in the packed record bytes (record i's
+// column lives at BLOCK_HDR_SIZE + i * stride + offset) without copying or
+// decoding rows, and write the slots that pass into sel[] (a selection vector).
+// Return value = number of selected slots.
+//
+// Bounds are inclusive. An exclusive float bound can be turned into an
+// inclusive one with nextafterf, see kernel_float_bounds.
+
+#define SEL_MAX 1024   // enough for any block
+
+void kernel_float_bounds(float lo, int lo_inclusive, float hi, int hi_inclusive, float *lo_out, float *hi_out);
+
+int  block_select_float(const Block *b, int n, uint16_t stride, uint16_t offset,
+                        float lo, float hi, uint16_t *sel);
+int  block_select_int32(const Block *b, int n, uint16_t stride, uint16_t offset,
+                        int32_t lo, int32_t hi, uint16_t *sel);
+
+// SUM of a float column over the selected slots, or over slots [0, n) when sel is NULL
+double block_sum_float(const Block *b, int n, uint16_t stride, uint16_t offset, const uint16_t *sel);
+
+// layout-aware versions over all live records of a block: they take the field
+// instead of offset/stride and also run on compressed blocks, where they work
+// on the encoded values. deleted slots are dropped from the selection.
+// block_column_sum sums every live record when sel is NULL
+int    block_filter_float(const Block *b, const Schema *s, int field, float lo, float hi, uint16_t *sel);
+int    block_filter_int32(const Block *b, const Schema *s, int field, int32_t lo, int32_t hi, uint16_t *sel);
+double block_column_sum(const Block *b, const Schema *s, int field, const uint16_t *sel, int n_sel);
+float  block_value_float(const Block *b, const Schema *s, int field, int slot);
+
+// portable versions (always scalar), used as the reference in benchmarks
+int  block_select_float_scalar(const Block *b, int n, uint16_t stride, uint16_t offset,
+                               float lo, float hi, uint16_t *sel);
+
+#endif
@@ -14,6 +14,10 @@ typedef struct {
     uint16_t  width;   // bytes for this field in the packed record
 } Field;
 
+// positions of the fields set up by schema_init_default
+enum { FLD_GAME_ID = 0, FLD_GAME_DATE_EST, FLD_HOME_TEAM_ID, FLD_VISITOR_TEAM_ID,
+       FLD_FT_PCT_HOME, FLD_HOME_TEAM_WINS };
+
 typedef struct {
     Field    fields[MAX_FIELDS];
     uint16_t n_fields;
@@ -50,6 +54,13 @@ void schema_print(const Schema* s);
 void encode_row(const Schema* s, const Row* r, uint8_t* dst /*size record_size*/);
 void decode_row(const Schema* s, const uint8_t* src, Row* r);
 
+// numeric view of one field of a decoded row (dates become yyyymmdd), used by
+// zone maps and other per-column synopses
+double row_field_value(const Schema* s, const Row* r, int field);
+int32_t date_key(const char* game_date);   // "dd/mm/yyyy" -> yyyymmdd
+int schema_field_index(const Schema* s, const char* name);  // case-insensitive, -1 if missing
+uint16_t schema_field_offset(const Schema* s, int field);   // byte offset inside the packed record
+
 // quick CSV -> Row (very simple, assumes known header order)
 int parse_row_from_csv_line(const char* line, Row* out);
 
@@ -0,0 +1,75 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include <stdint.h>
+#include <stddef.h>
+#include "schema.h"
+#include "cursor.h"
+#include "snapshot.h"
+
+// Query server.
+// `serve` opens a table and btree.db once (a snapshot, see snapshot.h) and
+// answers requests on a Unix domain socket, so the buffer pool, the index
+// root and the zone map stay warm from one query to the next. One thread
+// serves every connection with poll(), a request at a time, so the buffer
+// pool and the index file need no locks. Sockets are non-blocking: answers a
+// client has not taken wait in its own buffer, and it is not read from until
+// they are below SRV_OUT_HIGH, so a client that does not read only stalls
+// itself. Before each request the snapshot is checked (two stat calls); once
+// maintenance has swapped in new files or written to them in place, they are
+// opened again.
+//
+// Protocol, in host byte order like the files (the socket is local). A
+// connection sends any number of requests and gets one response to each, in
+// order.
+// request:  len (4B, bytes after it), op (1B), pad (3B), then by op
+//   SRV_PING       -
+//   SRV_STATS      -                            -> records (8B), blocks (4B),
+//                                                  generation (8B), index (1B)
+//   SRV_AGGREGATE  lo (4B float), hi (4B float) -> count (8B), sum (8B double)
+//   SRV_RANGE      lo, hi, limit (4B)           -> n (4B), then n rows
+//   SRV_SHUTDOWN   -
+// response: len (4B, bytes after it), status (1B, SRV_OK or an error), pad (3B),
+//           payload
+// row: game_id (4B), date (10B), home team (4B), visitor team (4B),
+//      FT_PCT_home (4B float), home team wins (1B)
+// Ranges are on FT_PCT_home, both ends inclusive. A range answer holds at most
+// SRV_MAX_ROWS rows, a limit of 0 asks for that many.
+
+#define SRV_SOCKET "project_c.sock"
+#define SRV_MAX_CLIENTS 256
+#define SRV_MAX_ROWS 10000
+#define SRV_HDR 8
+#define SRV_ROW_SIZE 27
+#define SRV_MAX_REQUEST 64     // a request longer than this closes the connection
+#define SRV_OUT_HIGH (64 << 10) // unsent answers above which a connection is not read
+#define SRV_MAX_BACKLOG (1 << 20)   // unsent answers that close the connection
+
+enum { SRV_PING = 1, SRV_STATS, SRV_AGGREGATE, SRV_RANGE, SRV_SHUTDOWN };
+enum { SRV_OK = 0, SRV_BAD_REQUEST, SRV_FAILED };
+
+typedef struct {
+    uint64_t requests;
+    uint64_t connections;
+    uint32_t reopens;           // snapshots opened again after a swap
+    double   busy_ms;           // spent answering
+} ServerStats;
+
+// the two queries, on whichever version s holds: through its index, or
+// scanning the heap when it has none. rows must have room for limit rows
+int  srv_aggregate(Snapshot* s, float lo, float hi, uint64_t* count, double* sum);
+int  srv_range(Snapshot* s, float lo, float hi, uint32_t limit, Row* rows, uint32_t* n);
+
+// serves until SRV_SHUTDOWN or SIGINT / SIGTERM. ready_fd >= 0 gets one byte
+// once the socket accepts connections
+int  srv_run(const char* db_path, const char* socket_path, int buf_frames, int ready_fd, ServerStats* st);
+
+// ---- client side ----
+
+int  srv_connect(const char* socket_path);
+// sends op with body and waits for the answer. *resp is grown as needed
+// (free it when done); returns the status, -1 if the connection failed
+int  srv_call(int fd, uint8_t op, const void* body, uint32_t body_len, uint8_t** resp, uint32_t* cap,
+              uint32_t* resp_len);
+void srv_decode_row(const uint8_t* p, Row* r);
+
+#endif
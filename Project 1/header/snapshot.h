@@ -0,0 +1,75 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <stdint.h>
+#include <stddef.h>
+#include "heapfile.h"
+#include "file_manager_btree.h"
+#include "batch_delete.h"
+
+// Snapshots: a reader keeps one consistent version of a table and its index
+// while a bulk delete or an index rebuild runs, without locks.
+//
+// Maintenance never writes to files a reader may have open: it works on whole
+// copies. A bulk delete copies the table ("<dbfile>.new" with its .zm and
+// .fsm) and btree.db ("btree.db.new"), deletes on the copies, syncs them and
+// renames them over the originals: the heap file, its maps, then the index.
+// The copy costs O(table size) however few rows go: a clone of shared extents
+// where the file system has them (FICLONE on btrfs or xfs), otherwise
+// copy_file_range, so the bytes at least stay in the kernel, then an fsync
+// of the copy. An index rebuild writes "btree.db.new" and renames it
+// (scan_db_into).
+// An open file outlives its name, so a reader goes on reading the version it
+// opened until it closes it, and never sees a page half way through a change.
+// Each swap stores a new generation in the heap header and the index meta page.
+//
+// snap_open opens the index, then the heap with its maps, and keeps them if no
+// name was replaced meanwhile and both carry the same generation; otherwise a
+// swap was in flight and it opens again. A heap that stays newer than its
+// index for SNAP_SWAP_WAIT_MS was swapped without its index (a crash between
+// two renames, or a CLUSTER whose rebuild is still running) and an index of
+// another generation does not belong to the table at all: the snapshot then
+// has no index and index queries fall back to scanning the heap.
+//
+// vacuum, insert_bplus, the appending loads and ingest still change the files
+// in place. They store a new generation in the heap header before the first
+// change and give it to the index when both are written out, so meanwhile a
+// snapshot opened has no index. A snapshot kept open notices them with
+// snap_stale, which compares size and modification time as well as the inode.
+//
+// Only one maintenance operation may run at a time, readers any number.
+
+#define SNAP_SWAP_WAIT_MS 50
+
+// what stat says of a file, to tell whether it was replaced or written since
+typedef struct {
+    uint64_t ino, size;
+    int64_t  mtime_ns;
+} SnapStamp;
+
+typedef struct {
+    char             path[512];     // hf.fm.path points here
+    HeapFile         hf;
+    BtreeFileManager ix;
+    int              has_index;     // 0: no btree.db, or not of this generation
+    uint64_t         generation;
+    uint32_t         retries;       // opens repeated because a swap was in flight
+    SnapStamp        heap_at, ix_at;  // at open; ix_at of the btree.db turned down too, zero if none
+} Snapshot;
+
+int  snap_open(Snapshot* s, const char* db_path, int buf_frames);
+void snap_close(Snapshot* s);
+// 1 if the files of s were replaced or written since it was opened
+int  snap_stale(const Snapshot* s);
+
+typedef struct {
+    BatchDeleteStats del;
+    uint64_t generation;            // of the new version
+    double   copy_ms, swap_ms;
+} SnapDeleteStats;
+
+// batch_delete on copies of db_path and btree.db, which then replace them.
+// fails while a writer holds the log of db_path, and holds it itself until
+// the swap is done
+int  snap_delete(const char* db_path, RecordLocation* locs, size_t n, SnapDeleteStats* st);
+
+#endif
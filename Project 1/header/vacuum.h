@@ -0,0 +1,33 @@
+#ifndef VACUUM_H
+#define VACUUM_H
+#include <stdint.h>
+#include "heapfile.h"
+
+// Heap vacuum.
+// Live records are moved from the end of the file into the holes of earlier
+// row blocks (two fingers: the first block with room, the last block with
+// records) until they meet; the empty tail is then cut off the file.
+// Compressed blocks with dead rows are merged first: their live rows are
+// encoded again into as few compressed blocks as they fill, and the places
+// left over become empty row blocks, cut off with the tail or filled. Every
+// record that moves is written to a remap table (old rid -> new rid), and one
+// pass over the leaves of the index rewrites the entries it names, so the
+// index is kept instead of rebuilt. Zone map and free-space map are rebuilt
+// tight at the end.
+
+typedef struct {
+    uint32_t blocks_before;
+    uint32_t blocks_after;
+    uint64_t live_records;
+    uint64_t moved;                // records that got a new rid
+    uint32_t packed_compacted;     // compressed blocks re-encoded
+    uint32_t packed_after;         // compressed blocks they were merged into
+    uint64_t index_remapped;       // index entries rewritten
+    int      index_found;          // 0 = no index file, nothing to remap
+    double   move_ms, index_ms, flush_ms;
+} VacuumStats;
+
+int  hf_vacuum(HeapFile* hf, const char* btree_filename, VacuumStats* st);
+void vacuum_print(const VacuumStats* st);
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef WAL_H
+#define WAL_H
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Write-ahead log, "<dbfile>.wal".
+// Every change to a heap block or a B+ tree node is logged as the byte ranges
+// it changed, with their old and new contents, before the page may reach the
+// file. Redo writes the new bytes and undo the old ones, so both can be
+// repeated any number of times. A transaction is durable once its commit
+// record is on disk; the pages themselves are written back lazily (eviction,
+// checkpoint, close).
+//
+// Group commit: a committing thread that finds no write in progress becomes
+// the leader. If other transactions are open, it waits up to group_usec for
+// them to commit too, then writes and fsyncs all buffered records at once.
+// Committers that arrive meanwhile wait for the leader, or lead the next
+// group. A commit with wait = 0 only buffers its record; the log is written
+// when group_commits records have piled up or at the next forced write, which
+// is how one process turns a run of small transactions into few fsyncs.
+//
+// Only the process holding the lock may replay or empty the log: a log held
+// by a running writer is not a crash, and hf_open leaves it alone.
+//
+// Recovery on open, ARIES style:
+//   analysis  read the log up to the first torn or corrupt record, note which
+//             transactions committed
+//   redo      apply every record in log order (repeating history)
+//   undo      roll the transactions without a commit back, newest record first
+// The files are then synced and the log is emptied. Because redo and undo only
+// write bytes, a crash during recovery just means recovery runs again.
+//
+// Fuzzy checkpoints keep the log short without stopping writers for a full
+// flush. Each one writes only the pages that have been dirty since before the
+// previous checkpoint, syncs them, and logs the dirty page table (every page
+// still dirty, with the lsn of its first change not yet on disk) and the open
+// transaction. Recovery redoes a record only if its page is in that table and
+// the record is not older than the page's first change (analysis adds pages
+// first changed after the checkpoint). The log before the oldest of those lsns,
+// the checkpoint itself and the first record of the open transaction is not
+// needed any more; the rest is copied to a new file that replaces the log.
+//
+// file:  "WLOG", version (4B), start lsn (8B), then records
+// record len (4B), type (1B), file (1B), pad (2B), page (4B), txn (8B),
+//        payload, crc32 of everything before it (4B)
+// update payload: n ranges (2B), then per range offset (2B), length (2B),
+//        old bytes, new bytes
+// checkpoint payload: n dirty (4B), per page file (1B), pad (3B), page (4B),
+//        first lsn (8B); n open (4B), per transaction txn (8B), first lsn (8B)
+// An lsn is the position of a record in the log since it was first created,
+// header included (so 0 is never one); dropping records moves start lsn
+// forward, so lsns never repeat.
+
+#define WAL_MAGIC "WLOG"
+#define WAL_VERSION 1
+#define WAL_HDR_SIZE 16
+#define WAL_REC_HDR 20
+#define WAL_GROUP_COMMITS 64    // buffered commits that trigger a log write
+#define WAL_GROUP_USEC 200      // how long a leader waits for other committers
+#define WAL_CHECKPOINT_BYTES (8u << 20)  // log written between two checkpoints
+
+enum { WAL_UPDATE = 1, WAL_COMMIT = 2, WAL_CHECKPOINT = 3 };
+enum { WAL_FILE_HEAP = 0, WAL_FILE_INDEX = 1 };
+
+struct BtreeFileManager;
+
+typedef struct Wal {
+    int             fd;
+    char            path[512];
+    pthread_mutex_t mu;
+    pthread_cond_t  done;           // a group write finished
+    pthread_cond_t  joined;         // a commit arrived while the leader gathers
+    uint8_t*        buf;            // records not yet handed to a write
+    size_t          len, cap;
+    uint8_t*        spare;          // the leader writes from here meanwhile
+    size_t          spare_cap;
+    uint64_t        start_lsn;      // lsn of the first record in the file
+    uint64_t        end_lsn;        // after the last record, buffered ones included
+    uint64_t        flushed_lsn;    // written and synced up to here
+    uint64_t        commit_lsn;     // after the last commit record
+    int             leader;         // a group write is running
+    uint32_t        pending;        // commits in buf
+    uint32_t        open_txns;
+    uint32_t        group_commits;
+    uint32_t        group_usec;
+    uint64_t        next_txn;
+    uint64_t        active;         // transaction of the storage layer (0 = none)
+    uint64_t        active_first;   // lsn of its first record, 0 = none yet
+    struct BtreeFileManager* index; // written back and synced by a checkpoint
+    uint64_t        ckpt_lsn;       // lsn of the last checkpoint record
+    uint64_t        ckpt_bytes;     // log between automatic checkpoints, 0 = none
+
+    uint64_t        commits, syncs, bytes;
+    uint64_t        checkpoints, dropped;   // log bytes dropped by checkpoints
+    uint64_t        ckpt_pages;     // pages the checkpoints wrote
+} Wal;
+
+// one entry of the dirty page table
+typedef struct WalDirty {
+    uint8_t  file;
+    uint32_t page;
+    uint64_t rec_lsn;           // first change that may not be in the file
+} WalDirty;
+
+// a writer holds an exclusive flock on the log from wal_open to wal_close;
+// wal_open fails if another process has it
+int  wal_open(Wal* w, const char* db_path);
+int  wal_close(Wal* w);             // writes what is buffered
+// takes that lock without attaching the log, e.g. to recover it. returns the
+// open log (close it to let go), -1 if there is none, -2 if a writer has it
+int  wal_lock(const char* db_path);
+
+uint64_t wal_begin(Wal* w);         // new transaction, also made the active one
+int  wal_commit(Wal* w, uint64_t txn, int wait);
+// writes and syncs every record up to lsn (all of them for UINT64_MAX)
+int  wal_force(Wal* w, uint64_t lsn);
+// drops every record: only after all logged pages were written and synced
+int  wal_truncate(Wal* w);
+// drops the records before lsn: the rest of the log is copied to a new file
+int  wal_truncate_before(Wal* w, uint64_t lsn);
+
+// logs the difference between two versions of a page. *lsn is where the
+// record starts and *end where it ends (both 0 and nothing logged when the
+// versions are equal), either may be NULL
+int  wal_log_update(Wal* w, uint64_t txn, uint8_t file, uint32_t page, const uint8_t* before,
+                    const uint8_t* after, size_t size, uint64_t* lsn, uint64_t* end);
+// logs and forces a checkpoint record with the dirty page table. *low is the
+// oldest lsn recovery can still need
+int  wal_log_checkpoint(Wal* w, const WalDirty* dirty, uint32_t n, uint64_t* low);
+// an automatic checkpoint is due
+int  wal_checkpoint_due(Wal* w);
+
+// ---- recovery ----
+
+typedef struct {
+    int      fd;                // -1: records of this file are skipped
+    uint32_t page_base;         // pages in front of page 0
+    uint32_t page_size;
+} WalTarget;
+
+typedef struct {
+    uint64_t records;           // valid records in the log
+    uint64_t log_bytes;
+    uint32_t committed, losers;
+    uint64_t redone, undone;    // update records applied
+    uint64_t skipped;           // redo not needed, the page was already written
+    int      checkpoint;        // a checkpoint record was found
+    uint64_t redo_lsn;          // oldest change redone
+    int      torn_tail;         // the log ended in a partial record
+    double   ms;
+} WalRecoveryStats;
+
+// 1 if "<db_path>.wal" holds any records
+int  wal_pending(const char* db_path);
+// replays "<db_path>.wal" onto the targets (indexed by file), syncs them and
+// empties the log. a missing or empty log is not an error
+int  wal_recover(const char* db_path, WalTarget* targets, int n_targets, WalRecoveryStats* st);
+void wal_recovery_print(const WalRecoveryStats* st);
+
+#endif
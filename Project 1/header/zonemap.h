@@ -0,0 +1,48 @@
+#ifndef ZONEMAP_H
+#define ZONEMAP_H
+#include <stdint.h>
+#include "block.h"
+#include "schema.h"
+
+// Zone map = per-block synopsis kept in "<dbfile>.zm".
+// For every data block it stores the number of records and, per field, the
+// min/max value (dates as yyyymmdd), so a scan can skip a block whose range
+// cannot satisfy the predicate without reading it.
+
+#define ZM_MAX_COLS 8
+#define ZM_PATH_MAX 512
+
+typedef struct {
+    uint16_t used;               // records in the block
+    uint16_t nulls;              // FT_PCT_home values that are NaN (missing)
+    double   min[ZM_MAX_COLS];
+    double   max[ZM_MAX_COLS];
+} ZoneEntry;
+
+typedef struct {
+    char       path[ZM_PATH_MAX];
+    ZoneEntry* entries;
+    uint32_t   n_blocks;
+    uint32_t   capacity;
+    uint16_t   n_cols;
+    int        valid;            // 0 = no zone map, scans read every block
+    int        dirty;
+} ZoneMap;
+
+int  zm_init(ZoneMap* zm, const char* db_path, uint16_t n_cols);   // empty map
+int  zm_load(ZoneMap* zm, const char* db_path);                    // -1 if missing
+int  zm_save(ZoneMap* zm);
+void zm_free(ZoneMap* zm);
+
+// maintenance
+int  zm_reset_block(ZoneMap* zm, uint32_t block_id);
+void zm_add_row(ZoneMap* zm, const Schema* s, uint32_t block_id, const Row* r);
+int  zm_rebuild_block(ZoneMap* zm, const Schema* s, uint32_t block_id, const Block* b);
+// one record less; min/max are left as they are, a superset is still correct
+void zm_remove_row(ZoneMap* zm, uint32_t block_id);
+
+// pruning: 0 only when no record of the block can have lo <= col <= hi (bounds per flags)
+int  zm_block_may_match(const ZoneMap* zm, uint32_t block_id, int col,
+                        double lo, int lo_inclusive, double hi, int hi_inclusive);
+
+#endif
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch_delete.h"
+#include "bptree_ops.h"
+#include "build_bplus.h"
+#include "bench.h"
+
+// this file is for deleting a whole set of records at once.
+// phases: sort the record ids, rewrite the heap block by block, fix the index,
+// flush. each phase is timed on its own so the report shows where time goes.
+
+#define RADIX_BITS 16
+#define RADIX_BUCKETS (1u << RADIX_BITS)
+
+// digit d of the (block << 16 | slot) key: 0 = slot, 1/2 = low/high half of block
+static uint32_t rid_digit(const RecordLocation* r, int d)
+{
+    if (d == 0)
+        return r->slot_id;
+    return (r->block_id >> (16 * (d - 1))) & (RADIX_BUCKETS - 1);
+}
+
+int rid_radix_sort(RecordLocation* locs, size_t n)
+{
+    if (n < 2)
+        return 0;
+    RecordLocation* tmp = malloc(n * sizeof(RecordLocation));
+    size_t* count = malloc(RADIX_BUCKETS * sizeof(size_t));
+    if (!tmp || !count) {
+        free(tmp);
+        free(count);
+        return -1;
+    }
+
+    RecordLocation* src = locs;
+    RecordLocation* dst = tmp;
+    for (int d = 0; d < 3; d++) {
+        memset(count, 0, RADIX_BUCKETS * sizeof(size_t));
+        for (size_t i = 0; i < n; i++)
+            count[rid_digit(&src[i], d)]++;
+        // a digit that is the same everywhere does not change the order
+        if (count[rid_digit(&src[0], d)] == n)
+            continue;
+
+        size_t pos = 0;
+        for (uint32_t k = 0; k < RADIX_BUCKETS; k++) {
+            size_t c = count[k];
+            count[k] = pos;
+            pos += c;
+        }
+        for (size_t i = 0; i < n; i++)
+            dst[count[rid_digit(&src[i], d)]++] = src[i];
+        RecordLocation* t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != locs)
+        memcpy(locs, src, n * sizeof(RecordLocation));
+    free(tmp);
+    free(count);
+    return 0;
+}
+
+int batch_delete(HeapFile* hf, RecordLocation* locs, size_t n, BatchDeleteStats* st)
+{
+    return batch_delete_at(hf, "btree.db", locs, n, st);
+}
+
+int batch_delete_at(HeapFile* hf, const char* btree_path, RecordLocation* locs, size_t n, BatchDeleteStats* st)
+{
+    memset(st, 0, sizeof(BatchDeleteStats));
+    st->requested = n;
+    if (!hf || n == 0)
+        return 0;
+
+    // phase 1: group the victims by block
+    double t0 = bench_now_ms();
+    if (rid_radix_sort(locs, n) != 0)
+        return -1;
+    size_t u = 1;
+    for (size_t i = 1; i < n; i++) {
+        if (locs[i].block_id != locs[u - 1].block_id || locs[i].slot_id != locs[u - 1].slot_id)
+            locs[u++] = locs[i];
+    }
+    n = u;
+    double t1 = bench_now_ms();
+    st->sort_ms = t1 - t0;
+
+    // phase 2: each affected block is fetched and rewritten once. with a log,
+    // the heap and the index change in one transaction
+    hf_begin(hf);
+    uint16_t slots[SEL_MAX];
+    int compacted_any = 0;
+    for (size_t i = 0; i < n; ) {
+        uint32_t b = locs[i].block_id;
+        int k = 0;
+        while (i < n && locs[i].block_id == b) {
+            if (k < SEL_MAX)
+                slots[k++] = locs[i].slot_id;
+            i++;
+        }
+        int compacted;
+        int d = hf_delete_slots(hf, b, slots, k, &compacted);
+        if (d < 0) {
+            fprintf(stderr, "Failed to delete records of block %u\n", b);
+            return -1;
+        }
+        st->deleted += (size_t)d;
+        st->blocks_touched++;
+        compacted_any |= compacted;
+    }
+    double t2 = bench_now_ms();
+    st->heap_ms = t2 - t1;
+
+    // phase 3: the index. record ids are still valid unless a block was compacted
+    if (compacted_any) {
+        st->index_rebuilt = 1;
+        // the rebuild is not logged: the log must not hold pages of the old tree
+        if (hf->wal && (hf_commit(hf, 1) != 0 || hf_checkpoint(hf) != 0))
+            return -1;
+        if (scan_db_into(hf, btree_path) != 0) {
+            fprintf(stderr, "Failed to rebuild B+ tree index\n");
+            return -1;
+        }
+    } else {
+        BtreeFileManager btfm;
+        if (btfm_open(&btfm, btree_path, NODE_SIZE) != 0) {
+            fprintf(stderr, "Failed to open B+ tree file\n");
+            return -1;
+        }
+        int rc = hf->wal ? btfm_use_wal(&btfm, hf->wal) : 0;
+        if (rc == 0)
+            rc = bptree_delete_batch(&btfm, locs, n, &st->index_removed);
+        if (rc == 0)
+            rc = hf_commit(hf, 1);
+        if (btfm_close(&btfm) != 0)
+            rc = -1;
+        if (rc != 0) {
+            fprintf(stderr, "Failed to remove the index entries\n");
+            return -1;
+        }
+    }
+    double t3 = bench_now_ms();
+    st->index_ms = t3 - t2;
+
+    // phase 4: write the dirty blocks, the zone map, the free-space map and the header
+    bp_flush_all(&hf->bp);
+    hf_sync_meta(hf);
+    st->flush_ms = bench_now_ms() - t3;
+    return 0;
+}
+
+void batch_delete_print(const BatchDeleteStats* st)
+{
+    printf("Batch delete: %zu requested, %zu deleted in %u blocks\n",
+           st->requested, st->deleted, st->blocks_touched);
+    printf("  sort  %10.3f ms  (radix, by block and slot)\n", st->sort_ms);
+    printf("  heap  %10.3f ms  (one rewrite per block)\n", st->heap_ms);
+    if (st->index_rebuilt)
+        printf("  index %10.3f ms  (rebuilt, older blocks were compacted)\n", st->index_ms);
+    else
+        printf("  index %10.3f ms  (%u entries removed in one pass)\n", st->index_ms, st->index_removed);
+    printf("  flush %10.3f ms\n", st->flush_ms);
+    printf("  total %10.3f ms\n", st->sort_ms + st->heap_ms + st->index_ms + st->flush_ms);
+}
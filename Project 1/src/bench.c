@@ -0,0 +1,1855 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "heapfile.h"
+#include "scan_kernel.h"
+#include "compress.h"
+#include "parallel_scan.h"
+#include "batch_delete.h"
+#include "build_bplus.h"
+#include "bptree_ops.h"
+#include "csv_loader.h"
+#include "csv_parse.h"
+#include "dump.h"
+#include "bptree_olc.h"
+#include "snapshot.h"
+#include "server.h"
+
+// this file holds the benchmarks behind the bench_* commands.
+// data blocks are read into memory first so the timings measure CPU work, not I/O.
+
+double bench_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// reads every data block of the heap file into one array
+static Block *load_all_blocks(HeapFile *hf)
+{
+    Block *blocks = malloc((size_t)(hf->n_blocks ? hf->n_blocks : 1) * sizeof(Block));
+    if (!blocks)
+        return NULL;
+    for (uint32_t b = 0; b < hf->n_blocks; b++) {
+        if (fm_read_block(&hf->fm, b, &blocks[b]) != 0) {
+            free(blocks);
+            return NULL;
+        }
+    }
+    return blocks;
+}
+
+static void report(const char *name, uint64_t records, uint64_t matches, double ms)
+{
+    double secs = ms / 1000.0;
+    printf("  %-28s %10.3f ms  %8.1f M records/s  (%llu matches)\n", name, ms,
+           secs > 0 ? records / secs / 1e6 : 0.0, (unsigned long long)matches);
+}
+
+int bench_scan(const char *db_filename, float min_key, int iters)
+{
+    HeapFile hf;
+    if (hf_open(&hf, db_filename, 64) != 0) {
+        fprintf(stderr, "Failed to open database file: %s\n", db_filename);
+        return -1;
+    }
+    if (hf.layout == BLOCK_FMT_PACKED) {
+        // the strided kernels need fixed-width columns
+        printf("%s is compressed, use bench_layout to time its kernels\n", db_filename);
+        hf_close(&hf);
+        return 0;
+    }
+    Block *blocks = load_all_blocks(&hf);
+    if (!blocks) {
+        hf_close(&hf);
+        return -1;
+    }
+
+    const int cap = block_capacity_records(hf.schema.record_size);
+    float lo, hi;
+    kernel_float_bounds(min_key, 0, INFINITY, 1, &lo, &hi);
+
+    uint64_t records = 0;
+    for (uint32_t b = 0; b < hf.n_blocks; b++) {
+        int used = block_used_count(&blocks[b]);
+        records += used > cap ? cap : used;
+    }
+    records *= (uint64_t)iters;
+
+    printf("=== Scan kernel benchmark: FT_PCT_home > %.3f ===\n", min_key);
+    printf("Blocks: %u, iterations: %d\n", hf.n_blocks, iters);
+
+    // 1. the per-row path: copy record, decode whole row, test one float
+    uint8_t recbuf[512];
+    Row r;
+    uint64_t m_row = 0;
+    double t0 = bench_now_ms();
+    for (int it = 0; it < iters; it++) {
+        for (uint32_t b = 0; b < hf.n_blocks; b++) {
+            int used = block_used_count(&blocks[b]);
+            if (used > cap) used = cap;
+            for (int s = 0; s < used; s++) {
+                block_get_record(&blocks[b], &hf.schema, s, recbuf);
+                decode_row(&hf.schema, recbuf, &r);
+                if (r.ft_pct_home > min_key)
+                    m_row++;
+            }
+        }
+    }
+    report("per-row decode", records, m_row, bench_now_ms() - t0);
+
+    // 2. scalar kernel on the packed column
+    uint16_t sel[SEL_MAX];
+    uint64_t m_scalar = 0;
+    t0 = bench_now_ms();
+    for (int it = 0; it < iters; it++) {
+        for (uint32_t b = 0; b < hf.n_blocks; b++) {
+            int used = block_used_count(&blocks[b]);
+            if (used > cap) used = cap;
+            uint16_t off, stride;
+            block_column(&blocks[b], &hf.schema, FLD_FT_PCT_HOME, &off, &stride);
+            m_scalar += block_select_float_scalar(&blocks[b], used, stride, off, lo, hi, sel);
+        }
+    }
+    report("kernel (scalar)", records, m_scalar, bench_now_ms() - t0);
+
+    // 3. the kernel used by scans (SSE2 where available)
+    uint64_t m_simd = 0;
+    t0 = bench_now_ms();
+    for (int it = 0; it < iters; it++) {
+        for (uint32_t b = 0; b < hf.n_blocks; b++) {
+            int used = block_used_count(&blocks[b]);
+            if (used > cap) used = cap;
+            uint16_t off, stride;
+            block_column(&blocks[b], &hf.schema, FLD_FT_PCT_HOME, &off, &stride);
+            m_simd += block_select_float(&blocks[b], used, stride, off, lo, hi, sel);
+        }
+    }
+#if defined(__SSE2__)
+    report("kernel (SSE2)", records, m_simd, bench_now_ms() - t0);
+#else
+    report("kernel (default)", records, m_simd, bench_now_ms() - t0);
+#endif
+
+    if (m_row != m_scalar || m_row != m_simd)
+        printf("WARNING: match counts differ\n");
+
+    free(blocks);
+    hf_close(&hf);
+    return 0;
+}
+
+// copies every row of the heap file into fresh in-memory blocks of the given layout
+static Block *repack_blocks(HeapFile *hf, const Block *src, uint64_t n_records, uint8_t layout, uint32_t *n_out)
+{
+    const Schema *s = &hf->schema;
+    const int cap = block_capacity_with_bitmap(s->record_size);
+    Block *dst = calloc((size_t)(n_records / cap + 1), sizeof(Block));
+    CBlockBuilder cb;
+    if (!dst || (layout == BLOCK_FMT_PACKED && cblock_builder_init(&cb, s) != 0)) {
+        free(dst);
+        return NULL;
+    }
+
+    uint8_t recbuf[512];
+    uint32_t n = 0;
+    int slot = 0;
+    for (uint32_t b = 0; b < hf->n_blocks; b++) {
+        int used = block_used_count(&src[b]);
+        int scap = block_capacity(&src[b], s);
+        if (used > scap) used = scap;
+        for (int i = 0; i < used; i++) {
+            if (!block_slot_live(&src[b], s, i) || block_get_record(&src[b], s, i, recbuf) != 0)
+                continue;
+            if (layout == BLOCK_FMT_PACKED) {
+                if (cblock_builder_add(&cb, recbuf) != 0) {
+                    cblock_builder_finish(&cb, &dst[n++]);
+                    cblock_builder_add(&cb, recbuf);
+                }
+                continue;
+            }
+            if (slot == 0)
+                block_init(&dst[n], layout);
+            block_put_record(&dst[n], s, slot, recbuf);
+            block_set_used_count(&dst[n], (uint16_t)++slot);
+            if (slot == cap) {
+                slot = 0;
+                n++;
+            }
+        }
+    }
+    if (layout == BLOCK_FMT_PACKED) {
+        if (cb.n_rows > 0)
+            cblock_builder_finish(&cb, &dst[n++]);
+        cblock_builder_free(&cb);
+    }
+    *n_out = n + (slot > 0);
+    return dst;
+}
+
+static void bench_layout_one(const char *label, const Block *blocks, uint32_t n_blocks, const Schema *s,
+                             float min_key, int32_t team, int iters, uint64_t records)
+{
+    float lo, hi;
+    kernel_float_bounds(min_key, 0, INFINITY, 1, &lo, &hi);
+    uint16_t sel[SEL_MAX];
+
+    printf("%s %u blocks, %.2f bytes/record\n", label, n_blocks,
+           records ? (double)n_blocks * BLOCK_SIZE * iters / records : 0.0);
+
+    // filter only: FT_PCT_home > min_key
+    uint64_t matches = 0;
+    double t0 = bench_now_ms();
+    for (int it = 0; it < iters; it++) {
+        for (uint32_t b = 0; b < n_blocks; b++)
+            matches += block_filter_float(&blocks[b], s, FLD_FT_PCT_HOME, lo, hi, sel);
+    }
+    report("filter FT_PCT_home", records, matches / iters, bench_now_ms() - t0);
+
+    // aggregate only: SUM(FT_PCT_home) over every row
+    double sum = 0.0;
+    t0 = bench_now_ms();
+    for (int it = 0; it < iters; it++) {
+        for (uint32_t b = 0; b < n_blocks; b++)
+            sum += block_column_sum(&blocks[b], s, FLD_FT_PCT_HOME, NULL, 0);
+    }
+    report("SUM(FT_PCT_home)", records, records / iters, bench_now_ms() - t0);
+    printf("    sum = %.3f\n", sum / iters);
+
+    // filter on one column, aggregate another over the selected slots
+    double fsum = 0.0;
+    matches = 0;
+    t0 = bench_now_ms();
+    for (int it = 0; it < iters; it++) {
+        for (uint32_t b = 0; b < n_blocks; b++) {
+            int n = block_filter_int32(&blocks[b], s, FLD_HOME_TEAM_ID, team, team, sel);
+            fsum += block_column_sum(&blocks[b], s, FLD_FT_PCT_HOME, sel, n);
+            matches += n;
+        }
+    }
+    report("HOME_TEAM_ID = t, SUM(FT_PCT)", records, matches / iters, bench_now_ms() - t0);
+    printf("    sum = %.3f\n", fsum / iters);
+}
+
+int bench_layout(const char *db_filename, float min_key, int iters)
+{
+    HeapFile hf;
+    if (hf_open(&hf, db_filename, 64) != 0) {
+        fprintf(stderr, "Failed to open database file: %s\n", db_filename);
+        return -1;
+    }
+    Block *blocks = load_all_blocks(&hf);
+    if (!blocks) {
+        hf_close(&hf);
+        return -1;
+    }
+
+    uint64_t n_records = 0;
+    for (uint32_t b = 0; b < hf.n_blocks; b++)
+        n_records += block_used_count(&blocks[b]);
+
+    // the team of the first row is used for the cross-column query
+    int32_t team = 0;
+    Row first;
+    if (hf.n_blocks > 0 && hf_read_row(&hf, 0, 0, &first) == 0)
+        team = first.home_team_id;
+
+    uint32_t n_nsm = 0, n_pax = 0, n_packed = 0;
+    Block *nsm = repack_blocks(&hf, blocks, n_records, BLOCK_FMT_NSM, &n_nsm);
+    Block *pax = repack_blocks(&hf, blocks, n_records, BLOCK_FMT_PAX, &n_pax);
+    Block *packed = repack_blocks(&hf, blocks, n_records, BLOCK_FMT_PACKED, &n_packed);
+    free(blocks);
+    if (!nsm || !pax || !packed) {
+        free(nsm);
+        free(pax);
+        free(packed);
+        hf_close(&hf);
+        return -1;
+    }
+
+    uint64_t records = n_records * (uint64_t)iters;
+    printf("=== Block layout benchmark: NSM vs PAX vs compressed ===\n");
+    printf("Records: %llu, iterations: %d, FT_PCT_home > %.3f, HOME_TEAM_ID = %d\n",
+           (unsigned long long)n_records, iters, min_key, team);
+    bench_layout_one("NSM (row after row):", nsm, n_nsm, &hf.schema, min_key, team, iters, records);
+    bench_layout_one("PAX (one minipage per field):", pax, n_pax, &hf.schema, min_key, team, iters, records);
+    bench_layout_one("Compressed (dict/FOR/dec):", packed, n_packed, &hf.schema, min_key, team, iters, records);
+
+    free(nsm);
+    free(pax);
+    free(packed);
+    hf_close(&hf);
+    return 0;
+}
+
+static double pscan_time(HeapFile *hf, const ParallelScanSpec *spec, int iters, ScanResult *last)
+{
+    double t0 = bench_now_ms();
+    for (int it = 0; it < iters; it++) {
+        if (pscan_run(hf, spec, last) != 0)
+            return -1.0;
+    }
+    return bench_now_ms() - t0;
+}
+
+int bench_pscan(const char *db_filename, float min_key, int iters)
+{
+    HeapFile hf;
+    if (hf_open(&hf, db_filename, 64) != 0) {
+        fprintf(stderr, "Failed to open database file: %s\n", db_filename);
+        return -1;
+    }
+
+    ParallelScanSpec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.range.lo = min_key;
+    spec.range.hi = INFINITY;
+    spec.filter = 1;
+    int max_threads = pscan_default_threads();
+
+    printf("=== Parallel scan benchmark: FT_PCT_home > %.3f ===\n", min_key);
+    printf("Blocks: %u, morsel: %d blocks, iterations: %d, up to %d threads\n",
+           hf.n_blocks, PSCAN_MORSEL_BLOCKS, iters, max_threads);
+
+    // one untimed pass so every run finds the file in the OS cache
+    ScanResult res;
+    spec.threads = 1;
+    if (pscan_time(&hf, &spec, 1, &res) < 0) {
+        hf_close(&hf);
+        return -1;
+    }
+
+    double base_ms = 0.0;
+    for (int t = 1; ; t = (t * 2 > max_threads && t < max_threads) ? max_threads : t * 2) {
+        spec.threads = t;
+        double ms = pscan_time(&hf, &spec, iters, &res);
+        if (ms < 0) {
+            hf_close(&hf);
+            return -1;
+        }
+        if (t == 1)
+            base_ms = ms;
+        double secs = ms / 1000.0;
+        printf("  %2d threads %10.3f ms  %8.1f M records/s  speedup %5.2fx  (%llu matches, %u stolen)\n",
+               res.threads, ms, secs > 0 ? res.records * (double)iters / secs / 1e6 : 0.0,
+               ms > 0 ? base_ms / ms : 0.0, (unsigned long long)res.matches, res.morsels_stolen);
+        if (t >= max_threads)
+            break;
+    }
+
+    hf_close(&hf);
+    return 0;
+}
+
+// ---- synthetic data and the batch delete benchmark ----
+
+static uint64_t gen_next(uint64_t *x)
+{
+    // xorshift64*
+    *x ^= *x >> 12;
+    *x ^= *x << 25;
+    *x ^= *x >> 27;
+    return *x * 0x2545F4914F6CDD1DULL;
+}
+
+static int gen_range(uint64_t *x, int lo, int hi)
+{
+    return lo + (int)(gen_next(x) % (uint64_t)(hi - lo + 1));
+}
+
+int bench_gen_csv(const char *csv_path, uint64_t rows, uint64_t seed)
+{
+    FILE *fp = fopen(csv_path, "w");
+    if (!fp) {
+        fprintf(stderr, "Failed to create %s\n", csv_path);
+        return -1;
+    }
+    uint64_t x = seed ? seed : 88172645463325252ULL;
+    fprintf(fp, "GAME_DATE_EST\tTEAM_ID_home\tPTS_home\tFG_PCT_home\tFT_PCT_home\tFG3_PCT_home\tAST_home\tREB_home\tHOME_TEAM_WINS\n");
+    for (uint64_t i = 0; i < rows; i++) {
+        // percentages with three decimals like the real data
+        fprintf(fp, "%02d/%02d/%d\t%d\t%d\t%.3f\t%.3f\t%.3f\t%d\t%d\t%d\n",
+                gen_range(&x, 1, 28), gen_range(&x, 1, 12), gen_range(&x, 2003, 2022),
+                1610612737 + gen_range(&x, 0, 29), gen_range(&x, 70, 150),
+                gen_range(&x, 300, 650) / 1000.0, gen_range(&x, 400, 1000) / 1000.0,
+                gen_range(&x, 150, 600) / 1000.0,
+                gen_range(&x, 10, 40), gen_range(&x, 30, 60), gen_range(&x, 0, 1));
+    }
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Failed to write %s\n", csv_path);
+        return -1;
+    }
+    printf("Wrote %llu rows to %s\n", (unsigned long long)rows, csv_path);
+    return 0;
+}
+
+static int copy_file(const char *from, const char *to)
+{
+    FILE *in = fopen(from, "rb");
+    if (!in)
+        return -1;
+    FILE *out = fopen(to, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+    char buf[1 << 16];
+    size_t n;
+    int rc = 0;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) {
+            rc = -1;
+            break;
+        }
+    }
+    fclose(in);
+    if (fclose(out) != 0)
+        rc = -1;
+    return rc;
+}
+
+// scan_db reports every level it builds; keep that out of the benchmark table
+static int build_index_quiet(HeapFile *hf)
+{
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (saved >= 0 && null_fd >= 0)
+        dup2(null_fd, STDOUT_FILENO);
+    int rc = scan_db(hf);
+    fflush(stdout);
+    if (saved >= 0) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+    if (null_fd >= 0)
+        close(null_fd);
+    return rc;
+}
+
+// one round: fresh copy of the table, index built, then the top pct percent of
+// FT_PCT_home deleted as a batch
+static int bench_delete_round(const char *db_filename, const char *work, double pct)
+{
+    char from[608], to[608];
+    if (copy_file(db_filename, work) != 0) {
+        fprintf(stderr, "Failed to copy %s\n", db_filename);
+        return -1;
+    }
+    snprintf(from, sizeof(from), "%s.zm", db_filename);
+    snprintf(to, sizeof(to), "%s.zm", work);
+    copy_file(from, to);
+
+    HeapFile hf;
+    if (hf_open(&hf, work, 64) != 0) {
+        fprintf(stderr, "Failed to open database file: %s\n", work);
+        return -1;
+    }
+    if (build_index_quiet(&hf) != 0) {
+        hf_close(&hf);
+        return -1;
+    }
+    uint32_t before = hf_count_records(&hf);
+
+    // the key above which pct percent of the records lie
+    BtreeFileManager btfm;
+    float cut;
+    if (btfm_open(&btfm, "btree.db", NODE_SIZE) != 0 ||
+        bptree_percentile(&btfm, 1.0 - pct / 100.0, &cut) != 0) {
+        fprintf(stderr, "Failed to read the index\n");
+        hf_close(&hf);
+        return -1;
+    }
+    btfm_close(&btfm);
+
+    // victims in key order, straight from the index
+    KeyRange r = {cut, INFINITY, 1, 1};
+    IndexCursor c;
+    RecordLocation *locs = NULL;
+    size_t n = 0, cap = 0;
+    if (idx_cursor_open(&c, "btree.db", &r, 0) != 0) {
+        hf_close(&hf);
+        return -1;
+    }
+    RecordLocation loc;
+    int rc;
+    while ((rc = idx_cursor_next(&c, &loc)) == 1) {
+        if (n == cap) {
+            cap = cap ? cap * 2 : 4096;
+            RecordLocation *tmp = realloc(locs, cap * sizeof(RecordLocation));
+            if (!tmp) {
+                rc = -1;
+                break;
+            }
+            locs = tmp;
+        }
+        locs[n++] = loc;
+    }
+    idx_cursor_close(&c);
+
+    BatchDeleteStats st;
+    if (rc == 0)
+        rc = batch_delete(&hf, locs, n, &st);
+    free(locs);
+    if (rc != 0) {
+        hf_close(&hf);
+        return -1;
+    }
+
+    uint32_t after = hf_count_records(&hf);
+    double total = st.sort_ms + st.heap_ms + st.index_ms + st.flush_ms;
+    printf("  %5.1f%%  %10zu  %8u  %9.2f  %9.2f  %9.2f  %9.2f  %9.2f  %7.2f%s\n",
+           pct, st.deleted, st.blocks_touched, st.sort_ms, st.heap_ms, st.index_ms, st.flush_ms,
+           total, total > 0 ? st.deleted / total / 1000.0 : 0.0,
+           after + st.deleted == before ? "" : "  (count mismatch)");
+    hf_close(&hf);
+    return 0;
+}
+
+int bench_delete(const char *db_filename, const double *pcts, int n_pcts)
+{
+    char work[600];
+    snprintf(work, sizeof(work), "%s.bench", db_filename);
+
+    printf("=== Batch delete benchmark: %s ===\n", db_filename);
+    printf("  %6s  %10s  %8s  %9s  %9s  %9s  %9s  %9s  %7s\n",
+           "pct", "deleted", "blocks", "sort ms", "heap ms", "index ms", "flush ms", "total ms", "M rec/s");
+    int rc = 0;
+    for (int i = 0; i < n_pcts && rc == 0; i++)
+        rc = bench_delete_round(db_filename, work, pcts[i]);
+
+    char zm[608];
+    snprintf(zm, sizeof(zm), "%s.zm", work);
+    remove(work);
+    remove(zm);
+    snprintf(zm, sizeof(zm), "%s.wal", work);
+    remove(zm);
+
+    // btree.db indexes the scratch copy now, point it back at the original
+    HeapFile hf;
+    if (hf_open(&hf, db_filename, 64) == 0) {
+        build_index_quiet(&hf);
+        hf_close(&hf);
+    }
+    return rc;
+}
+
+// ---- CSV load throughput ----
+
+static int files_equal(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    int eq = fa && fb;
+    static char ba[1 << 16], bb[1 << 16];
+    while (eq) {
+        size_t na = fread(ba, 1, sizeof(ba), fa), nb = fread(bb, 1, sizeof(bb), fb);
+        if (na != nb || memcmp(ba, bb, na) != 0)
+            eq = 0;
+        if (na == 0)
+            break;
+    }
+    if (fa)
+        fclose(fa);
+    if (fb)
+        fclose(fb);
+    return eq;
+}
+
+static void remove_table(const char *db)
+{
+    char path[620];
+    remove(db);
+    snprintf(path, sizeof(path), "%s.zm", db);
+    remove(path);
+    snprintf(path, sizeof(path), "%s.fsm", db);
+    remove(path);
+    snprintf(path, sizeof(path), "%s.wal", db);
+    remove(path);
+}
+
+// loads csv_path into db with the serial loader (threads < 0) or the parallel one
+static double load_once(const char *csv_path, const char *db, int threads, CsvLoadStats *st)
+{
+    Schema s;
+    schema_init_default(&s);
+    HeapFile hf;
+    if (hf_create(&hf, db, &s, 64) != 0)
+        return -1.0;
+    double t0 = bench_now_ms();
+    int rc = threads < 0 ? hf_load_csv(&hf, csv_path) : hf_load_csv_parallel(&hf, csv_path, threads, st);
+    hf_close(&hf);
+    double ms = bench_now_ms() - t0;
+    return rc == 0 ? ms : -1.0;
+}
+
+int bench_load(const char *csv_path)
+{
+    char ref[600], work[600];
+    snprintf(ref, sizeof(ref), "%s.bench_ref.db", csv_path);
+    snprintf(work, sizeof(work), "%s.bench.db", csv_path);
+    int max_threads = pscan_default_threads();
+
+    CsvLoadStats st;
+    memset(&st, 0, sizeof(st));
+    // the untimed first pass also brings the file into the OS cache
+    if (load_once(csv_path, work, 1, &st) < 0) {
+        fprintf(stderr, "Failed to load %s\n", csv_path);
+        remove_table(work);
+        return -1;
+    }
+    double mb = st.bytes / 1e6;
+    printf("=== CSV load benchmark: %s ===\n", csv_path);
+    printf("%.1f MB, %llu rows, %u chunks of %u MB, up to %d threads\n", mb,
+           (unsigned long long)st.rows, st.chunks, CSV_CHUNK_BYTES >> 20, max_threads);
+
+    double ms = load_once(csv_path, ref, -1, NULL);
+    if (ms < 0) {
+        remove_table(work);
+        return -1;
+    }
+    double base_ms = ms;
+    printf("  serial     %10.3f ms  %8.1f MB/s  (fgets + strtok)\n", ms, ms > 0 ? mb / (ms / 1000.0) : 0.0);
+
+    int rc = 0;
+    for (int t = 1; ; t = (t * 2 > max_threads && t < max_threads) ? max_threads : t * 2) {
+        ms = load_once(csv_path, work, t, &st);
+        if (ms < 0) {
+            rc = -1;
+            break;
+        }
+        printf("  %2d threads %10.3f ms  %8.1f MB/s  speedup %5.2fx  parse %.1f ms, write %.1f ms  %s\n",
+               st.threads, ms, ms > 0 ? mb / (ms / 1000.0) : 0.0, ms > 0 ? base_ms / ms : 0.0,
+               st.parse_ms, st.write_ms, files_equal(ref, work) ? "same file" : "FILES DIFFER");
+        if (t >= max_threads)
+            break;
+    }
+    remove_table(ref);
+    remove_table(work);
+    return rc;
+}
+
+// ---- CSV parse throughput ----
+
+typedef struct {
+    uint64_t rows;
+    double   check;     // sum over a few fields, to see that every variant parsed the same
+} ParseTally;
+
+static void tally_row(ParseTally *t, const Row *r)
+{
+    t->rows++;
+    t->check += r->ft_pct_home + r->home_team_id * 1e-9 + r->game_id + r->home_team_wins + r->game_date[0];
+}
+
+// the serial loader's way: copy each line out, then parse_row_by_index
+static void parse_lines_strtok(const char *p, const char *end, const CsvIdx *idx, ParseTally *t)
+{
+    char line[8192];
+    Row r;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *e = nl ? nl + 1 : end;
+        size_t n = (size_t)(e - p) < sizeof(line) - 1 ? (size_t)(e - p) : sizeof(line) - 1;
+        memcpy(line, p, n);
+        line[n] = '\0';
+        if (parse_row_by_index(line, idx, &r) == 0)
+            tally_row(t, &r);
+        p = e;
+    }
+}
+
+static void parse_lines_scan(const char *p, const char *end, const CsvIdx *idx, int simd, ParseTally *t)
+{
+    CsvScan scan;
+    csv_scan_init(&scan, p, end, simd);
+    Row r;
+    int rc;
+    while ((rc = csv_scan_row(&scan, idx, &r)) >= 0) {
+        if (rc == 1)
+            tally_row(t, &r);
+    }
+}
+
+int bench_parse(const char *csv_path, int iters)
+{
+    FILE *fp = fopen(csv_path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Failed to open %s\n", csv_path);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *data = size > 0 ? malloc((size_t)size) : NULL;
+    if (!data || fread(data, 1, (size_t)size, fp) != (size_t)size) {
+        fprintf(stderr, "Failed to read %s\n", csv_path);
+        free(data);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    const char *end = data + size;
+    const char *nl = memchr(data, '\n', (size_t)size);
+    const char *body = nl ? nl + 1 : end;
+    char header[8192];
+    size_t hl = (size_t)(body - data) < sizeof(header) - 1 ? (size_t)(body - data) : sizeof(header) - 1;
+    memcpy(header, data, hl);
+    header[hl] = '\0';
+    CsvIdx idx;
+    if (parse_header_map(header, &idx) != 0) {
+        fprintf(stderr, "Header does not contain required columns.\n");
+        free(data);
+        return -1;
+    }
+
+    printf("=== CSV parse benchmark: %s ===\n", csv_path);
+    printf("%.1f MB in memory, iterations: %d, separator kernel: %s\n", size / 1e6, iters, csv_scan_kernel());
+
+    static const char *names[] = {"copy + strtok + atof", "scanner (byte loop)", "scanner (bitmask)"};
+    ParseTally ref;
+    memset(&ref, 0, sizeof(ref));
+    for (int v = 0; v < 3; v++) {
+        ParseTally t;
+        double t0 = bench_now_ms();
+        for (int it = 0; it < iters; it++) {
+            memset(&t, 0, sizeof(t));
+            if (v == 0)
+                parse_lines_strtok(body, end, &idx, &t);
+            else
+                parse_lines_scan(body, end, &idx, v == 2, &t);
+        }
+        double ms = bench_now_ms() - t0;
+        if (v == 0)
+            ref = t;
+        double secs = ms / 1000.0;
+        printf("  %-22s %10.3f ms  %8.1f MB/s  %7.2f M rows/s%s\n", names[v], ms,
+               secs > 0 ? size / 1e6 * iters / secs : 0.0, secs > 0 ? t.rows / 1e6 * iters / secs : 0.0,
+               (t.rows == ref.rows && t.check == ref.check) ? "" : "  ROWS DIFFER");
+    }
+    free(data);
+    return 0;
+}
+
+// one table loaded from csv_path, then dumped and imported again: MB/s of each
+// way to fill a table, the imported file has to be the same as the loaded one
+int bench_import(const char *csv_path)
+{
+    char ref[600], work[600], bin[600], csv[600];
+    snprintf(ref, sizeof(ref), "%s.bench_ref.db", csv_path);
+    snprintf(work, sizeof(work), "%s.bench.db", csv_path);
+    snprintf(bin, sizeof(bin), "%s.bench.dump", csv_path);
+    snprintf(csv, sizeof(csv), "%s.bench_export.csv", csv_path);
+
+    CsvLoadStats st;
+    memset(&st, 0, sizeof(st));
+    double par_ms = load_once(csv_path, work, 0, &st);
+    double ser_ms = par_ms < 0 ? -1.0 : load_once(csv_path, ref, -1, NULL);
+    if (ser_ms < 0) {
+        fprintf(stderr, "Failed to load %s\n", csv_path);
+        remove_table(ref);
+        remove_table(work);
+        return -1;
+    }
+    double mb = st.bytes / 1e6, rows = (double)st.rows;
+    printf("=== Reload benchmark: %s ===\n", csv_path);
+    printf("%.1f MB of CSV, %llu rows\n", mb, (unsigned long long)st.rows);
+    printf("  load (serial)      %10.3f ms  %8.1f MB/s  %6.2f M rows/s\n", ser_ms, mb / (ser_ms / 1000.0),
+           rows / 1e6 / (ser_ms / 1000.0));
+    printf("  load (%d threads)   %10.3f ms  %8.1f MB/s  %6.2f M rows/s\n", st.threads, par_ms,
+           mb / (par_ms / 1000.0), rows / 1e6 / (par_ms / 1000.0));
+
+    HeapFile hf;
+    DumpStats ex, im, cx;
+    int rc = hf_open(&hf, ref, 64);
+    if (rc == 0) {
+        rc = hf_export_bin(&hf, bin, &ex);
+        if (rc == 0)
+            rc = hf_export_csv(&hf, csv, &cx);
+        hf_close(&hf);
+    }
+    if (rc == 0) {
+        Schema s;
+        schema_init_default(&s);
+        remove_table(work);
+        rc = hf_create(&hf, work, &s, 64);
+        if (rc == 0) {
+            double t0 = bench_now_ms();
+            rc = hf_import_bin(&hf, bin, &im);
+            hf_close(&hf);
+            im.ms = bench_now_ms() - t0;    // with the final flush, like the loads
+        }
+    }
+    if (rc == 0) {
+        double secs = im.ms / 1000.0;
+        printf("  import (dump)      %10.3f ms  %8.1f MB/s  %6.2f M rows/s  speedup %.2fx / %.2fx  %s\n", im.ms,
+               im.bytes / 1e6 / secs, im.rows / 1e6 / secs, ser_ms / im.ms, par_ms / im.ms,
+               files_equal(ref, work) ? "same file" : "FILES DIFFER");
+        printf("  dump %.1f MB (%.0f%% of the CSV), export %.3f ms, CSV export %.3f ms\n", ex.bytes / 1e6,
+               mb > 0 ? 100.0 * ex.bytes / 1e6 / mb : 0.0, ex.ms, cx.ms);
+    }
+    remove_table(ref);
+    remove_table(work);
+    remove(bin);
+    remove(csv);
+    return rc;
+}
+
+// ---- commit throughput ----
+
+#define COMMIT_ROWS 2000
+
+enum { COMMIT_FLUSH, COMMIT_FSYNC, COMMIT_WAL_WAIT, COMMIT_WAL_GROUP };
+
+// inserts the rows one at a time into a new table, each made durable on its own
+// (or, for COMMIT_WAL_GROUP, committed without waiting for the log)
+static double commit_run(const char *db, const Row *rows, uint32_t n, int mode, uint64_t *syncs)
+{
+    Schema s;
+    schema_init_default(&s);
+    HeapFile hf;
+    remove_table(db);
+    if (hf_create(&hf, db, &s, 64) != 0)
+        return -1.0;
+    if (mode >= COMMIT_WAL_WAIT && hf_enable_wal(&hf) != 0) {
+        hf_close(&hf);
+        return -1.0;
+    }
+    int rc = 0;
+    double t0 = bench_now_ms();
+    for (uint32_t i = 0; i < n && rc == 0; i++) {
+        uint32_t b;
+        uint16_t slot;
+        hf_begin(&hf);
+        rc = hf_insert(&hf, &rows[i], &b, &slot);
+        if (rc != 0)
+            break;
+        if (mode == COMMIT_FLUSH)
+            rc = bp_flush_all(&hf.bp);
+        else if (mode == COMMIT_FSYNC)
+            rc = (bp_flush_all(&hf.bp) == 0 && fm_sync(&hf.fm) == 0) ? 0 : -1;
+        else
+            rc = hf_commit(&hf, mode == COMMIT_WAL_WAIT);
+    }
+    // whatever is still only in memory becomes durable before the clock stops
+    if (rc == 0 && hf.wal)
+        rc = wal_force(hf.wal, UINT64_MAX);
+    double ms = bench_now_ms() - t0;
+    *syncs = hf.wal ? hf.wal->syncs : (mode == COMMIT_FSYNC ? n : 0);
+    hf_close(&hf);
+    return rc == 0 ? ms : -1.0;
+}
+
+typedef struct {
+    Wal     *wal;
+    uint32_t n;
+    int      rc;
+} CommitWorker;
+
+// one small update per transaction, committed with wait: the log alone
+static void *commit_worker(void *arg)
+{
+    CommitWorker *cw = (CommitWorker *)arg;
+    uint8_t before[64], after[64];
+    memset(before, 0, sizeof(before));
+    for (uint32_t i = 0; i < cw->n && cw->rc == 0; i++) {
+        uint64_t txn = wal_begin(cw->wal);
+        memcpy(after, before, sizeof(after));
+        memcpy(after + 8, &i, sizeof(i));
+        if (wal_log_update(cw->wal, txn, WAL_FILE_HEAP, i, before, after, sizeof(after), NULL, NULL) != 0 ||
+            wal_commit(cw->wal, txn, 1) != 0)
+            cw->rc = -1;
+    }
+    return NULL;
+}
+
+static int commit_threads(const char *db, uint32_t n, int threads)
+{
+    Wal w;
+    if (wal_open(&w, db) != 0)
+        return -1;
+    CommitWorker *cw = calloc((size_t)threads, sizeof(CommitWorker));
+    pthread_t *tid = calloc((size_t)threads, sizeof(pthread_t));
+    int rc = (cw && tid) ? 0 : -1;
+    double t0 = bench_now_ms();
+    int started = 0;
+    for (int t = 0; t < threads && rc == 0; t++) {
+        cw[t].wal = &w;
+        cw[t].n = n / (uint32_t)threads;
+        if (pthread_create(&tid[t], NULL, commit_worker, &cw[t]) != 0)
+            rc = -1;
+        else
+            started++;
+    }
+    uint64_t done = 0;
+    for (int t = 0; t < started; t++) {
+        pthread_join(tid[t], NULL);
+        if (cw[t].rc != 0)
+            rc = -1;
+        done += cw[t].n;
+    }
+    double ms = bench_now_ms() - t0;
+    if (rc == 0)
+        printf("  %2d threads  %10.3f ms  %9.0f commits/s  %6llu fsyncs  %6.1f commits per fsync\n", threads, ms,
+               ms > 0 ? done / (ms / 1000.0) : 0.0, (unsigned long long)w.syncs,
+               w.syncs ? (double)w.commits / w.syncs : 0.0);
+    wal_close(&w);
+    free(cw);
+    free(tid);
+    char path[620];
+    snprintf(path, sizeof(path), "%s.wal", db);
+    remove(path);
+    return rc;
+}
+
+// the first n rows of a CSV file, NULL if there are none
+static Row *read_rows(const char *csv_path, uint32_t n, uint32_t *got)
+{
+    *got = 0;
+    FILE *f = fopen(csv_path, "r");
+    if (!f) {
+        fprintf(stderr, "open %s failed\n", csv_path);
+        return NULL;
+    }
+    char line[8192];
+    CsvIdx idx;
+    Row *rows = malloc((size_t)n * sizeof(Row));
+    if (rows && fgets(line, sizeof(line), f) && parse_header_map(line, &idx) == 0) {
+        while (*got < n && fgets(line, sizeof(line), f))
+            if (parse_row_by_index(line, &idx, &rows[*got]) == 0)
+                (*got)++;
+    }
+    fclose(f);
+    if (*got == 0) {
+        fprintf(stderr, "No rows in %s\n", csv_path);
+        free(rows);
+        return NULL;
+    }
+    return rows;
+}
+
+int bench_commit(const char *csv_path, uint32_t n)
+{
+    uint32_t got;
+    Row *rows = read_rows(csv_path, n ? n : COMMIT_ROWS, &got);
+    if (!rows)
+        return -1;
+
+    char ref[600], work[600];
+    snprintf(ref, sizeof(ref), "%s.bench_ref.db", csv_path);
+    snprintf(work, sizeof(work), "%s.bench.db", csv_path);
+    // only the runs below decide whether a table has a log
+    hf_set_default_wal(0, 0);
+
+    static const char *names[] = {"flush per block", "fsync per block", "wal, wait", "wal, group"};
+    static const char *notes[] = {"(fflush: lost on power failure)", "(data file)", "(one log write per commit)",
+                                  "(commits written in groups)"};
+    printf("=== Commit benchmark: %u single-row inserts from %s ===\n", got, csv_path);
+    int rc = 0;
+    double base_ms = 0.0;
+    for (int mode = COMMIT_FLUSH; mode <= COMMIT_WAL_GROUP && rc == 0; mode++) {
+        uint64_t syncs = 0;
+        const char *db = mode == COMMIT_FLUSH ? ref : work;
+        double ms = commit_run(db, rows, got, mode, &syncs);
+        if (ms < 0) {
+            fprintf(stderr, "%s run failed\n", names[mode]);
+            rc = -1;
+            break;
+        }
+        if (mode == COMMIT_FSYNC)
+            base_ms = ms;
+        printf("  %-16s %10.3f ms  %9.0f commits/s  %6llu fsyncs  %s", names[mode], ms,
+               ms > 0 ? got / (ms / 1000.0) : 0.0, (unsigned long long)syncs, notes[mode]);
+        if (mode > COMMIT_FSYNC)
+            printf("  %.1fx  %s", ms > 0 ? base_ms / ms : 0.0, files_equal(ref, db) ? "same file" : "FILES DIFFER");
+        printf("\n");
+    }
+    free(rows);
+    remove_table(ref);
+
+    // the log alone, committers on several threads sharing its writes
+    if (rc == 0) {
+        printf("log commits with wait, %u in total:\n", got);
+        for (int t = 1; t <= 16 && rc == 0; t *= 2)
+            rc = commit_threads(work, got, t);
+    }
+    remove_table(work);
+    return rc;
+}
+
+// ---- restart time ----
+
+#define RECOVERY_ROWS 200000
+
+typedef struct {
+    double   ms;
+    uint64_t checkpoints, dropped, pages;
+} CrashRun;
+
+// in a child process: inserts the rows under the log and dies without writing
+// back a single page that the checkpoints did not write. each transaction
+// also deletes an old row of a block far from the last one and inserts a
+// second copy of its row, which fills that hole, while the first copy goes
+// to the last block. the last block stays dirty for a while and holds the
+// log back, the scattered blocks are written when the buffer pool evicts
+// them, and recovery finds their changes in the files
+static void crash_child(const char *db, const Row *rows, uint32_t n, uint64_t ckpt_bytes, int out)
+{
+    CrashRun cr;
+    memset(&cr, 0, sizeof(cr));
+    hf_set_default_wal(1, 0);
+    hf_set_checkpoint_bytes(ckpt_bytes);
+    HeapFile hf;
+    int rc = hf_open(&hf, db, 64);
+    uint32_t old_blocks = rc == 0 ? hf.n_blocks : 0;
+    double t0 = bench_now_ms();
+    for (uint32_t i = 0; i < n && rc == 0; i++) {
+        uint32_t b;
+        uint16_t slot;
+        Row old;
+        hf_begin(&hf);
+        rc = hf_insert(&hf, &rows[i], &b, &slot);
+        if (rc == 0 && old_blocks) {
+            b = (uint32_t)((uint64_t)i * 7919 % old_blocks);
+            slot = (uint16_t)(i / old_blocks);
+            if (hf_read_row(&hf, b, slot, &old) == 0 && (rc = hf_delete_record(&hf, b, slot)) == 0)
+                rc = hf_insert(&hf, &rows[i], &b, &slot);
+        }
+        if (rc == 0)
+            rc = hf_commit(&hf, 0);
+    }
+    if (rc == 0)
+        rc = wal_force(hf.wal, UINT64_MAX);
+    cr.ms = rc == 0 ? bench_now_ms() - t0 : -1.0;
+    if (rc == 0) {
+        cr.checkpoints = hf.wal->checkpoints;
+        cr.dropped = hf.wal->dropped;
+        cr.pages = hf.wal->ckpt_pages;
+    }
+    ssize_t wr = write(out, &cr, sizeof(cr));
+    _exit(wr == (ssize_t)sizeof(cr) && rc == 0 ? 0 : 1);
+}
+
+// ckpt_bytes = 0: no checkpoints. *log_bytes gets the size of the log at the crash
+static int recovery_round(const char *db_filename, const char *work, const Row *rows, uint32_t n, uint64_t ckpt_bytes,
+                          uint64_t *log_bytes)
+{
+    char from[608], to[608];
+    if (copy_file(db_filename, work) != 0)
+        return -1;
+    snprintf(from, sizeof(from), "%s.zm", db_filename);
+    snprintf(to, sizeof(to), "%s.zm", work);
+    copy_file(from, to);
+    snprintf(to, sizeof(to), "%s.wal", work);
+    remove(to);
+
+    int fds[2];
+    if (pipe(fds) != 0)
+        return -1;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        crash_child(work, rows, n, ckpt_bytes, fds[1]);
+    }
+    close(fds[1]);
+    CrashRun cr;
+    int status = 0;
+    ssize_t got = read(fds[0], &cr, sizeof(cr));
+    close(fds[0]);
+    waitpid(pid, &status, 0);
+    if (got != (ssize_t)sizeof(cr) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Insert run with checkpoints every %llu bytes failed\n", (unsigned long long)ckpt_bytes);
+        return -1;
+    }
+    struct stat sb;
+    *log_bytes = stat(to, &sb) == 0 ? (uint64_t)sb.st_size : 0;
+    double log_mb = *log_bytes / 1e6;
+
+    // restart: hf_open recovers, then rebuilds the maps and the record count
+    HeapFile hf;
+    double t0 = bench_now_ms();
+    if (hf_open(&hf, work, 64) != 0)
+        return -1;
+    double open_ms = bench_now_ms() - t0;
+    WalRecoveryStats st = hf.recovery;
+    hf_close(&hf);
+    char label[32];
+    if (ckpt_bytes)
+        snprintf(label, sizeof(label), "%.2f MB", ckpt_bytes / 1e6);
+    else
+        snprintf(label, sizeof(label), "off");
+    printf("%8s %10.1f %6llu %8llu %9.2f %9.1f %9llu %9llu %9llu %10.3f %10.3f\n", label, cr.ms,
+           (unsigned long long)cr.checkpoints, (unsigned long long)cr.pages, log_mb, cr.dropped / 1e6,
+           (unsigned long long)st.records, (unsigned long long)st.redone, (unsigned long long)st.skipped, st.ms,
+           open_ms);
+    return 0;
+}
+
+int bench_recovery(const char *db_filename, const char *csv_path, uint32_t n)
+{
+    uint32_t got;
+    Row *rows = read_rows(csv_path, n ? n : RECOVERY_ROWS, &got);
+    if (!rows)
+        return -1;
+    char work[600];
+    snprintf(work, sizeof(work), "%s.bench", db_filename);
+    // the intervals are 2/3, 2/9 and 2/33 of the log a run without checkpoints
+    // leaves, so each of them checkpoints whatever the row count, and the
+    // crash comes half an interval after the last checkpoint
+    static const uint32_t ckpt_div[] = {3, 9, 33};
+
+    printf("=== Restart benchmark: %s + %u logged inserts, then a crash ===\n", db_filename, got);
+    printf("%8s %10s %6s %8s %9s %9s %9s %9s %9s %10s %10s\n", "ckpt", "insert ms", "ckpts", "written",
+           "log MB", "dropped", "records", "redone", "skipped", "redo ms", "open ms");
+    uint64_t full, log_bytes;
+    int rc = recovery_round(db_filename, work, rows, got, 0, &full);
+    for (size_t i = 0; i < sizeof(ckpt_div) / sizeof(ckpt_div[0]) && rc == 0; i++)
+        rc = recovery_round(db_filename, work, rows, got, full * 2 / ckpt_div[i] ? full * 2 / ckpt_div[i] : 1,
+                            &log_bytes);
+    free(rows);
+    remove_table(work);
+    return rc;
+}
+
+// ---- concurrent index access ----
+
+#define OLC_OPS 1000000
+
+enum { OLC_MUTEX, OLC_RWLOCK, OLC_LATCH_FREE };
+
+typedef struct {
+    OlcTree         *tree;
+    int              mode;
+    pthread_mutex_t *mu;
+    pthread_rwlock_t *rw;
+    const float     *keys;      // keys in the tree, for lookups
+    uint32_t         n_keys;
+    uint32_t         ops;
+    int              write_pct;
+    uint64_t         seed;
+    uint32_t         id;
+    uint64_t         inserts, misses;
+    int              rc;
+} OlcWorker;
+
+static void *olc_worker(void *arg)
+{
+    OlcWorker *w = (OlcWorker *)arg;
+    uint64_t x = w->seed;
+    for (uint32_t i = 0; i < w->ops && w->rc == 0; i++) {
+        uint64_t r = gen_next(&x);
+        if ((int)(r % 100) < w->write_pct) {
+            // FT_PCT_home-like keys in [0, 1] with a record id no table has
+            float key = (float)((gen_next(&x) >> 40) / (double)(1 << 24));
+            uint32_t block = 0xF0000000u + w->id;
+            uint16_t slot = (uint16_t)i;
+            if (w->mode == OLC_MUTEX)
+                pthread_mutex_lock(w->mu);
+            else if (w->mode == OLC_RWLOCK)
+                pthread_rwlock_wrlock(w->rw);
+            if (olc_insert(w->tree, key, block, slot) != 0)
+                w->rc = -1;
+            if (w->mode == OLC_MUTEX)
+                pthread_mutex_unlock(w->mu);
+            else if (w->mode == OLC_RWLOCK)
+                pthread_rwlock_unlock(w->rw);
+            w->inserts++;
+        } else {
+            float key = w->keys[(r >> 32) % w->n_keys];
+            uint32_t block;
+            uint16_t slot;
+            if (w->mode == OLC_MUTEX)
+                pthread_mutex_lock(w->mu);
+            else if (w->mode == OLC_RWLOCK)
+                pthread_rwlock_rdlock(w->rw);
+            int found = olc_lookup(w->tree, key, &block, &slot);
+            if (w->mode == OLC_MUTEX)
+                pthread_mutex_unlock(w->mu);
+            else if (w->mode == OLC_RWLOCK)
+                pthread_rwlock_unlock(w->rw);
+            if (found < 0)
+                w->rc = -1;
+            else if (found == 0)
+                w->misses++;
+        }
+    }
+    return NULL;
+}
+
+// every key of the loaded tree in leaf order
+static float *olc_keys(OlcTree *t, uint64_t *n)
+{
+    if (olc_count(t, n) != 0 || *n == 0)
+        return NULL;
+    float *keys = malloc(*n * sizeof(float));
+    if (!keys)
+        return NULL;
+    uint32_t id = atomic_load(&t->root);
+    while (t->nodes[id].node.level > 1)
+        id = int_get_child(&t->nodes[id].node, 0);
+    uint64_t k = 0;
+    for (; id != BTREE_NO_NODE; id = leaf_get_next(&t->nodes[id].node))
+        for (int i = 0; i < t->nodes[id].node.key_count; i++)
+            keys[k++] = leaf_get_key(&t->nodes[id].node, i);
+    return keys;
+}
+
+// one run on a fresh copy of the index; the tree is kept in *t for the caller
+static int olc_round(BtreeFileManager *fm, OlcTree *t, const float *keys, uint64_t n_keys, uint32_t ops,
+                     int write_pct, int mode, int threads, double *base_ops)
+{
+    uint32_t inserts = (uint32_t)((uint64_t)ops * (uint32_t)write_pct / 100);
+    // a split leaves two half-full leaves; 10% more inserts than expected fit too
+    uint32_t extra = (inserts + inserts / 10) / (MAX_LEAF_KEYS / 2 - 1) * 2 + 1024;
+    if (olc_load(t, fm, extra) != 0)
+        return -1;
+    uint64_t before;
+    olc_count(t, &before);
+
+    pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+    pthread_rwlock_t rw = PTHREAD_RWLOCK_INITIALIZER;
+    OlcWorker *w = calloc((size_t)threads, sizeof(OlcWorker));
+    pthread_t *tid = calloc((size_t)threads, sizeof(pthread_t));
+    int rc = (w && tid) ? 0 : -1;
+    int started = 0;
+    double t0 = bench_now_ms();
+    for (int i = 0; i < threads && rc == 0; i++) {
+        w[i].tree = t;
+        w[i].mode = mode;
+        w[i].mu = &mu;
+        w[i].rw = &rw;
+        w[i].keys = keys;
+        w[i].n_keys = (uint32_t)n_keys;
+        w[i].ops = ops / (uint32_t)threads;
+        w[i].write_pct = write_pct;
+        w[i].seed = 88172645463325252ULL + (uint64_t)i * 0x9E3779B97F4A7C15ULL;
+        w[i].id = (uint32_t)i;
+        if (pthread_create(&tid[i], NULL, olc_worker, &w[i]) != 0)
+            rc = -1;
+        else
+            started++;
+    }
+    uint64_t done = 0, ins = 0, misses = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(tid[i], NULL);
+        if (w[i].rc != 0)
+            rc = -1;
+        done += w[i].ops;
+        ins += w[i].inserts;
+        misses += w[i].misses;
+    }
+    double ms = bench_now_ms() - t0;
+    free(w);
+    free(tid);
+
+    uint64_t after = 0;
+    int ok = rc == 0 && olc_count(t, &after) == 0 && after == before + ins && misses == 0;
+    double per_sec = ms > 0 ? done / (ms / 1000.0) : 0.0;
+    // the 1-thread run is the baseline of its mode
+    if (*base_ops == 0.0)
+        *base_ops = per_sec;
+    static const char *names[] = {"mutex", "rwlock", "olc"};
+    printf("  %-7s %2d threads  %10.3f ms  %11.0f ops/s  %5.2fx  %9llu restarts  %s\n", names[mode], threads, ms,
+           per_sec, *base_ops > 0 ? per_sec / *base_ops : 0.0, (unsigned long long)atomic_load(&t->restarts),
+           ok ? "ok" : "ENTRIES LOST");
+    return ok ? 0 : -1;
+}
+
+int bench_olc(uint32_t ops, const int *write_pcts, int n_pcts)
+{
+    if (ops == 0)
+        ops = OLC_OPS;
+    BtreeFileManager fm;
+    if (btfm_open(&fm, "btree.db", NODE_SIZE) != 0) {
+        fprintf(stderr, "No btree.db, run build_bplus first\n");
+        return -1;
+    }
+    OlcTree t;
+    if (olc_load(&t, &fm, 0) != 0) {
+        btfm_close(&fm);
+        return -1;
+    }
+    uint64_t n_keys;
+    float *keys = olc_keys(&t, &n_keys);
+    olc_free(&t);
+    if (!keys) {
+        fprintf(stderr, "The index is empty\n");
+        btfm_close(&fm);
+        return -1;
+    }
+
+    printf("=== Concurrent index: %u lookups + inserts on btree.db (%llu entries) ===\n", ops,
+           (unsigned long long)n_keys);
+    int rc = 0;
+    uint64_t expect = 0;
+    for (int p = 0; p < n_pcts && rc == 0; p++) {
+        printf("%d%% inserts:\n", write_pcts[p]);
+        for (int mode = OLC_MUTEX; mode <= OLC_LATCH_FREE && rc == 0; mode++) {
+            double base_ops = 0.0;
+            for (int threads = 1; threads <= 16 && rc == 0; threads *= 2) {
+                rc = olc_round(&fm, &t, keys, n_keys, ops, write_pcts[p], mode, threads, &base_ops);
+                if (rc == 0)
+                    olc_count(&t, &expect);
+                // the last tree is kept to be written back below
+                if (rc != 0 || p + 1 < n_pcts || mode < OLC_LATCH_FREE || threads < 16)
+                    olc_free(&t);
+            }
+        }
+    }
+    free(keys);
+
+    // the tree that grew under 16 threads, written to a copy of the index
+    if (rc == 0) {
+        BtreeFileManager out;
+        RangeAggregate agg;
+        const char *copy = "btree.db.olc";
+        rc = (copy_file("btree.db", copy) == 0 && btfm_open(&out, copy, NODE_SIZE) == 0) ? 0 : -1;
+        if (rc == 0) {
+            rc = olc_save(&t, &out) == 0 && bptree_range_aggregate(&out, -INFINITY, 1, INFINITY, 1, &agg) == 0 &&
+                 agg.count == expect ? 0 : -1;
+            printf("written back: %u entries, %s\n", rc == 0 ? agg.count : 0, rc == 0 ? "aggregates match" : "MISMATCH");
+            btfm_close(&out);
+        }
+        remove(copy);
+        olc_free(&t);
+    }
+    btfm_close(&fm);
+    return rc;
+}
+
+// ---- readers during maintenance ----
+
+#define SNAP_ROUNDS 5
+#define SNAP_QUERY_LO 0.9f
+#define SNAP_QUERY_ROWS 1000
+
+typedef struct {
+    const char  *db;
+    int          snapshot;      // 0 = files opened by name, as before snapshots
+    _Atomic int *stop;
+    uint64_t     queries, torn, scanned, retries;
+    double      *lat;
+    uint32_t     n_lat, cap_lat;
+    int          rc;
+} SnapReader;
+
+// the first SNAP_QUERY_ROWS with FT_PCT_home >= SNAP_QUERY_LO through the index; torn if an entry leads to a
+// deleted slot or to another record than the one indexed. returns 1 if torn
+static int snap_query_index(BtreeFileManager *ix, HeapFile *hf, const char *path)
+{
+    KeyRange r = {SNAP_QUERY_LO, INFINITY, 1, 1};
+    IndexCursor c;
+    int rc = ix ? idx_cursor_open_on(&c, ix, &r, SNAP_QUERY_ROWS, 0) : idx_cursor_open(&c, path, &r, SNAP_QUERY_ROWS);
+    if (rc != 0)
+        return 1;
+    RecordLocation loc;
+    Row row;
+    int torn = 0;
+    while ((rc = idx_cursor_next(&c, &loc)) == 1) {
+        if (hf_read_row(hf, loc.block_id, loc.slot_id, &row) != 0 || row.ft_pct_home != loc.key_value)
+            torn = 1;
+    }
+    idx_cursor_close(&c);
+    return torn || rc < 0;
+}
+
+static void *snap_reader(void *arg)
+{
+    SnapReader *sr = (SnapReader *)arg;
+    while (!atomic_load(sr->stop) && sr->rc == 0) {
+        double t0 = bench_now_ms();
+        if (sr->snapshot) {
+            Snapshot s;
+            if (snap_open(&s, sr->db, 16) != 0) {
+                sr->torn++;     // a query that fails is as bad as a wrong one
+            } else {
+                sr->retries += s.retries;
+                if (s.has_index) {
+                    sr->torn += (uint64_t)snap_query_index(&s.ix, &s.hf, NULL);
+                } else {
+                    // the fallback: every row from the heap itself
+                    KeyRange r = {SNAP_QUERY_LO, INFINITY, 1, 1};
+                    HeapCursor c;
+                    RecordLocation loc;
+                    Row row;
+                    heap_cursor_open(&c, &s.hf, &r, SNAP_QUERY_ROWS);
+                    while (heap_cursor_next(&c, &loc, &row) == 1)
+                        ;
+                    heap_cursor_close(&c);
+                    sr->scanned++;
+                }
+                snap_close(&s);
+            }
+        } else {
+            HeapFile hf;
+            if (hf_open(&hf, sr->db, 16) != 0) {
+                sr->torn++;
+            } else {
+                sr->torn += (uint64_t)snap_query_index(NULL, &hf, "btree.db");
+                hf_close(&hf);
+            }
+        }
+        if (sr->n_lat == sr->cap_lat) {
+            uint32_t cap = sr->cap_lat ? sr->cap_lat * 2 : 1024;
+            double *tmp = realloc(sr->lat, cap * sizeof(double));
+            if (!tmp) {
+                sr->rc = -1;
+                break;
+            }
+            sr->lat = tmp;
+            sr->cap_lat = cap;
+        }
+        sr->lat[sr->n_lat++] = bench_now_ms() - t0;
+        sr->queries++;
+    }
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// every record with FT_PCT_home >= cut, from the index as it is now
+static RecordLocation *snap_victims(float cut, size_t *n)
+{
+    *n = 0;
+    KeyRange r = {cut, INFINITY, 1, 1};
+    IndexCursor c;
+    if (idx_cursor_open(&c, "btree.db", &r, 0) != 0)
+        return NULL;
+    size_t cap = 4096;
+    RecordLocation *locs = malloc(cap * sizeof(RecordLocation));
+    RecordLocation loc;
+    while (locs && idx_cursor_next(&c, &loc) == 1) {
+        if (*n == cap) {
+            RecordLocation *tmp = realloc(locs, cap * 2 * sizeof(RecordLocation));
+            if (!tmp) {
+                free(locs);
+                locs = NULL;
+                break;
+            }
+            locs = tmp;
+            cap *= 2;
+        }
+        locs[(*n)++] = loc;
+    }
+    idx_cursor_close(&c);
+    return locs;
+}
+
+// SNAP_ROUNDS batch deletes of ever more of the top keys on a fresh copy of the
+// table, with readers querying it all along
+static int snap_round(const char *db_filename, const char *work, int snapshot, int readers)
+{
+    char from[608], to[608];
+    remove_table(work);
+    if (copy_file(db_filename, work) != 0) {
+        fprintf(stderr, "Failed to copy %s\n", db_filename);
+        return -1;
+    }
+    snprintf(from, sizeof(from), "%s.zm", db_filename);
+    snprintf(to, sizeof(to), "%s.zm", work);
+    copy_file(from, to);
+    HeapFile hf;
+    if (hf_open(&hf, work, 64) != 0 || build_index_quiet(&hf) != 0)
+        return -1;
+    hf_close(&hf);
+
+    _Atomic int stop = 0;
+    SnapReader *sr = calloc((size_t)readers, sizeof(SnapReader));
+    pthread_t *tid = calloc((size_t)readers, sizeof(pthread_t));
+    int rc = (sr && tid) ? 0 : -1;
+    int started = 0;
+    for (int i = 0; i < readers && rc == 0; i++) {
+        sr[i].db = work;
+        sr[i].snapshot = snapshot;
+        sr[i].stop = &stop;
+        if (pthread_create(&tid[i], NULL, snap_reader, &sr[i]) != 0)
+            rc = -1;
+        else
+            started++;
+    }
+
+    double t0 = bench_now_ms();
+    size_t deleted = 0;
+    for (int round = 0; round < SNAP_ROUNDS && rc == 0; round++) {
+        size_t n;
+        RecordLocation *locs = snap_victims(0.95f - 0.03f * round, &n);
+        if (!locs) {
+            rc = -1;
+            break;
+        }
+        if (snapshot) {
+            SnapDeleteStats st;
+            rc = snap_delete(work, locs, n, &st);
+            deleted += st.del.deleted;
+        } else {
+            BatchDeleteStats st;
+            rc = hf_open(&hf, work, 64);
+            if (rc == 0) {
+                rc = batch_delete(&hf, locs, n, &st);
+                deleted += st.deleted;
+                hf_close(&hf);
+            }
+        }
+        free(locs);
+    }
+    double ms = bench_now_ms() - t0;
+    atomic_store(&stop, 1);
+
+    uint64_t queries = 0, torn = 0, scanned = 0, retries = 0;
+    uint32_t n_lat = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(tid[i], NULL);
+        if (sr[i].rc != 0)
+            rc = -1;
+        queries += sr[i].queries;
+        torn += sr[i].torn;
+        scanned += sr[i].scanned;
+        retries += sr[i].retries;
+        n_lat += sr[i].n_lat;
+    }
+    double *lat = malloc((n_lat ? n_lat : 1) * sizeof(double));
+    if (lat) {
+        n_lat = 0;
+        for (int i = 0; i < started; i++) {
+            memcpy(lat + n_lat, sr[i].lat, sr[i].n_lat * sizeof(double));
+            n_lat += sr[i].n_lat;
+        }
+        qsort(lat, n_lat, sizeof(double), cmp_double);
+    }
+    if (rc == 0 && lat && n_lat > 0)
+        printf("  %-9s %8zu %10.1f %8llu %8llu %8llu %8llu %9.3f %9.3f %9.3f\n", snapshot ? "snapshot" : "in place",
+               deleted, ms, (unsigned long long)queries, (unsigned long long)torn, (unsigned long long)scanned,
+               (unsigned long long)retries, lat[(n_lat + 1) / 2 - 1], lat[(n_lat * 99 + 99) / 100 - 1],
+               lat[n_lat - 1]);
+    for (int i = 0; i < started; i++)
+        free(sr[i].lat);
+    free(lat);
+    free(sr);
+    free(tid);
+    return rc;
+}
+
+int bench_snapshot(const char *db_filename, int readers)
+{
+    char work[600];
+    snprintf(work, sizeof(work), "%s.bench", db_filename);
+    if (readers < 1)
+        readers = 2;
+
+    printf("=== Readers during bulk deletes: %s, %d readers of FT_PCT_home >= %.2f LIMIT %d, %d deletes ===\n",
+           db_filename, readers, SNAP_QUERY_LO, SNAP_QUERY_ROWS, SNAP_ROUNDS);
+    printf("  %-9s %8s %10s %8s %8s %8s %8s %9s %9s %9s\n", "mode", "deleted", "delete ms", "queries", "torn",
+           "scanned", "retries", "p50 ms", "p99 ms", "max ms");
+    int rc = snap_round(db_filename, work, 0, readers);
+    if (rc == 0)
+        rc = snap_round(db_filename, work, 1, readers);
+    remove_table(work);
+
+    // btree.db indexes the scratch copy now, point it back at the original
+    HeapFile hf;
+    if (hf_open(&hf, db_filename, 64) == 0) {
+        build_index_quiet(&hf);
+        hf_close(&hf);
+    }
+    return rc;
+}
+
+// ---- query server ----
+
+#define SERVE_REQUESTS 20000
+#define SERVE_COLD_QUERIES 200
+#define SERVE_CHECKS 50
+#define SERVE_RANGE_ROWS 10
+
+typedef struct {
+    uint8_t op;
+    float   lo, hi;
+} ServeQuery;
+
+// half COUNT/SUM over a slice of the keys, half the first rows of a range
+static void serve_query(uint64_t *x, ServeQuery *q)
+{
+    q->lo = 0.5f + (float)(gen_next(x) % 450) / 1000.0f;
+    if (gen_next(x) & 1) {
+        q->op = SRV_AGGREGATE;
+        q->hi = q->lo + 0.05f;
+    } else {
+        q->op = SRV_RANGE;
+        q->hi = INFINITY;
+    }
+}
+
+// on an open snapshot: the count, and the sum or the first game id
+static int serve_direct(Snapshot *s, const ServeQuery *q, Row *rows, uint64_t *count, double *check)
+{
+    if (q->op == SRV_AGGREGATE)
+        return srv_aggregate(s, q->lo, q->hi, count, check);
+    uint32_t n;
+    int rc = srv_range(s, q->lo, q->hi, SERVE_RANGE_ROWS, rows, &n);
+    *count = n;
+    *check = n ? rows[0].game_id : 0;
+    return rc;
+}
+
+// the same through the server
+static int serve_remote(int fd, const ServeQuery *q, uint8_t **resp, uint32_t *cap, uint64_t *count, double *check)
+{
+    uint8_t body[12];
+    uint32_t len, limit = SERVE_RANGE_ROWS;
+    memcpy(body, &q->lo, 4);
+    memcpy(body + 4, &q->hi, 4);
+    memcpy(body + 8, &limit, 4);
+    if (srv_call(fd, q->op, body, q->op == SRV_RANGE ? 12 : 8, resp, cap, &len) != SRV_OK)
+        return -1;
+    if (q->op == SRV_AGGREGATE) {
+        if (len < 16)
+            return -1;
+        memcpy(count, *resp, 8);
+        memcpy(check, *resp + 8, 8);
+        return 0;
+    }
+    uint32_t n;
+    if (len < 4)
+        return -1;
+    memcpy(&n, *resp, 4);
+    if (len < 4 + n * SRV_ROW_SIZE)
+        return -1;
+    Row r;
+    *count = n;
+    *check = 0;
+    if (n) {
+        srv_decode_row(*resp + 4, &r);
+        *check = r.game_id;
+    }
+    return 0;
+}
+
+typedef struct {
+    const char *socket_path;
+    uint32_t    n;
+    uint64_t    seed;
+    double     *lat;
+    int         rc;
+} ServeClient;
+
+static void *serve_client(void *arg)
+{
+    ServeClient *c = arg;
+    int fd = srv_connect(c->socket_path);
+    if (fd < 0) {
+        c->rc = -1;
+        return NULL;
+    }
+    uint8_t *resp = NULL;
+    uint32_t cap = 0;
+    uint64_t x = c->seed, count;
+    double check;
+    ServeQuery q;
+    for (uint32_t i = 0; i < c->n && c->rc == 0; i++) {
+        serve_query(&x, &q);
+        double t0 = bench_now_ms();
+        c->rc = serve_remote(fd, &q, &resp, &cap, &count, &check);
+        c->lat[i] = bench_now_ms() - t0;
+    }
+    free(resp);
+    close(fd);
+    return NULL;
+}
+
+static void serve_report(const char *mode, int clients, double *lat, uint32_t n, double ms)
+{
+    qsort(lat, n, sizeof(double), cmp_double);
+    printf("  %-8s %8d %9u %10.0f %9.3f %9.3f %9.3f\n", mode, clients, n, n / (ms / 1000.0),
+           lat[(n + 1) / 2 - 1], lat[(n * 99 + 99) / 100 - 1], lat[n - 1]);
+}
+
+// every connection sends its share of requests, one at a time
+static int serve_round(const char *socket_path, int clients, uint32_t requests)
+{
+    ServeClient *sc = calloc((size_t)clients, sizeof(ServeClient));
+    pthread_t *tid = calloc((size_t)clients, sizeof(pthread_t));
+    double *lat = malloc(requests * sizeof(double));
+    int rc = (sc && tid && lat) ? 0 : -1;
+    int started = 0;
+    uint32_t per = requests / (uint32_t)clients, total = 0;
+    double t0 = bench_now_ms();
+    for (int i = 0; i < clients && rc == 0; i++) {
+        sc[i].socket_path = socket_path;
+        sc[i].n = per;
+        sc[i].seed = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);
+        sc[i].lat = lat + total;
+        total += per;
+        if (pthread_create(&tid[i], NULL, serve_client, &sc[i]) != 0)
+            rc = -1;
+        else
+            started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(tid[i], NULL);
+        if (sc[i].rc != 0)
+            rc = -1;
+    }
+    double ms = bench_now_ms() - t0;
+    if (rc == 0 && total > 0)
+        serve_report("server", clients, lat, total, ms);
+    else
+        fprintf(stderr, "Requests to the server at %s failed\n", socket_path);
+    free(lat);
+    free(sc);
+    free(tid);
+    return rc;
+}
+
+// a snapshot opened and closed around each query
+static int serve_cold(const char *db_filename, uint32_t n)
+{
+    double *lat = malloc(n * sizeof(double));
+    Row *rows = malloc(SERVE_RANGE_ROWS * sizeof(Row));
+    int rc = (lat && rows) ? 0 : -1;
+    uint64_t x = 0x9E3779B97F4A7C15ULL, count;
+    double check, t0 = bench_now_ms();
+    ServeQuery q;
+    for (uint32_t i = 0; i < n && rc == 0; i++) {
+        serve_query(&x, &q);
+        double t1 = bench_now_ms();
+        Snapshot s;
+        rc = snap_open(&s, db_filename, 64);
+        if (rc == 0) {
+            rc = serve_direct(&s, &q, rows, &count, &check);
+            snap_close(&s);
+        }
+        lat[i] = bench_now_ms() - t1;
+    }
+    if (rc == 0)
+        serve_report("cold", 1, lat, n, bench_now_ms() - t0);
+    free(lat);
+    free(rows);
+    return rc;
+}
+
+// the answers of the server against reading the table directly
+static int serve_check(const char *db_filename, const char *socket_path)
+{
+    Snapshot s;
+    if (snap_open(&s, db_filename, 64) != 0)
+        return -1;
+    int fd = srv_connect(socket_path);
+    Row *rows = malloc(SERVE_RANGE_ROWS * sizeof(Row));
+    uint8_t *resp = NULL;
+    uint32_t cap = 0, agree = 0;
+    uint64_t x = 42, c1, c2;
+    double k1, k2;
+    ServeQuery q;
+    int rc = (fd >= 0 && rows) ? 0 : -1;
+    for (int i = 0; i < SERVE_CHECKS && rc == 0; i++) {
+        serve_query(&x, &q);
+        rc = serve_direct(&s, &q, rows, &c1, &k1);
+        if (rc == 0)
+            rc = serve_remote(fd, &q, &resp, &cap, &c2, &k2);
+        if (rc == 0 && c1 == c2 && k1 == k2)
+            agree++;
+    }
+    if (rc == 0)
+        printf("Answers checked: %u of %d agree with a direct read (index: %s)\n", agree, SERVE_CHECKS,
+               s.has_index ? "yes" : "no, heap scans");
+    if (fd >= 0)
+        close(fd);
+    free(resp);
+    free(rows);
+    snap_close(&s);
+    return rc == 0 && agree == SERVE_CHECKS ? 0 : -1;
+}
+
+int bench_serve(const char *db_filename, int clients, uint32_t requests)
+{
+    if (clients < 1)
+        clients = 4;
+    if (requests == 0)
+        requests = SERVE_REQUESTS;
+    char sock[600];
+    snprintf(sock, sizeof(sock), "%s.sock", db_filename);
+
+    // the server runs in a child, as it would in a process of its own
+    int fds[2];
+    if (pipe(fds) != 0)
+        return -1;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        ServerStats st;
+        int rc = srv_run(db_filename, sock, 64, fds[1], &st);
+        if (rc == 0)
+            printf("Server: %llu requests on %llu connections, %.1f ms answering, %u reopens\n",
+                   (unsigned long long)st.requests, (unsigned long long)st.connections, st.busy_ms, st.reopens);
+        fflush(stdout);
+        _exit(rc == 0 ? 0 : 1);
+    }
+    close(fds[1]);
+    uint8_t ready;
+    ssize_t got = read(fds[0], &ready, 1);
+    close(fds[0]);
+    int rc = got == 1 ? 0 : -1;
+
+    if (rc == 0) {
+        printf("=== Query server: %s, half COUNT/SUM over 0.05 of FT_PCT_home, half ranges LIMIT %d ===\n",
+               db_filename, SERVE_RANGE_ROWS);
+        rc = serve_check(db_filename, sock);
+    }
+    if (rc == 0) {
+        printf("  %-8s %8s %9s %10s %9s %9s %9s\n", "mode", "clients", "requests", "qps", "p50 ms", "p99 ms",
+               "max ms");
+        rc = serve_cold(db_filename, requests < SERVE_COLD_QUERIES ? requests : SERVE_COLD_QUERIES);
+    }
+    for (int c = 1; rc == 0; c *= 2) {
+        if (c > clients)
+            c = clients;
+        rc = serve_round(sock, c, requests);
+        if (c == clients)
+            break;
+    }
+
+    // the server prints its own summary on the way out
+    fflush(stdout);
+    int fd = srv_connect(sock);
+    uint8_t *resp = NULL;
+    uint32_t cap = 0, len;
+    if (fd >= 0) {
+        srv_call(fd, SRV_SHUTDOWN, NULL, 0, &resp, &cap, &len);
+        close(fd);
+    } else
+        kill(pid, SIGTERM);
+    free(resp);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "The server on %s failed\n", db_filename);
+        rc = -1;
+    }
+    return rc;
+}
@@ -1,4 +1,5 @@
 #include "block.h"
+#include "compress.h"
 #include <string.h>
 
 int block_capacity_records(uint16_t record_size)
@@ -9,6 +10,14 @@ int block_capacity_records(uint16_t record_size)
     return (cap < 0) ? 0 : cap;
 }
 
+int block_capacity_with_bitmap(uint16_t record_size)
+{
+    int cap = block_capacity_records(record_size);
+    while (cap > 0 && (size_t)cap * record_size + (size_t)(cap + 7) / 8 > BLOCK_SIZE - BLOCK_HDR_SIZE)
+        cap--;
+    return cap;
+}
+
 int block_write_record(Block *b, uint16_t record_size, int slot, const uint8_t *rec)
 {
     int cap = block_capacity_records(record_size);
@@ -28,3 +37,331 @@ int block_read_record(const Block *b, uint16_t record_size, int slot, uint8_t *o
     memcpy(out, &b->bytes[off], record_size);
     return 0;
 }
+
+// PAX: the data area is split into one minipage per field, each sized for a full
+// block of values. field f starts at capacity * (offset of f in the packed record)
+static size_t pax_value_offset(const Schema *s, int cap, int field, int slot)
+{
+    return BLOCK_HDR_SIZE + (size_t)cap * schema_field_offset(s, field) + (size_t)slot * s->fields[field].width;
+}
+
+int block_put_record(Block *b, const Schema *s, int slot, const uint8_t *rec)
+{
+    if (block_format(b) == BLOCK_FMT_PACKED)
+        return -1;
+    int cap = block_capacity(b, s);
+    if (slot < 0 || slot >= cap)
+        return -1;
+    block_mark_live(b, s, slot);
+    if (block_format(b) != BLOCK_FMT_PAX)
+    {
+        memcpy(&b->bytes[BLOCK_HDR_SIZE + (size_t)slot * s->record_size], rec, s->record_size);
+        return 0;
+    }
+
+    uint16_t roff = 0;
+    for (int f = 0; f < s->n_fields; f++)
+    {
+        memcpy(&b->bytes[pax_value_offset(s, cap, f, slot)], rec + roff, s->fields[f].width);
+        roff += s->fields[f].width;
+    }
+    return 0;
+}
+
+int block_get_record(const Block *b, const Schema *s, int slot, uint8_t *out)
+{
+    if (block_format(b) == BLOCK_FMT_PACKED)
+        return cblock_get_record(b, s, slot, out);
+    int cap = block_capacity(b, s);
+    if (slot < 0 || slot >= cap)
+        return -1;
+    if (block_format(b) != BLOCK_FMT_PAX)
+    {
+        memcpy(out, &b->bytes[BLOCK_HDR_SIZE + (size_t)slot * s->record_size], s->record_size);
+        return 0;
+    }
+
+    uint16_t roff = 0;
+    for (int f = 0; f < s->n_fields; f++)
+    {
+        memcpy(out + roff, &b->bytes[pax_value_offset(s, cap, f, slot)], s->fields[f].width);
+        roff += s->fields[f].width;
+    }
+    return 0;
+}
+
+int block_capacity(const Block *b, const Schema *s)
+{
+    if (block_format(b) == BLOCK_FMT_PACKED)
+        return CBLOCK_MAX_ROWS;
+    if (block_flags(b) & BLOCK_FLAG_VALIDITY)
+        return block_capacity_with_bitmap(s->record_size);
+    return block_capacity_records(s->record_size);
+}
+
+void block_init(Block *b, uint8_t fmt)
+{
+    memset(b, 0, sizeof(Block));
+    block_set_format(b, fmt);
+    if (fmt != BLOCK_FMT_PACKED)
+        block_set_flags(b, BLOCK_FLAG_VALIDITY);
+}
+
+// ---- validity bitmap ----
+
+// the bitmap covers every slot the block can hold; a compressed block never
+// grows, so its bitmap only covers the rows it was built with
+static size_t bitmap_bytes(const Block *b, const Schema *s)
+{
+    int slots = (block_format(b) == BLOCK_FMT_PACKED) ? block_used_count(b) : block_capacity(b, s);
+    return ((size_t)slots + 7) / 8;
+}
+
+static const uint8_t *bitmap_of(const Block *b, const Schema *s)
+{
+    return b->bytes + BLOCK_SIZE - bitmap_bytes(b, s);
+}
+
+int block_slot_live(const Block *b, const Schema *s, int slot)
+{
+    if (slot < 0 || slot >= block_used_count(b))
+        return 0;
+    if (!(block_flags(b) & BLOCK_FLAG_HAS_DEAD))
+        return 1;
+    return (bitmap_of(b, s)[slot >> 3] >> (slot & 7)) & 1;
+}
+
+int block_kill_slot(Block *b, const Schema *s, int slot)
+{
+    if (!(block_flags(b) & BLOCK_FLAG_VALIDITY))
+        return -1;
+    if (!block_slot_live(b, s, slot))
+        return -1;
+    uint8_t *bm = (uint8_t *)bitmap_of(b, s);
+    bm[slot >> 3] &= (uint8_t)~(1u << (slot & 7));
+    block_set_flags(b, block_flags(b) | BLOCK_FLAG_HAS_DEAD);
+    return 0;
+}
+
+void block_mark_live(Block *b, const Schema *s, int slot)
+{
+    if (!(block_flags(b) & BLOCK_FLAG_VALIDITY))
+        return;
+    uint8_t *bm = (uint8_t *)bitmap_of(b, s);
+    bm[slot >> 3] |= (uint8_t)(1u << (slot & 7));
+}
+
+// slots below the used count, never more than the block holds
+static int block_slots(const Block *b, const Schema *s)
+{
+    int used = block_used_count(b);
+    int cap = block_capacity(b, s);
+    return used > cap ? cap : used;
+}
+
+int block_live_count(const Block *b, const Schema *s)
+{
+    int n = block_slots(b, s);
+    if (!(block_flags(b) & BLOCK_FLAG_HAS_DEAD))
+        return n;
+    const uint8_t *bm = bitmap_of(b, s);
+    int live = 0;
+    for (int i = 0; i < n / 8; i++)
+        live += __builtin_popcount(bm[i]);
+    for (int i = n & ~7; i < n; i++)
+        live += (bm[i >> 3] >> (i & 7)) & 1;
+    return live;
+}
+
+int block_live_slots(const Block *b, const Schema *s, uint16_t *sel)
+{
+    int n = block_slots(b, s);
+    if (!(block_flags(b) & BLOCK_FLAG_HAS_DEAD))
+    {
+        for (int i = 0; i < n; i++)
+            sel[i] = (uint16_t)i;
+        return n;
+    }
+
+    // walk the set bits only
+    const uint8_t *bm = bitmap_of(b, s);
+    int k = 0;
+    for (int byte = 0; byte * 8 < n; byte++)
+    {
+        unsigned bits = bm[byte];
+        if (byte * 8 + 8 > n)
+            bits &= (1u << (n - byte * 8)) - 1;
+        while (bits)
+        {
+            sel[k++] = (uint16_t)(byte * 8 + __builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+    return k;
+}
+
+int block_sel_live(const Block *b, const Schema *s, uint16_t *sel, int n)
+{
+    if (!(block_flags(b) & BLOCK_FLAG_HAS_DEAD))
+        return n;
+    const uint8_t *bm = bitmap_of(b, s);
+    int k = 0;
+    for (int i = 0; i < n; i++)
+    {
+        sel[k] = sel[i];
+        k += (bm[sel[i] >> 3] >> (sel[i] & 7)) & 1;
+    }
+    return k;
+}
+
+int block_free_slots(const Block *b, const Schema *s)
+{
+    if (block_format(b) == BLOCK_FMT_PACKED)
+        return 0;
+    return block_capacity(b, s) - block_live_count(b, s);
+}
+
+int block_insert_record(Block *b, const Schema *s, const uint8_t *rec)
+{
+    if (block_format(b) == BLOCK_FMT_PACKED)
+        return -1;
+    int used = block_used_count(b);
+    int slot = used;
+    if (block_flags(b) & BLOCK_FLAG_HAS_DEAD)
+    {
+        // the first dead slot below the used count
+        const uint8_t *bm = bitmap_of(b, s);
+        for (int byte = 0; byte * 8 < used; byte++)
+        {
+            unsigned holes = ~bm[byte] & 0xFFu;
+            if (byte * 8 + 8 > used)
+                holes &= (1u << (used - byte * 8)) - 1;
+            if (holes)
+            {
+                slot = byte * 8 + __builtin_ctz(holes);
+                break;
+            }
+        }
+    }
+    if (slot >= block_capacity(b, s))
+        return -1;
+    if (block_put_record(b, s, slot, rec) != 0)
+        return -1;
+    if (slot == used)
+        block_set_used_count(b, (uint16_t)(used + 1));
+
+    // the last hole was filled, scans can go back to the fast path
+    if ((block_flags(b) & BLOCK_FLAG_HAS_DEAD) && block_live_count(b, s) == block_used_count(b))
+        block_set_flags(b, block_flags(b) & (uint8_t)~BLOCK_FLAG_HAS_DEAD);
+    return slot;
+}
+
+int block_pop_record(Block *b, const Schema *s, uint8_t *out)
+{
+    if (block_format(b) == BLOCK_FMT_PACKED)
+        return -1;
+    int slot = block_used_count(b) - 1;
+    while (slot >= 0 && !block_slot_live(b, s, slot))
+        slot--;
+    if (slot < 0 || block_get_record(b, s, slot, out) != 0)
+        return -1;
+    block_kill_slot(b, s, slot);
+
+    // dead slots at the end are no longer part of the block
+    int used = slot;
+    while (used > 0 && !block_slot_live(b, s, used - 1))
+        used--;
+    block_set_used_count(b, (uint16_t)used);
+    if ((block_flags(b) & BLOCK_FLAG_HAS_DEAD) && block_live_count(b, s) == used)
+        block_set_flags(b, block_flags(b) & (uint8_t)~BLOCK_FLAG_HAS_DEAD);
+    return slot;
+}
+
+int block_remove_record(Block *b, const Schema *s, int slot)
+{
+    int used = block_used_count(b);
+    if (slot < 0 || slot >= used)
+        return -1;
+    if (block_format(b) == BLOCK_FMT_PACKED)
+        return cblock_remove_record(b, s, slot);
+
+    uint8_t temp_buf[512];
+    for (int i = slot + 1; i < used; i++)
+    {
+        int live = block_slot_live(b, s, i);
+        if (block_get_record(b, s, i, temp_buf) == 0)
+            block_put_record(b, s, i - 1, temp_buf);
+        if (!live)
+            block_kill_slot(b, s, i - 1);
+    }
+    if (block_flags(b) & BLOCK_FLAG_VALIDITY)
+    {
+        uint8_t *bm = (uint8_t *)bitmap_of(b, s);
+        bm[(used - 1) >> 3] &= (uint8_t)~(1u << ((used - 1) & 7));
+    }
+    block_set_used_count(b, (uint16_t)(used - 1));
+    return 0;
+}
+
+int block_remove_records(Block *b, const Schema *s, const uint16_t *slots, int n)
+{
+    int used = block_used_count(b);
+    if (n <= 0)
+        return 0;
+    if (slots[n - 1] >= used)
+        return -1;
+    if (block_format(b) == BLOCK_FMT_PACKED)
+    {
+        // highest slot first so the lower slot numbers stay valid
+        for (int k = n - 1; k >= 0; k--)
+            if (cblock_remove_record(b, s, slots[k]) != 0)
+                return -1;
+        return 0;
+    }
+
+    // one pass: every kept record moves down by the number of removed slots before it
+    uint8_t temp_buf[512];
+    int w = 0, k = 0;
+    for (int i = 0; i < used; i++)
+    {
+        if (k < n && slots[k] == i)
+        {
+            k++;
+            continue;
+        }
+        if (w != i)
+        {
+            int live = block_slot_live(b, s, i);
+            if (block_get_record(b, s, i, temp_buf) == 0)
+                block_put_record(b, s, w, temp_buf);
+            if (!live)
+                block_kill_slot(b, s, w);
+        }
+        w++;
+    }
+    if (block_flags(b) & BLOCK_FLAG_VALIDITY)
+    {
+        uint8_t *bm = (uint8_t *)bitmap_of(b, s);
+        for (int i = w; i < used; i++)
+            bm[i >> 3] &= (uint8_t)~(1u << (i & 7));
+    }
+    block_set_used_count(b, (uint16_t)w);
+    return 0;
+}
+
+int block_column(const Block *b, const Schema *s, int field, uint16_t *offset, uint16_t *stride)
+{
+    if (block_format(b) == BLOCK_FMT_PACKED)
+        return cblock_plain_column(b, s, field, offset, stride);
+    if (block_format(b) == BLOCK_FMT_PAX)
+    {
+        *offset = (uint16_t)(block_capacity(b, s) * schema_field_offset(s, field));
+        *stride = s->fields[field].width;
+    }
+    else
+    {
+        *offset = schema_field_offset(s, field);
+        *stride = s->record_size;
+    }
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bptree.h"
+#include "bptree_ops.h"
+#include "file_manager_btree.h"
+
+// this file answers COUNT/SUM/AVG and rank/percentile queries from the subtree
+// aggregates stored in the internal nodes. every query follows a single
+// root-to-leaf path: children fully left of the path are added from their
+// stored aggregate, only the leaf at the end is looked at entry by entry.
+
+// count and sum of all entries with key < x (or <= x when inclusive)
+static int prefix_aggregate(BtreeFileManager *fm, const BtreeMeta *meta, float x, int inclusive,
+                            uint32_t *count, double *sum, uint32_t *nodes)
+{
+    *count = 0;
+    *sum = 0.0;
+    if (meta->root_id == BTREE_NO_NODE)
+        return 0;
+
+    Node n;
+    uint32_t node_id = meta->root_id;
+    while (1) {
+        if (btfm_read_node(fm, node_id, &n) != 0)
+            return -1;
+        (*nodes)++;
+        if (n.level == 1)
+            break;
+
+        // every child in front of the first separator beyond x lies entirely below x
+        int i = 0;
+        while (i < n.key_count) {
+            float k = int_get_key(&n, i);
+            if (inclusive ? (k > x) : (k >= x))
+                break;
+            i++;
+        }
+        for (int c = 0; c < i; c++) {
+            uint32_t cc;
+            double cs;
+            int_get_child_agg(&n, c, &cc, &cs);
+            *count += cc;
+            *sum += cs;
+        }
+        node_id = int_get_child(&n, i);
+    }
+
+    for (int i = 0; i < n.key_count; i++) {
+        float k = leaf_get_key(&n, i);
+        if (inclusive ? (k > x) : (k >= x))
+            break;
+        (*count)++;
+        *sum += k;
+    }
+    return 0;
+}
+
+// count and sum of the whole tree: one read of the root
+static int total_aggregate(BtreeFileManager *fm, const BtreeMeta *meta, uint32_t *count, double *sum, uint32_t *nodes)
+{
+    *count = 0;
+    *sum = 0.0;
+    if (meta->root_id == BTREE_NO_NODE)
+        return 0;
+
+    Node root;
+    if (btfm_read_node(fm, meta->root_id, &root) != 0)
+        return -1;
+    (*nodes)++;
+
+    if (root.level > 1) {
+        int_total_agg(&root, count, sum);
+        return 0;
+    }
+    for (int i = 0; i < root.key_count; i++) {
+        (*count)++;
+        *sum += leaf_get_key(&root, i);
+    }
+    return 0;
+}
+
+int bptree_range_aggregate(BtreeFileManager *fm, float lo, int lo_inclusive, float hi, int hi_inclusive, RangeAggregate *out)
+{
+    memset(out, 0, sizeof(RangeAggregate));
+
+    BtreeMeta meta;
+    if (btfm_read_meta(fm, &meta) != 0)
+        return -1;
+
+    // [lo, hi] = prefix(hi) - prefix(lo), open ends fall back to the root total / zero
+    uint32_t hi_count, lo_count = 0;
+    double hi_sum, lo_sum = 0.0;
+
+    if (isinf(hi) && hi > 0) {
+        if (total_aggregate(fm, &meta, &hi_count, &hi_sum, &out->nodes_accessed) != 0)
+            return -1;
+    } else if (prefix_aggregate(fm, &meta, hi, hi_inclusive, &hi_count, &hi_sum, &out->nodes_accessed) != 0) {
+        return -1;
+    }
+
+    if (!(isinf(lo) && lo < 0)) {
+        if (prefix_aggregate(fm, &meta, lo, !lo_inclusive, &lo_count, &lo_sum, &out->nodes_accessed) != 0)
+            return -1;
+    }
+
+    if (hi_count > lo_count) {
+        out->count = hi_count - lo_count;
+        out->sum = hi_sum - lo_sum;
+    }
+    return 0;
+}
+
+int bptree_rank(BtreeFileManager *fm, float key, uint32_t *rank)
+{
+    BtreeMeta meta;
+    if (btfm_read_meta(fm, &meta) != 0)
+        return -1;
+
+    double sum;
+    uint32_t nodes = 0;
+    return prefix_aggregate(fm, &meta, key, 0, rank, &sum, &nodes);
+}
+
+int bptree_select(BtreeFileManager *fm, uint32_t k, float *key)
+{
+    BtreeMeta meta;
+    if (btfm_read_meta(fm, &meta) != 0 || meta.root_id == BTREE_NO_NODE)
+        return -1;
+
+    Node n;
+    uint32_t node_id = meta.root_id;
+    while (1) {
+        if (btfm_read_node(fm, node_id, &n) != 0)
+            return -1;
+        if (n.level == 1)
+            break;
+
+        // skip whole children while k is beyond their count
+        int i = 0;
+        for (; i < n.key_count; i++) {
+            uint32_t cc;
+            double cs;
+            int_get_child_agg(&n, i, &cc, &cs);
+            if (k < cc)
+                break;
+            k -= cc;
+        }
+        node_id = int_get_child(&n, i);
+    }
+
+    if (k >= n.key_count)
+        return -1;
+    *key = leaf_get_key(&n, (int)k);
+    return 0;
+}
+
+int bptree_percentile(BtreeFileManager *fm, double p, float *key)
+{
+    BtreeMeta meta;
+    if (btfm_read_meta(fm, &meta) != 0)
+        return -1;
+
+    uint32_t count, nodes = 0;
+    double sum;
+    if (total_aggregate(fm, &meta, &count, &sum, &nodes) != 0 || count == 0)
+        return -1;
+
+    if (p < 0.0)
+        p = 0.0;
+    if (p > 1.0)
+        p = 1.0;
+    return bptree_select(fm, (uint32_t)(p * (count - 1) + 0.5), key);
+}
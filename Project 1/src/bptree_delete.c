@@ -2,16 +2,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <math.h>
 #include "bptree.h"
+#include "bptree_ops.h"
 #include "file_manager_btree.h"
 #include "heapfile.h"
-
-// Structure to store location of a record that needs to be deleted
-typedef struct {
-    uint32_t block_id;    // Which data block contains this record
-    uint16_t slot_id;     // Which slot within that block
-    float key_value;      // The FT_PCT_home value for this record
-} RecordLocation;
+#include "cursor.h"
+#include "parallel_scan.h"
+#include "bench.h"
+#include "batch_delete.h"
+#include "snapshot.h"
 
 // Structure to store results of the search operation
 typedef struct {
@@ -45,44 +45,8 @@ static int ensure_records_capacity(SearchResult *result, size_t needed)
     return 0;
 }
 
-// Helper function to read a key from a leaf node at a specific entry index
-static float read_leaf_key(const Node *leaf, int entry_index)
-{
-    // In leaf nodes, each entry has format: [record_pointer][key]
-    // Calculate offset to the key part of the entry
-    size_t offset = entry_index * (RECORD_POINTER_SIZE + KEY_SIZE) + RECORD_POINTER_SIZE;
-    
-    float key;
-    memcpy(&key, &leaf->bytes[offset], KEY_SIZE);
-    return key;
-}
-
-// Helper function to read record pointer (block_id, slot_id) from a leaf node entry
-static void read_leaf_record_pointer(const Node *leaf, int entry_index, uint32_t *block_id, uint16_t *slot_id)
-{
-    // Calculate offset to the record pointer part of the entry
-    size_t offset = entry_index * (RECORD_POINTER_SIZE + KEY_SIZE);
-    
-    // Read block_id (first 4 bytes) and slot_id (next 4 bytes, but cast to uint16_t)
-    memcpy(block_id, &leaf->bytes[offset], 4);
-    
-    uint32_t slot_temp;
-    memcpy(&slot_temp, &leaf->bytes[offset + 4], 4);
-    *slot_id = (uint16_t)slot_temp;
-}
-
-// Helper function to get the next leaf node ID from the current leaf's link
-static uint32_t get_next_leaf_id(const Node *leaf)
-{
-    // Next leaf pointer is stored at the end of the node
-    size_t off = (NODE_SIZE - NODE_HDR_SIZE) - 4;
-    uint32_t next_id;
-    memcpy(&next_id, &leaf->bytes[off], 4);
-    
-    return next_id;
-}
-
-// Main function to perform B+ tree range search for records with key >= min_key
+// Main function to perform B+ tree range search for records with key > min_key
+// The matches are collected from an index cursor so deletion gets the full list of locations
 int bptree_range_search(const char *btree_filename, float min_key, SearchResult *result)
 {
     // Initialize result structure
@@ -91,202 +55,35 @@ int bptree_range_search(const char *btree_filename, float min_key, SearchResult
     // Record start time for performance measurement
     clock_t start_time = clock();
     
-    // Open the B+ tree file
-    BtreeFileManager btfm;
-    
-    if (btfm_open(&btfm, btree_filename, NODE_SIZE) != 0) {
-        fprintf(stderr, "Failed to open B+ tree file: %s\n", btree_filename);
-        return -1;
-    }
-    
-    // Step 1: Find the root node and navigate to the appropriate leaf node
-    
-    // Find the root node - it should be the last allocated node (highest level)
-    uint32_t root_node_id = 0;
-    uint8_t max_level = 0;
-    int found_root = 0;
-    
-    // Try reading nodes starting from 0 to find the root
-    for (uint32_t test_id = 0; test_id < 100; test_id++) {
-        Node test_node;
-        int read_result = btfm_read_node(&btfm, test_id, &test_node);
-        
-        if (read_result == 0) {
-            if (test_node.level > max_level) {
-                max_level = test_node.level;
-                root_node_id = test_id;
-                found_root = 1;
-            }
-        } else {
-            break; // No more nodes to read
-        }
-    }
-    
-    if (!found_root) {
-        fprintf(stderr, "ERROR: Could not find any readable nodes in B+ tree file\n");
-        btfm_close(&btfm);
+    // Open a cursor over (min_key, +inf); this descends from the root to the first leaf
+    KeyRange range = {min_key, INFINITY, 0, 0};
+    IndexCursor cur;
+    if (idx_cursor_open(&cur, btree_filename, &range, 0) != 0) {
         return -1;
     }
     
-
-    
-    uint32_t current_node_id = root_node_id;
-    Node *current_node = malloc(sizeof(Node));
-    if (!current_node) {
-        btfm_close(&btfm);
-        return -1;
-    }
-    
-    // Navigate down the tree until we reach a leaf
-    while (1) {
-        // Read the current node
-        if (btfm_read_node(&btfm, current_node_id, current_node) != 0) {
-            fprintf(stderr, "Failed to read node %u\n", current_node_id);
-            free(current_node);
-            btfm_close(&btfm);
+    // Walk the leaf chain and record every qualifying entry
+    RecordLocation loc;
+    int rc;
+    while ((rc = idx_cursor_next(&cur, &loc)) == 1) {
+        if (ensure_records_capacity(result, result->count + 1) != 0) {
+            fprintf(stderr, "Failed to allocate memory for records\n");
+            idx_cursor_close(&cur);
             return -1;
         }
-        
-
-        
-        // Count this node access
-        if (current_node->level == 1) {
-            result->leaf_nodes_accessed++;
-            break;  // We've reached a leaf node
-        } else {
-            result->index_nodes_accessed++;
-        }
-        
-        // For internal nodes, find the appropriate child to follow
-        // We need to find the rightmost child whose key is <= min_key
-        if (current_node->level > 1) {
-            // Read first child pointer (always at the beginning)
-            uint32_t child_id;
-            memcpy(&child_id, &current_node->bytes[0], 4);
-            
-
-            
-            // Check each key in the internal node
-            for (int i = 0; i < current_node->key_count; i++) {
-                // Calculate offset for the i-th key-pointer pair
-                size_t key_offset = NODE_POINTER_SIZE + i * (KEY_SIZE + NODE_POINTER_SIZE);
-                
-                float node_key;
-                memcpy(&node_key, &current_node->bytes[key_offset], KEY_SIZE);
-                
-
-                
-                // If this key is > min_key, we should go to the previous child
-                // If this is the first key and it's > min_key, use first child
-                if (node_key > min_key) {
-                    if (i == 0) {
-                        // Use first child pointer
-
-                    } else {
-                        // Use previous child pointer
-                        size_t prev_ptr_offset = NODE_POINTER_SIZE + (i-1) * (KEY_SIZE + NODE_POINTER_SIZE) + KEY_SIZE;
-                        memcpy(&child_id, &current_node->bytes[prev_ptr_offset], 4);
-
-                    }
-                    break;
-                } else if (i == current_node->key_count - 1) {
-                    // This is the last key and it's <= min_key, use its child pointer
-                    size_t ptr_offset = NODE_POINTER_SIZE + i * (KEY_SIZE + NODE_POINTER_SIZE) + KEY_SIZE;
-                    memcpy(&child_id, &current_node->bytes[ptr_offset], 4);
-
-                }
-            }
-            
-            current_node_id = child_id;
-
-        }
-    }
-    
-    // Step 2: Search through leaf nodes starting from the found leaf
-    uint32_t leaf_id = current_node_id;
-    int found_first = 0;  // Flag to indicate if we've found the first qualifying record
-    
-
-    
-    while (leaf_id != UINT32_MAX) {  // Check for end of leaf chain marker
-        // Read the current leaf node
-        if (btfm_read_node(&btfm, leaf_id, current_node) != 0) {
-            fprintf(stderr, "Failed to read leaf node %u\n", leaf_id);
-            break;
-        }
-        
-        result->leaf_nodes_accessed++;
-
-        
-        // Scan all entries in this leaf node
-        for (int i = 0; i < current_node->key_count; i++) {
-            float key = read_leaf_key(current_node, i);
-            
-
-            
-            // If we haven't found the first qualifying record yet, check if this is it
-            if (!found_first) {
-                if (key > min_key) {
-                    found_first = 1;
-
-                } else {
-                    continue;  // Skip this record, it's below our threshold
-                }
-            }
-            
-            // If we reach here, this record qualifies for deletion
-            if (ensure_records_capacity(result, result->count + 1) != 0) {
-                fprintf(stderr, "Failed to allocate memory for records\n");
-                free(current_node);
-                btfm_close(&btfm);
-                return -1;
-            }
-            
-            // Read the record location from the leaf entry
-            uint32_t block_id;
-            uint16_t slot_id;
-            read_leaf_record_pointer(current_node, i, &block_id, &slot_id);
-            
-            // Store the record location
-            result->records[result->count].block_id = block_id;
-            result->records[result->count].slot_id = slot_id;
-            result->records[result->count].key_value = key;
-            result->total_key_value += key;
-            result->count++;
-        }
-        
-        // Move to the next leaf node
-        uint32_t next_leaf_id = get_next_leaf_id(current_node);
-
-        
-        if (next_leaf_id == leaf_id) {
-            // Prevent infinite loop if there's a circular reference
-
-            break;
-        }
-        leaf_id = next_leaf_id;
-        
-        // If we haven't found any qualifying records in this leaf and we haven't
-        // found the first qualifying record yet, continue to next leaf
-        if (!found_first) {
-            continue;
-        }
-        
-        // If next_leaf_id is 0 or invalid, we've reached the end
-        if (next_leaf_id == 0 || next_leaf_id >= 1000000) {  // Sanity check for valid node ID
-
-            break;
-        }
+        result->records[result->count++] = loc;
+        result->total_key_value += loc.key_value;
     }
+    result->index_nodes_accessed = cur.index_nodes_accessed;
+    result->leaf_nodes_accessed = cur.leaf_nodes_accessed;
+    idx_cursor_close(&cur);
+    if (rc < 0)
+        return -1;
     
     // Calculate elapsed time
     clock_t end_time = clock();
     result->search_time_ms = ((double)(end_time - start_time) / CLOCKS_PER_SEC) * 1000.0;
     
-    // Clean up
-    free(current_node);
-    btfm_close(&btfm);
-    
     // Print summary statistics
     printf("\nB+ Tree Search Results:\n");
     printf("  Records found: %zu\n", result->count);
@@ -320,8 +117,8 @@ int linear_scan_search(const char *db_filename, float min_key, SearchResult *res
     // Initialize result structure
     memset(result, 0, sizeof(SearchResult));
     
-    // Record start time for performance measurement
-    clock_t start_time = clock();
+    // Record start time for performance measurement (wall clock, the scan runs on several threads)
+    double start_ms = bench_now_ms();
     
     // Open the heap file (database)
     HeapFile hf;
@@ -330,68 +127,40 @@ int linear_scan_search(const char *db_filename, float min_key, SearchResult *res
         return -1;
     }
     
-    uint8_t recbuf[512];  // Buffer to hold raw record bytes
-    Row r;                // Decoded record structure
-    
-    // Scan every single block in the database
-    for (uint32_t b = 0; b < hf.n_blocks; b++) {
-        Block *cur = bp_fetch(&hf.bp, b);  // Get block from buffer pool
-        if (!cur) {
-            fprintf(stderr, "Failed to fetch block %u\n", b);
-            hf_close(&hf);
-            return -1;
-        }
-        
-        // Count this as a data block access
-        result->leaf_nodes_accessed++; // Using this field to count data blocks accessed
-        
-        int used = block_used_count(cur);
-        int cap = block_capacity_records(hf.schema.record_size);
-        if (used > cap) used = cap;
-        
-        // Scan every record in this block
-        for (int s = 0; s < used; s++) {
-            // Read raw bytes of record
-            if (block_read_record(cur, hf.schema.record_size, s, recbuf) != 0) {
-                fprintf(stderr, "Failed to read record at block %u, slot %d\n", b, s);
-                continue;
-            }
-            
-            // Convert raw bytes to Row structure
-            decode_row(&hf.schema, recbuf, &r);
-            
-            // Check if this record qualifies for deletion
-            if (r.ft_pct_home > min_key) {
-                // Ensure we have space in our results array
-                if (ensure_records_capacity(result, result->count + 1) != 0) {
-                    fprintf(stderr, "Failed to allocate memory for records\n");
-                    hf_close(&hf);
-                    return -1;
-                }
-                
-                // Store the record location
-                result->records[result->count].block_id = b;
-                result->records[result->count].slot_id = (uint16_t)s;
-                result->records[result->count].key_value = r.ft_pct_home;
-                result->total_key_value += r.ft_pct_home;
-                result->count++;
-            }
-        }
-        
-        // Progress tracking (silent)
-    }
+    // Scan every block in parallel, each worker filters its morsels of blocks
+    ParallelScanSpec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.range.lo = min_key;
+    spec.range.hi = INFINITY;
+    spec.filter = 1;
+    spec.collect = 1;
+    ScanResult scan;
+    int rc = pscan_run(&hf, &spec, &scan);
+    result->records = scan.locs;
+    result->count = scan.n_locs;
+    result->capacity = scan.n_locs;
+    result->total_key_value = scan.sum;
+    result->leaf_nodes_accessed = scan.blocks_read; // Using this field to count data blocks accessed
+    uint32_t blocks_pruned = scan.blocks_pruned;
+    uint32_t total_blocks = hf.n_blocks;
     
     // Calculate elapsed time
-    clock_t end_time = clock();
-    result->search_time_ms = ((double)(end_time - start_time) / CLOCKS_PER_SEC) * 1000.0;
+    result->search_time_ms = bench_now_ms() - start_ms;
     
     // Clean up
     hf_close(&hf);
+    if (rc != 0)
+        return -1;
     
     // Print summary statistics
     printf("\nLinear Scan Search Results:\n");
     printf("  Records found: %zu\n", result->count);
     printf("  Data blocks accessed: %u\n", result->leaf_nodes_accessed); // We reused this field
+    if (total_blocks > 0) {
+        printf("  Data blocks pruned by zone map: %u (%.1f%%)\n", blocks_pruned,
+               100.0 * blocks_pruned / total_blocks);
+    }
+    printf("  Scan threads: %d (%u morsels stolen)\n", scan.threads, scan.morsels_stolen);
     printf("  Search time: %.3f ms\n", result->search_time_ms);
     
     if (result->count > 0) {
@@ -484,6 +253,20 @@ void run_comparison_tests()
     printf("  Time speedup: %.2fx\n", avg_linear_time / avg_bptree_time);
     printf("  I/O reduction: %.2fx\n", (double)avg_linear_blocks / avg_bptree_nodes);
     
+    // Same COUNT/AVG answered from the subtree aggregates of the internal nodes
+    BtreeFileManager btfm;
+    RangeAggregate agg;
+    if (btfm_open(&btfm, "btree.db", NODE_SIZE) == 0) {
+        if (bptree_range_aggregate(&btfm, 0.9f, 0, INFINITY, 0, &agg) == 0) {
+            printf("\nAggregate query (subtree counts):\n");
+            printf("  Records counted: %u\n", agg.count);
+            if (agg.count > 0)
+                printf("  Average FT_PCT_home: %.6f\n", agg.sum / agg.count);
+            printf("  Nodes accessed: %u\n", agg.nodes_accessed);
+        }
+        btfm_close(&btfm);
+    }
+    
     // Clean up all results
     for (int i = 0; i < 3; i++) {
         cleanup_search_result(&bptree_results[i]);
@@ -522,54 +305,25 @@ int bptree_perform_deletion(const char *db_filename, SearchResult *result)
     
     printf("\nProceeding with deletion of %zu records...\n", result->count);
     
-    // Open the heap file and delete records
-    HeapFile hf;
-    if (hf_open(&hf, db_filename, 64) != 0) {
-        fprintf(stderr, "Failed to open database file: %s\n", db_filename);
-        return -1;
-    }
-    
-    // Sort records by block_id and slot_id in descending order
-    // This ensures we delete from end to beginning to avoid slot shifting issues
-    for (size_t i = 0; i < result->count - 1; i++) {
-        for (size_t j = i + 1; j < result->count; j++) {
-            RecordLocation *a = &result->records[i];
-            RecordLocation *b = &result->records[j];
-            
-            // Sort by block_id descending, then by slot_id descending
-            if (a->block_id < b->block_id || 
-                (a->block_id == b->block_id && a->slot_id < b->slot_id)) {
-                RecordLocation temp = *a;
-                *a = *b;
-                *b = temp;
-            }
-        }
-    }
-    
-    // Delete records from heap file
-    size_t deleted_count = 0;
-    for (size_t i = 0; i < result->count; i++) {
-        if (hf_delete_record(&hf, result->records[i].block_id, result->records[i].slot_id) == 0) {
-            deleted_count++;
-        }
-    }
-    
-    printf("Successfully deleted %zu records from database.\n", deleted_count);
-    
-    // Rebuild the B+ tree with remaining records
-    printf("Rebuilding B+ tree index...\n");
-    extern int scan_db(HeapFile *hf);
-    
-    if (scan_db(&hf) != 0) {
-        fprintf(stderr, "Failed to rebuild B+ tree index\n");
-        hf_close(&hf);
+    // Delete as one set: each affected block is rewritten once and the index
+    // entries are removed in the same pass (see batch_delete.h). It runs on
+    // copies of the table and btree.db that then replace them, so readers keep
+    // the version they opened meanwhile (see snapshot.h)
+    SnapDeleteStats st;
+    if (snap_delete(db_filename, result->records, result->count, &st) != 0) {
+        fprintf(stderr, "Batch delete failed\n");
         return -1;
     }
     
-    printf("B+ tree index rebuilt successfully.\n");
-    
-    // Clean up
-    hf_close(&hf);
+    printf("Successfully deleted %zu records from database.\n", st.del.deleted);
+    if (st.del.index_rebuilt)
+        printf("B+ tree index rebuilt successfully.\n");
+    else
+        printf("Removed %u entries from the B+ tree index (no rebuild needed).\n", st.del.index_removed);
+    batch_delete_print(&st.del);
+    printf("  copy  %10.3f ms  (table and index copied for the delete)\n", st.copy_ms);
+    printf("  swap  %10.3f ms  (generation %llu renamed into place)\n", st.swap_ms,
+           (unsigned long long)st.generation);
     
     printf("=== Record Deletion Process Complete ===\n\n");
     
@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bptree.h"
+#include "bptree_ops.h"
+#include "file_manager_btree.h"
+
+// this file is for entry-level maintenance of the b+tree (insert, batch insert, batch delete)
+// insert walks one root-to-leaf path and fixes the child aggregates of every internal
+// node on the way back up, so the tree stays usable for O(height) aggregates.
+// deletes do not merge underfull nodes, they are left in place until the next rebuild.
+
+// what a child reports back to its parent after an insert
+typedef struct {
+    int      split;         // 1 if the child was split into two nodes
+    float    sep_key;       // lower bound of the new right node
+    uint32_t right_id;
+    uint32_t left_count, right_count;
+    double   left_sum, right_sum;
+} SplitInfo;
+
+typedef struct {
+    float    key;
+    uint32_t block_id;
+    uint32_t slot;
+} LeafEntry;
+
+static int alloc_node(BtreeFileManager *fm, BtreeMeta *meta, uint32_t *out_id)
+{
+    if (btfm_alloc_node(fm, out_id) != 0)
+        return -1;
+    meta->node_count++;
+    return 0;
+}
+
+static double leaf_sum(const Node *leaf)
+{
+    double sum = 0.0;
+    for (int i = 0; i < leaf->key_count; i++)
+        sum += leaf_get_key(leaf, i);
+    return sum;
+}
+
+// first position whose key is > key, so equal keys keep their insertion order
+static int leaf_upper_bound(const Node *leaf, float key)
+{
+    int lo = 0, hi = leaf->key_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (leaf_get_key(leaf, mid) <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// child to descend into for an insert: number of separators <= key
+static int int_child_for_insert(const Node *n, float key)
+{
+    int i = 0;
+    while (i < n->key_count && int_get_key(n, i) <= key)
+        i++;
+    return i;
+}
+
+static int split_leaf(BtreeFileManager *fm, BtreeMeta *meta, Node *leaf, int pos,
+                      float key, uint32_t block_id, uint16_t slot_id, SplitInfo *out)
+{
+    // gather the full entry list including the new one
+    LeafEntry all[MAX_LEAF_KEYS + 1];
+    int total = 0;
+    for (int i = 0; i < leaf->key_count; i++) {
+        if (i == pos) {
+            all[total].key = key;
+            all[total].block_id = block_id;
+            all[total].slot = slot_id;
+            total++;
+        }
+        uint16_t s;
+        all[total].key = leaf_get_key(leaf, i);
+        leaf_get_record(leaf, i, &all[total].block_id, &s);
+        all[total].slot = s;
+        total++;
+    }
+    if (pos == leaf->key_count) {
+        all[total].key = key;
+        all[total].block_id = block_id;
+        all[total].slot = slot_id;
+        total++;
+    }
+
+    uint32_t right_id;
+    if (alloc_node(fm, meta, &right_id) != 0)
+        return -1;
+    meta->leaf_count++;
+
+    uint32_t old_next = leaf_get_next(leaf);
+    uint32_t old_prev = leaf_get_prev(leaf);
+    int left_n = total / 2;
+
+    Node right;
+    node_init(&right, 1, right_id);
+    node_init(leaf, 1, leaf->node_id);
+    for (int i = 0; i < total; i++) {
+        Node *dst = (i < left_n) ? leaf : &right;
+        node_write_record_key(dst, all[i].key, all[i].block_id, (int)all[i].slot);
+    }
+    link_leaf_node(&right, old_next);
+    link_leaf_prev(&right, leaf->node_id);
+    link_leaf_node(leaf, right_id);
+    link_leaf_prev(leaf, old_prev);
+
+    if (btfm_write_node(fm, &right) != 0 || btfm_write_node(fm, leaf) != 0)
+        return -1;
+
+    // the old right neighbour now points back to the new leaf
+    if (old_next == BTREE_NO_NODE) {
+        meta->last_leaf = right_id;
+    } else {
+        Node neighbour;
+        if (btfm_read_node(fm, old_next, &neighbour) != 0)
+            return -1;
+        link_leaf_prev(&neighbour, right_id);
+        if (btfm_write_node(fm, &neighbour) != 0)
+            return -1;
+    }
+
+    out->split = 1;
+    out->sep_key = right.lower_bound;
+    out->right_id = right_id;
+    out->left_count = leaf->key_count;
+    out->left_sum = leaf_sum(leaf);
+    out->right_count = right.key_count;
+    out->right_sum = leaf_sum(&right);
+    return 0;
+}
+
+static int split_internal(BtreeFileManager *fm, BtreeMeta *meta, Node *n, int pos, const SplitInfo *child, SplitInfo *out)
+{
+    // gather keys, children and aggregates with the new child inserted at pos
+    float    keys[MAX_INTERNAL_KEYS + 1];
+    uint32_t kids[MAX_INT_CHILDREN + 1];
+    uint32_t counts[MAX_INT_CHILDREN + 1];
+    double   sums[MAX_INT_CHILDREN + 1];
+
+    int nk = 0, nc = 0;
+    for (int i = 0; i <= n->key_count; i++) {
+        if (i > 0)
+            keys[nk++] = int_get_key(n, i - 1);
+        kids[nc] = int_get_child(n, i);
+        int_get_child_agg(n, i, &counts[nc], &sums[nc]);
+        nc++;
+        if (i + 1 == pos) {
+            keys[nk++] = child->sep_key;
+            kids[nc] = child->right_id;
+            counts[nc] = child->right_count;
+            sums[nc] = child->right_sum;
+            nc++;
+        }
+    }
+
+    uint32_t right_id;
+    if (alloc_node(fm, meta, &right_id) != 0)
+        return -1;
+
+    // left keeps the first half of the children, the separator between the halves moves up
+    int left_children = nc / 2;
+    float lower_bound = n->lower_bound;
+    Node right;
+    node_init(n, n->level, n->node_id);
+    node_init(&right, n->level, right_id);
+
+    node_set_first_child(n, kids[0]);
+    set_int_node_lb(n, lower_bound);
+    int_set_child_agg(n, 0, counts[0], sums[0]);
+    for (int i = 1; i < left_children; i++) {
+        node_write_node_key(n, keys[i - 1], kids[i]);
+        int_set_child_agg(n, i, counts[i], sums[i]);
+    }
+
+    node_set_first_child(&right, kids[left_children]);
+    set_int_node_lb(&right, keys[left_children - 1]);
+    int_set_child_agg(&right, 0, counts[left_children], sums[left_children]);
+    for (int i = left_children + 1; i < nc; i++) {
+        node_write_node_key(&right, keys[i - 1], kids[i]);
+        int_set_child_agg(&right, i - left_children, counts[i], sums[i]);
+    }
+
+    if (btfm_write_node(fm, &right) != 0 || btfm_write_node(fm, n) != 0)
+        return -1;
+
+    out->split = 1;
+    out->sep_key = keys[left_children - 1];
+    out->right_id = right_id;
+    int_total_agg(n, &out->left_count, &out->left_sum);
+    int_total_agg(&right, &out->right_count, &out->right_sum);
+    return 0;
+}
+
+static int insert_rec(BtreeFileManager *fm, BtreeMeta *meta, uint32_t node_id,
+                      float key, uint32_t block_id, uint16_t slot_id, SplitInfo *out)
+{
+    Node n;
+    if (btfm_read_node(fm, node_id, &n) != 0)
+        return -1;
+    out->split = 0;
+
+    if (n.level == 1) {
+        int pos = leaf_upper_bound(&n, key);
+        if (n.key_count < MAX_LEAF_KEYS) {
+            leaf_insert_at(&n, pos, key, block_id, slot_id);
+            return btfm_write_node(fm, &n);
+        }
+        return split_leaf(fm, meta, &n, pos, key, block_id, slot_id, out);
+    }
+
+    int i = int_child_for_insert(&n, key);
+    SplitInfo child;
+    if (insert_rec(fm, meta, int_get_child(&n, i), key, block_id, slot_id, &child) != 0)
+        return -1;
+
+    if (!child.split) {
+        uint32_t c;
+        double s;
+        int_get_child_agg(&n, i, &c, &s);
+        int_set_child_agg(&n, i, c + 1, s + key);
+        return btfm_write_node(fm, &n);
+    }
+
+    if (n.key_count < MAX_INTERNAL_KEYS) {
+        int_set_child_agg(&n, i, child.left_count, child.left_sum);
+        int_insert_child(&n, i + 1, child.sep_key, child.right_id, child.right_count, child.right_sum);
+        return btfm_write_node(fm, &n);
+    }
+
+    int_set_child_agg(&n, i, child.left_count, child.left_sum);
+    return split_internal(fm, meta, &n, i + 1, &child, out);
+}
+
+int bptree_insert(BtreeFileManager *fm, float key, uint32_t block_id, uint16_t slot_id)
+{
+    BtreeMeta meta;
+    if (btfm_read_meta(fm, &meta) != 0)
+        return -1;
+
+    // empty tree: the first leaf becomes the root
+    if (meta.root_id == BTREE_NO_NODE) {
+        uint32_t leaf_id;
+        if (alloc_node(fm, &meta, &leaf_id) != 0)
+            return -1;
+        Node leaf;
+        node_init(&leaf, 1, leaf_id);
+        node_write_record_key(&leaf, key, block_id, slot_id);
+        link_leaf_node(&leaf, BTREE_NO_NODE);
+        link_leaf_prev(&leaf, BTREE_NO_NODE);
+        if (btfm_write_node(fm, &leaf) != 0)
+            return -1;
+        meta.root_id = leaf_id;
+        meta.first_leaf = leaf_id;
+        meta.last_leaf = leaf_id;
+        meta.leaf_count = 1;
+        meta.height = 1;
+        return btfm_write_meta(fm, &meta);
+    }
+
+    SplitInfo split;
+    if (insert_rec(fm, &meta, meta.root_id, key, block_id, slot_id, &split) != 0)
+        return -1;
+
+    // root split: grow the tree by one level
+    if (split.split) {
+        Node old_root;
+        if (btfm_read_node(fm, meta.root_id, &old_root) != 0)
+            return -1;
+
+        uint32_t new_root_id;
+        if (alloc_node(fm, &meta, &new_root_id) != 0)
+            return -1;
+        Node root;
+        node_init(&root, (uint8_t)(meta.height + 1), new_root_id);
+        node_set_first_child(&root, meta.root_id);
+        set_int_node_lb(&root, old_root.lower_bound);
+        int_set_child_agg(&root, 0, split.left_count, split.left_sum);
+        int_insert_child(&root, 1, split.sep_key, split.right_id, split.right_count, split.right_sum);
+        if (btfm_write_node(fm, &root) != 0)
+            return -1;
+
+        meta.root_id = new_root_id;
+        meta.height++;
+    }
+    return btfm_write_meta(fm, &meta);
+}
+
+// ---- batch delete ----
+
+// set of record ids as one bit per (block, slot), slots below RID_SLOTS.
+// a few bytes per block, so a batch covering most of the table stays in cache
+// far better than a hash table with one entry per record
+#define RID_SLOT_BITS 10
+#define RID_SLOTS (1u << RID_SLOT_BITS)
+
+typedef struct {
+    uint64_t *bits;
+    uint32_t  n_blocks;
+} RidSet;
+
+static int rid_set_init(RidSet *set, const RecordLocation *locs, size_t n)
+{
+    uint32_t max_block = 0;
+    for (size_t i = 0; i < n; i++)
+        if (locs[i].block_id > max_block)
+            max_block = locs[i].block_id;
+    set->n_blocks = max_block + 1;
+    set->bits = calloc(((size_t)set->n_blocks << RID_SLOT_BITS) / 64, sizeof(uint64_t));
+    if (!set->bits)
+        return -1;
+    for (size_t i = 0; i < n; i++) {
+        if (locs[i].slot_id >= RID_SLOTS)
+            return -1;
+        size_t bit = ((size_t)locs[i].block_id << RID_SLOT_BITS) | locs[i].slot_id;
+        set->bits[bit >> 6] |= 1ULL << (bit & 63);
+    }
+    return 0;
+}
+
+static int rid_set_has(const RidSet *set, uint32_t block_id, uint16_t slot_id)
+{
+    if (block_id >= set->n_blocks || slot_id >= RID_SLOTS)
+        return 0;
+    size_t bit = ((size_t)block_id << RID_SLOT_BITS) | slot_id;
+    return (set->bits[bit >> 6] >> (bit & 63)) & 1;
+}
+
+// removes every entry of the subtree whose record is in the set and whose key is
+// in [kmin, kmax]. each node is read and written at most once; the removed count
+// and key sum are reported so the parent can fix its child aggregate
+static int delete_batch_rec(BtreeFileManager *fm, uint32_t node_id, float kmin, float kmax,
+                            const RidSet *set, uint32_t *removed, double *removed_sum)
+{
+    Node n;
+    if (btfm_read_node(fm, node_id, &n) != 0)
+        return -1;
+    *removed = 0;
+    *removed_sum = 0.0;
+
+    if (n.level == 1) {
+        const size_t esz = RECORD_POINTER_SIZE + KEY_SIZE;
+        int w = 0;
+        for (int i = 0; i < n.key_count; i++) {
+            uint32_t b;
+            uint16_t s;
+            leaf_get_record(&n, i, &b, &s);
+            if (rid_set_has(set, b, s)) {
+                (*removed)++;
+                *removed_sum += leaf_get_key(&n, i);
+                continue;
+            }
+            if (w != i)
+                memcpy(&n.bytes[w * esz], &n.bytes[i * esz], esz);
+            w++;
+        }
+        if (*removed == 0)
+            return 0;
+        memset(&n.bytes[w * esz], 0, (n.key_count - w) * esz);
+        n.key_count = (uint16_t)w;
+        if (w > 0)
+            n.lower_bound = leaf_get_key(&n, 0);
+        return btfm_write_node(fm, &n);
+    }
+
+    // only the children that can hold a key in [kmin, kmax]
+    int lo = 0;
+    while (lo < n.key_count && int_get_key(&n, lo) < kmin)
+        lo++;
+    int hi = int_child_for_insert(&n, kmax);
+
+    for (int i = lo; i <= hi; i++) {
+        uint32_t r;
+        double rs;
+        if (delete_batch_rec(fm, int_get_child(&n, i), kmin, kmax, set, &r, &rs) != 0)
+            return -1;
+        if (r == 0)
+            continue;
+        uint32_t c;
+        double s;
+        int_get_child_agg(&n, i, &c, &s);
+        int_set_child_agg(&n, i, c - r, s - rs);
+        *removed += r;
+        *removed_sum += rs;
+    }
+    if (*removed == 0)
+        return 0;
+    return btfm_write_node(fm, &n);
+}
+
+int bptree_delete_batch(BtreeFileManager *fm, const RecordLocation *locs, size_t n, uint32_t *removed)
+{
+    *removed = 0;
+    BtreeMeta meta;
+    if (btfm_read_meta(fm, &meta) != 0)
+        return -1;
+    if (meta.root_id == BTREE_NO_NODE || n == 0)
+        return 0;
+
+    float kmin = locs[0].key_value, kmax = locs[0].key_value;
+    for (size_t i = 1; i < n; i++) {
+        if (locs[i].key_value < kmin)
+            kmin = locs[i].key_value;
+        if (locs[i].key_value > kmax)
+            kmax = locs[i].key_value;
+    }
+
+    RidSet set;
+    if (rid_set_init(&set, locs, n) != 0) {
+        free(set.bits);
+        return -1;
+    }
+    double removed_sum;
+    int rc = delete_batch_rec(fm, meta.root_id, kmin, kmax, &set, removed, &removed_sum);
+    free(set.bits);
+    return rc;
+}
+
+static int loc_key_cmp(const void *a, const void *b)
+{
+    const RecordLocation *x = a, *y = b;
+    if (x->key_value != y->key_value)
+        return x->key_value < y->key_value ? -1 : 1;
+    if (x->block_id != y->block_id)
+        return x->block_id < y->block_id ? -1 : 1;
+    return (int)x->slot_id - (int)y->slot_id;
+}
+
+int bptree_insert_batch(BtreeFileManager *fm, RecordLocation *locs, size_t n, uint32_t *inserted)
+{
+    *inserted = 0;
+    // in key order consecutive inserts walk the same path and hit the same leaves
+    qsort(locs, n, sizeof(RecordLocation), loc_key_cmp);
+    for (size_t i = 0; i < n; i++) {
+        if (bptree_insert(fm, locs[i].key_value, locs[i].block_id, locs[i].slot_id) != 0)
+            return -1;
+        (*inserted)++;
+    }
+    return 0;
+}
@@ -46,26 +46,39 @@ int link_leaf_node(Node *node, uint32_t next_node_id)
     return 0;
 }
 
+// link a leaf back to the leaf on its left, stored just before the next pointer
+int link_leaf_prev(Node *node, uint32_t prev_node_id)
+{
+    size_t off = (NODE_SIZE - NODE_HDR_SIZE) - 8;
+    memcpy(&node->bytes[off], &prev_node_id, 4);
+
+    return 0;
+}
+
 // set the lower bound of an internal node
 void set_int_node_lb(Node *n, float lower_bound)
 {
     n->lower_bound = lower_bound;
 }
 
+// set the pointer in front of the first key of an internal node (child 0)
+int node_set_first_child(Node *n, uint32_t node_id)
+{
+    memset(n->bytes, 0, NODE_POINTER_SIZE);
+    memcpy(n->bytes, &node_id, 4);
+    return 0;
+}
+
 // write the key and the pointer to the child node into the internal node
 int node_write_node_key(Node *n, float key, uint32_t node_id)
 {
     if ((n->key_count) >= MAX_INTERNAL_KEYS)
         return -1;
-
-    if ((n->key_count) == 0){
-        memcpy(&n->bytes, &node_id, NODE_POINTER_SIZE);
-    }
     
     size_t off = NODE_POINTER_SIZE + n->key_count * (KEY_SIZE + NODE_POINTER_SIZE);
 
     memcpy(&n->bytes[off], &key, KEY_SIZE);
-    memcpy(&n->bytes[off + KEY_SIZE], &node_id, NODE_POINTER_SIZE);
+    memcpy(&n->bytes[off + KEY_SIZE], &node_id, 4);
     n->key_count += 1;
     return 0;
 }
@@ -115,3 +128,144 @@ int decode_node(const uint8_t *src, Node *n)
     return 0;
 }
 
+// ---- leaf accessors ----
+// leaf entry i is [record pointer 8B][key 4B]
+
+float leaf_get_key(const Node *n, int i)
+{
+    float key;
+    size_t off = (size_t)i * (RECORD_POINTER_SIZE + KEY_SIZE) + RECORD_POINTER_SIZE;
+    memcpy(&key, &n->bytes[off], KEY_SIZE);
+    return key;
+}
+
+void leaf_get_record(const Node *n, int i, uint32_t *block_id, uint16_t *slot_id)
+{
+    size_t off = (size_t)i * (RECORD_POINTER_SIZE + KEY_SIZE);
+    uint32_t slot;
+    memcpy(block_id, &n->bytes[off], 4);
+    memcpy(&slot, &n->bytes[off + 4], 4);
+    *slot_id = (uint16_t)slot;
+}
+
+void leaf_set_record(Node *n, int i, uint32_t block_id, uint16_t slot_id)
+{
+    size_t off = (size_t)i * (RECORD_POINTER_SIZE + KEY_SIZE);
+    uint32_t slot = slot_id;
+    memcpy(&n->bytes[off], &block_id, 4);
+    memcpy(&n->bytes[off + 4], &slot, 4);
+}
+
+uint32_t leaf_get_next(const Node *n)
+{
+    uint32_t next_id;
+    memcpy(&next_id, &n->bytes[(NODE_SIZE - NODE_HDR_SIZE) - 4], 4);
+    return next_id;
+}
+
+uint32_t leaf_get_prev(const Node *n)
+{
+    uint32_t prev_id;
+    memcpy(&prev_id, &n->bytes[(NODE_SIZE - NODE_HDR_SIZE) - 8], 4);
+    return prev_id;
+}
+
+// insert an entry at position pos, shifting the later entries right
+int leaf_insert_at(Node *n, int pos, float key, uint32_t block_id, int slot)
+{
+    const size_t esz = RECORD_POINTER_SIZE + KEY_SIZE;
+    if (n->key_count >= MAX_LEAF_KEYS || pos < 0 || pos > n->key_count)
+        return -1;
+
+    memmove(&n->bytes[(pos + 1) * esz], &n->bytes[pos * esz], (n->key_count - pos) * esz);
+
+    size_t off = pos * esz;
+    memcpy(&n->bytes[off], &block_id, 4);
+    memcpy(&n->bytes[off + 4], &slot, 4);
+    memcpy(&n->bytes[off + RECORD_POINTER_SIZE], &key, KEY_SIZE);
+    n->key_count += 1;
+    n->lower_bound = leaf_get_key(n, 0);
+    return 0;
+}
+
+// remove the entry at position pos, shifting the later entries left
+int leaf_remove_at(Node *n, int pos)
+{
+    const size_t esz = RECORD_POINTER_SIZE + KEY_SIZE;
+    if (pos < 0 || pos >= n->key_count)
+        return -1;
+
+    memmove(&n->bytes[pos * esz], &n->bytes[(pos + 1) * esz], (n->key_count - pos - 1) * esz);
+    n->key_count -= 1;
+    memset(&n->bytes[n->key_count * esz], 0, esz);
+    if (n->key_count > 0)
+        n->lower_bound = leaf_get_key(n, 0);
+    return 0;
+}
+
+// ---- internal node accessors ----
+// layout: [child 0][key 0][child 1][key 1][child 2] ... then the aggregate array
+
+float int_get_key(const Node *n, int i)
+{
+    float key;
+    memcpy(&key, &n->bytes[NODE_POINTER_SIZE + (size_t)i * (KEY_SIZE + NODE_POINTER_SIZE)], KEY_SIZE);
+    return key;
+}
+
+uint32_t int_get_child(const Node *n, int i)
+{
+    uint32_t child;
+    size_t off = (i == 0) ? 0 : NODE_POINTER_SIZE + (size_t)(i - 1) * (KEY_SIZE + NODE_POINTER_SIZE) + KEY_SIZE;
+    memcpy(&child, &n->bytes[off], 4);
+    return child;
+}
+
+void int_get_child_agg(const Node *n, int i, uint32_t *count, double *sum)
+{
+    size_t off = INT_AGG_OFFSET + (size_t)i * CHILD_AGG_SIZE;
+    memcpy(count, &n->bytes[off], 4);
+    memcpy(sum, &n->bytes[off + 4], 8);
+}
+
+void int_set_child_agg(Node *n, int i, uint32_t count, double sum)
+{
+    size_t off = INT_AGG_OFFSET + (size_t)i * CHILD_AGG_SIZE;
+    memcpy(&n->bytes[off], &count, 4);
+    memcpy(&n->bytes[off + 4], &sum, 8);
+}
+
+// insert a new child at position pos (>= 1) with separator key in front of it
+int int_insert_child(Node *n, int pos, float key, uint32_t node_id, uint32_t count, double sum)
+{
+    const size_t esz = KEY_SIZE + NODE_POINTER_SIZE;
+    if (n->key_count >= MAX_INTERNAL_KEYS || pos < 1 || pos > n->key_count + 1)
+        return -1;
+
+    // key/pointer pairs: pair j holds key j and child j+1
+    size_t pair = NODE_POINTER_SIZE + (size_t)(pos - 1) * esz;
+    memmove(&n->bytes[pair + esz], &n->bytes[pair], (n->key_count - (pos - 1)) * esz);
+    memset(&n->bytes[pair], 0, esz);
+    memcpy(&n->bytes[pair], &key, KEY_SIZE);
+    memcpy(&n->bytes[pair + KEY_SIZE], &node_id, 4);
+
+    size_t agg = INT_AGG_OFFSET + (size_t)pos * CHILD_AGG_SIZE;
+    memmove(&n->bytes[agg + CHILD_AGG_SIZE], &n->bytes[agg], (n->key_count + 1 - pos) * CHILD_AGG_SIZE);
+    n->key_count += 1;
+    int_set_child_agg(n, pos, count, sum);
+    return 0;
+}
+
+// sum of the child aggregates = aggregate of the whole subtree
+void int_total_agg(const Node *n, uint32_t *count, double *sum)
+{
+    *count = 0;
+    *sum = 0.0;
+    for (int i = 0; i <= n->key_count; i++) {
+        uint32_t c;
+        double s;
+        int_get_child_agg(n, i, &c, &s);
+        *count += c;
+        *sum += s;
+    }
+}
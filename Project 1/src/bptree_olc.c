@@ -0,0 +1,494 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+#include "bptree_olc.h"
+
+// this file is for the concurrent in-memory b+tree (optimistic lock coupling).
+// an operation is tried with one of the *_once functions; RESTART means a node
+// it read changed under it, and it runs again from the root.
+
+#define OLC_LOCKED 2u
+#define RESTART 1
+
+typedef struct {
+    float    key;
+    uint32_t block_id;
+    uint16_t slot;
+} OlcEntry;
+
+// ---- version latches ----
+
+// the version of an unlocked node, -1 if it is locked
+static int read_lock(OlcNode *n, uint64_t *v)
+{
+    uint64_t x = atomic_load_explicit(&n->version, memory_order_acquire);
+    if (x & OLC_LOCKED)
+        return -1;
+    *v = x;
+    return 0;
+}
+
+// what was read since read_lock is valid if the version has not moved
+static int validate(OlcNode *n, uint64_t v)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&n->version, memory_order_relaxed) == v ? 0 : -1;
+}
+
+// write lock, only if nothing changed since v was read
+static int upgrade(OlcNode *n, uint64_t v)
+{
+    return atomic_compare_exchange_strong(&n->version, &v, v + OLC_LOCKED) ? 0 : -1;
+}
+
+// clears the lock bit and counts the write
+static void write_unlock(OlcNode *n)
+{
+    atomic_fetch_add_explicit(&n->version, OLC_LOCKED, memory_order_release);
+}
+
+static void restart(OlcTree *t, int *tries)
+{
+    atomic_fetch_add_explicit(&t->restarts, 1, memory_order_relaxed);
+    // the thread holding the lock may not be running: give it the core
+    if (++*tries > 8)
+        sched_yield();
+}
+
+// ---- searching a node (key_count may be torn while a writer is busy) ----
+
+static int key_count(const Node *n, int max)
+{
+    return n->key_count > max ? max : n->key_count;
+}
+
+// separators <= key: the child an insert goes to
+static int child_upper(const Node *n, float key)
+{
+    int kc = key_count(n, MAX_INTERNAL_KEYS), i = 0;
+    while (i < kc && int_get_key(n, i) <= key)
+        i++;
+    return i;
+}
+
+// separators < key: the leftmost child that can hold key
+static int child_lower(const Node *n, float key)
+{
+    int kc = key_count(n, MAX_INTERNAL_KEYS), i = 0;
+    while (i < kc && int_get_key(n, i) < key)
+        i++;
+    return i;
+}
+
+// first position whose key is > key (upper = 1) or >= key (upper = 0)
+static int leaf_search(const Node *n, float key, int upper)
+{
+    int lo = 0, hi = key_count(n, MAX_LEAF_KEYS);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        float k = leaf_get_key(n, mid);
+        if (k < key || (upper && k == key))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// ---- structure changes, with the affected nodes locked ----
+
+static uint32_t alloc_node(OlcTree *t)
+{
+    uint32_t id = atomic_fetch_add(&t->next_id, 1);
+    if (id >= t->cap) {
+        fprintf(stderr, "Concurrent B+ tree is out of nodes (%u)\n", t->cap);
+        return BTREE_NO_NODE;
+    }
+    return id;
+}
+
+// the upper half of a full internal node moves to right, returns the separator
+static float split_inner(Node *n, Node *right, uint32_t right_id)
+{
+    float    keys[MAX_INTERNAL_KEYS];
+    uint32_t kids[MAX_INT_CHILDREN];
+    int nk = n->key_count, nc = nk + 1;
+    for (int i = 0; i < nk; i++)
+        keys[i] = int_get_key(n, i);
+    for (int i = 0; i < nc; i++)
+        kids[i] = int_get_child(n, i);
+
+    int left = nc / 2;
+    float lower_bound = n->lower_bound;
+    node_init(n, n->level, n->node_id);
+    node_set_first_child(n, kids[0]);
+    set_int_node_lb(n, lower_bound);
+    for (int i = 1; i < left; i++)
+        node_write_node_key(n, keys[i - 1], kids[i]);
+
+    node_init(right, n->level, right_id);
+    node_set_first_child(right, kids[left]);
+    set_int_node_lb(right, keys[left - 1]);
+    for (int i = left + 1; i < nc; i++)
+        node_write_node_key(right, keys[i - 1], kids[i]);
+    return keys[left - 1];
+}
+
+// the upper half of a full leaf moves to right, which is linked in after it
+static float split_leaf(Node *leaf, Node *right, uint32_t right_id)
+{
+    OlcEntry all[MAX_LEAF_KEYS];
+    int total = leaf->key_count, left = total / 2;
+    for (int i = 0; i < total; i++) {
+        all[i].key = leaf_get_key(leaf, i);
+        leaf_get_record(leaf, i, &all[i].block_id, &all[i].slot);
+    }
+    uint32_t next = leaf_get_next(leaf), prev = leaf_get_prev(leaf);
+
+    node_init(right, 1, right_id);
+    node_init(leaf, 1, leaf->node_id);
+    for (int i = 0; i < total; i++)
+        node_write_record_key(i < left ? leaf : right, all[i].key, all[i].block_id, all[i].slot);
+    link_leaf_node(right, next);
+    link_leaf_prev(right, leaf->node_id);
+    link_leaf_node(leaf, right_id);
+    link_leaf_prev(leaf, prev);
+    return right->lower_bound;
+}
+
+// the root was split: a new root above it and right. the old root is locked,
+// so nobody can pass it before the new root is in place
+static int grow_root(OlcTree *t, OlcNode *old, float sep, uint32_t right_id)
+{
+    uint32_t id = alloc_node(t);
+    if (id == BTREE_NO_NODE)
+        return -1;
+    Node *root = &t->nodes[id].node;
+    node_init(root, (uint8_t)(old->node.level + 1), id);
+    node_set_first_child(root, old->node.node_id);
+    set_int_node_lb(root, old->node.lower_bound);
+    int_insert_child(root, 1, sep, right_id, 0, 0.0);
+    atomic_store_explicit(&t->root, id, memory_order_release);
+    return 0;
+}
+
+// ---- load / free ----
+
+int olc_load(OlcTree *t, BtreeFileManager *fm, uint32_t extra_nodes)
+{
+    memset(t, 0, sizeof(OlcTree));
+    BtreeMeta meta;
+    uint32_t pages;
+    if (btfm_read_meta(fm, &meta) != 0 || btfm_page_count(fm, &pages) != 0) {
+        fprintf(stderr, "No B+ tree to load\n");
+        return -1;
+    }
+    t->cap = pages + extra_nodes;
+    t->nodes = calloc(t->cap, sizeof(OlcNode));
+    if (!t->nodes)
+        return -1;
+    for (uint32_t id = 1; id < pages; id++) {
+        if (btfm_read_node(fm, id, &t->nodes[id].node) != 0) {
+            fprintf(stderr, "Failed to read node %u\n", id);
+            olc_free(t);
+            return -1;
+        }
+    }
+    atomic_store(&t->next_id, pages > 1 ? pages : 1);
+    atomic_store(&t->root, meta.root_id);
+    t->generation = meta.generation;
+    return 0;
+}
+
+void olc_free(OlcTree *t)
+{
+    free(t->nodes);
+    t->nodes = NULL;
+    t->cap = 0;
+}
+
+// ---- lookup ----
+
+static int lookup_once(OlcTree *t, float key, uint32_t *block_id, uint16_t *slot_id)
+{
+    uint32_t root_id = atomic_load_explicit(&t->root, memory_order_acquire);
+    if (root_id == BTREE_NO_NODE)
+        return 0;
+    OlcNode *node = &t->nodes[root_id];
+    uint64_t v;
+    if (read_lock(node, &v) != 0 || atomic_load(&t->root) != root_id)
+        return -RESTART;
+
+    while (node->node.level > 1) {
+        uint32_t child = int_get_child(&node->node, child_lower(&node->node, key));
+        if (validate(node, v) != 0)
+            return -RESTART;
+        if (child == 0 || child >= t->cap)
+            return -2;
+        OlcNode *c = &t->nodes[child];
+        uint64_t cv;
+        // the child is only the right one if the parent still is as it was
+        if (read_lock(c, &cv) != 0 || validate(node, v) != 0)
+            return -RESTART;
+        node = c;
+        v = cv;
+    }
+
+    // the first key >= key can be in a later leaf
+    for (;;) {
+        const Node *n = &node->node;
+        int pos = leaf_search(n, key, 0);
+        if (pos < key_count(n, MAX_LEAF_KEYS)) {
+            float k = leaf_get_key(n, pos);
+            uint32_t b;
+            uint16_t s;
+            leaf_get_record(n, pos, &b, &s);
+            if (validate(node, v) != 0)
+                return -RESTART;
+            if (k != key)
+                return 0;
+            *block_id = b;
+            *slot_id = s;
+            return 1;
+        }
+        uint32_t next = leaf_get_next(n);
+        if (validate(node, v) != 0)
+            return -RESTART;
+        if (next == BTREE_NO_NODE)
+            return 0;
+        if (next >= t->cap)
+            return -2;
+        OlcNode *c = &t->nodes[next];
+        uint64_t cv;
+        if (read_lock(c, &cv) != 0 || validate(node, v) != 0)
+            return -RESTART;
+        node = c;
+        v = cv;
+    }
+}
+
+int olc_lookup(OlcTree *t, float key, uint32_t *block_id, uint16_t *slot_id)
+{
+    int tries = 0, rc;
+    while ((rc = lookup_once(t, key, block_id, slot_id)) == -RESTART)
+        restart(t, &tries);
+    return rc < 0 ? -1 : rc;
+}
+
+// ---- insert ----
+
+// the first leaf of an empty tree, published with a compare-and-swap
+static int insert_first(OlcTree *t, float key, uint32_t block_id, uint16_t slot_id)
+{
+    uint32_t id = alloc_node(t);
+    if (id == BTREE_NO_NODE)
+        return -1;
+    Node *leaf = &t->nodes[id].node;
+    node_init(leaf, 1, id);
+    node_write_record_key(leaf, key, block_id, slot_id);
+    link_leaf_node(leaf, BTREE_NO_NODE);
+    link_leaf_prev(leaf, BTREE_NO_NODE);
+    uint32_t empty = BTREE_NO_NODE;
+    return atomic_compare_exchange_strong(&t->root, &empty, id) ? 0 : RESTART;
+}
+
+// a full node was found on the way down: split it under the locks of its parent
+// (NULL for the root) and itself. the caller starts over either way
+static int split_node(OlcTree *t, OlcNode *parent, uint64_t pv, int pos, OlcNode *node, uint64_t v)
+{
+    if (parent && upgrade(parent, pv) != 0)
+        return RESTART;
+    if (upgrade(node, v) != 0) {
+        if (parent)
+            write_unlock(parent);
+        return RESTART;
+    }
+    // a leaf's right neighbour points back at it: that pointer changes too
+    OlcNode *next = NULL;
+    if (node->node.level == 1 && leaf_get_next(&node->node) != BTREE_NO_NODE) {
+        uint32_t next_id = leaf_get_next(&node->node);
+        uint64_t nv;
+        if (next_id < t->cap)
+            next = &t->nodes[next_id];
+        if (!next || read_lock(next, &nv) != 0 || upgrade(next, nv) != 0) {
+            write_unlock(node);
+            if (parent)
+                write_unlock(parent);
+            return next ? RESTART : -1;
+        }
+    }
+
+    int rc = 0;
+    uint32_t right_id = alloc_node(t);
+    if (right_id == BTREE_NO_NODE) {
+        rc = -1;
+    } else {
+        Node *right = &t->nodes[right_id].node;
+        float sep;
+        if (node->node.level == 1) {
+            sep = split_leaf(&node->node, right, right_id);
+            if (next)
+                link_leaf_prev(&next->node, right_id);
+        } else {
+            sep = split_inner(&node->node, right, right_id);
+        }
+        if (parent)
+            int_insert_child(&parent->node, pos + 1, sep, right_id, 0, 0.0);
+        else
+            rc = grow_root(t, node, sep, right_id);
+    }
+    if (next)
+        write_unlock(next);
+    write_unlock(node);
+    if (parent)
+        write_unlock(parent);
+    return rc == 0 ? RESTART : -1;
+}
+
+static int insert_once(OlcTree *t, float key, uint32_t block_id, uint16_t slot_id)
+{
+    uint32_t root_id = atomic_load_explicit(&t->root, memory_order_acquire);
+    if (root_id == BTREE_NO_NODE)
+        return insert_first(t, key, block_id, slot_id);
+    OlcNode *node = &t->nodes[root_id], *parent = NULL;
+    uint64_t v, pv = 0;
+    int pos = 0;
+    if (read_lock(node, &v) != 0 || atomic_load(&t->root) != root_id)
+        return RESTART;
+
+    for (;;) {
+        int leaf = node->node.level == 1;
+        if (node->node.key_count >= (leaf ? MAX_LEAF_KEYS : MAX_INTERNAL_KEYS))
+            return split_node(t, parent, pv, pos, node, v);
+        if (leaf)
+            break;
+        // the node was reached through parent: valid only if parent did not change
+        if (parent && validate(parent, pv) != 0)
+            return RESTART;
+        int i = child_upper(&node->node, key);
+        uint32_t child = int_get_child(&node->node, i);
+        if (validate(node, v) != 0)
+            return RESTART;
+        if (child == 0 || child >= t->cap)
+            return -1;
+        parent = node;
+        pv = v;
+        pos = i;
+        node = &t->nodes[child];
+        if (read_lock(node, &v) != 0)
+            return RESTART;
+    }
+
+    // only the leaf is locked; its parent must still lead to it
+    if (upgrade(node, v) != 0)
+        return RESTART;
+    if (parent && validate(parent, pv) != 0) {
+        write_unlock(node);
+        return RESTART;
+    }
+    leaf_insert_at(&node->node, leaf_search(&node->node, key, 1), key, block_id, slot_id);
+    write_unlock(node);
+    return 0;
+}
+
+int olc_insert(OlcTree *t, float key, uint32_t block_id, uint16_t slot_id)
+{
+    int tries = 0, rc;
+    while ((rc = insert_once(t, key, block_id, slot_id)) == RESTART)
+        restart(t, &tries);
+    return rc;
+}
+
+// ---- single-threaded: checks and writing back ----
+
+static uint32_t edge_leaf(OlcTree *t, uint32_t id, int rightmost)
+{
+    while (id != BTREE_NO_NODE && id < t->cap && t->nodes[id].node.level > 1) {
+        const Node *n = &t->nodes[id].node;
+        id = int_get_child(n, rightmost ? n->key_count : 0);
+    }
+    return id;
+}
+
+int olc_count(OlcTree *t, uint64_t *entries)
+{
+    *entries = 0;
+    uint32_t id = edge_leaf(t, atomic_load(&t->root), 0);
+    float last = -INFINITY;
+    while (id != BTREE_NO_NODE) {
+        if (id >= t->cap)
+            return -1;
+        const Node *n = &t->nodes[id].node;
+        for (int i = 0; i < n->key_count; i++) {
+            float k = leaf_get_key(n, i);
+            if (k < last)
+                return -1;
+            last = k;
+        }
+        *entries += n->key_count;
+        id = leaf_get_next(n);
+    }
+    return 0;
+}
+
+// post-order: the aggregates of every child are known before the node is written
+static int save_rec(OlcTree *t, BtreeFileManager *fm, uint32_t id, BtreeMeta *meta, uint32_t *count, double *sum)
+{
+    if (id == 0 || id >= t->cap)
+        return -1;
+    Node *n = &t->nodes[id].node;
+    *count = 0;
+    *sum = 0.0;
+    meta->node_count++;
+    if (n->level == 1) {
+        meta->leaf_count++;
+        *count = n->key_count;
+        for (int i = 0; i < n->key_count; i++)
+            *sum += leaf_get_key(n, i);
+    } else {
+        for (int i = 0; i <= n->key_count; i++) {
+            uint32_t c;
+            double s;
+            if (save_rec(t, fm, int_get_child(n, i), meta, &c, &s) != 0)
+                return -1;
+            int_set_child_agg(n, i, c, s);
+            *count += c;
+            *sum += s;
+        }
+    }
+    return btfm_write_node(fm, n);
+}
+
+int olc_save(OlcTree *t, BtreeFileManager *fm)
+{
+    uint32_t used = atomic_load(&t->next_id), pages;
+    if (used > t->cap)
+        used = t->cap;
+    if (btfm_page_count(fm, &pages) != 0)
+        return -1;
+    // the nodes made in memory get their pages first
+    while (pages < used) {
+        uint32_t id;
+        if (btfm_alloc_node(fm, &id) != 0)
+            return -1;
+        pages = id + 1;
+    }
+
+    BtreeMeta meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.generation = t->generation;
+    meta.root_id = atomic_load(&t->root);
+    meta.first_leaf = meta.last_leaf = BTREE_NO_NODE;
+    if (meta.root_id != BTREE_NO_NODE) {
+        uint32_t count;
+        double sum;
+        if (save_rec(t, fm, meta.root_id, &meta, &count, &sum) != 0)
+            return -1;
+        meta.first_leaf = edge_leaf(t, meta.root_id, 0);
+        meta.last_leaf = edge_leaf(t, meta.root_id, 1);
+        meta.height = t->nodes[meta.root_id].node.level;
+    }
+    return btfm_write_meta(fm, &meta);
+}
@@ -1,4 +1,5 @@
 #include "buffer_pool.h"
+#include "wal.h"
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
@@ -12,6 +13,7 @@ int bp_init(BufferPool *bp, FileManager *fm, int capacity)
     bp->fm = fm;
     bp->capacity = capacity;
     bp->clock_tick = 0;
+    bp->wal = NULL;
     bp->frames = (Frame *)calloc(capacity, sizeof(Frame));
     return bp->frames ? 0 : -1;
 }
@@ -24,6 +26,18 @@ void bp_destroy(BufferPool *bp)
     bp->frames = NULL;
 }
 
+// write-ahead rule: the log records of a block go to disk before the block does
+static int write_frame(BufferPool *bp, Frame *f)
+{
+    if (bp->wal && f->lsn > bp->wal->flushed_lsn && wal_force(bp->wal, f->lsn) != 0)
+        return -1;
+    if (fm_write_block(bp->fm, f->block_id, &f->block) != 0)
+        return -1;
+    f->dirty = false;
+    f->lsn = f->rec_lsn = 0;
+    return 0;
+}
+
 static int find_frame(BufferPool *bp, uint32_t block_id)
 {
     for (int i = 0; i < bp->capacity; i++)
@@ -104,6 +118,8 @@ Block* bp_fetch(BufferPool* bp, uint32_t block_id){
             if (fm_read_block(bp->fm, block_id, &bp->frames[i].block) != 0) return NULL;
             bp->frames[i].valid    = true;
             bp->frames[i].dirty    = false;
+            bp->frames[i].lsn      = 0;
+            bp->frames[i].rec_lsn  = 0;
             bp->frames[i].block_id = block_id;
             bp->frames[i].tick     = bp->clock_tick;
             return &bp->frames[i].block;
@@ -124,16 +140,17 @@ Block* bp_fetch(BufferPool* bp, uint32_t block_id){
 
     // flush victim if dirty
     if (bp->frames[victim].valid && bp->frames[victim].dirty) {
-        if (fm_write_block(bp->fm, bp->frames[victim].block_id, &bp->frames[victim].block) != 0) {
+        if (write_frame(bp, &bp->frames[victim]) != 0) {
             return NULL;
         }
-        bp->frames[victim].dirty = false;
     }
 
     // load requested block into victim frame
     if (fm_read_block(bp->fm, block_id, &bp->frames[victim].block) != 0) return NULL;
     bp->frames[victim].valid    = true;
     bp->frames[victim].dirty    = false;
+    bp->frames[victim].lsn      = 0;
+    bp->frames[victim].rec_lsn  = 0;
     bp->frames[victim].block_id = block_id;
     bp->frames[victim].tick     = bp->clock_tick;
 
@@ -148,6 +165,54 @@ void bp_mark_dirty(BufferPool *bp, uint32_t block_id)
         bp->frames[idx].dirty = true;
 }
 
+void bp_mark_logged(BufferPool *bp, uint32_t block_id, uint64_t rec_lsn, uint64_t lsn)
+{
+    int idx = find_frame(bp, block_id);
+    if (idx >= 0)
+    {
+        Frame *f = &bp->frames[idx];
+        if (f->rec_lsn == 0)
+            f->rec_lsn = rec_lsn;
+        f->dirty = true;
+        if (lsn > f->lsn)
+            f->lsn = lsn;
+    }
+}
+
+int bp_flush_older(BufferPool *bp, uint64_t lsn, uint32_t *written)
+{
+    int err = 0;
+    *written = 0;
+    for (int i = 0; i < bp->capacity; i++)
+    {
+        Frame *f = &bp->frames[i];
+        if (f->valid && f->dirty && f->rec_lsn < lsn)
+        {
+            if (write_frame(bp, f) != 0)
+                err = -1;
+            else
+                (*written)++;
+        }
+    }
+    return err;
+}
+
+uint32_t bp_dirty_table(BufferPool *bp, WalDirty *out)
+{
+    uint32_t n = 0;
+    for (int i = 0; i < bp->capacity; i++)
+    {
+        if (bp->frames[i].valid && bp->frames[i].dirty)
+        {
+            out[n].file = WAL_FILE_HEAP;
+            out[n].page = bp->frames[i].block_id;
+            out[n].rec_lsn = bp->frames[i].rec_lsn;
+            n++;
+        }
+    }
+    return n;
+}
+
 int bp_flush_all(BufferPool *bp)
 {
     int err = 0;
@@ -155,10 +220,22 @@ int bp_flush_all(BufferPool *bp)
     {
         if (bp->frames[i].valid && bp->frames[i].dirty)
         {
-            if (fm_write_block(bp->fm, bp->frames[i].block_id, &bp->frames[i].block) != 0)
+            // a frame that was not written stays dirty, and in the dirty page table
+            if (write_frame(bp, &bp->frames[i]) != 0)
                 err = -1;
-            bp->frames[i].dirty = false;
         }
     }
     return err;
 }
+
+void bp_discard_from(BufferPool *bp, uint32_t first_block)
+{
+    for (int i = 0; i < bp->capacity; i++)
+    {
+        if (bp->frames[i].valid && bp->frames[i].block_id >= first_block)
+        {
+            bp->frames[i].valid = false;
+            bp->frames[i].dirty = false;
+        }
+    }
+}
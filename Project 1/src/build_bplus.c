@@ -2,8 +2,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "bptree.h"
 #include "build_bplus.h"
+#include "parallel_scan.h"
 
 
 typedef struct {
@@ -12,21 +14,6 @@ typedef struct {
     uint16_t slot_id;
 } KeyPointer;
 
-static int ensure_capacity(KeyPointer **entries, size_t *capacity, size_t needed)
-{
-    if (needed <= *capacity)
-        return 0;
-    size_t new_cap = (*capacity == 0) ? 256 : *capacity;
-    while (new_cap < needed)
-        new_cap *= 2;
-    KeyPointer *tmp = realloc(*entries, new_cap * sizeof(KeyPointer));
-    if (!tmp)
-        return -1;
-    *entries = tmp;
-    *capacity = new_cap;
-    return 0;
-}
-
 static int compare_key_pointer(const void *a, const void *b)
 {
     const KeyPointer *ka = (const KeyPointer *)a;
@@ -46,171 +33,149 @@ static int compare_key_pointer(const void *a, const void *b)
     return 0;
 }
 
-int scan_db(HeapFile *hf)
+// the new tree reaches the disk before its name does
+static int finish_index(BtreeFileManager *fm, const char *tmp, const char *path)
 {
-    if (!hf)
-        return -1;
+    int rc = (fflush(fm->fp) == 0 && fsync(fileno(fm->fp)) == 0) ? 0 : -1;
+    if (btfm_close(fm) != 0)
+        rc = -1;
+    if (rc == 0 && rename(tmp, path) != 0) {
+        fprintf(stderr, "Could not replace %s\n", path);
+        rc = -1;
+    }
+    if (rc != 0)
+        remove(tmp);
+    return rc;
+}
 
-    uint8_t recbuf[512];
-    Row r;
+int scan_db(HeapFile *hf)
+{
+    return scan_db_into(hf, "btree.db");
+}
 
-    KeyPointer *entries = NULL;
-    size_t count = 0;
-    size_t capacity = 0;
+// the tree is built in "<path>.new" and renamed over path when complete, so
+// path is never missing or half built. a reader that has the old file open
+// keeps reading it (see snapshot.h)
+int scan_db_into(HeapFile *hf, const char *path)
+{
+    if (!hf || !path)
+        return -1;
 
-    for (uint32_t b = 0; b < hf->n_blocks; b++)
+    // collect (key, rid) of every record with a parallel scan
+    ParallelScanSpec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.collect = 1;
+    ScanResult scan;
+    if (pscan_run(hf, &spec, &scan) != 0)
     {
-        Block *cur = bp_fetch(&hf->bp, b);
-        if (!cur)
-        {
-            free(entries);
-            return -1;
-        }
-
-        int used = block_used_count(cur);
-        int cap = block_capacity_records(hf->schema.record_size);
-        if (used > cap)
-            used = cap;
+        free(scan.locs);
+        return -1;
+    }
 
-        for (int s = 0; s < used; s++)
-        {
-            if (block_read_record(cur, hf->schema.record_size, s, recbuf) != 0)
-            {
-                free(entries);
-                return -1;
-            }
-            decode_row(&hf->schema, recbuf, &r);
-
-            if (ensure_capacity(&entries, &capacity, count + 1) != 0)
-            {
-                free(entries);
-                return -1;
-            }
-
-            entries[count].key = r.ft_pct_home;
-            entries[count].block_id = b;
-            entries[count].slot_id = (uint16_t)s;
-            count++;
-        }
+    size_t count = scan.n_locs;
+    KeyPointer *entries = malloc((count ? count : 1) * sizeof(KeyPointer));
+    if (!entries)
+    {
+        free(scan.locs);
+        return -1;
     }
+    for (size_t i = 0; i < count; i++)
+    {
+        entries[i].key = scan.locs[i].key_value;
+        entries[i].block_id = scan.locs[i].block_id;
+        entries[i].slot_id = scan.locs[i].slot_id;
+    }
+    free(scan.locs);
 
     // sort the entries by key, 
     if (count > 1)
         qsort(entries, count, sizeof(KeyPointer), compare_key_pointer);
 
     // open B+tree file (one page per node)
-    remove("btree.db");
-    
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.new", path);
+    remove(tmp);
+
     BtreeFileManager fm;
-    if (btfm_open(&fm, "btree.db", NODE_SIZE) != 0) {
-        fprintf(stderr, "Could not open btree.db\n");
+    if (btfm_open(&fm, tmp, NODE_SIZE) != 0) {
+        fprintf(stderr, "Could not open %s\n", tmp);
         free(entries);
         return -1;
     }
 
-    // nothing to index?
-    if (count == 0) {
+    // node 0 is the meta page, tree nodes start at 1. the generation pairs
+    // the tree with the heap it was built from
+    BtreeMeta meta = {BTREE_NO_NODE, BTREE_NO_NODE, BTREE_NO_NODE, 0, 0, 0, hf->generation};
+    if (btfm_write_meta(&fm, &meta) != 0) {
         btfm_close(&fm);
         free(entries);
-        return 0;
+        return -1;
     }
 
-    // allocate first leaf id
-    uint32_t node_id;
-    if (btfm_alloc_node(&fm, &node_id) != 0) {
-        fprintf(stderr, "alloc node failed\n");
-        btfm_close(&fm);
+    // nothing to index?
+    if (count == 0) {
         free(entries);
-        return -1;
+        return finish_index(&fm, tmp, path);
     }
-    // build leaves and persist as they fill
-    int leaf_count = 0;
+
+    // build leaves and persist as they fill, remembering each leaf's
+    // lower bound and aggregate for the level above
+    int leaf_count = (int)((count + MAX_LEAF_KEYS - 1) / MAX_LEAF_KEYS);
+    ChildListEntry *leaves = malloc((size_t)leaf_count * sizeof(ChildListEntry));
     Node *curr = malloc(sizeof(Node));
-    if (!curr) {
+    if (!leaves || !curr) {
+        free(leaves);
+        free(curr);
         btfm_close(&fm);
         free(entries);
         return -1;
     }
-    node_init(curr, 1, node_id);
-    leaf_count = 1;
-
-    float array[1000];
-    uint32_t leaf_node_ids[1000];
-    leaf_node_ids[0] = node_id;
-
-
-    for (size_t i = 0; i < count; i++) {
-        int wr = node_write_record_key(curr,
-                                    entries[i].key,
-                                    entries[i].block_id,
-                                    entries[i].slot_id);
-        if (wr >= 0) continue;
-        
-        array[leaf_count - 1] = curr->lower_bound;
-        
-        uint32_t new_id;
-        if (btfm_alloc_node(&fm, &new_id) != 0) {
-            fprintf(stderr, "alloc node failed\n");
-            free(curr);
-            btfm_close(&fm);
-            free(entries);
-            return -1;
+
+    size_t i = 0;
+    for (int l = 0; l < leaf_count; l++) {
+        uint32_t node_id = (uint32_t)l + 1;
+        node_init(curr, 1, node_id);
+
+        double sum = 0.0;
+        for (; i < count && curr->key_count < MAX_LEAF_KEYS; i++) {
+            node_write_record_key(curr, entries[i].key, entries[i].block_id, entries[i].slot_id);
+            sum += entries[i].key;
         }
-        
-        link_leaf_node(curr, new_id);
+        link_leaf_node(curr, (l + 1 < leaf_count) ? node_id + 1 : BTREE_NO_NODE);
+        link_leaf_prev(curr, (l > 0) ? node_id - 1 : BTREE_NO_NODE);
 
         if (btfm_write_node(&fm, curr) != 0) {
             fprintf(stderr, "Error writing node %u to disk\n", curr->node_id);
+            free(leaves);
             free(curr);
             btfm_close(&fm);
             free(entries);
             return -1;
         }
 
-        Node *next = malloc(sizeof(Node));
-        if (!next) {
-            free(curr);
-            btfm_close(&fm);
-            free(entries);
-            return -1;
-        }
-        node_init(next, 1, new_id);
-        leaf_count++;
-        leaf_node_ids[leaf_count - 1] = new_id;
-
-        // Move to the new leaf and retry the same entry
-        free(curr);
-        curr = next;
-
-        if (node_write_record_key(curr,
-                                entries[i].key,
-                                entries[i].block_id,
-                                entries[i].slot_id) < 0) {
-            fprintf(stderr, "Unexpected: write failed on fresh leaf\n");
-            free(curr);
-            btfm_close(&fm);
-            free(entries);
-            return -1;
-        }
+        leaves[l].key = curr->lower_bound;
+        leaves[l].node_id = node_id;
+        leaves[l].count = curr->key_count;
+        leaves[l].sum = sum;
     }
-    array[leaf_count - 1] = curr->lower_bound;
+    free(curr);
 
-    link_leaf_node(curr, UINT32_MAX);
-    
-    // Persist the final (partially filled) leaf
-    if (btfm_write_node(&fm, curr) != 0) {
-        fprintf(stderr, "Error writing final node %u to disk\n", curr->node_id);
-        free(curr);
+    // build the upper levels using bulkloading method
+    meta.first_leaf = 1;
+    meta.last_leaf = (uint32_t)leaf_count;
+    meta.leaf_count = (uint32_t)leaf_count;
+    meta.node_count = (uint32_t)leaf_count;
+    if (bulkload(leaves, leaf_count, &fm, &meta) == -1) {
+        fprintf(stderr, "bulkload failed\n");
+        free(leaves);
         btfm_close(&fm);
         free(entries);
         return -1;
     }
 
-    // build the upper levels using bulkloading method
-    int total_nodes = 0;
-    if (bulkload(array, leaf_count, &fm, &total_nodes)== -1) {
-        fprintf(stderr, "bulkload failed\n");
-        free(curr);
+    if (btfm_write_meta(&fm, &meta) != 0) {
+        fprintf(stderr, "Error writing meta page\n");
+        free(leaves);
         btfm_close(&fm);
         free(entries);
         return -1;
@@ -218,232 +183,144 @@ int scan_db(HeapFile *hf)
 
     printf("Parameters n : %d\n", MAX_LEAF_KEYS + 1);
     printf("Total leaf nodes: %d\n", leaf_count);
-    printf("Total nodes (incl. root): %d\n", total_nodes);
-    printf("Number of levels: 2\n");
-    
+    printf("Total nodes (incl. root): %u\n", meta.node_count);
+    printf("Number of levels: %u\n", meta.height);
     
-    free(curr);
-    btfm_close(&fm);
+    free(leaves);
     free(entries);
-    return 0;
+    return finish_index(&fm, tmp, path);
 }
 
-int bulkload(float *lower_bound_array, int child_count, BtreeFileManager *fm, int *total_nodes)
+// builds the internal levels bottom-up from the list of leaves until one root remains.
+// node ids are handed out sequentially after the leaves, so meta->node_count is also
+// the id of the last node written
+int bulkload(ChildListEntry *child_list, int child_count, BtreeFileManager *fm, BtreeMeta *meta)
 {
-
+    meta->height = 1;
     if (child_count == 1)
-        return 0; // single leaf node as root
-    else
     {
-        ChildListEntry child_list[100];
-        for (int i = 0; i < child_count; i++)
-        {
-            child_list[i].key = lower_bound_array[i];
-            child_list[i].node_id = i;
-        }
-        int level = 1;
-        *total_nodes = child_count;
+        meta->root_id = child_list[0].node_id; // single leaf node as root
+        return 0;
+    }
+
+    // each level has at most as many nodes as the one below
+    ChildListEntry *parent_list = malloc((size_t)child_count * sizeof(ChildListEntry));
+    ChildListEntry *level_list = malloc((size_t)child_count * sizeof(ChildListEntry));
+    if (!parent_list || !level_list)
+    {
+        free(parent_list);
+        free(level_list);
+        return -1;
+    }
+    memcpy(level_list, child_list, (size_t)child_count * sizeof(ChildListEntry));
+
+    int level = 1;
+    while (1)
+    {
+        level += 1;
+        int parent_count = 0;
 
-        while (1)
+        if (pack_internals(level_list, child_count, level, meta->node_count + 1, &parent_count, parent_list, fm) == -1)
         {
-            level += 1;
-            int parent_count = 0;
-            ChildListEntry parent_list[100];
-
-            if (pack_internals(child_list, child_count, level, *total_nodes, &parent_count, parent_list, fm) == -1)
-            {
-                printf("Error in packing internal nodes\n");
-                return -1;
-            }
-            if (parent_count == 1)
-            {
-                *total_nodes += parent_count;
-                return 0;
-            }
-            else
-            {
-                // prepare for next iteration
-                *total_nodes += parent_count;
-                child_count = parent_count;
-                memcpy(child_list, parent_list, parent_count * sizeof(ChildListEntry));
-            }
+            printf("Error in packing internal nodes\n");
+            free(parent_list);
+            free(level_list);
+            return -1;
         }
+        meta->node_count += parent_count;
+
+        if (parent_count == 1)
+            break;
+
+        // prepare for next iteration
+        child_count = parent_count;
+        memcpy(level_list, parent_list, parent_count * sizeof(ChildListEntry));
+    }
+
+    meta->height = (uint8_t)level;
+    meta->root_id = meta->node_count;
+    free(parent_list);
+    free(level_list);
+    return 0;
+}
+
+// writes one internal node holding children [from, to) and appends it to parent_list
+static int write_internal(ChildListEntry *child_list, int from, int to, int level, uint32_t node_id,
+                          int print_keys, int *parent_count, ChildListEntry *parent_list, BtreeFileManager *fm)
+{
+    Node *n = malloc(sizeof(Node));
+    if (!n)
+        return -1;
+    node_init(n, level, node_id);
+    node_set_first_child(n, child_list[from].node_id);
+    set_int_node_lb(n, child_list[from].key);
+    int_set_child_agg(n, 0, child_list[from].count, child_list[from].sum);
+
+    uint32_t count = child_list[from].count;
+    double sum = child_list[from].sum;
+
+    // fill node
+    for (int j = from + 1; j < to; j++)
+    {
+        node_write_node_key(n, child_list[j].key, child_list[j].node_id);
+        int_set_child_agg(n, j - from, child_list[j].count, child_list[j].sum);
+        count += child_list[j].count;
+        sum += child_list[j].sum;
+        if (print_keys)
+            printf("Node key index %d: value  : %.2f\n", j, child_list[j].key);
     }
 
+    if (btfm_write_node(fm, n) != 0)
+    {
+        fprintf(stderr, "Error writing internal node %u to disk\n", node_id);
+        free(n);
+        return -1;
+    }
+    free(n);
+
+    parent_list[*parent_count].key = child_list[from].key;
+    parent_list[*parent_count].node_id = node_id;
+    parent_list[*parent_count].count = count;
+    parent_list[*parent_count].sum = sum;
+    *parent_count += 1;
     return 0;
 }
 
-int pack_internals(ChildListEntry *child_list, int node_count, int level, int total_nodes, int *parent_count, ChildListEntry *parent_list, BtreeFileManager *fm)
+int pack_internals(ChildListEntry *child_list, int node_count, int level, uint32_t first_id, int *parent_count, ChildListEntry *parent_list, BtreeFileManager *fm)
 {
-    if (node_count < MAX_INT_CHILDREN)
+    if (node_count <= MAX_INT_CHILDREN)
     {
         printf("\nFilling all child nodes into one parent node\n");
-        // fill it all into one node
-        // create node
-        Node *n = malloc(sizeof(Node));
-        node_init(n, level, total_nodes); 
-
-        // fill node
-        for (int i = 1; i < node_count; i++)
-        {
-            node_write_node_key(n, child_list[i].key, child_list[i].node_id);
-            printf("Node key index %d: value  : %.2f\n", i, child_list[i].key);
-        }
-        if (btfm_write_node(fm, n) != 0)
-        {
-            fprintf(stderr, "Error writing root node to disk\n");
-            free(n);
-            btfm_close(fm);
+        // fill it all into one node, this is the root
+        if (write_internal(child_list, 0, node_count, level, first_id, 1, parent_count, parent_list, fm) != 0)
             return -1;
-        }
         printf("\n");
-        free(n);
-        *parent_count += 1;
+        return 0;
     }
-    else
+
+    // Divide the child nodes into groups of MAX_INT_CHILDREN, each group gets one parent node
+    int num_nodes = (node_count + MAX_INT_CHILDREN - 1) / MAX_INT_CHILDREN;
+    int last_size = node_count - (num_nodes - 1) * MAX_INT_CHILDREN;
+
+    // if the last node would underflow, borrow from the second last node
+    int num_borrow = 0;
+    if (last_size - 1 < MIN_INTERNAL_KEYS)
+        num_borrow = MIN_INTERNAL_KEYS + 1 - last_size;
+
+    printf("Level %d: %d nodes, borrowing %d children for the last node\n", level, num_nodes, num_borrow);
+
+    int from = 0;
+    for (int i = 0; i < num_nodes; i++)
     {
-        // Divide the child nodes into groups of MAX_INT_CHILDREN, each group gets one parent node
-        if (node_count % MAX_INT_CHILDREN == 0)
-        {
-            printf("Splitting at every %d nodes\n", node_count / MAX_INT_CHILDREN);
-
-            int num_nodes = node_count / MAX_INT_CHILDREN;
-
-            for (int i = 0; i < num_nodes; i++)
-            {
-
-                // create_node
-                Node *n = malloc(sizeof(Node));
-                node_init(n, level, total_nodes + *parent_count); // temp id=0
-                // put the first value into parentlist
-                parent_list[*parent_count].key = child_list[i * MAX_INT_CHILDREN].key;
-                parent_list[*parent_count].node_id = child_list[i * MAX_INT_CHILDREN].node_id;
-
-                *parent_count += 1;
-
-                // fill node
-                for (int j = i * MAX_INT_CHILDREN + 1; j < (i + 1) * MAX_INT_CHILDREN; j++)
-                {
-                    node_write_node_key(n, child_list[j].key, child_list[j].node_id);
-                    // also print content of root node nicely. prev pointer and all keys with their node ids
-                    printf("Root node key %d: %.2f\n", j, child_list[j].key);
-                }
-
-                // write the node to disk
-                if (btfm_write_node(fm, n) != 0)
-                {
-                    fprintf(stderr, "Error writing root node to disk\n");
-                    free(n);
-                    btfm_close(fm);
-                    return -1;
-                }
-                free(n);
-            }
-        }
+        int size = MAX_INT_CHILDREN;
+        if (i == num_nodes - 2)
+            size -= num_borrow;
+        else if (i == num_nodes - 1)
+            size = node_count - from;
 
-        else if ((node_count % MAX_INT_CHILDREN) - 1 < MIN_INTERNAL_KEYS && node_count % MAX_INT_CHILDREN > 0)
-        {
-            printf("Splitting with borrowing for the last two nodes\n");
-            // split is every num_nodes multiple except for the last two nodes
-            // settle the split for the last two nodes, borrow from the second last node
-            int num_nodes = node_count / MAX_INT_CHILDREN + 1;
-            int num_borrow = MIN_INTERNAL_KEYS - (node_count % MAX_INT_CHILDREN) + 1;
-            int borrow_from = ((num_nodes - 1) * MAX_INT_CHILDREN) - num_borrow;
-
-            printf("num_nodes: %d, num_borrow: %d, borrow_from: %d\n", num_nodes, num_borrow, borrow_from);
-
-            for (int i = 0; i < num_nodes - 2; i++)
-            {
-                printf("Creating node %d\n", i);
-                // create_node
-                Node *n = malloc(sizeof(Node));
-                node_init(n, level, total_nodes + *parent_count); // temp id=0
-                // put the first value into parentlist
-                parent_list[*parent_count].key = child_list[i * MAX_INT_CHILDREN].key;
-                parent_list[*parent_count].node_id = child_list[i * MAX_INT_CHILDREN].node_id;
-
-                *parent_count += 1;
-
-                // fill node
-                for (int j = i * MAX_INT_CHILDREN + 1; j < (i + 1) * MAX_INT_CHILDREN; j++)
-                {
-                    node_write_node_key(n, child_list[j].key, child_list[j].node_id);
-                    // also print content of root node nicely. prev pointer and all keys with their node ids
-                    printf("Root node key %d: %.2f\n", j, child_list[j].key);
-                }
-                printf("\n");
-
-                // write the node to disk
-                if (btfm_write_node(fm, n) != 0)
-                {
-                    fprintf(stderr, "Error writing root node to disk\n");
-                    free(n);
-                    btfm_close(fm);
-                    return -1;
-                }
-                free(n);
-            }
-
-            // handle the last two nodes
-
-            // create node
-            Node *n = malloc(sizeof(Node));
-            node_init(n, level, total_nodes + *parent_count);
-
-            // put the first value into parentlist
-            parent_list[*parent_count].key = child_list[(num_nodes - 2) * MAX_INT_CHILDREN].key;
-            parent_list[*parent_count].node_id = child_list[(num_nodes - 2) * MAX_INT_CHILDREN].node_id;
-
-            *parent_count += 1;
-
-            printf("Creating node %d\n", num_nodes - 2);
-
-            for (int j = (num_nodes - 2) * MAX_INT_CHILDREN + 1; j < borrow_from; j++)
-            {
-                node_write_node_key(n, child_list[j].key, child_list[j].node_id);
-                // also print content of root node nicely. prev pointer and all keys with their node ids
-                printf("Root node key %d: %.2f\n", j, child_list[j].key);
-            }
-
-            // write the node to disk
-            if (btfm_write_node(fm, n) != 0)
-            {
-                fprintf(stderr, "Error writing root node to disk\n");
-                free(n);
-                btfm_close(fm);
-                return -1;
-            }
-            free(n);
-
-            // create node
-            n = malloc(sizeof(Node));
-            node_init(n, level, total_nodes + *parent_count);
-
-            // put the first value into parentlist
-            parent_list[*parent_count].key = child_list[borrow_from].key;
-            parent_list[*parent_count].node_id = child_list[borrow_from].node_id;
-
-            *parent_count += 1;
-
-            printf("Creating node %d\n", num_nodes - 1);
-            // fill node
-            for (int j = borrow_from + 1; j < node_count; j++)
-            {
-                node_write_node_key(n, child_list[j].key, child_list[j].node_id);
-                // also print content of root node nicely. prev pointer and all keys with their node ids
-                printf("Root node key %d: %.2f\n", j, child_list[j].key);
-            }
-
-            // write the node to disk
-            if (btfm_write_node(fm, n) != 0)
-            {
-                fprintf(stderr, "Error writing root node to disk\n");
-                free(n);
-                btfm_close(fm);
-                return -1;
-            }
-            free(n);
-        }
+        if (write_internal(child_list, from, from + size, level, first_id + i, 0, parent_count, parent_list, fm) != 0)
+            return -1;
+        from += size;
     }
     return 0;
-}
\ No newline at end of file
+}
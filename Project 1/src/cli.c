@@ -3,18 +3,107 @@
 #include "schema.h"
 #include "build_bplus.h"
 #include "file_manager_btree.h"
+#include "bptree_ops.h"
+#include "cursor.h"
+#include "bench.h"
+#include "parallel_scan.h"
+#include "vacuum.h"
+#include "cluster.h"
+#include "csv_loader.h"
+#include "dump.h"
+#include "ingest.h"
+#include "snapshot.h"
+#include "server.h"
+#include "scan_kernel.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 static void usage()
 {
     printf("Usage:\n");
-    printf("  load <csv> <dbfile> [--buf N]\n");
+    printf("  load <csv> <dbfile> [--buf N] [--layout nsm|pax|packed] [--threads N] [--append]\n");
+    printf("  export <dbfile> <outfile> [--csv]           # Live rows to a binary columnar dump, or a tab-separated CSV file\n");
+    printf("  import <dumpfile> <dbfile> [--layout nsm|pax|packed] [--append]   # Load a binary dump without parsing\n");
+    printf("  ingest <dbfile> [fifo] [--batch N] [--batch-ms MS] [--quiet]   # Append rows streamed on stdin (or a FIFO) in micro-batches\n");
     printf("  stats <dbfile> [--buf N]\n");
     printf("  scan  <dbfile> [--buf N] [--limit K]\n");
     printf("  build_bplus <dbfile> [--buf N]\n");
     printf("  delete_bplus <dbfile> <min_key> [--buf N]    # Delete records with FT_PCT_home > min_key\n");
+    printf("  insert_bplus <dbfile> <csvfile> [--wal] [--group N] [--ckpt MB]   # Insert rows into free slots (free-space map) and the index\n");
+    printf("  vacuum <dbfile>                              # Compact the heap, shrink the file and remap the index\n");
+    printf("  cluster <dbfile> <column> [--mem MB]         # Rewrite the heap sorted on column (external sort), rebuild the index\n");
+    printf("  range_bplus <dbfile> <min_key> [max_key] [--limit K] [--desc]   # Stream rows with min_key <= FT_PCT_home <= max_key via the index\n");
+    printf("  range_scan  <dbfile> <min_key> [max_key] [--limit K]   # Same range via a full heap scan\n");
+    printf("  top_bplus <dbfile> <K>                       # K records with the highest FT_PCT_home\n");
+    printf("  serve <dbfile> [--socket PATH] [--buf N]     # Keep the table open and answer queries on a Unix socket\n");
+    printf("  client ping|stats|shutdown [--socket PATH]   # Ask a running server\n");
+    printf("  client agg|range <min_key> [max_key] [--limit K] [--socket PATH]   # COUNT/SUM or rows of a range, from the server\n");
+    printf("  zonemap <dbfile> [<column> <lo> <hi>]       # Zone map summary and pruning ratio for lo <= column <= hi\n");
+    printf("  bench_scan <dbfile> <min_key> [iters]       # Per-row decode vs batch filter kernels\n");
+    printf("  bench_layout <dbfile> <min_key> [iters]     # Filter / SUM kernels over NSM, PAX and compressed blocks\n");
+    printf("  bench_pscan <dbfile> <min_key> [iters]      # Parallel scan scaling from 1 thread to --threads N (default: all cores)\n");
+    printf("  bench_delete <dbfile> [pct ...]             # Batch delete of the top pct%% of FT_PCT_home (default 1 10 50 90)\n");
+    printf("  bench_load <csvfile>                        # CSV load MB/s: serial loader vs parallel parsing with 1..--threads N threads\n");
+    printf("  bench_parse <csvfile> [iters]               # CSV parse MB/s: strtok parser vs the SIMD separator scanner\n");
+    printf("  bench_import <csvfile>                      # Reload MB/s and rows/s: CSV loaders vs export + import of a binary dump\n");
+    printf("  bench_commit <csvfile> [rows]               # Durable single-row inserts: flush per block vs the write-ahead log\n");
+    printf("  bench_recovery <dbfile> <csvfile> [rows]    # Restart time after a crash, with fuzzy checkpoints every 2/3..2/33 of the log or none\n");
+    printf("  bench_snapshot <dbfile> [readers]           # Readers during bulk deletes: torn results and latency, in place vs snapshot swaps\n");
+    printf("  bench_serve <dbfile> [clients] [requests]   # Cold opens per query vs a query server, 1..clients connections: QPS, p50/p99\n");
+    printf("  bench_olc [ops] [write_pct ...]             # Concurrent lookups + inserts on btree.db: locks vs optimistic lock coupling (default 5 50)\n");
+    printf("  gen <csvfile> <rows> [seed]                 # Write rows of synthetic games.txt-style data\n");
+    printf("  aggregate_bplus <min_key> [max_key]          # COUNT/SUM/AVG of FT_PCT_home in [min_key, max_key]\n");
+    printf("  rank_bplus <key>                             # Number of records with FT_PCT_home < key\n");
+    printf("  percentile_bplus <p>                         # FT_PCT_home at percentile p (0..100)\n");
+}
+
+// argv[i] as a key, if there is one: flags start with "--", keys may be negative
+static int key_arg(int argc, char **argv, int i, float *key)
+{
+    if (i >= argc)
+        return 0;
+    char *end;
+    float v = strtof(argv[i], &end);
+    if (end == argv[i] || *end != '\0')
+        return 0;
+    *key = v;
+    return 1;
+}
+
+// adds the rows of an appending load to btree.db, if there is an index.
+// they start at (first_block, first_slot) and run to the end of the file
+static int index_appended(HeapFile *hf, uint32_t first_block, uint16_t first_slot, uint64_t rows)
+{
+    FILE *probe = fopen("btree.db", "rb");
+    if (!probe)
+    {
+        printf("No btree.db, index not updated\n");
+        return 0;
+    }
+    fclose(probe);
+
+    BtreeFileManager btfm;
+    uint32_t inserted = 0;
+    double t0 = bench_now_ms();
+    int rc = btfm_open(&btfm, "btree.db", NODE_SIZE);
+    if (rc == 0)
+    {
+        rc = hf_index_rows(hf, &btfm, first_block, first_slot, rows, &inserted);
+        btfm_close(&btfm);
+    }
+    if (rc == 0)
+        rc = hf_stamp_index(hf, "btree.db");
+    if (rc != 0)
+    {
+        fprintf(stderr, "index update failed after %u entries\n", inserted);
+        return -1;
+    }
+    printf("Index: %u entries inserted in %.3f ms\n", inserted, bench_now_ms() - t0);
+    return 0;
 }
 
 int run_cli(int argc, char **argv)
@@ -24,35 +113,218 @@ int run_cli(int argc, char **argv)
         usage();
         return 1;
     }
-    int buf = 64, limit = 10;
+    int buf = 64, limit = 10, desc = 0, mem_mb = 64, append = 0, csv_out = 0, quiet = 0;
+    uint32_t batch_rows = INGEST_BATCH_ROWS, batch_ms = INGEST_BATCH_MS;
+    uint8_t layout = BLOCK_FMT_NSM;
+    const char *socket_path = SRV_SOCKET;
     for (int i = 0; i < argc; i++)
     {
+        if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc && strcmp(argv[i + 1], "pax") == 0)
+            layout = BLOCK_FMT_PAX;
+        if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc && strcmp(argv[i + 1], "packed") == 0)
+            layout = BLOCK_FMT_PACKED;
+        if (strcmp(argv[i], "--desc") == 0)
+            desc = 1;
+        if (strcmp(argv[i], "--append") == 0)
+            append = 1;
+        if (strcmp(argv[i], "--csv") == 0)
+            csv_out = 1;
+        if (strcmp(argv[i], "--quiet") == 0)
+            quiet = 1;
+        if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            batch_rows = (uint32_t)atoi(argv[i + 1]);
+        if (strcmp(argv[i], "--batch-ms") == 0 && i + 1 < argc)
+            batch_ms = (uint32_t)atoi(argv[i + 1]);
         if (strcmp(argv[i], "--buf") == 0 && i + 1 < argc)
             buf = atoi(argv[i + 1]);
         if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc)
             limit = atoi(argv[i + 1]);
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+            socket_path = argv[i + 1];
+        if (strcmp(argv[i], "--mem") == 0 && i + 1 < argc)
+            mem_mb = atoi(argv[i + 1]);
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            pscan_set_default_threads(atoi(argv[i + 1]));
+        if (strcmp(argv[i], "--wal") == 0)
+            hf_set_default_wal(1, 0);
+        if (strcmp(argv[i], "--group") == 0 && i + 1 < argc)
+            hf_set_default_wal(1, (uint32_t)atoi(argv[i + 1]));
+        if (strcmp(argv[i], "--ckpt") == 0 && i + 1 < argc)
+            hf_set_checkpoint_bytes((uint64_t)atoi(argv[i + 1]) << 20);
     }
     if (strcmp(argv[1], "load") == 0 && argc >= 4)
     {
         const char *csv = argv[2];
         const char *db = argv[3];
-        Schema s;
-        schema_init_default(&s);
         HeapFile hf;
-        if (hf_create(&hf, db, &s, buf) != 0)
+        if (append)
         {
-            fprintf(stderr, "create failed\n");
-            return 2;
+            // keep what is there, the new rows go after it in the file's own layout
+            if (hf_open(&hf, db, buf) != 0 || hf_new_generation(&hf) != 0)
+            {
+                fprintf(stderr, "open failed\n");
+                return 2;
+            }
+        }
+        else
+        {
+            Schema s;
+            schema_init_default(&s);
+            if (hf_create(&hf, db, &s, buf) != 0)
+            {
+                fprintf(stderr, "create failed\n");
+                return 2;
+            }
+            hf.layout = layout;
         }
-        if (hf_load_csv(&hf, csv) != 0)
+        uint32_t blocks_before = hf.n_blocks;
+        CsvLoadStats st;
+        if (hf_load_csv_parallel(&hf, csv, 0, &st) != 0)
         {
             fprintf(stderr, "load failed\n");
             return 3;
         }
+        csv_load_print(&st);
+        if (append)
+        {
+            printf("Appended from block %u slot %u: %u -> %u blocks\n", st.first_block, st.first_slot,
+                   blocks_before, hf.n_blocks);
+            if (index_appended(&hf, st.first_block, st.first_slot, st.rows) != 0)
+            {
+                hf_close(&hf);
+                return 3;
+            }
+        }
+        hf_print_stats(&hf);
+        hf_close(&hf);
+        return 0;
+    }
+    else if (strcmp(argv[1], "export") == 0 && argc >= 4)
+    {
+        HeapFile hf;
+        if (hf_open(&hf, argv[2], buf) != 0)
+        {
+            fprintf(stderr, "open failed\n");
+            return 2;
+        }
+        DumpStats st;
+        int rc = csv_out ? hf_export_csv(&hf, argv[3], &st) : hf_export_bin(&hf, argv[3], &st);
+        hf_close(&hf);
+        if (rc != 0)
+        {
+            fprintf(stderr, "export failed\n");
+            return 3;
+        }
+        dump_print(csv_out ? "Exported (CSV)" : "Exported", &st);
+        return 0;
+    }
+    else if (strcmp(argv[1], "import") == 0 && argc >= 4)
+    {
+        const char *dump = argv[2];
+        const char *db = argv[3];
+        HeapFile hf;
+        if (append)
+        {
+            if (hf_open(&hf, db, buf) != 0 || hf_new_generation(&hf) != 0)
+            {
+                fprintf(stderr, "open failed\n");
+                return 2;
+            }
+        }
+        else
+        {
+            Schema s;
+            schema_init_default(&s);
+            if (hf_create(&hf, db, &s, buf) != 0)
+            {
+                fprintf(stderr, "create failed\n");
+                return 2;
+            }
+            hf.layout = layout;
+        }
+        DumpStats st;
+        if (hf_import_bin(&hf, dump, &st) != 0)
+        {
+            fprintf(stderr, "import failed\n");
+            hf_close(&hf);
+            return 3;
+        }
+        dump_print("Imported", &st);
+        if (append && index_appended(&hf, st.first_block, st.first_slot, st.rows) != 0)
+        {
+            hf_close(&hf);
+            return 3;
+        }
         hf_print_stats(&hf);
         hf_close(&hf);
         return 0;
     }
+    else if (strcmp(argv[1], "ingest") == 0 && argc >= 3)
+    {
+        const char *db = argv[2];
+        const char *src = (argc >= 4 && argv[3][0] != '-') ? argv[3] : NULL;
+        HeapFile hf;
+        FILE *probe = fopen(db, "rb");
+        if (probe)
+        {
+            fclose(probe);
+            if (hf_open(&hf, db, buf) != 0 || hf_new_generation(&hf) != 0)
+            {
+                fprintf(stderr, "open failed\n");
+                return 2;
+            }
+        }
+        else
+        {
+            Schema s;
+            schema_init_default(&s);
+            if (hf_create(&hf, db, &s, buf) != 0)
+            {
+                fprintf(stderr, "create failed\n");
+                return 2;
+            }
+            hf.layout = layout;
+        }
+        int fd = src ? open(src, O_RDONLY) : 0;
+        if (fd < 0)
+        {
+            fprintf(stderr, "Failed to open %s\n", src);
+            hf_close(&hf);
+            return 2;
+        }
+
+        BtreeFileManager btfm;
+        IngestOpts o = {batch_rows, batch_ms, NULL, !quiet};
+        probe = fopen("btree.db", "rb");
+        if (probe)
+        {
+            fclose(probe);
+            if (btfm_open(&btfm, "btree.db", NODE_SIZE) == 0)
+                o.index = &btfm;
+        }
+        if (!o.index)
+            printf("No btree.db, index not updated\n");
+
+        IngestStats st;
+        int rc = hf_ingest(&hf, fd, &o, &st);
+        if (src)
+            close(fd);
+        if (o.index)
+        {
+            btfm_close(&btfm);
+            if (rc == 0)
+                rc = hf_stamp_index(&hf, "btree.db");
+        }
+        ingest_print(&st);
+        hf_print_stats(&hf);
+        hf_close(&hf);
+        if (rc != 0)
+        {
+            fprintf(stderr, "ingest failed\n");
+            return 3;
+        }
+        return 0;
+    }
     else if (strcmp(argv[1], "stats") == 0 && argc >= 3)
     {
         const char *db = argv[2];
@@ -144,33 +416,13 @@ int run_cli(int argc, char **argv)
         // Open the B+ tree file to analyze the updated structure
         BtreeFileManager btfm;
         if (btfm_open(&btfm, "btree.db", 4096) == 0) {
-            uint32_t total_nodes = 0;
-            uint32_t leaf_nodes = 0;
-            uint8_t max_level = 0;
-            uint32_t root_node_id = 0;
-            
-            // Count nodes and find root
-            for (uint32_t test_id = 0; test_id < 1000; test_id++) {
-                Node test_node;
-                if (btfm_read_node(&btfm, test_id, &test_node) == 0) {
-                    total_nodes++;
-                    if (test_node.level == 1) {
-                        leaf_nodes++;
-                    } else {
-                        if (test_node.level > max_level) {
-                            max_level = test_node.level;
-                            root_node_id = test_id;
-                        }
-                    }
-                } else {
-                    break; // No more nodes
-                }
+            BtreeMeta meta;
+            if (btfm_read_meta(&btfm, &meta) == 0) {
+                printf("Total leaf nodes: %u\n", meta.leaf_count);
+                printf("Total nodes (incl. root): %u\n", meta.node_count);
+                printf("Number of levels: %u\n", meta.height);
             }
             
-            printf("Total leaf nodes: %u\n", leaf_nodes);
-            printf("Total nodes (incl. root): %u\n", total_nodes);
-            printf("Number of levels: %u\n", max_level);
-            
             btfm_close(&btfm);
         }
         printf("================================\n");
@@ -180,6 +432,535 @@ int run_cli(int argc, char **argv)
         
         return 0;
     }
+    else if (strcmp(argv[1], "vacuum") == 0 && argc >= 3)
+    {
+        const char *db = argv[2];
+        HeapFile hf;
+        if (hf_open(&hf, db, buf) != 0)
+        {
+            fprintf(stderr, "open failed\n");
+            return 2;
+        }
+
+        // blocks a full scan and the FT_PCT_home > 0.9 scan read, before and after
+        ParallelScanSpec full, range;
+        memset(&full, 0, sizeof(full));
+        memset(&range, 0, sizeof(range));
+        range.range.lo = 0.9f;
+        range.range.hi = INFINITY;
+        range.filter = 1;
+        ScanResult full_before, range_before, full_after, range_after;
+        if (pscan_run(&hf, &full, &full_before) != 0 || pscan_run(&hf, &range, &range_before) != 0)
+        {
+            hf_close(&hf);
+            return 3;
+        }
+
+        VacuumStats st;
+        if (hf_vacuum(&hf, "btree.db", &st) != 0)
+        {
+            fprintf(stderr, "vacuum failed\n");
+            hf_close(&hf);
+            return 3;
+        }
+        vacuum_print(&st);
+
+        if (pscan_run(&hf, &full, &full_after) != 0 || pscan_run(&hf, &range, &range_after) != 0)
+        {
+            hf_close(&hf);
+            return 3;
+        }
+        printf("Blocks scanned          before    after\n");
+        printf("  full scan           %8u %8u  (%llu records)\n", full_before.blocks_read, full_after.blocks_read,
+               (unsigned long long)full_after.records);
+        printf("  FT_PCT_home > 0.9   %8u %8u  (%llu matches)\n", range_before.blocks_read, range_after.blocks_read,
+               (unsigned long long)range_after.matches);
+        hf_close(&hf);
+        return 0;
+    }
+    else if (strcmp(argv[1], "cluster") == 0 && argc >= 4)
+    {
+        const char *db = argv[2];
+        Schema s;
+        schema_init_default(&s);
+        int field = schema_field_index(&s, argv[3]);
+        if (field < 0)
+        {
+            fprintf(stderr, "Unknown column: %s\n", argv[3]);
+            return 2;
+        }
+
+        // the existing FT_PCT_home > 0.9 query, before and after
+        HeapFile hf;
+        uint32_t scan_before, index_before, scan_after, index_after;
+        if (hf_open(&hf, db, buf) != 0)
+        {
+            fprintf(stderr, "open failed\n");
+            return 2;
+        }
+        if (cluster_range_blocks(&hf, "btree.db", 0.9f, &scan_before, &index_before) != 0)
+            scan_before = index_before = 0;
+        hf_close(&hf);
+
+        ClusterStats st;
+        if (hf_cluster(db, field, (size_t)(mem_mb > 0 ? mem_mb : 1) << 20, &st) != 0)
+        {
+            fprintf(stderr, "cluster failed\n");
+            return 3;
+        }
+        cluster_print(&st);
+
+        if (hf_open(&hf, db, buf) != 0 ||
+            cluster_range_blocks(&hf, "btree.db", 0.9f, &scan_after, &index_after) != 0)
+        {
+            fprintf(stderr, "open failed\n");
+            return 3;
+        }
+        hf_close(&hf);
+        printf("FT_PCT_home > 0.9       before    after\n");
+        printf("  heap scan blocks    %8u %8u\n", scan_before, scan_after);
+        printf("  index range blocks  %8u %8u\n", index_before, index_after);
+        return 0;
+    }
+    else if (strcmp(argv[1], "insert_bplus") == 0 && argc >= 4)
+    {
+        const char *db = argv[2];
+        FILE *f = fopen(argv[3], "r");
+        if (!f)
+        {
+            fprintf(stderr, "open %s failed\n", argv[3]);
+            return 2;
+        }
+        char line[8192];
+        CsvIdx idx;
+        if (!fgets(line, sizeof(line), f) || parse_header_map(line, &idx) != 0)
+        {
+            fprintf(stderr, "Header does not contain required columns.\n");
+            fclose(f);
+            return 2;
+        }
+        HeapFile hf;
+        if (hf_open(&hf, db, buf) != 0 || hf_new_generation(&hf) != 0)
+        {
+            fprintf(stderr, "open failed\n");
+            fclose(f);
+            return 2;
+        }
+        BtreeFileManager btfm;
+        if (btfm_open(&btfm, "btree.db", NODE_SIZE) != 0)
+        {
+            fprintf(stderr, "open btree.db failed\n");
+            hf_close(&hf);
+            fclose(f);
+            return 2;
+        }
+        if (hf.wal && btfm_use_wal(&btfm, hf.wal) != 0)
+        {
+            fprintf(stderr, "btree.db: log not attached\n");
+            btfm_close(&btfm);
+            hf_close(&hf);
+            fclose(f);
+            return 2;
+        }
+
+        // every row goes to a free slot if there is one, and into the index.
+        // with --wal each row is a transaction, its commit is group-written
+        uint32_t blocks_before = hf.n_blocks;
+        uint64_t inserted = 0, reused = 0;
+        int rc = 0;
+        Row r;
+        while (rc == 0 && fgets(line, sizeof(line), f))
+        {
+            if (parse_row_by_index(line, &idx, &r) != 0)
+                continue;
+            uint32_t b;
+            uint16_t slot;
+            hf_begin(&hf);
+            if (hf_insert(&hf, &r, &b, &slot) != 0 || bptree_insert(&btfm, r.ft_pct_home, b, slot) != 0 ||
+                hf_commit(&hf, 0) != 0)
+            {
+                fprintf(stderr, "insert failed after %llu rows\n", (unsigned long long)inserted);
+                rc = 3;
+                break;
+            }
+            inserted++;
+            if (b < blocks_before)
+                reused++;
+        }
+        fclose(f);
+        btfm_close(&btfm);
+        if (rc == 0 && hf_stamp_index(&hf, "btree.db") != 0)
+            rc = 3;
+        printf("Inserted %llu rows: %llu into existing blocks, %llu into %u new blocks\n",
+               (unsigned long long)inserted, (unsigned long long)reused,
+               (unsigned long long)(inserted - reused), hf.n_blocks - blocks_before);
+        printf("Blocks: %u -> %u, free slots left: %llu\n", blocks_before, hf.n_blocks,
+               (unsigned long long)fsm_total_free(&hf.fsm));
+        hf_close(&hf);
+        return rc;
+    }
+    else if ((strcmp(argv[1], "range_bplus") == 0 || strcmp(argv[1], "range_scan") == 0 ||
+              strcmp(argv[1], "top_bplus") == 0) && argc >= 4)
+    {
+        const char *db = argv[2];
+        int use_index = strcmp(argv[1], "range_scan") != 0;
+        KeyRange range = {(float)atof(argv[3]), INFINITY, 1, 1};
+        key_arg(argc, argv, 4, &range.hi);
+
+        // top K = ORDER BY FT_PCT_home DESC LIMIT K over the whole key space
+        if (strcmp(argv[1], "top_bplus") == 0)
+        {
+            limit = atoi(argv[3]);
+            range.lo = -INFINITY;
+            range.hi = INFINITY;
+            desc = 1;
+        }
+
+        // the table and its index as of one version, whatever maintenance runs meanwhile
+        Snapshot snap;
+        if (snap_open(&snap, db, buf) != 0)
+        {
+            fprintf(stderr, "open failed\n");
+            return 2;
+        }
+        if (use_index && !snap.has_index)
+        {
+            printf("btree.db is missing or belongs to another version of %s, scanning the table\n", db);
+            use_index = 0;
+        }
+
+        // rows are printed as the cursor produces them, nothing is materialized
+        uint64_t lim = limit > 0 ? (uint64_t)limit : 0;
+        RecordLocation loc;
+        Row r;
+        int rc;
+        if (use_index)
+        {
+            IndexCursor cur;
+            if (idx_cursor_open_on(&cur, &snap.ix, &range, lim, desc) != 0)
+            {
+                snap_close(&snap);
+                return 3;
+            }
+            while ((rc = idx_cursor_next(&cur, &loc)) == 1)
+            {
+                if (hf_read_row(&snap.hf, loc.block_id, loc.slot_id, &r) != 0)
+                    continue;
+                printf("%d,%s,%d,%d,%.3f,%d\n", r.game_id, r.game_date, r.home_team_id,
+                       r.visitor_team_id, r.ft_pct_home, r.home_team_wins);
+            }
+            printf("Rows: %llu, index nodes accessed: %u, leaf nodes accessed: %u\n",
+                   (unsigned long long)cur.returned, cur.index_nodes_accessed, cur.leaf_nodes_accessed);
+            idx_cursor_close(&cur);
+        }
+        else
+        {
+            HeapCursor cur;
+            heap_cursor_open(&cur, &snap.hf, &range, lim);
+            while ((rc = heap_cursor_next(&cur, &loc, &r)) == 1)
+            {
+                printf("%d,%s,%d,%d,%.3f,%d\n", r.game_id, r.game_date, r.home_team_id,
+                       r.visitor_team_id, r.ft_pct_home, r.home_team_wins);
+            }
+            printf("Rows: %llu, data blocks accessed: %u\n",
+                   (unsigned long long)cur.returned, cur.blocks_accessed);
+            heap_cursor_close(&cur);
+        }
+        snap_close(&snap);
+        return rc < 0 ? 3 : 0;
+    }
+    else if (strcmp(argv[1], "serve") == 0 && argc >= 3)
+    {
+        ServerStats st;
+        printf("Serving %s on %s\n", argv[2], socket_path);
+        fflush(stdout);
+        if (srv_run(argv[2], socket_path, buf, -1, &st) != 0)
+            return 3;
+        printf("Served %llu requests on %llu connections, %.1f ms answering, %u reopens\n",
+               (unsigned long long)st.requests, (unsigned long long)st.connections, st.busy_ms, st.reopens);
+        return 0;
+    }
+    else if (strcmp(argv[1], "client") == 0 && argc >= 3)
+    {
+        static const char *ops[] = {"ping", "stats", "agg", "range", "shutdown"};
+        uint8_t op = 0;
+        for (int i = 0; i < 5; i++)
+            if (strcmp(argv[2], ops[i]) == 0)
+                op = (uint8_t)(SRV_PING + i);
+        if (op == 0 || ((op == SRV_AGGREGATE || op == SRV_RANGE) && argc < 4))
+        {
+            usage();
+            return 1;
+        }
+        float lo = argc >= 4 ? (float)atof(argv[3]) : 0.0f;
+        float hi = INFINITY;
+        key_arg(argc, argv, 4, &hi);
+        uint32_t lim = limit > 0 ? (uint32_t)limit : 0;
+        uint8_t body[12];
+        memcpy(body, &lo, 4);
+        memcpy(body + 4, &hi, 4);
+        memcpy(body + 8, &lim, 4);
+
+        int fd = srv_connect(socket_path);
+        if (fd < 0)
+        {
+            fprintf(stderr, "No server on %s\n", socket_path);
+            return 2;
+        }
+        uint8_t *resp = NULL;
+        uint32_t cap = 0, len = 0;
+        double t0 = bench_now_ms();
+        int status = srv_call(fd, op, body, op == SRV_RANGE ? 12 : op == SRV_AGGREGATE ? 8 : 0, &resp, &cap, &len);
+        double ms = bench_now_ms() - t0;
+        close(fd);
+        if (status != SRV_OK)
+        {
+            fprintf(stderr, "Request failed (%s)\n", status < 0 ? "connection lost" :
+                    status == SRV_BAD_REQUEST ? "bad request" : "server error");
+            free(resp);
+            return 3;
+        }
+        if (op == SRV_STATS && len >= 21)
+        {
+            uint64_t records, generation;
+            uint32_t blocks;
+            memcpy(&records, resp, 8);
+            memcpy(&blocks, resp + 8, 4);
+            memcpy(&generation, resp + 12, 8);
+            printf("Records: %llu, blocks: %u, generation: %llu, index: %s\n", (unsigned long long)records, blocks,
+                   (unsigned long long)generation, resp[20] ? "yes" : "no, heap scans");
+        }
+        else if (op == SRV_AGGREGATE && len >= 16)
+        {
+            uint64_t count;
+            double sum;
+            memcpy(&count, resp, 8);
+            memcpy(&sum, resp + 8, 8);
+            printf("Range [%.3f, %.3f]\n", lo, hi);
+            printf("  COUNT: %llu\n", (unsigned long long)count);
+            printf("  SUM:   %.6f\n", sum);
+            if (count > 0)
+                printf("  AVG:   %.6f\n", sum / count);
+        }
+        else if (op == SRV_RANGE && len >= 4)
+        {
+            uint32_t n;
+            Row r;
+            memcpy(&n, resp, 4);
+            for (uint32_t i = 0; i < n && 4 + (i + 1) * SRV_ROW_SIZE <= len; i++)
+            {
+                srv_decode_row(resp + 4 + i * SRV_ROW_SIZE, &r);
+                printf("%d,%s,%d,%d,%.3f,%d\n", r.game_id, r.game_date, r.home_team_id,
+                       r.visitor_team_id, r.ft_pct_home, r.home_team_wins);
+            }
+            printf("Rows: %u\n", n);
+        }
+        else if (op == SRV_PING)
+            printf("pong\n");
+        printf("Answered in %.3f ms\n", ms);
+        free(resp);
+        return 0;
+    }
+    else if (strcmp(argv[1], "zonemap") == 0 && argc >= 3)
+    {
+        const char *db = argv[2];
+        HeapFile hf;
+        if (hf_open(&hf, db, buf) != 0)
+        {
+            fprintf(stderr, "open failed\n");
+            return 2;
+        }
+        if (!hf.zm.valid || hf.zm.n_blocks != hf.n_blocks)
+        {
+            printf("Zone map missing or stale, rebuilding %s\n", hf.zm.path);
+            if (hf_build_zonemap(&hf) != 0)
+            {
+                fprintf(stderr, "zone map build failed\n");
+                hf_close(&hf);
+                return 3;
+            }
+        }
+        printf("Zone map: %s (%u blocks, %u columns)\n", hf.zm.path, hf.zm.n_blocks, hf.zm.n_cols);
+
+        if (argc >= 6)
+        {
+            int col = schema_field_index(&hf.schema, argv[3]);
+            if (col < 0 || col >= hf.zm.n_cols)
+            {
+                fprintf(stderr, "unknown column %s\n", argv[3]);
+                hf_close(&hf);
+                return 3;
+            }
+            // dates are compared as yyyymmdd
+            double lo = strchr(argv[4], '/') ? (double)date_key(argv[4]) : atof(argv[4]);
+            double hi = strchr(argv[5], '/') ? (double)date_key(argv[5]) : atof(argv[5]);
+
+            uint32_t kept = 0;
+            for (uint32_t b = 0; b < hf.n_blocks; b++)
+                kept += zm_block_may_match(&hf.zm, b, col, lo, 1, hi, 1);
+            uint32_t pruned = hf.n_blocks - kept;
+            printf("Predicate %.3f <= %s <= %.3f\n", lo, hf.schema.fields[col].name, hi);
+            printf("  Blocks to read: %u\n", kept);
+            printf("  Blocks pruned: %u\n", pruned);
+            if (hf.n_blocks > 0)
+                printf("  Pruning ratio: %.1f%%\n", 100.0 * pruned / hf.n_blocks);
+        }
+        hf_close(&hf);
+        return 0;
+    }
+    else if (strcmp(argv[1], "bench_scan") == 0 && argc >= 4)
+    {
+        int iters = (argc >= 5 && argv[4][0] != '-') ? atoi(argv[4]) : 20;
+        if (iters < 1)
+            iters = 1;
+        return bench_scan(argv[2], (float)atof(argv[3]), iters) == 0 ? 0 : 3;
+    }
+    else if (strcmp(argv[1], "bench_layout") == 0 && argc >= 4)
+    {
+        int iters = 20;
+        if (argc >= 5 && argv[4][0] != '-')
+            iters = atoi(argv[4]);
+        if (iters < 1)
+            iters = 1;
+        return bench_layout(argv[2], (float)atof(argv[3]), iters) == 0 ? 0 : 3;
+    }
+    else if (strcmp(argv[1], "bench_pscan") == 0 && argc >= 4)
+    {
+        int iters = (argc >= 5 && argv[4][0] != '-') ? atoi(argv[4]) : 20;
+        if (iters < 1)
+            iters = 1;
+        return bench_pscan(argv[2], (float)atof(argv[3]), iters) == 0 ? 0 : 3;
+    }
+    else if (strcmp(argv[1], "bench_delete") == 0 && argc >= 3)
+    {
+        double pcts[16] = {1, 10, 50, 90};
+        int n = 0;
+        for (int i = 3; i < argc && n < 16 && argv[i][0] != '-'; i++)
+            pcts[n++] = atof(argv[i]);
+        if (n == 0)
+            n = 4;
+        return bench_delete(argv[2], pcts, n) == 0 ? 0 : 3;
+    }
+    else if (strcmp(argv[1], "bench_load") == 0 && argc >= 3)
+    {
+        return bench_load(argv[2]) == 0 ? 0 : 3;
+    }
+    else if (strcmp(argv[1], "bench_parse") == 0 && argc >= 3)
+    {
+        int iters = (argc >= 4 && argv[3][0] != '-') ? atoi(argv[3]) : 3;
+        if (iters < 1)
+            iters = 1;
+        return bench_parse(argv[2], iters) == 0 ? 0 : 3;
+    }
+    else if (strcmp(argv[1], "bench_import") == 0 && argc >= 3)
+    {
+        return bench_import(argv[2]) == 0 ? 0 : 3;
+    }
+    else if (strcmp(argv[1], "bench_commit") == 0 && argc >= 3)
+    {
+        uint32_t rows = (argc >= 4 && argv[3][0] != '-') ? (uint32_t)atoi(argv[3]) : 0;
+        return bench_commit(argv[2], rows) == 0 ? 0 : 3;
+    }
+    else if (strcmp(argv[1], "bench_recovery") == 0 && argc >= 4)
+    {
+        uint32_t rows = (argc >= 5 && argv[4][0] != '-') ? (uint32_t)atoi(argv[4]) : 0;
+        return bench_recovery(argv[2], argv[3], rows) == 0 ? 0 : 3;
+    }
+    else if (strcmp(argv[1], "bench_snapshot") == 0 && argc >= 3)
+    {
+        int readers = (argc >= 4 && argv[3][0] != '-') ? atoi(argv[3]) : 2;
+        return bench_snapshot(argv[2], readers) == 0 ? 0 : 3;
+    }
+    else if (strcmp(argv[1], "bench_serve") == 0 && argc >= 3)
+    {
+        int clients = (argc >= 4 && argv[3][0] != '-') ? atoi(argv[3]) : 4;
+        uint32_t requests = (argc >= 5 && argv[4][0] != '-') ? (uint32_t)atoi(argv[4]) : 0;
+        return bench_serve(argv[2], clients, requests) == 0 ? 0 : 3;
+    }
+    else if (strcmp(argv[1], "bench_olc") == 0)
+    {
+        uint32_t ops = (argc >= 3 && argv[2][0] != '-') ? (uint32_t)atoi(argv[2]) : 0;
+        int pcts[16] = {5, 50};
+        int n = 0;
+        for (int i = 3; i < argc && n < 16 && argv[i][0] != '-'; i++)
+            pcts[n++] = atoi(argv[i]);
+        if (n == 0)
+            n = 2;
+        return bench_olc(ops, pcts, n) == 0 ? 0 : 3;
+    }
+    else if (strcmp(argv[1], "gen") == 0 && argc >= 4)
+    {
+        uint64_t seed = (argc >= 5 && argv[4][0] != '-') ? strtoull(argv[4], NULL, 10) : 0;
+        return bench_gen_csv(argv[2], strtoull(argv[3], NULL, 10), seed) == 0 ? 0 : 3;
+    }
+    else if (strcmp(argv[1], "aggregate_bplus") == 0 && argc >= 3)
+    {
+        float lo = (float)atof(argv[2]);
+        float hi = INFINITY;
+        key_arg(argc, argv, 3, &hi);
+
+        BtreeFileManager btfm;
+        if (btfm_open(&btfm, "btree.db", NODE_SIZE) != 0)
+        {
+            fprintf(stderr, "open btree.db failed\n");
+            return 2;
+        }
+        RangeAggregate agg;
+        if (bptree_range_aggregate(&btfm, lo, 1, hi, 1, &agg) != 0)
+        {
+            fprintf(stderr, "aggregate failed\n");
+            btfm_close(&btfm);
+            return 3;
+        }
+        printf("Range [%.3f, %.3f]\n", lo, hi);
+        printf("  COUNT: %u\n", agg.count);
+        printf("  SUM:   %.6f\n", agg.sum);
+        if (agg.count > 0)
+            printf("  AVG:   %.6f\n", agg.sum / agg.count);
+        printf("  Index nodes accessed: %u\n", agg.nodes_accessed);
+        btfm_close(&btfm);
+        return 0;
+    }
+    else if (strcmp(argv[1], "rank_bplus") == 0 && argc >= 3)
+    {
+        float key = (float)atof(argv[2]);
+        BtreeFileManager btfm;
+        if (btfm_open(&btfm, "btree.db", NODE_SIZE) != 0)
+        {
+            fprintf(stderr, "open btree.db failed\n");
+            return 2;
+        }
+        uint32_t rank;
+        if (bptree_rank(&btfm, key, &rank) != 0)
+        {
+            fprintf(stderr, "rank failed\n");
+            btfm_close(&btfm);
+            return 3;
+        }
+        printf("Records with FT_PCT_home < %.3f: %u\n", key, rank);
+        btfm_close(&btfm);
+        return 0;
+    }
+    else if (strcmp(argv[1], "percentile_bplus") == 0 && argc >= 3)
+    {
+        double p = atof(argv[2]);
+        BtreeFileManager btfm;
+        if (btfm_open(&btfm, "btree.db", NODE_SIZE) != 0)
+        {
+            fprintf(stderr, "open btree.db failed\n");
+            return 2;
+        }
+        float key;
+        if (bptree_percentile(&btfm, p / 100.0, &key) != 0)
+        {
+            fprintf(stderr, "percentile failed\n");
+            btfm_close(&btfm);
+            return 3;
+        }
+        printf("P%.1f of FT_PCT_home: %.3f\n", p, key);
+        btfm_close(&btfm);
+        return 0;
+    }
     else
     {
         usage();
@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "cluster.h"
+#include "build_bplus.h"
+#include "parallel_scan.h"
+#include "cursor.h"
+#include "bench.h"
+
+// this file is for CLUSTER: an external merge sort of the heap on one column.
+
+// one sort entry: key, arrival number (keeps the sort stable), then the packed record
+typedef struct {
+    double   key;
+    uint64_t seq;
+} SortHead;
+
+static size_t entry_size(const Schema* s)
+{
+    return (sizeof(SortHead) + s->record_size + 7) & ~(size_t)7;
+}
+
+// NaN (a missing value) sorts after everything else
+static int head_cmp(const SortHead* x, const SortHead* y)
+{
+    int xn = isnan(x->key), yn = isnan(y->key);
+    if (xn != yn)
+        return xn - yn;
+    if (!xn && x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+static int entry_cmp(const void* a, const void* b)
+{
+    return head_cmp((const SortHead*)a, (const SortHead*)b);
+}
+
+static void run_path(char* out, size_t n, const char* db_path, uint32_t run)
+{
+    snprintf(out, n, "%s.run%u", db_path, run);
+}
+
+static int spill_run(const char* db_path, uint32_t run, const uint8_t* buf, size_t n, size_t esz)
+{
+    char path[600];
+    run_path(path, sizeof(path), db_path, run);
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create run file %s\n", path);
+        return -1;
+    }
+    size_t w = n ? fwrite(buf, esz, n, f) : 0;
+    int rc = (w != n || fclose(f) != 0) ? -1 : 0;
+    return rc;
+}
+
+// phase 1: read the heap into sorted runs. returns the number of runs, the
+// last (or only) run is left in buf
+static int make_runs(HeapFile* hf, int field, uint8_t* buf, size_t max_entries, size_t* n_last,
+                     const char* db_path, ClusterStats* st)
+{
+    const Schema* s = &hf->schema;
+    size_t esz = entry_size(s);
+    size_t n = 0;
+    uint32_t runs = 0;
+    uint16_t sel[SEL_MAX];
+    Row r;
+    for (uint32_t b = 0; b < hf->n_blocks; b++) {
+        Block* cur = bp_fetch(&hf->bp, b);
+        if (!cur)
+            return -1;
+        int k = block_live_slots(cur, s, sel);
+        for (int i = 0; i < k; i++) {
+            if (n == max_entries) {
+                qsort(buf, n, esz, entry_cmp);
+                if (spill_run(db_path, runs, buf, n, esz) != 0)
+                    return -1;
+                runs++;
+                n = 0;
+                // the block pointer may have been evicted while spilling
+                cur = bp_fetch(&hf->bp, b);
+                if (!cur)
+                    return -1;
+            }
+            uint8_t* e = buf + n * esz;
+            SortHead* h = (SortHead*)e;
+            if (block_get_record(cur, s, sel[i], e + sizeof(SortHead)) != 0)
+                return -1;
+            decode_row(s, e + sizeof(SortHead), &r);
+            h->key = row_field_value(s, &r, field);
+            h->seq = st->records++;
+            n++;
+        }
+    }
+    qsort(buf, n, esz, entry_cmp);
+    *n_last = n;
+    return (int)runs + 1;
+}
+
+// ---- k-way merge ----
+
+typedef struct {
+    FILE*    f;                 // NULL for the run kept in memory
+    uint8_t* mem;
+    size_t   mem_n, mem_pos;
+    uint8_t* cur;               // current entry
+} RunReader;
+
+static int run_next(RunReader* rr, size_t esz)
+{
+    if (!rr->f) {
+        if (rr->mem_pos >= rr->mem_n)
+            return 0;
+        rr->cur = rr->mem + rr->mem_pos++ * esz;
+        return 1;
+    }
+    return fread(rr->cur, esz, 1, rr->f) == 1;
+}
+
+static void heap_sift_down(RunReader** h, int n, int i)
+{
+    while (1) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && head_cmp((SortHead*)h[l]->cur, (SortHead*)h[m]->cur) < 0)
+            m = l;
+        if (r < n && head_cmp((SortHead*)h[r]->cur, (SortHead*)h[m]->cur) < 0)
+            m = r;
+        if (m == i)
+            return;
+        RunReader* t = h[i];
+        h[i] = h[m];
+        h[m] = t;
+        i = m;
+    }
+}
+
+static int merge_runs(HeapFile* out, const char* db_path, int n_runs, uint8_t* last, size_t n_last, size_t esz)
+{
+    RunReader* readers = calloc((size_t)n_runs, sizeof(RunReader));
+    RunReader** heap = calloc((size_t)n_runs, sizeof(RunReader*));
+    uint8_t* heads = malloc((size_t)n_runs * esz);
+    if (!readers || !heap || !heads) {
+        free(readers);
+        free(heap);
+        free(heads);
+        return -1;
+    }
+
+    int rc = 0, n = 0;
+    for (int i = 0; i < n_runs && rc == 0; i++) {
+        RunReader* rr = &readers[i];
+        if (i == n_runs - 1) {
+            rr->mem = last;
+            rr->mem_n = n_last;
+        } else {
+            char path[600];
+            run_path(path, sizeof(path), db_path, (uint32_t)i);
+            rr->f = fopen(path, "rb");
+            rr->cur = heads + (size_t)i * esz;
+            if (!rr->f) {
+                rc = -1;
+                break;
+            }
+        }
+        if (run_next(rr, esz))
+            heap[n++] = rr;
+    }
+    for (int i = n / 2 - 1; i >= 0; i--)
+        heap_sift_down(heap, n, i);
+
+    HfAppender ap;
+    if (rc == 0)
+        rc = hf_append_begin(out, &ap);
+    Row r;
+    while (rc == 0 && n > 0) {
+        RunReader* top = heap[0];
+        decode_row(&out->schema, top->cur + sizeof(SortHead), &r);
+        rc = hf_append_row(out, &ap, &r);
+        if (!run_next(top, esz))
+            heap[0] = heap[--n];
+        heap_sift_down(heap, n, 0);
+    }
+    if (rc == 0)
+        rc = hf_append_end(out, &ap);
+
+    for (int i = 0; i < n_runs; i++) {
+        if (readers[i].f)
+            fclose(readers[i].f);
+        if (i < n_runs - 1) {
+            char path[600];
+            run_path(path, sizeof(path), db_path, (uint32_t)i);
+            remove(path);
+        }
+    }
+    free(readers);
+    free(heap);
+    free(heads);
+    return rc;
+}
+
+static int replace_file(const char* from, const char* to, const char* suffix)
+{
+    char a[620], b[620];
+    snprintf(a, sizeof(a), "%s%s", from, suffix);
+    snprintf(b, sizeof(b), "%s%s", to, suffix);
+    return rename(a, b);
+}
+
+int hf_cluster(const char* db_path, int field, size_t mem_bytes, ClusterStats* st)
+{
+    memset(st, 0, sizeof(ClusterStats));
+    HeapFile hf;
+    if (hf_open(&hf, db_path, 64) != 0) {
+        fprintf(stderr, "Failed to open database file: %s\n", db_path);
+        return -1;
+    }
+    if (field < 0 || field >= hf.schema.n_fields) {
+        hf_close(&hf);
+        return -1;
+    }
+    st->blocks_before = hf.n_blocks;
+
+    size_t esz = entry_size(&hf.schema);
+    size_t max_entries = mem_bytes / esz;
+    if (max_entries < 1024)
+        max_entries = 1024;
+    uint8_t* buf = malloc(max_entries * esz);
+    if (!buf) {
+        hf_close(&hf);
+        return -1;
+    }
+
+    double t0 = bench_now_ms();
+    size_t n_last = 0;
+    int runs = make_runs(&hf, field, buf, max_entries, &n_last, db_path, st);
+    double t1 = bench_now_ms();
+    st->sort_ms = t1 - t0;
+    if (runs < 0) {
+        free(buf);
+        hf_close(&hf);
+        return -1;
+    }
+    st->runs = (uint32_t)runs;
+
+    // the sorted records go to a new file of the same layout
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.clustered", db_path);
+    HeapFile out;
+    if (hf_create(&out, tmp, &hf.schema, 64) != 0) {
+        free(buf);
+        hf_close(&hf);
+        return -1;
+    }
+    out.layout = hf.layout;
+    // a new version of the table: readers drop btree.db until it is rebuilt
+    out.generation = hf.generation + 1;
+    hf_close(&hf);
+
+    int rc = merge_runs(&out, db_path, runs, buf, n_last, esz);
+    free(buf);
+    st->blocks_after = out.n_blocks;
+    hf_close(&out);
+    if (rc != 0) {
+        remove(tmp);
+        return -1;
+    }
+    if (replace_file(tmp, db_path, "") != 0 || replace_file(tmp, db_path, ".zm") != 0 ||
+        replace_file(tmp, db_path, ".fsm") != 0) {
+        fprintf(stderr, "Failed to replace %s\n", db_path);
+        return -1;
+    }
+    // the log of the new file was emptied when it was closed
+    char tmp_wal[620];
+    snprintf(tmp_wal, sizeof(tmp_wal), "%s.wal", tmp);
+    remove(tmp_wal);
+    double t2 = bench_now_ms();
+    st->merge_ms = t2 - t1;
+
+    // every record moved, the index is built again from the new file
+    if (hf_open(&hf, db_path, 64) != 0)
+        return -1;
+    rc = scan_db(&hf);
+    hf_close(&hf);
+    st->index_ms = bench_now_ms() - t2;
+    return rc;
+}
+
+void cluster_print(const ClusterStats* st)
+{
+    printf("Cluster: %llu records, %u -> %u blocks\n",
+           (unsigned long long)st->records, st->blocks_before, st->blocks_after);
+    if (st->runs > 1)
+        printf("  sort  %10.3f ms  (%u sorted runs spilled)\n", st->sort_ms, st->runs);
+    else
+        printf("  sort  %10.3f ms  (in memory)\n", st->sort_ms);
+    printf("  merge %10.3f ms  (written to a new heap file)\n", st->merge_ms);
+    printf("  index %10.3f ms  (rebuilt)\n", st->index_ms);
+}
+
+int cluster_range_blocks(HeapFile* hf, const char* btree_filename, float lo,
+                         uint32_t* scan_blocks, uint32_t* index_blocks)
+{
+    *scan_blocks = *index_blocks = 0;
+    ParallelScanSpec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.range.lo = lo;
+    spec.range.hi = INFINITY;
+    spec.filter = 1;
+    ScanResult res;
+    if (pscan_run(hf, &spec, &res) != 0)
+        return -1;
+    *scan_blocks = res.blocks_read;
+
+    // distinct heap blocks behind the index entries of the range
+    uint8_t* seen = calloc(hf->n_blocks / 8 + 1, 1);
+    if (!seen)
+        return -1;
+    IndexCursor c;
+    if (idx_cursor_open(&c, btree_filename, &spec.range, 0) != 0) {
+        free(seen);
+        return -1;
+    }
+    RecordLocation loc;
+    while (idx_cursor_next(&c, &loc) == 1) {
+        if (loc.block_id >= hf->n_blocks || (seen[loc.block_id >> 3] >> (loc.block_id & 7)) & 1)
+            continue;
+        seen[loc.block_id >> 3] |= (uint8_t)(1u << (loc.block_id & 7));
+        (*index_blocks)++;
+    }
+    idx_cursor_close(&c);
+    free(seen);
+    return 0;
+}
@@ -0,0 +1,613 @@
+#include "compress.h"
+#include "scan_kernel.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// this file is for the compressed block format: building a block from staged
+// rows, reading single records back and the scan kernels over encoded columns.
+
+#define CBLOCK_MAX_DECIMALS 4
+
+static const double pow10_tab[CBLOCK_MAX_DECIMALS + 1] = { 1.0, 10.0, 100.0, 1000.0, 10000.0 };
+
+// one directory entry as stored in the block
+typedef struct {
+    int      enc;
+    int      bits;
+    int      decimals;
+    uint16_t off;        // start of the field's data inside the block
+    uint16_t n_dict;
+    int32_t  base;
+} CDir;
+
+static int bits_for(uint64_t x)
+{
+    int b = 0;
+    while (x) {
+        b++;
+        x >>= 1;
+    }
+    return b;
+}
+
+static int is_int_field(const Field* f)
+{
+    return (f->type == F_INT32 && f->width == 4) || (f->type == F_BOOL && f->width == 1);
+}
+
+static int is_float_field(const Field* f)
+{
+    return f->type == F_FLOAT && f->width == 4;
+}
+
+static int64_t raw_int(const Field* f, const uint8_t* p)
+{
+    if (f->width == 1)
+        return p[0];
+    int32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static float raw_float(const uint8_t* p)
+{
+    float v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// fewest decimal digits that give v back exactly, > CBLOCK_MAX_DECIMALS if none do
+static int float_decimals(float v)
+{
+    for (int d = 0; d <= CBLOCK_MAX_DECIMALS; d++) {
+        double x = (double)v * pow10_tab[d];
+        if (!(fabs(x) < 2147483647.0))
+            break;
+        long long k = llround(x);
+        if ((float)((double)k / pow10_tab[d]) == v)
+            return d;
+    }
+    return CBLOCK_MAX_DECIMALS + 1;
+}
+
+static float dec_value(int64_t k, int decimals)
+{
+    return (float)((double)k / pow10_tab[decimals]);
+}
+
+// ---- bit packing ----
+
+static inline uint32_t get_code(const uint8_t* codes, int bits, int i)
+{
+    if (bits == 0)
+        return 0;
+    size_t pos = (size_t)i * bits;
+    uint64_t w;
+    memcpy(&w, codes + (pos >> 3), 8);
+    return (uint32_t)((w >> (pos & 7)) & ((1ull << bits) - 1));
+}
+
+static void put_code(uint8_t* codes, int bits, int i, uint32_t code)
+{
+    if (bits == 0)
+        return;
+    size_t pos = (size_t)i * bits;
+    uint64_t w;
+    memcpy(&w, codes + (pos >> 3), 8);
+    w |= (uint64_t)code << (pos & 7);
+    memcpy(codes + (pos >> 3), &w, 8);
+}
+
+static size_t packed_bytes(int n, int bits)
+{
+    return ((size_t)n * bits + 7) / 8;
+}
+
+// ---- encoding choice ----
+
+// smallest exact encoding for a field with these statistics over n rows
+static size_t field_choice(const Field* fld, const CFieldStats* st, int n, int* enc, int* bits)
+{
+    size_t best = (size_t)n * fld->width;
+    *enc = CENC_PLAIN;
+    *bits = 0;
+    if (n == 0)
+        return 0;
+
+    if (is_int_field(fld)) {
+        int b = bits_for((uint64_t)(st->imax - st->imin));
+        size_t sz = packed_bytes(n, b);
+        if (b <= 32 && sz < best) {
+            best = sz;
+            *enc = CENC_FOR;
+            *bits = b;
+        }
+    } else if (is_float_field(fld) && st->decimals <= CBLOCK_MAX_DECIMALS) {
+        double p = pow10_tab[st->decimals];
+        if (fabs(st->fmin * p) < 2147483647.0 && fabs(st->fmax * p) < 2147483647.0) {
+            int b = bits_for((uint64_t)(llround(st->fmax * p) - llround(st->fmin * p)));
+            size_t sz = packed_bytes(n, b);
+            if (sz < best) {
+                best = sz;
+                *enc = CENC_DEC;
+                *bits = b;
+            }
+        }
+    }
+
+    if (st->dict_ok && st->n_dict > 0) {
+        int b = bits_for(st->n_dict - 1);
+        size_t sz = (size_t)st->n_dict * fld->width + packed_bytes(n, b);
+        if (sz < best) {
+            best = sz;
+            *enc = CENC_DICT;
+            *bits = b;
+        }
+    }
+    return best;
+}
+
+// statistics after adding one value, without touching the builder.
+// *dict_new is set when the value is not yet in the dictionary
+static void stats_with(const CFieldStats* st, const Field* fld, const uint8_t* val, int first,
+                       CFieldStats* out, int* dict_new)
+{
+    *out = *st;
+    *dict_new = 0;
+
+    if (is_int_field(fld)) {
+        int64_t v = raw_int(fld, val);
+        if (first || v < out->imin) out->imin = v;
+        if (first || v > out->imax) out->imax = v;
+    } else if (is_float_field(fld)) {
+        float v = raw_float(val);
+        if (first || v < out->fmin) out->fmin = v;
+        if (first || v > out->fmax) out->fmax = v;
+        int d = float_decimals(v);
+        if (d > out->decimals) out->decimals = d;
+    }
+
+    if (out->dict_ok) {
+        for (int j = 0; j < out->n_dict; j++)
+            if (memcmp(out->dict + (size_t)j * fld->width, val, fld->width) == 0)
+                return;
+        if (out->n_dict >= CBLOCK_DICT_MAX) {
+            out->dict_ok = 0;
+        } else {
+            out->n_dict++;
+            *dict_new = 1;
+        }
+    }
+}
+
+static void stats_reset(CFieldStats* st)
+{
+    st->imin = st->imax = 0;
+    st->fmin = st->fmax = 0.0;
+    st->decimals = 0;
+    st->n_dict = 0;
+    st->dict_ok = 1;
+}
+
+// ---- builder ----
+
+int cblock_builder_init(CBlockBuilder* cb, const Schema* s)
+{
+    memset(cb, 0, sizeof(CBlockBuilder));
+    cb->s = s;
+    cb->rows = malloc((size_t)CBLOCK_MAX_ROWS * s->record_size);
+    if (!cb->rows)
+        return -1;
+    for (int i = 0; i < s->n_fields; i++) {
+        stats_reset(&cb->f[i]);
+        cb->f[i].dict = malloc((size_t)CBLOCK_DICT_MAX * s->fields[i].width);
+        if (!cb->f[i].dict) {
+            cblock_builder_free(cb);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void cblock_builder_free(CBlockBuilder* cb)
+{
+    free(cb->rows);
+    cb->rows = NULL;
+    for (int i = 0; i < MAX_FIELDS; i++) {
+        free(cb->f[i].dict);
+        cb->f[i].dict = NULL;
+    }
+}
+
+int cblock_builder_add(CBlockBuilder* cb, const uint8_t* rec)
+{
+    const Schema* s = cb->s;
+    if (cb->n_rows >= CBLOCK_MAX_ROWS)
+        return 1;
+
+    CFieldStats next[MAX_FIELDS];
+    int dict_new[MAX_FIELDS];
+    size_t total = BLOCK_HDR_SIZE + (size_t)s->n_fields * CBLOCK_DIR_ENTRY + CBLOCK_SLACK
+                 + (size_t)(cb->n_rows + 1 + 7) / 8;
+    uint16_t off = 0;
+    for (int i = 0; i < s->n_fields; i++) {
+        int enc, bits;
+        stats_with(&cb->f[i], &s->fields[i], rec + off, cb->n_rows == 0, &next[i], &dict_new[i]);
+        total += field_choice(&s->fields[i], &next[i], cb->n_rows + 1, &enc, &bits);
+        off += s->fields[i].width;
+    }
+    if (total > BLOCK_SIZE)
+        return 1;
+
+    off = 0;
+    for (int i = 0; i < s->n_fields; i++) {
+        if (dict_new[i])
+            memcpy(next[i].dict + (size_t)(next[i].n_dict - 1) * s->fields[i].width, rec + off, s->fields[i].width);
+        cb->f[i] = next[i];
+        off += s->fields[i].width;
+    }
+    memcpy(cb->rows + (size_t)cb->n_rows * s->record_size, rec, s->record_size);
+    cb->n_rows++;
+    return 0;
+}
+
+static void write_dir(Block* b, int field, const CDir* d)
+{
+    uint8_t* p = b->bytes + BLOCK_HDR_SIZE + (size_t)field * CBLOCK_DIR_ENTRY;
+    p[0] = (uint8_t)d->enc;
+    p[1] = (uint8_t)d->bits;
+    p[2] = (uint8_t)d->decimals;
+    p[3] = 0;
+    memcpy(p + 4, &d->off, 2);
+    memcpy(p + 6, &d->n_dict, 2);
+    memcpy(p + 8, &d->base, 4);
+}
+
+static void read_dir(const Block* b, int field, CDir* d)
+{
+    const uint8_t* p = b->bytes + BLOCK_HDR_SIZE + (size_t)field * CBLOCK_DIR_ENTRY;
+    d->enc = p[0];
+    d->bits = p[1];
+    d->decimals = p[2];
+    memcpy(&d->off, p + 4, 2);
+    memcpy(&d->n_dict, p + 6, 2);
+    memcpy(&d->base, p + 8, 4);
+}
+
+void cblock_builder_finish(CBlockBuilder* cb, Block* out)
+{
+    const Schema* s = cb->s;
+    const int n = cb->n_rows;
+
+    block_init(out, BLOCK_FMT_PACKED);
+    block_set_used_count(out, (uint16_t)n);
+
+    // validity bitmap at the end of the block, every row starts live
+    block_set_flags(out, BLOCK_FLAG_VALIDITY);
+    for (int i = 0; i < n; i++)
+        block_mark_live(out, s, i);
+
+    size_t pos = BLOCK_HDR_SIZE + (size_t)s->n_fields * CBLOCK_DIR_ENTRY;
+    uint16_t foff = 0;
+    for (int f = 0; f < s->n_fields; f++) {
+        const Field* fld = &s->fields[f];
+        const CFieldStats* st = &cb->f[f];
+        const uint8_t* src = cb->rows + foff;
+        const size_t rs = s->record_size;
+        const uint16_t w = fld->width;
+
+        CDir d;
+        memset(&d, 0, sizeof(CDir));
+        size_t size = field_choice(fld, st, n, &d.enc, &d.bits);
+        d.off = (uint16_t)pos;
+        uint8_t* data = out->bytes + pos;
+
+        switch (d.enc) {
+        case CENC_FOR:
+            d.base = (int32_t)st->imin;
+            for (int i = 0; i < n; i++)
+                put_code(data, d.bits, i, (uint32_t)(raw_int(fld, src + i * rs) - st->imin));
+            break;
+        case CENC_DEC: {
+            d.decimals = st->decimals;
+            double p = pow10_tab[d.decimals];
+            long long kmin = llround(st->fmin * p);
+            d.base = (int32_t)kmin;
+            for (int i = 0; i < n; i++)
+                put_code(data, d.bits, i, (uint32_t)(llround((double)raw_float(src + i * rs) * p) - kmin));
+            break;
+        }
+        case CENC_DICT: {
+            d.n_dict = st->n_dict;
+            memcpy(data, st->dict, (size_t)st->n_dict * w);
+            uint8_t* codes = data + (size_t)st->n_dict * w;
+            for (int i = 0; i < n; i++) {
+                uint32_t code = 0;
+                while (code < st->n_dict && memcmp(st->dict + (size_t)code * w, src + i * rs, w) != 0)
+                    code++;
+                put_code(codes, d.bits, i, code);
+            }
+            break;
+        }
+        default:
+            for (int i = 0; i < n; i++)
+                memcpy(data + (size_t)i * w, src + i * rs, w);
+            break;
+        }
+        write_dir(out, f, &d);
+        pos += size;
+        foff += w;
+    }
+
+    cb->n_rows = 0;
+    for (int f = 0; f < s->n_fields; f++)
+        stats_reset(&cb->f[f]);
+}
+
+// ---- reading ----
+
+static const uint8_t* dir_codes(const Block* b, const Field* fld, const CDir* d)
+{
+    if (d->enc == CENC_DICT)
+        return b->bytes + d->off + (size_t)d->n_dict * fld->width;
+    return b->bytes + d->off;
+}
+
+// raw bytes of one field of one row
+static void field_value(const Block* b, const Field* fld, const CDir* d, int slot, uint8_t* dst)
+{
+    const uint8_t* data = b->bytes + d->off;
+    switch (d->enc) {
+    case CENC_FOR: {
+        int64_t v = (int64_t)d->base + get_code(data, d->bits, slot);
+        if (fld->width == 1) {
+            dst[0] = (uint8_t)v;
+        } else {
+            int32_t v32 = (int32_t)v;
+            memcpy(dst, &v32, 4);
+        }
+        break;
+    }
+    case CENC_DEC: {
+        float v = dec_value((int64_t)d->base + get_code(data, d->bits, slot), d->decimals);
+        memcpy(dst, &v, 4);
+        break;
+    }
+    case CENC_DICT:
+        memcpy(dst, data + (size_t)get_code(dir_codes(b, fld, d), d->bits, slot) * fld->width, fld->width);
+        break;
+    default:
+        memcpy(dst, data + (size_t)slot * fld->width, fld->width);
+        break;
+    }
+}
+
+int cblock_get_record(const Block* b, const Schema* s, int slot, uint8_t* out)
+{
+    if (slot < 0 || slot >= block_used_count(b))
+        return -1;
+    uint16_t roff = 0;
+    for (int f = 0; f < s->n_fields; f++) {
+        CDir d;
+        read_dir(b, f, &d);
+        field_value(b, &s->fields[f], &d, slot, out + roff);
+        roff += s->fields[f].width;
+    }
+    return 0;
+}
+
+int cblock_remove_record(Block* b, const Schema* s, int slot)
+{
+    int used = block_used_count(b);
+    if (slot < 0 || slot >= used)
+        return -1;
+
+    // re-encode the remaining rows, a subset always fits where the whole block did
+    CBlockBuilder cb;
+    if (cblock_builder_init(&cb, s) != 0)
+        return -1;
+    uint8_t recbuf[512];
+    uint8_t dead[CBLOCK_MAX_ROWS];
+    for (int i = 0; i < used; i++) {
+        if (i == slot)
+            continue;
+        dead[cb.n_rows] = !block_slot_live(b, s, i);
+        if (cblock_get_record(b, s, i, recbuf) != 0 || cblock_builder_add(&cb, recbuf) != 0) {
+            cblock_builder_free(&cb);
+            return -1;
+        }
+    }
+    int n = cb.n_rows;
+    cblock_builder_finish(&cb, b);
+    cblock_builder_free(&cb);
+
+    // slots that were already deleted stay deleted
+    for (int i = 0; i < n; i++)
+        if (dead[i])
+            block_kill_slot(b, s, i);
+    return 0;
+}
+
+int cblock_compact(Block* b, const Schema* s, int16_t* new_slot)
+{
+    int used = block_used_count(b);
+    CBlockBuilder cb;
+    if (cblock_builder_init(&cb, s) != 0)
+        return -1;
+    uint8_t recbuf[512];
+    for (int i = 0; i < used; i++) {
+        new_slot[i] = -1;
+        if (!block_slot_live(b, s, i))
+            continue;
+        new_slot[i] = (int16_t)cb.n_rows;
+        if (cblock_get_record(b, s, i, recbuf) != 0 || cblock_builder_add(&cb, recbuf) != 0) {
+            cblock_builder_free(&cb);
+            return -1;
+        }
+    }
+    int n = cb.n_rows;
+    if (n > 0)
+        cblock_builder_finish(&cb, b);
+    else
+        block_init(b, BLOCK_FMT_PACKED);
+    cblock_builder_free(&cb);
+    return n;
+}
+
+int cblock_field_encoding(const Block* b, int field)
+{
+    CDir d;
+    read_dir(b, field, &d);
+    return d.enc;
+}
+
+int cblock_plain_column(const Block* b, const Schema* s, int field, uint16_t* offset, uint16_t* stride)
+{
+    CDir d;
+    read_dir(b, field, &d);
+    if (d.enc != CENC_PLAIN)
+        return -1;
+    *offset = (uint16_t)(d.off - BLOCK_HDR_SIZE);
+    *stride = s->fields[field].width;
+    return 0;
+}
+
+// ---- scan kernels ----
+
+static uint32_t max_code(int bits)
+{
+    return (uint32_t)((1ull << bits) - 1);
+}
+
+int cblock_select_float(const Block* b, const Schema* s, int field, float lo, float hi, uint16_t* sel)
+{
+    const Field* fld = &s->fields[field];
+    const int n = block_used_count(b);
+    CDir d;
+    read_dir(b, field, &d);
+    const uint8_t* codes = dir_codes(b, fld, &d);
+    int k = 0;
+
+    if (d.enc == CENC_PLAIN)
+        return block_select_float(b, n, 4, (uint16_t)(d.off - BLOCK_HDR_SIZE), lo, hi, sel);
+
+    if (d.enc == CENC_DEC) {
+        // decoded values grow with the code, so the predicate is a code range
+        uint32_t top = max_code(d.bits);
+        uint64_t a = 0, z = (uint64_t)top + 1;
+        while (a < z) {
+            uint64_t m = (a + z) / 2;
+            if (dec_value((int64_t)d.base + (int64_t)m, d.decimals) >= lo) z = m; else a = m + 1;
+        }
+        uint64_t clo = a;
+        a = 0;
+        z = (uint64_t)top + 1;
+        while (a < z) {
+            uint64_t m = (a + z) / 2;
+            if (dec_value((int64_t)d.base + (int64_t)m, d.decimals) > hi) z = m; else a = m + 1;
+        }
+        if (a == 0 || clo > a - 1)
+            return 0;
+        uint32_t c_lo = (uint32_t)clo, c_hi = (uint32_t)(a - 1);
+        for (int i = 0; i < n; i++) {
+            uint32_t c = get_code(codes, d.bits, i);
+            sel[k] = (uint16_t)i;
+            k += (c >= c_lo) & (c <= c_hi);
+        }
+        return k;
+    }
+
+    if (d.enc == CENC_DICT) {
+        // evaluate the predicate once per distinct value
+        uint8_t pass[CBLOCK_DICT_MAX];
+        for (int j = 0; j < d.n_dict; j++) {
+            float v = raw_float(b->bytes + d.off + (size_t)j * 4);
+            pass[j] = (v >= lo) & (v <= hi);
+        }
+        for (int i = 0; i < n; i++) {
+            sel[k] = (uint16_t)i;
+            k += pass[get_code(codes, d.bits, i)];
+        }
+    }
+    return k;
+}
+
+int cblock_select_int32(const Block* b, const Schema* s, int field, int32_t lo, int32_t hi, uint16_t* sel)
+{
+    const Field* fld = &s->fields[field];
+    const int n = block_used_count(b);
+    CDir d;
+    read_dir(b, field, &d);
+    const uint8_t* codes = dir_codes(b, fld, &d);
+    int k = 0;
+
+    if (d.enc == CENC_PLAIN)
+        return block_select_int32(b, n, 4, (uint16_t)(d.off - BLOCK_HDR_SIZE), lo, hi, sel);
+
+    if (d.enc == CENC_FOR) {
+        int64_t clo = (int64_t)lo - d.base;
+        int64_t chi = (int64_t)hi - d.base;
+        if (clo < 0) clo = 0;
+        if (chi > (int64_t)max_code(d.bits)) chi = max_code(d.bits);
+        if (chi < clo)
+            return 0;
+        uint32_t c_lo = (uint32_t)clo, c_hi = (uint32_t)chi;
+        for (int i = 0; i < n; i++) {
+            uint32_t c = get_code(codes, d.bits, i);
+            sel[k] = (uint16_t)i;
+            k += (c >= c_lo) & (c <= c_hi);
+        }
+        return k;
+    }
+
+    if (d.enc == CENC_DICT) {
+        uint8_t pass[CBLOCK_DICT_MAX];
+        for (int j = 0; j < d.n_dict; j++) {
+            int32_t v = (int32_t)raw_int(fld, b->bytes + d.off + (size_t)j * fld->width);
+            pass[j] = (v >= lo) & (v <= hi);
+        }
+        for (int i = 0; i < n; i++) {
+            sel[k] = (uint16_t)i;
+            k += pass[get_code(codes, d.bits, i)];
+        }
+    }
+    return k;
+}
+
+double cblock_sum_float(const Block* b, const Schema* s, int field, const uint16_t* sel, int n)
+{
+    const Field* fld = &s->fields[field];
+    CDir d;
+    read_dir(b, field, &d);
+    const uint8_t* codes = dir_codes(b, fld, &d);
+    double sum = 0.0;
+
+    if (d.enc == CENC_PLAIN)
+        return block_sum_float(b, n, 4, (uint16_t)(d.off - BLOCK_HDR_SIZE), sel);
+
+    if (d.enc == CENC_DEC) {
+        for (int i = 0; i < n; i++) {
+            int slot = sel ? sel[i] : i;
+            sum += dec_value((int64_t)d.base + get_code(codes, d.bits, slot), d.decimals);
+        }
+    } else if (d.enc == CENC_DICT) {
+        float vals[CBLOCK_DICT_MAX];
+        for (int j = 0; j < d.n_dict; j++)
+            vals[j] = raw_float(b->bytes + d.off + (size_t)j * 4);
+        for (int i = 0; i < n; i++) {
+            int slot = sel ? sel[i] : i;
+            sum += vals[get_code(codes, d.bits, slot)];
+        }
+    }
+    return sum;
+}
+
+float cblock_value_float(const Block* b, const Schema* s, int field, int slot)
+{
+    CDir d;
+    read_dir(b, field, &d);
+    uint8_t v[4];
+    field_value(b, &s->fields[field], &d, slot, v);
+    return raw_float(v);
+}
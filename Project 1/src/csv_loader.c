@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "csv_loader.h"
+#include "csv_parse.h"
+#include "parallel_scan.h"
+#include "bench.h"
+
+// this file is for the parallel CSV loader: parser threads turn chunks of the
+// mapped input into rows, the calling thread appends them in file order.
+
+typedef struct {
+    const char* begin;
+    const char* end;
+    Row*        rows;
+    size_t      n_rows, cap;
+    uint64_t    skipped;
+    int         ready;          // parsed, waiting for the writer
+} CsvChunk;
+
+typedef struct {
+    const CsvIdx*   idx;
+    CsvChunk*       chunks;
+    uint32_t        n_chunks;
+    uint32_t        window;     // chunks that may be parsed ahead of the writer
+    pthread_mutex_t mu;
+    pthread_cond_t  parsed;     // a chunk became ready
+    pthread_cond_t  room;       // the writer finished a chunk
+    uint32_t        next;       // next chunk to hand to a parser
+    uint32_t        written;    // chunks the writer is done with
+    int             failed;
+} CsvShared;
+
+typedef struct {
+    CsvShared* sh;
+    double     parse_ms;
+} CsvWorker;
+
+static int parse_chunk(CsvShared* sh, CsvChunk* c)
+{
+    // about 40 bytes per line in games.txt-shaped files
+    size_t guess = (size_t)(c->end - c->begin) / 40 + 16;
+    c->rows = malloc(guess * sizeof(Row));
+    if (!c->rows)
+        return -1;
+    c->cap = guess;
+
+    CsvScan scan;
+    csv_scan_init(&scan, c->begin, c->end, 1);
+    while (1) {
+        if (c->n_rows == c->cap) {
+            size_t cap = c->cap * 2;
+            Row* tmp = realloc(c->rows, cap * sizeof(Row));
+            if (!tmp)
+                return -1;
+            c->rows = tmp;
+            c->cap = cap;
+        }
+        int rc = csv_scan_row(&scan, sh->idx, &c->rows[c->n_rows]);
+        if (rc < 0)
+            break;
+        if (rc == 1)
+            c->n_rows++;
+        else
+            c->skipped++;
+    }
+    return 0;
+}
+
+static void* csv_worker(void* arg)
+{
+    CsvWorker* w = (CsvWorker*)arg;
+    CsvShared* sh = w->sh;
+    while (1) {
+        pthread_mutex_lock(&sh->mu);
+        while (!sh->failed && sh->next < sh->n_chunks && sh->next >= sh->written + sh->window)
+            pthread_cond_wait(&sh->room, &sh->mu);
+        if (sh->failed || sh->next >= sh->n_chunks) {
+            pthread_mutex_unlock(&sh->mu);
+            break;
+        }
+        CsvChunk* c = &sh->chunks[sh->next++];
+        pthread_mutex_unlock(&sh->mu);
+
+        double t0 = bench_now_ms();
+        int rc = parse_chunk(sh, c);
+        w->parse_ms += bench_now_ms() - t0;
+
+        pthread_mutex_lock(&sh->mu);
+        if (rc != 0)
+            sh->failed = 1;
+        c->ready = 1;
+        pthread_cond_broadcast(&sh->parsed);
+        pthread_mutex_unlock(&sh->mu);
+    }
+    return NULL;
+}
+
+// chunk boundaries: every chunk ends right after a newline, or at the end of the file
+static CsvChunk* split_chunks(const char* p, const char* end, uint32_t* n_out)
+{
+    size_t cap = (size_t)(end - p) / CSV_CHUNK_BYTES + 2;
+    CsvChunk* chunks = calloc(cap, sizeof(CsvChunk));
+    if (!chunks)
+        return NULL;
+    uint32_t n = 0;
+    while (p < end) {
+        const char* stop = end;
+        if ((size_t)(end - p) > CSV_CHUNK_BYTES) {
+            const char* nl = memchr(p + CSV_CHUNK_BYTES, '\n', (size_t)(end - p - CSV_CHUNK_BYTES));
+            stop = nl ? nl + 1 : end;
+        }
+        chunks[n].begin = p;
+        chunks[n].end = stop;
+        n++;
+        p = stop;
+    }
+    *n_out = n;
+    return chunks;
+}
+
+int hf_load_csv_parallel(HeapFile* hf, const char* csv_path, int threads, CsvLoadStats* st)
+{
+    memset(st, 0, sizeof(CsvLoadStats));
+    double t_start = bench_now_ms();
+
+    int fd = open(csv_path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    st->bytes = (uint64_t)sb.st_size;
+    const char* data = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s\n", csv_path);
+        return -1;
+    }
+    const char* end = data + sb.st_size;
+    madvise((void*)data, (size_t)sb.st_size, MADV_SEQUENTIAL);
+
+    // header line
+    const char* nl = memchr(data, '\n', (size_t)sb.st_size);
+    const char* body = nl ? nl + 1 : end;
+    char line[8192];
+    size_t hl = (size_t)(body - data) < sizeof(line) - 1 ? (size_t)(body - data) : sizeof(line) - 1;
+    memcpy(line, data, hl);
+    line[hl] = '\0';
+    CsvIdx idx;
+    if (parse_header_map(line, &idx) != 0) {
+        munmap((void*)data, (size_t)sb.st_size);
+        fprintf(stderr, "Header does not contain required columns.\n");
+        return -1;
+    }
+
+    CsvShared sh;
+    memset(&sh, 0, sizeof(sh));
+    sh.idx = &idx;
+    sh.chunks = split_chunks(body, end, &sh.n_chunks);
+    if (!sh.chunks) {
+        munmap((void*)data, (size_t)sb.st_size);
+        return -1;
+    }
+    if (threads <= 0)
+        threads = pscan_default_threads();
+    if ((uint32_t)threads > sh.n_chunks)
+        threads = sh.n_chunks > 0 ? (int)sh.n_chunks : 1;
+    sh.window = (uint32_t)threads * CSV_WINDOW_PER_THREAD;
+    pthread_mutex_init(&sh.mu, NULL);
+    pthread_cond_init(&sh.parsed, NULL);
+    pthread_cond_init(&sh.room, NULL);
+    st->chunks = sh.n_chunks;
+
+    CsvWorker* workers = calloc((size_t)threads, sizeof(CsvWorker));
+    pthread_t* tids = calloc((size_t)threads, sizeof(pthread_t));
+    HfAppender ap;
+    int rc = (workers && tids) ? hf_append_begin(hf, &ap) : -1;
+    int appending = rc == 0;
+    if (appending) {
+        st->first_block = ap.first_block;
+        st->first_slot = (uint16_t)ap.first_slot;
+    }
+
+    int started = 0;
+    if (rc == 0) {
+        for (; started < threads; started++) {
+            workers[started].sh = &sh;
+            if (pthread_create(&tids[started], NULL, csv_worker, &workers[started]) != 0)
+                break;
+        }
+        if (started == 0)
+            rc = -1;
+    }
+    st->threads = started;
+
+    // the writer: chunks in file order, rows in line order
+    for (uint32_t i = 0; rc == 0 && i < sh.n_chunks; i++) {
+        CsvChunk* c = &sh.chunks[i];
+        pthread_mutex_lock(&sh.mu);
+        while (!c->ready && !sh.failed)
+            pthread_cond_wait(&sh.parsed, &sh.mu);
+        if (sh.failed)
+            rc = -1;
+        pthread_mutex_unlock(&sh.mu);
+        if (rc != 0)
+            break;
+
+        double t0 = bench_now_ms();
+        for (size_t r = 0; r < c->n_rows && rc == 0; r++)
+            rc = hf_append_row(hf, &ap, &c->rows[r]);
+        st->write_ms += bench_now_ms() - t0;
+        st->rows += c->n_rows;
+        st->skipped += c->skipped;
+        free(c->rows);
+        c->rows = NULL;
+
+        pthread_mutex_lock(&sh.mu);
+        sh.written++;
+        pthread_cond_broadcast(&sh.room);
+        pthread_mutex_unlock(&sh.mu);
+    }
+
+    // a failed writer releases the parsers that wait for room
+    pthread_mutex_lock(&sh.mu);
+    if (rc != 0)
+        sh.failed = 1;
+    pthread_cond_broadcast(&sh.room);
+    pthread_mutex_unlock(&sh.mu);
+    for (int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+        st->parse_ms += workers[i].parse_ms;
+    }
+
+    if (appending) {
+        double t0 = bench_now_ms();
+        if (hf_append_end(hf, &ap) != 0)
+            rc = -1;
+        st->write_ms += bench_now_ms() - t0;
+    }
+
+    for (uint32_t i = 0; i < sh.n_chunks; i++)
+        free(sh.chunks[i].rows);
+    free(sh.chunks);
+    free(workers);
+    free(tids);
+    pthread_cond_destroy(&sh.parsed);
+    pthread_cond_destroy(&sh.room);
+    pthread_mutex_destroy(&sh.mu);
+    munmap((void*)data, (size_t)sb.st_size);
+    st->total_ms = bench_now_ms() - t_start;
+    return rc;
+}
+
+void csv_load_print(const CsvLoadStats* st)
+{
+    double secs = st->total_ms / 1000.0;
+    printf("Loaded %llu rows (%llu lines skipped) from %.1f MB in %.3f ms: %.1f MB/s, %.2f M rows/s\n",
+           (unsigned long long)st->rows, (unsigned long long)st->skipped, st->bytes / 1e6, st->total_ms,
+           secs > 0 ? st->bytes / 1e6 / secs : 0.0, secs > 0 ? st->rows / 1e6 / secs : 0.0);
+    printf("  %d parser threads, %u chunks, parse %.3f ms (all threads), write %.3f ms\n",
+           st->threads, st->chunks, st->parse_ms, st->write_ms);
+}
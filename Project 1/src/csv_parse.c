@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <string.h>
+#include "csv_parse.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// this file is for the zero-copy CSV parser used by the loader.
+// separators are found 64 bytes at a time as a bitmask, cells are trimmed and
+// parsed where they lie in the input buffer.
+
+// ---- separator bitmasks ----
+
+// bit i set = p[i] is ',', '\t' or '\n', for the first n bytes
+static uint64_t sep_mask_scalar(const char *p, size_t n)
+{
+    uint64_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        char c = p[i];
+        m |= (uint64_t)((c == ',') | (c == '\t') | (c == '\n')) << i;
+    }
+    return m;
+}
+
+// the same for a full 64-byte window
+static uint64_t sep_mask64(const char *p)
+{
+#if defined(__AVX2__)
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i nl = _mm256_set1_epi8('\n');
+    uint64_t m = 0;
+    for (int h = 0; h < 2; h++) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + 32 * h));
+        __m256i eq = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, comma), _mm256_cmpeq_epi8(v, tab)),
+                                     _mm256_cmpeq_epi8(v, nl));
+        m |= (uint64_t)(uint32_t)_mm256_movemask_epi8(eq) << (32 * h);
+    }
+    return m;
+#elif defined(__SSE2__)
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i nl = _mm_set1_epi8('\n');
+    uint64_t m = 0;
+    for (int q = 0; q < 4; q++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * q));
+        __m128i eq = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, comma), _mm_cmpeq_epi8(v, tab)),
+                                  _mm_cmpeq_epi8(v, nl));
+        m |= (uint64_t)(uint16_t)_mm_movemask_epi8(eq) << (16 * q);
+    }
+    return m;
+#else
+    return sep_mask_scalar(p, 64);
+#endif
+}
+
+const char *csv_scan_kernel(void)
+{
+#if defined(__AVX2__)
+    return "AVX2";
+#elif defined(__SSE2__)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+static void load_window(CsvScan *s)
+{
+    size_t left = (size_t)(s->end - s->base);
+    if (left >= 64)
+        s->mask = s->simd ? sep_mask64(s->base) : sep_mask_scalar(s->base, 64);
+    else
+        s->mask = sep_mask_scalar(s->base, left);   // never read past the end
+}
+
+void csv_scan_init(CsvScan *s, const char *begin, const char *end, int simd)
+{
+    s->pos = begin;
+    s->end = end;
+    s->base = begin;
+    s->simd = simd;
+    s->idx = NULL;
+    load_window(s);
+}
+
+// first separator at or after from, or end
+static const char *next_sep(CsvScan *s, const char *from)
+{
+    while (1) {
+        size_t skip = from > s->base ? (size_t)(from - s->base) : 0;
+        if (skip < 64) {
+            uint64_t m = s->mask & (~0ULL << skip);
+            if (m)
+                return s->base + __builtin_ctzll(m);
+        }
+        if (s->end - s->base <= 64)
+            return s->end;
+        s->base += 64;
+        load_window(s);
+    }
+}
+
+// ---- cells and numbers ----
+
+typedef struct {
+    const char *p;
+    size_t len;
+} Cell;
+
+// trimmed and unquoted like parse_row_by_index does it
+static Cell cell_trim(const char *p, size_t len)
+{
+    while (len && (*p == ' ' || *p == '\t'))
+        p++, len--;
+    while (len && (p[len - 1] == ' ' || p[len - 1] == '\t' || p[len - 1] == '\r' || p[len - 1] == '\n'))
+        len--;
+    if (len >= 2 && (*p == '"' || *p == '\'') && p[len - 1] == *p)
+        p++, len -= 2;
+    Cell c = {p, len};
+    return c;
+}
+
+// atoi on a cell that is not NUL-terminated
+static int32_t cell_int(Cell c)
+{
+    size_t i = 0;
+    while (i < c.len && (c.p[i] == ' ' || c.p[i] == '\t'))
+        i++;
+    int neg = 0;
+    if (i < c.len && (c.p[i] == '-' || c.p[i] == '+'))
+        neg = c.p[i++] == '-';
+    int64_t v = 0;
+    while (i < c.len && (unsigned)(c.p[i] - '0') < 10 && v < ((int64_t)1 << 40))
+        v = v * 10 + (c.p[i++] - '0');
+    return (int32_t)(neg ? -v : v);
+}
+
+// atof on a cell. a plain decimal ("0.812") is m / 10^k, which is the correctly
+// rounded double just like strtod gives; anything else goes through strtod on a copy
+static double cell_float(Cell c)
+{
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+                                   1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+    size_t i = 0;
+    int neg = 0;
+    if (i < c.len && (c.p[i] == '-' || c.p[i] == '+'))
+        neg = c.p[i++] == '-';
+    uint64_t m = 0;
+    int digits = 0, frac = -1;
+    for (; i < c.len; i++) {
+        unsigned d = (unsigned)(c.p[i] - '0');
+        if (d < 10) {
+            m = m * 10 + d;
+            digits++;
+            frac += frac >= 0;
+        } else if (c.p[i] == '.' && frac < 0) {
+            frac = 0;
+        } else {
+            break;
+        }
+    }
+    if (i == c.len && digits > 0 && digits <= 15 && frac <= 15) {
+        double v = frac > 0 ? (double)m / pow10[frac] : (double)m;
+        return neg ? -v : v;
+    }
+    char tmp[64];
+    size_t n = c.len < sizeof(tmp) - 1 ? c.len : sizeof(tmp) - 1;
+    memcpy(tmp, c.p, n);
+    tmp[n] = '\0';
+    return atof(tmp);
+}
+
+// only blanks that parse_row_by_index strips off the end of a line
+static int blank_tail(const char *p, const char *e)
+{
+    for (; p < e; p++)
+        if (*p != ' ' && *p != '\r')
+            return 0;
+    return 1;
+}
+
+// ---- rows ----
+
+// column number -> position in the Row fields we fill, -1 for unused columns
+static void map_columns(CsvScan *s, const CsvIdx *id)
+{
+    const int idx[6] = {id->i_GAME_ID, id->i_GAME_DATE_EST, id->i_HOME_TEAM_ID,
+                        id->i_VISITOR_TEAM_ID, id->i_FT_PCT_home, id->i_HOME_TEAM_WINS};
+    memset(s->slot_of, -1, sizeof(s->slot_of));
+    s->want = 0;
+    for (int k = 0; k < 6; k++) {
+        if (idx[k] < 0 || idx[k] >= CSV_SCAN_MAX_COLS)
+            continue;
+        s->slot_of[idx[k]] = (int8_t)k;
+        if (idx[k] > s->want)
+            s->want = idx[k];
+    }
+    s->idx = id;
+}
+
+int csv_scan_row(CsvScan *s, const CsvIdx *id, Row *out)
+{
+    if (s->pos >= s->end)
+        return -1;
+    if (s->idx != id)
+        map_columns(s, id);
+
+    Cell cells[6];
+    int found[6] = {0, 0, 0, 0, 0, 0};
+
+    // strtok semantics: runs of separators count as one, so empty cells do not
+    // take a column number
+    const char *p = s->pos;
+    int n = 0;
+    while (1) {
+        const char *d = next_sep(s, p);
+        int eol = d == s->end || *d == '\n';
+        if (d > p && n <= s->want) {
+            Cell c = cell_trim(p, (size_t)(d - p));
+            // blanks at the end of the line are stripped before tokenizing
+            if (!(eol && c.len == 0 && blank_tail(p, d))) {
+                int k = s->slot_of[n];
+                if (k >= 0) {
+                    cells[k] = c;
+                    found[k] = 1;
+                }
+                n++;
+            }
+        }
+        if (eol) {
+            s->pos = d < s->end ? d + 1 : d;
+            break;
+        }
+        p = d + 1;
+    }
+
+    if (!found[1] || !found[2] || !found[4] || !found[5])
+        return 0;
+
+    out->game_id = found[0] ? cell_int(cells[0]) : 0;
+    size_t dl = cells[1].len < 10 ? cells[1].len : 10;
+    memcpy(out->game_date, cells[1].p, dl);
+    memset(out->game_date + dl, 0, sizeof(out->game_date) - dl);
+    out->home_team_id = cell_int(cells[2]);
+    out->visitor_team_id = found[3] ? cell_int(cells[3]) : 0;
+    out->ft_pct_home = (float)cell_float(cells[4]);
+    out->home_team_wins = (uint8_t)cell_int(cells[5]);
+    return 1;
+}
+
+int parse_row_span(const char *line, size_t len, const CsvIdx *idx, Row *out)
+{
+    if (!line || !idx || !out)
+        return -1;
+    CsvScan s;
+    csv_scan_init(&s, line, line + len, 1);
+    return csv_scan_row(&s, idx, out) == 1 ? 0 : -1;
+}
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "cursor.h"
+
+// this file is for the streaming open/next/close cursors over the index and the heap.
+// rows are produced one at a time so memory stays at one page per cursor, the first
+// row comes back after a single descent, and a LIMIT stops the scan early.
+
+int key_in_range(const KeyRange *r, float key)
+{
+    if (r->lo_inclusive ? (key < r->lo) : (key <= r->lo))
+        return 0;
+    if (r->hi_inclusive ? (key > r->hi) : (key >= r->hi))
+        return 0;
+    return 1;
+}
+
+// key is past the upper end of the range, nothing further right can qualify
+static int key_above_range(const KeyRange *r, float key)
+{
+    return r->hi_inclusive ? (key > r->hi) : (key >= r->hi);
+}
+
+// key is below the lower end of the range, nothing further left can qualify
+static int key_below_range(const KeyRange *r, float key)
+{
+    return r->lo_inclusive ? (key < r->lo) : (key <= r->lo);
+}
+
+// ---- index cursor ----
+
+// opens the index file (or takes the open one, fm) and reads the meta page,
+// shared by both directions
+static int idx_cursor_start(IndexCursor *c, const char *btree_filename, BtreeFileManager *fm,
+                            const KeyRange *range, uint64_t limit, BtreeMeta *meta)
+{
+    memset(c, 0, sizeof(IndexCursor));
+    c->range = *range;
+    c->limit = limit;
+
+    if (fm) {
+        c->fm = *fm;
+        c->borrowed = 1;
+    } else if (btfm_open(&c->fm, btree_filename, NODE_SIZE) != 0) {
+        fprintf(stderr, "Failed to open B+ tree file: %s\n", btree_filename);
+        return -1;
+    }
+    if (btfm_read_meta(&c->fm, meta) != 0) {
+        fprintf(stderr, "ERROR: Could not find the root in B+ tree file\n");
+        idx_cursor_close(c);
+        return -1;
+    }
+    if (meta->root_id == BTREE_NO_NODE)
+        c->done = 1;
+    return 0;
+}
+
+// descends from the root to a leaf. child i is the number of separators that
+// are below the bound (or not above it when take_equal is set)
+static int idx_cursor_descend(IndexCursor *c, uint32_t root_id, float bound, int take_equal)
+{
+    uint32_t node_id = root_id;
+    while (1) {
+        if (btfm_read_node(&c->fm, node_id, &c->leaf) != 0) {
+            fprintf(stderr, "Failed to read node %u\n", node_id);
+            return -1;
+        }
+        if (c->leaf.level == 1) {
+            c->leaf_nodes_accessed++;
+            return 0;
+        }
+        c->index_nodes_accessed++;
+
+        int i = 0;
+        while (i < c->leaf.key_count) {
+            float k = int_get_key(&c->leaf, i);
+            if (take_equal ? (k > bound) : (k >= bound))
+                break;
+            i++;
+        }
+        node_id = int_get_child(&c->leaf, i);
+    }
+}
+
+static int idx_cursor_forward(IndexCursor *c, const char *btree_filename, BtreeFileManager *fm,
+                              const KeyRange *range, uint64_t limit)
+{
+    BtreeMeta meta;
+    if (idx_cursor_start(c, btree_filename, fm, range, limit, &meta) != 0)
+        return -1;
+    if (c->done)
+        return 0;
+
+    // descend to the leftmost leaf that can hold a key in the range
+    if (idx_cursor_descend(c, meta.root_id, range->lo, !range->lo_inclusive) != 0) {
+        idx_cursor_close(c);
+        return -1;
+    }
+    c->pos = 0;
+    return 0;
+}
+
+static int idx_cursor_backward(IndexCursor *c, const char *btree_filename, BtreeFileManager *fm,
+                               const KeyRange *range, uint64_t limit)
+{
+    BtreeMeta meta;
+    if (idx_cursor_start(c, btree_filename, fm, range, limit, &meta) != 0)
+        return -1;
+    c->reverse = 1;
+    if (c->done)
+        return 0;
+
+    // with no upper bound the scan starts straight at the tail of the leaf chain,
+    // otherwise descend to the rightmost leaf that can hold a key <= hi
+    int rc;
+    if (isinf(range->hi) && range->hi > 0) {
+        rc = btfm_read_node(&c->fm, meta.last_leaf, &c->leaf);
+        if (rc == 0)
+            c->leaf_nodes_accessed++;
+    } else {
+        rc = idx_cursor_descend(c, meta.root_id, range->hi, range->hi_inclusive);
+    }
+    if (rc != 0) {
+        idx_cursor_close(c);
+        return -1;
+    }
+    c->pos = c->leaf.key_count - 1;
+    return 0;
+}
+
+int idx_cursor_open(IndexCursor *c, const char *btree_filename, const KeyRange *range, uint64_t limit)
+{
+    return idx_cursor_forward(c, btree_filename, NULL, range, limit);
+}
+
+int idx_cursor_open_reverse(IndexCursor *c, const char *btree_filename, const KeyRange *range, uint64_t limit)
+{
+    return idx_cursor_backward(c, btree_filename, NULL, range, limit);
+}
+
+int idx_cursor_open_on(IndexCursor *c, BtreeFileManager *fm, const KeyRange *range, uint64_t limit, int reverse)
+{
+    return reverse ? idx_cursor_backward(c, NULL, fm, range, limit) : idx_cursor_forward(c, NULL, fm, range, limit);
+}
+
+// descending counterpart of idx_cursor_next
+static int idx_cursor_prev(IndexCursor *c, RecordLocation *out)
+{
+    while (!c->done) {
+        if (c->limit > 0 && c->returned >= c->limit) {
+            c->done = 1;
+            break;
+        }
+
+        if (c->pos < 0) {
+            // move to the previous leaf in the chain
+            uint32_t prev_id = leaf_get_prev(&c->leaf);
+            if (prev_id == BTREE_NO_NODE || prev_id == c->leaf.node_id) {
+                c->done = 1;
+                break;
+            }
+            if (btfm_read_node(&c->fm, prev_id, &c->leaf) != 0) {
+                fprintf(stderr, "Failed to read leaf node %u\n", prev_id);
+                return -1;
+            }
+            c->leaf_nodes_accessed++;
+            c->pos = c->leaf.key_count - 1;
+            continue;
+        }
+
+        float key = leaf_get_key(&c->leaf, c->pos);
+        if (key_below_range(&c->range, key)) {
+            c->done = 1;
+            break;
+        }
+        if (!key_in_range(&c->range, key)) {
+            c->pos--;
+            continue;
+        }
+
+        leaf_get_record(&c->leaf, c->pos, &out->block_id, &out->slot_id);
+        out->key_value = key;
+        c->pos--;
+        c->returned++;
+        return 1;
+    }
+    return 0;
+}
+
+int idx_cursor_next(IndexCursor *c, RecordLocation *out)
+{
+    if (c->reverse)
+        return idx_cursor_prev(c, out);
+
+    while (!c->done) {
+        if (c->limit > 0 && c->returned >= c->limit) {
+            c->done = 1;
+            break;
+        }
+
+        if (c->pos >= c->leaf.key_count) {
+            // move to the next leaf in the chain
+            uint32_t next_id = leaf_get_next(&c->leaf);
+            if (next_id == BTREE_NO_NODE || next_id == c->leaf.node_id) {
+                c->done = 1;
+                break;
+            }
+            if (btfm_read_node(&c->fm, next_id, &c->leaf) != 0) {
+                fprintf(stderr, "Failed to read leaf node %u\n", next_id);
+                return -1;
+            }
+            c->leaf_nodes_accessed++;
+            c->pos = 0;
+            continue;
+        }
+
+        float key = leaf_get_key(&c->leaf, c->pos);
+        if (key_above_range(&c->range, key)) {
+            c->done = 1;
+            break;
+        }
+        if (!key_in_range(&c->range, key)) {
+            c->pos++;
+            continue;
+        }
+
+        leaf_get_record(&c->leaf, c->pos, &out->block_id, &out->slot_id);
+        out->key_value = key;
+        c->pos++;
+        c->returned++;
+        return 1;
+    }
+    return 0;
+}
+
+void idx_cursor_close(IndexCursor *c)
+{
+    // a borrowed file belongs to whoever opened it
+    if (c->fm.fp && !c->borrowed)
+        btfm_close(&c->fm);
+    c->fm.fp = NULL;
+    c->done = 1;
+}
+
+// ---- heap cursor ----
+
+int heap_cursor_open(HeapCursor *c, HeapFile *hf, const KeyRange *range, uint64_t limit)
+{
+    memset(c, 0, sizeof(HeapCursor));
+    c->hf = hf;
+    c->range = *range;
+    c->limit = limit;
+    c->block_id = UINT32_MAX;   // nothing loaded yet
+    kernel_float_bounds(range->lo, range->lo_inclusive, range->hi, range->hi_inclusive, &c->klo, &c->khi);
+    return 0;
+}
+
+int heap_cursor_next(HeapCursor *c, RecordLocation *loc, Row *row)
+{
+    uint8_t recbuf[512];
+
+    while (!c->done) {
+        if (c->limit > 0 && c->returned >= c->limit) {
+            c->done = 1;
+            break;
+        }
+
+        if (c->block_id == UINT32_MAX || c->sel_pos >= c->n_sel) {
+            uint32_t next = (c->block_id == UINT32_MAX) ? 0 : c->block_id + 1;
+            while (next < c->hf->n_blocks &&
+                   !zm_block_may_match(&c->hf->zm, next, FLD_FT_PCT_HOME,
+                                       c->range.lo, c->range.lo_inclusive,
+                                       c->range.hi, c->range.hi_inclusive)) {
+                c->blocks_pruned++;
+                next++;
+            }
+            if (next >= c->hf->n_blocks) {
+                c->done = 1;
+                break;
+            }
+            Block *cur = bp_fetch(&c->hf->bp, next);
+            if (!cur) {
+                fprintf(stderr, "Failed to fetch block %u\n", next);
+                return -1;
+            }
+            memcpy(&c->blk, cur, sizeof(Block));
+            c->blocks_accessed++;
+            c->block_id = next;
+
+            // filter the whole block on the key column
+            c->n_sel = block_filter_float(&c->blk, &c->hf->schema, FLD_FT_PCT_HOME, c->klo, c->khi, c->sel);
+            c->sel_pos = 0;
+            continue;
+        }
+
+        int s = c->sel[c->sel_pos++];
+        if (row) {
+            if (block_get_record(&c->blk, &c->hf->schema, s, recbuf) != 0)
+                continue;
+            decode_row(&c->hf->schema, recbuf, row);
+        }
+        if (loc) {
+            loc->block_id = c->block_id;
+            loc->slot_id = (uint16_t)s;
+            loc->key_value = block_value_float(&c->blk, &c->hf->schema, FLD_FT_PCT_HOME, s);
+        }
+        c->returned++;
+        return 1;
+    }
+    return 0;
+}
+
+void heap_cursor_close(HeapCursor *c)
+{
+    c->done = 1;
+}
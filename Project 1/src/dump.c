@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dump.h"
+#include "scan_kernel.h"
+#include "bench.h"
+
+// this file is for export/import: binary columnar dumps and CSV export.
+
+#define DUMP_IO_BUF (1u << 20)
+
+typedef struct {
+    const Schema* s;
+    uint16_t      off[MAX_FIELDS];  // field offsets inside a record
+    uint8_t*      col[MAX_FIELDS];  // DUMP_CHUNK_ROWS values per field
+    uint32_t      n;                // rows in the chunk
+} DumpChunk;
+
+static int chunk_init(DumpChunk* c, const Schema* s)
+{
+    memset(c, 0, sizeof(DumpChunk));
+    c->s = s;
+    for (int f = 0; f < s->n_fields; f++) {
+        c->off[f] = schema_field_offset(s, f);
+        c->col[f] = malloc((size_t)DUMP_CHUNK_ROWS * s->fields[f].width);
+        if (!c->col[f])
+            return -1;
+    }
+    return 0;
+}
+
+static void chunk_free(DumpChunk* c)
+{
+    for (int f = 0; f < MAX_FIELDS; f++)
+        free(c->col[f]);
+}
+
+static int put_u16(FILE* f, uint16_t v)
+{
+    uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+    return fwrite(b, 1, 2, f) == 2 ? 0 : -1;
+}
+
+static int put_u32(FILE* f, uint32_t v)
+{
+    uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    return fwrite(b, 1, 4, f) == 4 ? 0 : -1;
+}
+
+static int get_u16(FILE* f, uint16_t* v)
+{
+    uint8_t b[2];
+    if (fread(b, 1, 2, f) != 2)
+        return -1;
+    *v = (uint16_t)(b[0] | (b[1] << 8));
+    return 0;
+}
+
+static int get_u32(FILE* f, uint32_t* v)
+{
+    uint8_t b[4];
+    if (fread(b, 1, 4, f) != 4)
+        return -1;
+    *v = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    return 0;
+}
+
+// ---- binary export ----
+
+static int write_schema(FILE* f, const Schema* s)
+{
+    if (fwrite(DUMP_MAGIC, 1, 4, f) != 4 || put_u16(f, DUMP_VERSION) || put_u16(f, s->n_fields) ||
+        put_u16(f, s->record_size) || put_u16(f, 0))
+        return -1;
+    for (int i = 0; i < s->n_fields; i++) {
+        char name[MAX_NAME];
+        memset(name, 0, sizeof(name));
+        strncpy(name, s->fields[i].name, MAX_NAME - 1);
+        uint8_t tp[2] = {(uint8_t)s->fields[i].type, 0};
+        if (fwrite(name, 1, MAX_NAME, f) != MAX_NAME || fwrite(tp, 1, 2, f) != 2 || put_u16(f, s->fields[i].width))
+            return -1;
+    }
+    return 0;
+}
+
+static int write_chunk(FILE* f, DumpChunk* c, DumpStats* st)
+{
+    if (put_u32(f, c->n))
+        return -1;
+    for (int i = 0; i < c->s->n_fields; i++) {
+        size_t len = (size_t)c->n * c->s->fields[i].width;
+        if (fwrite(c->col[i], 1, len, f) != len)
+            return -1;
+    }
+    st->rows += c->n;
+    st->chunks++;
+    c->n = 0;
+    return 0;
+}
+
+// calls emit for every live record of hf in heap order. the blocks are read
+// straight from the file, like the parallel scan, so the buffer pool is left alone
+typedef int (*RecordFn)(void* arg, const uint8_t* rec);
+
+static int for_each_record(HeapFile* hf, RecordFn emit, void* arg)
+{
+    const Schema* s = &hf->schema;
+    bp_flush_all(&hf->bp);
+    Block blk;
+    uint16_t sel[SEL_MAX];
+    uint8_t rec[BLOCK_SIZE];
+    for (uint32_t b = 0; b < hf->n_blocks; b++) {
+        if (fm_read_block(&hf->fm, b, &blk) != 0) {
+            fprintf(stderr, "Failed to read block %u\n", b);
+            return -1;
+        }
+        int n = block_live_slots(&blk, s, sel);
+        for (int i = 0; i < n; i++) {
+            if (block_get_record(&blk, s, sel[i], rec) != 0 || emit(arg, rec) != 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    FILE*      f;
+    DumpChunk  c;
+    DumpStats* st;
+} BinWriter;
+
+static int emit_bin(void* arg, const uint8_t* rec)
+{
+    BinWriter* w = (BinWriter*)arg;
+    DumpChunk* c = &w->c;
+    for (int i = 0; i < c->s->n_fields; i++) {
+        uint16_t wd = c->s->fields[i].width;
+        memcpy(c->col[i] + (size_t)c->n * wd, rec + c->off[i], wd);
+    }
+    if (++c->n == DUMP_CHUNK_ROWS)
+        return write_chunk(w->f, c, w->st);
+    return 0;
+}
+
+int hf_export_bin(HeapFile* hf, const char* path, DumpStats* st)
+{
+    memset(st, 0, sizeof(DumpStats));
+    double t0 = bench_now_ms();
+    BinWriter w;
+    w.st = st;
+    w.f = fopen(path, "wb");
+    if (!w.f) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return -1;
+    }
+    setvbuf(w.f, NULL, _IOFBF, DUMP_IO_BUF);
+
+    int rc = chunk_init(&w.c, &hf->schema);
+    if (rc == 0)
+        rc = write_schema(w.f, &hf->schema);
+    if (rc == 0)
+        rc = for_each_record(hf, emit_bin, &w);
+    if (rc == 0 && w.c.n > 0)
+        rc = write_chunk(w.f, &w.c, st);
+    if (rc == 0 && put_u32(w.f, 0) == 0) {
+        uint8_t total[8];
+        for (int i = 0; i < 8; i++)
+            total[i] = (uint8_t)(st->rows >> (8 * i));
+        rc = fwrite(total, 1, 8, w.f) == 8 ? 0 : -1;
+    } else {
+        rc = -1;
+    }
+    long size = ftell(w.f);
+    if (fclose(w.f) != 0)
+        rc = -1;
+    chunk_free(&w.c);
+    if (rc != 0) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return -1;
+    }
+    st->bytes = size > 0 ? (uint64_t)size : 0;
+    st->ms = bench_now_ms() - t0;
+    return 0;
+}
+
+// ---- CSV export ----
+
+typedef struct {
+    FILE*         f;
+    const Schema* s;
+    uint16_t      off[MAX_FIELDS];
+    DumpStats*    st;
+} CsvWriter;
+
+// shortest %g form that reads back as the same float. six digits already give
+// the short decimals of the data ("0.926"), %g drops the trailing zeros
+static int put_float(char* dst, float v)
+{
+    int n = 0;
+    for (int prec = 6; prec <= 9; prec++) {
+        n = snprintf(dst, 32, "%.*g", prec, (double)v);
+        if (strtof(dst, NULL) == v)
+            break;
+    }
+    return n;
+}
+
+static int put_int(char* dst, int32_t v)
+{
+    char tmp[12];
+    int n = 0, len = 0;
+    uint32_t u = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        dst[len++] = '-';
+    while (n)
+        dst[len++] = tmp[--n];
+    return len;
+}
+
+static int emit_csv(void* arg, const uint8_t* rec)
+{
+    CsvWriter* w = (CsvWriter*)arg;
+    char line[MAX_FIELDS * 40];
+    int len = 0;
+    for (int i = 0; i < w->s->n_fields; i++) {
+        const Field* fd = &w->s->fields[i];
+        const uint8_t* p = rec + w->off[i];
+        if (i > 0)
+            line[len++] = '\t';
+        if (fd->type == F_INT32) {
+            int32_t v;
+            memcpy(&v, p, 4);
+            len += put_int(line + len, v);
+        } else if (fd->type == F_FLOAT) {
+            float v;
+            memcpy(&v, p, 4);
+            len += put_float(line + len, v);
+        } else if (fd->type == F_BOOL) {
+            len += put_int(line + len, p[0]);
+        } else {
+            size_t n = fd->width < 32 ? fd->width : 32;
+            while (n > 0 && (p[n - 1] == '\0' || p[n - 1] == ' '))
+                n--;
+            memcpy(line + len, p, n);
+            len += (int)n;
+        }
+    }
+    line[len++] = '\n';
+    w->st->rows++;
+    return fwrite(line, 1, (size_t)len, w->f) == (size_t)len ? 0 : -1;
+}
+
+int hf_export_csv(HeapFile* hf, const char* path, DumpStats* st)
+{
+    memset(st, 0, sizeof(DumpStats));
+    double t0 = bench_now_ms();
+    CsvWriter w;
+    w.s = &hf->schema;
+    w.st = st;
+    for (int i = 0; i < w.s->n_fields; i++)
+        w.off[i] = schema_field_offset(w.s, i);
+    w.f = fopen(path, "w");
+    if (!w.f) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return -1;
+    }
+    setvbuf(w.f, NULL, _IOFBF, DUMP_IO_BUF);
+
+    // the field names are the column names load looks for
+    for (int i = 0; i < w.s->n_fields; i++)
+        fprintf(w.f, "%s%s", i > 0 ? "\t" : "", w.s->fields[i].name);
+    fputc('\n', w.f);
+
+    int rc = for_each_record(hf, emit_csv, &w);
+    long size = ftell(w.f);
+    if (fclose(w.f) != 0)
+        rc = -1;
+    if (rc != 0) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return -1;
+    }
+    st->bytes = size > 0 ? (uint64_t)size : 0;
+    st->ms = bench_now_ms() - t0;
+    return 0;
+}
+
+// ---- binary import ----
+
+// the dump has to describe the same records as the table: same fields in the
+// same order, with the same types and widths
+static int read_schema(FILE* f, const Schema* s)
+{
+    char magic[4];
+    uint16_t version, n_fields, record_size, pad;
+    if (fread(magic, 1, 4, f) != 4 || memcmp(magic, DUMP_MAGIC, 4) != 0) {
+        fprintf(stderr, "Not a dump file (bad magic)\n");
+        return -1;
+    }
+    if (get_u16(f, &version) || get_u16(f, &n_fields) || get_u16(f, &record_size) || get_u16(f, &pad))
+        return -1;
+    if (version != DUMP_VERSION) {
+        fprintf(stderr, "Unsupported dump version %u\n", version);
+        return -1;
+    }
+    if (n_fields != s->n_fields || record_size != s->record_size) {
+        fprintf(stderr, "Dump schema does not match the table (%u fields, %u bytes per record)\n", n_fields,
+                record_size);
+        return -1;
+    }
+    for (int i = 0; i < n_fields; i++) {
+        char name[MAX_NAME];
+        uint8_t tp[2];
+        uint16_t width;
+        if (fread(name, 1, MAX_NAME, f) != MAX_NAME || fread(tp, 1, 2, f) != 2 || get_u16(f, &width))
+            return -1;
+        name[MAX_NAME - 1] = '\0';
+        if (strcmp(name, s->fields[i].name) != 0 || tp[0] != (uint8_t)s->fields[i].type ||
+            width != s->fields[i].width) {
+            fprintf(stderr, "Dump field %d (%s) does not match the table field %s\n", i, name,
+                    s->fields[i].name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int hf_import_bin(HeapFile* hf, const char* path, DumpStats* st)
+{
+    memset(st, 0, sizeof(DumpStats));
+    double t0 = bench_now_ms();
+    const Schema* s = &hf->schema;
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return -1;
+    }
+    setvbuf(f, NULL, _IOFBF, DUMP_IO_BUF);
+    if (read_schema(f, s) != 0) {
+        fclose(f);
+        return -1;
+    }
+
+    DumpChunk c;
+    HfAppender ap;
+    int rc = chunk_init(&c, s);
+    int appending = rc == 0 && hf_append_begin(hf, &ap) == 0;
+    if (appending) {
+        st->first_block = ap.first_block;
+        st->first_slot = (uint16_t)ap.first_slot;
+    } else {
+        rc = -1;
+    }
+
+    uint8_t rec[BLOCK_SIZE];
+    while (rc == 0) {
+        if (get_u32(f, &c.n) != 0 || c.n > DUMP_CHUNK_ROWS) {
+            fprintf(stderr, "Truncated or corrupt dump after %llu rows\n", (unsigned long long)st->rows);
+            rc = -1;
+            break;
+        }
+        if (c.n == 0)
+            break;
+        for (int i = 0; i < s->n_fields && rc == 0; i++) {
+            size_t len = (size_t)c.n * s->fields[i].width;
+            if (fread(c.col[i], 1, len, f) != len) {
+                fprintf(stderr, "Truncated dump in chunk %u\n", st->chunks);
+                rc = -1;
+            }
+        }
+        // columns back into records, one memcpy per value
+        for (uint32_t r = 0; r < c.n && rc == 0; r++) {
+            for (int i = 0; i < s->n_fields; i++) {
+                uint16_t wd = s->fields[i].width;
+                memcpy(rec + c.off[i], c.col[i] + (size_t)r * wd, wd);
+            }
+            rc = hf_append_record(hf, &ap, rec);
+        }
+        if (rc == 0) {
+            st->rows += c.n;
+            st->chunks++;
+        }
+    }
+
+    if (rc == 0) {
+        uint8_t total[8];
+        uint64_t rows = 0;
+        if (fread(total, 1, 8, f) == 8)
+            for (int i = 0; i < 8; i++)
+                rows |= (uint64_t)total[i] << (8 * i);
+        if (rows != st->rows) {
+            fprintf(stderr, "Dump ends with a row count of %llu, read %llu\n", (unsigned long long)rows,
+                    (unsigned long long)st->rows);
+            rc = -1;
+        }
+    }
+    long size = ftell(f);
+    // rows appended before an error stay in the table, like a failed load
+    if (appending && hf_append_end(hf, &ap) != 0)
+        rc = -1;
+    chunk_free(&c);
+    fclose(f);
+    st->bytes = size > 0 ? (uint64_t)size : 0;
+    st->ms = bench_now_ms() - t0;
+    return rc;
+}
+
+void dump_print(const char* what, const DumpStats* st)
+{
+    double secs = st->ms / 1000.0;
+    printf("%s %llu rows, %.1f MB in %.3f ms: %.1f MB/s, %.2f M rows/s\n", what, (unsigned long long)st->rows,
+           st->bytes / 1e6, st->ms, secs > 0 ? st->bytes / 1e6 / secs : 0.0,
+           secs > 0 ? st->rows / 1e6 / secs : 0.0);
+}
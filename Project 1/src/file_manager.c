@@ -1,11 +1,19 @@
 #include "file_manager.h"
 #include <string.h>
+#include <unistd.h>
 
 int fm_open(FileManager* fm, const char* path, const char* mode){
     fm->fp = fopen(path, mode);
     fm->path = path;
     fm->data_reads = fm->data_writes = 0;
-    return fm->fp?0:-1;
+    fm->base = 0;
+    fm->lazy = 0;
+    if(!fm->fp) return -1;
+    // a file that starts with a header page keeps block 0 on the second page
+    char magic[4];
+    if(mode[0]=='r' && fread(magic, 1, 4, fm->fp)==4 && memcmp(magic, FM_HEADER_MAGIC, 4)==0)
+        fm->base = 1;
+    return 0;
 }
 void fm_close(FileManager* fm){
     if(fm->fp) fclose(fm->fp);
@@ -14,7 +22,7 @@ void fm_close(FileManager* fm){
 
 int fm_read_block(FileManager* fm, uint32_t block_id, Block* out){
     if(!fm->fp) return -1;
-    size_t off = (size_t)block_id * BLOCK_SIZE;
+    size_t off = ((size_t)block_id + fm->base) * BLOCK_SIZE;
     if(fseek(fm->fp, (long)off, SEEK_SET)!=0) return -1;
     size_t n = fread(out->bytes, 1, BLOCK_SIZE, fm->fp);
     if(n!=BLOCK_SIZE) return -1;
@@ -24,22 +32,70 @@ int fm_read_block(FileManager* fm, uint32_t block_id, Block* out){
 
 int fm_write_block(FileManager* fm, uint32_t block_id, const Block* in){
     if(!fm->fp) return -1;
-    size_t off = (size_t)block_id * BLOCK_SIZE;
+    size_t off = ((size_t)block_id + fm->base) * BLOCK_SIZE;
     if(fseek(fm->fp, (long)off, SEEK_SET)!=0) return -1;
     size_t n = fwrite(in->bytes, 1, BLOCK_SIZE, fm->fp);
     if(n!=BLOCK_SIZE) return -1;
-    fflush(fm->fp);
+    if(!fm->lazy) fflush(fm->fp);
     fm->data_writes++;
     return 0;
 }
 
+int fm_write_blocks(FileManager* fm, uint32_t first, uint32_t n, const Block* in){
+    if(!fm->fp) return -1;
+    if(n==0) return 0;
+    size_t off = ((size_t)first + fm->base) * BLOCK_SIZE;
+    if(fseek(fm->fp, (long)off, SEEK_SET)!=0) return -1;
+    size_t w = fwrite(in, BLOCK_SIZE, n, fm->fp);
+    if(w!=n) return -1;
+    fflush(fm->fp);
+    fm->data_writes += n;
+    return 0;
+}
+
 uint32_t fm_alloc_block(FileManager* fm, Block* zeroed){
     memset(zeroed->bytes, 0, BLOCK_SIZE);
     // append at end
     if(fseek(fm->fp, 0, SEEK_END)!=0) return (uint32_t)-1;
     long pos = ftell(fm->fp);
-    uint32_t new_id = (uint32_t)(pos / BLOCK_SIZE);
+    uint32_t new_id = (uint32_t)(pos / BLOCK_SIZE) - fm->base;
     fwrite(zeroed->bytes, 1, BLOCK_SIZE, fm->fp);
     fflush(fm->fp);
     return new_id;
 }
+
+int fm_truncate(FileManager* fm, uint32_t n_blocks){
+    if(!fm->fp) return -1;
+    if(fflush(fm->fp)!=0) return -1;
+    return ftruncate(fileno(fm->fp), ((off_t)n_blocks + fm->base) * BLOCK_SIZE) == 0 ? 0 : -1;
+}
+
+int fm_sync(FileManager* fm){
+    if(!fm->fp || fflush(fm->fp)!=0) return -1;
+    return fsync(fileno(fm->fp))==0 ? 0 : -1;
+}
+
+uint32_t fm_block_count(FileManager* fm){
+    if(!fm->fp || fseek(fm->fp, 0, SEEK_END)!=0) return 0;
+    long pages = ftell(fm->fp) / BLOCK_SIZE;
+    return pages > (long)fm->base ? (uint32_t)(pages - fm->base) : 0;
+}
+
+int fm_read_header(FileManager* fm, Block* out){
+    if(!fm->fp || !fm->base) return -1;
+    if(fseek(fm->fp, 0, SEEK_SET)!=0) return -1;
+    return fread(out->bytes, 1, BLOCK_SIZE, fm->fp)==BLOCK_SIZE ? 0 : -1;
+}
+
+int fm_write_header(FileManager* fm, const Block* in){
+    if(!fm->fp) return -1;
+    // only a new (empty) file can get a header page, older files keep block 0 first
+    if(!fm->base){
+        if(fseek(fm->fp, 0, SEEK_END)!=0 || ftell(fm->fp)!=0) return -1;
+        fm->base = 1;
+    }
+    if(fseek(fm->fp, 0, SEEK_SET)!=0) return -1;
+    if(fwrite(in->bytes, 1, BLOCK_SIZE, fm->fp)!=BLOCK_SIZE) return -1;
+    fflush(fm->fp);
+    return 0;
+}
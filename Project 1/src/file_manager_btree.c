@@ -5,6 +5,8 @@
 #include <errno.h>
 
 #include "file_manager_btree.h"
+#include "wal.h"
+#include <unistd.h>
 
 #if defined(_WIN32)
   #define FTELL  _ftelli64
@@ -46,22 +48,173 @@ int btfm_open(BtreeFileManager *fm, const char *path, size_t page_size) {
     }
     fm->fp = fp;
     fm->page_size = page_size;
+    fm->wal = NULL;
+    fm->cache = NULL;
+    fm->cache_n = 0;
     return 0;
 }
 
 int btfm_close(BtreeFileManager *fm) {
     if (!fm || !fm->fp) return -1;
+    int rc0 = 0;
+    if (fm->wal) {
+        rc0 = btfm_writeback(fm);
+        if (fm->wal->index == fm) fm->wal->index = NULL;
+        for (uint32_t i = 0; i < BTFM_CACHE_SLOTS; i++) free(fm->cache[i].page);
+        free(fm->cache);
+        fm->cache = NULL;
+        fm->wal = NULL;
+    }
     int rc = fflush(fm->fp);
     int rc2 = fclose(fm->fp);
     fm->fp = NULL;
-    return (rc == 0 && rc2 == 0) ? 0 : -1;
+    return (rc0 == 0 && rc == 0 && rc2 == 0) ? 0 : -1;
 }
 
 int btfm_sync(BtreeFileManager *fm) {
     if (!fm || !fm->fp) return -1;
+    if (fm->wal) return btfm_writeback(fm);
     return fflush(fm->fp) == 0 ? 0 : -1;
 }
 
+// --- write-back cache for logged pages ---
+static BtfmCached *cache_slot(BtreeFileManager *fm, uint32_t node_id) {
+    uint32_t h = (node_id * 2654435761u) & (BTFM_CACHE_SLOTS - 1);
+    while (fm->cache[h].node_id != BTREE_NO_NODE && fm->cache[h].node_id != node_id)
+        h = (h + 1) & (BTFM_CACHE_SLOTS - 1);
+    return &fm->cache[h];
+}
+
+int btfm_use_wal(BtreeFileManager *fm, struct Wal *wal) {
+    if (!fm || !fm->fp || !wal) return -1;
+    fm->cache = (BtfmCached *)calloc(BTFM_CACHE_SLOTS, sizeof(BtfmCached));
+    if (!fm->cache) return -1;
+    for (uint32_t i = 0; i < BTFM_CACHE_SLOTS; i++) fm->cache[i].node_id = BTREE_NO_NODE;
+    fm->cache_n = 0;
+    fm->wal = wal;
+    wal->index = fm;
+    return 0;
+}
+
+int btfm_writeback(BtreeFileManager *fm) {
+    if (!fm || !fm->fp) return -1;
+    if (!fm->wal) return fflush(fm->fp) == 0 ? 0 : -1;
+    // the records of every cached page are in the log before any page is written
+    if (fm->cache_n > 0 && wal_force(fm->wal, UINT64_MAX) != 0) return -1;
+    int rc = 0;
+    for (uint32_t i = 0; i < BTFM_CACHE_SLOTS && fm->cache_n > 0; i++) {
+        BtfmCached *c = &fm->cache[i];
+        if (c->node_id == BTREE_NO_NODE) continue;
+        if (btfm_seek_page(fm, c->node_id) != 0 || fwrite(c->page, 1, fm->page_size, fm->fp) != fm->page_size)
+            rc = -1;
+        c->node_id = BTREE_NO_NODE;
+        fm->cache_n--;
+    }
+    if (fflush(fm->fp) != 0 || fsync(fileno(fm->fp)) != 0) rc = -1;
+    return rc;
+}
+
+int btfm_writeback_older(BtreeFileManager *fm, uint64_t lsn, uint32_t *written) {
+    *written = 0;
+    if (!fm || !fm->fp || !fm->wal) return -1;
+    if (fm->cache_n == 0) return 0;
+    if (wal_force(fm->wal, UINT64_MAX) != 0) return -1;
+    // the pages that stay are put back into a fresh table, so no probe chain breaks
+    BtfmCached *keep = (BtfmCached *)malloc(fm->cache_n * sizeof(BtfmCached));
+    if (!keep) return -1;
+    uint32_t n_keep = 0;
+    int rc = 0;
+    for (uint32_t i = 0; i < BTFM_CACHE_SLOTS; i++) {
+        BtfmCached *c = &fm->cache[i];
+        if (c->node_id == BTREE_NO_NODE) continue;
+        if (c->rec_lsn < lsn) {
+            if (btfm_seek_page(fm, c->node_id) != 0 || fwrite(c->page, 1, fm->page_size, fm->fp) != fm->page_size)
+                rc = -1;
+            (*written)++;
+        } else {
+            keep[n_keep++] = *c;
+            c->page = NULL;
+        }
+        c->node_id = BTREE_NO_NODE;
+    }
+    fm->cache_n = 0;
+    for (uint32_t i = 0; i < n_keep; i++) {
+        BtfmCached *c = cache_slot(fm, keep[i].node_id);
+        free(c->page);
+        *c = keep[i];
+        fm->cache_n++;
+    }
+    free(keep);
+    if (fflush(fm->fp) != 0 || fsync(fileno(fm->fp)) != 0) rc = -1;
+    return rc;
+}
+
+uint32_t btfm_dirty_table(BtreeFileManager *fm, struct WalDirty *out) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; fm->cache && i < BTFM_CACHE_SLOTS; i++) {
+        if (fm->cache[i].node_id == BTREE_NO_NODE) continue;
+        out[n].file = WAL_FILE_INDEX;
+        out[n].page = fm->cache[i].node_id;
+        out[n].rec_lsn = fm->cache[i].rec_lsn;
+        n++;
+    }
+    return n;
+}
+
+// the current contents of a page: cached, in the file, or zeroes past its end
+static int btfm_page_image(BtreeFileManager *fm, uint32_t node_id, uint8_t *out) {
+    if (fm->cache) {
+        BtfmCached *c = cache_slot(fm, node_id);
+        if (c->node_id == node_id) {
+            memcpy(out, c->page, fm->page_size);
+            return 0;
+        }
+    }
+    memset(out, 0, fm->page_size);
+    if (btfm_seek_page(fm, node_id) != 0) return -1;
+    size_t rd = fread(out, 1, fm->page_size, fm->fp);
+    (void)rd;
+    clearerr(fm->fp);
+    return 0;
+}
+
+// logs the change of one page in the active transaction and keeps the new image
+static int btfm_log_page(BtreeFileManager *fm, uint32_t node_id, const uint8_t *page) {
+    if (!fm->wal->active) {
+        fprintf(stderr, "B+ tree write outside a transaction\n");
+        return -1;
+    }
+    uint8_t *old = (uint8_t *)malloc(fm->page_size);
+    if (!old) return -1;
+    uint64_t lsn = 0;
+    int rc = btfm_page_image(fm, node_id, old);
+    if (rc == 0)
+        rc = wal_log_update(fm->wal, fm->wal->active, WAL_FILE_INDEX, node_id, old, page, fm->page_size, &lsn, NULL);
+    free(old);
+    if (rc != 0) return -1;
+
+    BtfmCached *c = cache_slot(fm, node_id);
+    if (c->node_id != node_id) {
+        if (!c->page && !(c->page = (uint8_t *)malloc(fm->page_size))) return -1;
+        c->node_id = node_id;
+        c->rec_lsn = lsn;
+        fm->cache_n++;
+    }
+    if (c->rec_lsn == 0) c->rec_lsn = lsn;
+    memcpy(c->page, page, fm->page_size);
+    // the table stays sparse enough for short probes
+    if (fm->cache_n >= BTFM_CACHE_SLOTS * 3 / 4) return btfm_writeback(fm);
+    return 0;
+}
+
+int btfm_page_count(BtreeFileManager *fm, uint32_t *out_pages) {
+    if (!fm || !fm->fp || !out_pages) return -1;
+    file_off_t sz = btfm_file_size_bytes(fm->fp);
+    if (sz < 0) return -2;
+    *out_pages = (uint32_t)((size_t)sz / fm->page_size);
+    return 0;
+}
+
 int btfm_alloc_node(BtreeFileManager *fm, uint32_t *out_node_id) {
     if (!fm || !fm->fp || !out_node_id) return -1;
 
@@ -98,6 +251,11 @@ int btfm_write_node(BtreeFileManager *fm, const Node *n) {
         free(buf);
         return -3;
     }
+    if (fm->wal) {
+        int rc = btfm_log_page(fm, n->node_id, buf);
+        free(buf);
+        return rc == 0 ? 0 : -5;
+    }
 
     if (btfm_seek_page(fm, n->node_id) != 0) {
         free(buf);
@@ -113,6 +271,11 @@ int btfm_write_node(BtreeFileManager *fm, const Node *n) {
 int btfm_read_node(BtreeFileManager *fm, uint32_t node_id, Node *out) {
     if (!fm || !fm->fp || !out) return -1;
 
+    if (fm->cache) {
+        BtfmCached *c = cache_slot(fm, node_id);
+        if (c->node_id == node_id) return decode_node(c->page, out) == 0 ? 0 : -7;
+    }
+
     file_off_t sz = btfm_file_size_bytes(fm->fp);
     if (sz < 0) return -2;
 
@@ -136,4 +299,40 @@ int btfm_read_node(BtreeFileManager *fm, uint32_t node_id, Node *out) {
     if (rc != 0) return -7;
 
     return 0;
-}
\ No newline at end of file
+}
+
+// the meta page is stored as a node with level 0 so node scans never mistake it for a leaf
+int btfm_read_meta(BtreeFileManager *fm, BtreeMeta *out) {
+    if (!fm || !fm->fp || !out) return -1;
+
+    Node n;
+    if (btfm_read_node(fm, BTREE_META_NODE_ID, &n) != 0) return -1;
+    if (n.level != BTREE_META_LEVEL || memcmp(n.bytes, "BPTM", 4) != 0) return -1;
+
+    const uint8_t *p = n.bytes + 4;
+    memcpy(&out->root_id, p, 4);    p += 4;
+    memcpy(&out->first_leaf, p, 4); p += 4;
+    memcpy(&out->last_leaf, p, 4);  p += 4;
+    memcpy(&out->node_count, p, 4); p += 4;
+    memcpy(&out->leaf_count, p, 4); p += 4;
+    out->height = *p;               p += 4;
+    memcpy(&out->generation, p, 8);
+    return 0;
+}
+
+int btfm_write_meta(BtreeFileManager *fm, const BtreeMeta *meta) {
+    if (!fm || !fm->fp || !meta) return -1;
+
+    Node n;
+    node_init(&n, BTREE_META_LEVEL, BTREE_META_NODE_ID);
+    uint8_t *p = n.bytes;
+    memcpy(p, "BPTM", 4);            p += 4;
+    memcpy(p, &meta->root_id, 4);    p += 4;
+    memcpy(p, &meta->first_leaf, 4); p += 4;
+    memcpy(p, &meta->last_leaf, 4);  p += 4;
+    memcpy(p, &meta->node_count, 4); p += 4;
+    memcpy(p, &meta->leaf_count, 4); p += 4;
+    *p = meta->height;               p += 4;
+    memcpy(p, &meta->generation, 8);
+    return btfm_write_node(fm, &n);
+}
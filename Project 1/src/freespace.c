@@ -0,0 +1,151 @@
+#include "freespace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// this file is for the free-space map of the heap file.
+// like the zone map it is held in memory while the heap is open and written
+// back on close; the bucket lists are never stored, they are rebuilt on load.
+
+static int bucket_of(int free_slots){
+    int k = 0;
+    while (free_slots > 0 && k < FSM_BUCKETS - 1) {
+        free_slots >>= 1;
+        k++;
+    }
+    return k;
+}
+
+static void fsm_reset(FreeSpaceMap* fsm, const char* db_path){
+    memset(fsm, 0, sizeof(FreeSpaceMap));
+    snprintf(fsm->path, sizeof(fsm->path), "%s.fsm", db_path);
+    for (int k = 0; k < FSM_BUCKETS; k++) fsm->head[k] = FSM_NONE;
+}
+
+int fsm_init(FreeSpaceMap* fsm, const char* db_path){
+    fsm_reset(fsm, db_path);
+    fsm->valid = 1;
+    fsm->dirty = 1;
+    return 0;
+}
+
+void fsm_free(FreeSpaceMap* fsm){
+    free(fsm->free);
+    free(fsm->next);
+    free(fsm->prev);
+    fsm->free = NULL;
+    fsm->next = fsm->prev = NULL;
+    fsm->n_blocks = fsm->capacity = 0;
+    fsm->valid = 0;
+}
+
+static int fsm_reserve(FreeSpaceMap* fsm, uint32_t n){
+    if (n <= fsm->capacity) return 0;
+    uint32_t cap = fsm->capacity ? fsm->capacity : 64;
+    while (cap < n) cap *= 2;
+    uint8_t* f = realloc(fsm->free, cap);
+    if (!f) return -1;
+    fsm->free = f;
+    uint32_t* nx = realloc(fsm->next, (size_t)cap * sizeof(uint32_t));
+    if (!nx) return -1;
+    fsm->next = nx;
+    uint32_t* pv = realloc(fsm->prev, (size_t)cap * sizeof(uint32_t));
+    if (!pv) return -1;
+    fsm->prev = pv;
+    fsm->capacity = cap;
+    return 0;
+}
+
+static void unlink_block(FreeSpaceMap* fsm, uint32_t b){
+    int k = bucket_of(fsm->free[b]);
+    if (k == 0) return;
+    if (fsm->prev[b] != FSM_NONE) fsm->next[fsm->prev[b]] = fsm->next[b];
+    else fsm->head[k] = fsm->next[b];
+    if (fsm->next[b] != FSM_NONE) fsm->prev[fsm->next[b]] = fsm->prev[b];
+}
+
+static void link_block(FreeSpaceMap* fsm, uint32_t b){
+    fsm->prev[b] = fsm->next[b] = FSM_NONE;
+    int k = bucket_of(fsm->free[b]);
+    if (k == 0) return;
+    fsm->next[b] = fsm->head[k];
+    if (fsm->head[k] != FSM_NONE) fsm->prev[fsm->head[k]] = b;
+    fsm->head[k] = b;
+}
+
+int fsm_set(FreeSpaceMap* fsm, uint32_t block_id, int free_slots){
+    if (!fsm->valid) return 0;
+    if (free_slots < 0) free_slots = 0;
+    if (free_slots > 255) free_slots = 255;
+
+    if (block_id >= fsm->n_blocks) {
+        if (fsm_reserve(fsm, block_id + 1) != 0) return -1;
+        // blocks between the old end and block_id are unknown, count them as full
+        for (uint32_t b = fsm->n_blocks; b <= block_id; b++) {
+            fsm->free[b] = 0;
+            fsm->next[b] = fsm->prev[b] = FSM_NONE;
+        }
+        fsm->n_blocks = block_id + 1;
+    } else {
+        if (fsm->free[block_id] == free_slots) return 0;
+        unlink_block(fsm, block_id);
+    }
+    fsm->free[block_id] = (uint8_t)free_slots;
+    link_block(fsm, block_id);
+    fsm->dirty = 1;
+    return 0;
+}
+
+uint32_t fsm_find(const FreeSpaceMap* fsm){
+    if (!fsm->valid) return FSM_NONE;
+    // fill the fullest blocks first so the others keep their room
+    for (int k = 1; k < FSM_BUCKETS; k++)
+        if (fsm->head[k] != FSM_NONE) return fsm->head[k];
+    return FSM_NONE;
+}
+
+uint64_t fsm_total_free(const FreeSpaceMap* fsm){
+    uint64_t total = 0;
+    for (uint32_t b = 0; b < fsm->n_blocks; b++) total += fsm->free[b];
+    return total;
+}
+
+// file layout: "FSM1", n_blocks (4B), then one byte per block
+int fsm_load(FreeSpaceMap* fsm, const char* db_path){
+    fsm_reset(fsm, db_path);
+
+    FILE* f = fopen(fsm->path, "rb");
+    if (!f) return -1;
+
+    char magic[4];
+    uint32_t n_blocks;
+    if (fread(magic, 1, 4, f) != 4 || memcmp(magic, "FSM1", 4) != 0 ||
+        fread(&n_blocks, 4, 1, f) != 1 || fsm_reserve(fsm, n_blocks) != 0) {
+        fclose(f);
+        fsm_free(fsm);
+        return -1;
+    }
+    if (n_blocks > 0 && fread(fsm->free, 1, n_blocks, f) != n_blocks) {
+        fclose(f);
+        fsm_free(fsm);
+        return -1;
+    }
+    fclose(f);
+    fsm->n_blocks = n_blocks;
+    for (uint32_t b = 0; b < n_blocks; b++) link_block(fsm, b);
+    fsm->valid = 1;
+    fsm->dirty = 0;
+    return 0;
+}
+
+int fsm_save(FreeSpaceMap* fsm){
+    if (!fsm->valid) return 0;
+    FILE* f = fopen(fsm->path, "wb");
+    if (!f) return -1;
+    fwrite("FSM1", 1, 4, f);
+    fwrite(&fsm->n_blocks, 4, 1, f);
+    if (fsm->n_blocks > 0) fwrite(fsm->free, 1, fsm->n_blocks, f);
+    int rc = (ferror(f) || fclose(f) != 0) ? -1 : 0;
+    if (rc == 0) fsm->dirty = 0;
+    return rc;
+}
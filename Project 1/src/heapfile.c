@@ -1,7 +1,214 @@
 #include "heapfile.h"
+#include "compress.h"
+#include "parallel_scan.h"
+#include "bptree.h"
+#include "file_manager_btree.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// ---- header page ----
+
+#define HF_GENERATION_OFFSET (24 + MAX_FIELDS * 36)
+
+static int write_header(HeapFile* hf){
+    Block page;
+    memset(&page, 0, sizeof(Block));
+    uint8_t* p = page.bytes;
+    uint16_t version = HF_FORMAT_VERSION;
+    memcpy(p, FM_HEADER_MAGIC, 4);
+    memcpy(p + 4, &version, 2);
+    p[6] = hf->layout;
+    memcpy(p + 8, &hf->n_blocks, 4);
+    memcpy(p + 12, &hf->n_records, 8);
+    memcpy(p + 20, &hf->schema.n_fields, 2);
+    memcpy(p + 22, &hf->schema.record_size, 2);
+    for (int f = 0; f < hf->schema.n_fields; f++) {
+        uint8_t* e = p + 24 + f * 36;
+        memcpy(e, hf->schema.fields[f].name, MAX_NAME);
+        e[32] = (uint8_t)hf->schema.fields[f].type;
+        memcpy(e + 34, &hf->schema.fields[f].width, 2);
+    }
+    memcpy(p + HF_GENERATION_OFFSET, &hf->generation, 8);
+    if (fm_write_header(&hf->fm, &page) != 0) return -1;
+    hf->version = version;
+    hf->header_dirty = 0;
+    return 0;
+}
+
+static int read_header(HeapFile* hf){
+    Block page;
+    if (fm_read_header(&hf->fm, &page) != 0) return -1;
+    const uint8_t* p = page.bytes;
+    memcpy(&hf->version, p + 4, 2);
+    if (hf->version > HF_FORMAT_VERSION) {
+        fprintf(stderr, "File format version %u is newer than this program (%u)\n",
+                hf->version, HF_FORMAT_VERSION);
+        return -1;
+    }
+    hf->layout = p[6];
+    memcpy(&hf->n_blocks, p + 8, 4);
+    memcpy(&hf->n_records, p + 12, 8);
+    memset(&hf->schema, 0, sizeof(Schema));
+    memcpy(&hf->schema.n_fields, p + 20, 2);
+    memcpy(&hf->schema.record_size, p + 22, 2);
+    if (hf->schema.n_fields > MAX_FIELDS) return -1;
+    for (int f = 0; f < hf->schema.n_fields; f++) {
+        const uint8_t* e = p + 24 + f * 36;
+        memcpy(hf->schema.fields[f].name, e, MAX_NAME);
+        hf->schema.fields[f].name[MAX_NAME - 1] = '\0';
+        hf->schema.fields[f].type = (FieldType)e[32];
+        memcpy(&hf->schema.fields[f].width, e + 34, 2);
+    }
+    memcpy(&hf->generation, p + HF_GENERATION_OFFSET, 8);
+    return 0;
+}
+
+int hf_sync_meta(HeapFile* hf){
+    if (hf->read_only) return 0;
+    int rc = 0;
+    if (hf->zm.valid && hf->zm.dirty && zm_save(&hf->zm) != 0) rc = -1;
+    if (hf->fsm.valid && hf->fsm.dirty && fsm_save(&hf->fsm) != 0) rc = -1;
+    if (hf->has_header && hf->header_dirty && write_header(hf) != 0) rc = -1;
+    return rc;
+}
+
+int hf_new_generation(HeapFile* hf){
+    if (!hf->has_header || hf->read_only) return 0;
+    hf->generation++;
+    return write_header(hf);
+}
+
+int hf_stamp_index(HeapFile* hf, const char* index_path){
+    if (!hf->has_header || hf->read_only || access(index_path, F_OK) != 0) return 0;
+    // the heap is written out first: an index of its generation must find every row
+    if (bp_flush_all(&hf->bp) != 0 || hf_sync_meta(hf) != 0) return -1;
+    BtreeFileManager ix;
+    BtreeMeta meta;
+    if (btfm_open(&ix, index_path, NODE_SIZE) != 0) return -1;
+    int rc = 0;
+    if (btfm_read_meta(&ix, &meta) == 0 && meta.generation + 1 == hf->generation) {
+        meta.generation = hf->generation;
+        if (btfm_write_meta(&ix, &meta) != 0 || fflush(ix.fp) != 0) rc = -1;
+    }
+    if (btfm_close(&ix) != 0) rc = -1;
+    return rc;
+}
+
+// the record count only moves with the header, older files have no counter
+static void count_records(HeapFile* hf, int64_t delta){
+    if (!hf->has_header || delta == 0) return;
+    hf->n_records = (uint64_t)((int64_t)hf->n_records + delta);
+    hf->header_dirty = 1;
+}
+
+// ---- write-ahead log ----
+
+static int default_wal = 0;
+static uint32_t default_group = WAL_GROUP_COMMITS;
+static uint64_t default_ckpt = WAL_CHECKPOINT_BYTES;
+
+void hf_set_default_wal(int on, uint32_t group_commits){
+    default_wal = on;
+    if (group_commits) default_group = group_commits;
+}
+
+void hf_set_checkpoint_bytes(uint64_t bytes){
+    default_ckpt = bytes;
+}
+
+int hf_enable_wal(HeapFile* hf){
+    if (hf->wal) return 0;
+    Wal* w = malloc(sizeof(Wal));
+    if (!w || wal_open(w, hf->fm.path) != 0) { free(w); return -1; }
+    w->group_commits = default_group;
+    w->ckpt_bytes = default_ckpt;
+    hf->wal = w;
+    hf->bp.wal = w;
+    hf->fm.lazy = 1;    // durability comes from the log now
+    return 0;
+}
+
+uint64_t hf_begin(HeapFile* hf){
+    return hf->wal ? wal_begin(hf->wal) : 0;
+}
+
+int hf_commit(HeapFile* hf, int wait){
+    if (!hf->wal || !hf->wal->active) return 0;
+    if (wal_commit(hf->wal, hf->wal->active, wait) != 0) return -1;
+    // between two transactions: nothing is half done in the pages
+    return wal_checkpoint_due(hf->wal) ? hf_fuzzy_checkpoint(hf) : 0;
+}
+
+int hf_checkpoint(HeapFile* hf){
+    if (!hf->wal) return bp_flush_all(&hf->bp);
+    int rc = bp_flush_all(&hf->bp);     // forces the log before the first block
+    if (fm_sync(&hf->fm) != 0) rc = -1;
+    if (hf->wal->index && btfm_writeback(hf->wal->index) != 0) rc = -1;
+    if (hf_sync_meta(hf) != 0) rc = -1;
+    // the records of an open transaction are still needed to roll it back
+    if (rc == 0 && !hf->wal->active) rc = wal_truncate(hf->wal);
+    return rc;
+}
+
+int hf_fuzzy_checkpoint(HeapFile* hf){
+    if (!hf->wal) return bp_flush_all(&hf->bp);
+    Wal* w = hf->wal;
+    BtreeFileManager* ix = w->index;
+    // the flusher: a page still dirty since before the last checkpoint is
+    // written now, so the log never has to reach back further than that
+    uint64_t prev = w->ckpt_lsn;
+    uint32_t written = 0, k = 0;
+    int rc = bp_flush_older(&hf->bp, prev, &written);
+    if (fm_sync(&hf->fm) != 0) rc = -1;
+    if (ix && btfm_writeback_older(ix, prev, &k) != 0) rc = -1;
+    if (rc != 0) return -1;
+    w->ckpt_pages += written + k;
+
+    WalDirty* dpt = malloc(((size_t)hf->bp.capacity + BTFM_CACHE_SLOTS) * sizeof(WalDirty));
+    if (!dpt) return -1;
+    uint32_t n = bp_dirty_table(&hf->bp, dpt);
+    if (ix) n += btfm_dirty_table(ix, dpt + n);
+    uint64_t low = 0;
+    rc = wal_log_checkpoint(w, dpt, n, &low);
+    free(dpt);
+    if (rc == 0) rc = wal_truncate_before(w, low);
+    return rc;
+}
+
+// logs how a block changed, in the open transaction or as one of its own
+static int log_block(HeapFile* hf, uint32_t b, const Block* before, const Block* after){
+    int own = hf->wal->active == 0;
+    if (own) hf_begin(hf);
+    uint64_t lsn = 0, end = 0;
+    if (wal_log_update(hf->wal, hf->wal->active, WAL_FILE_HEAP, b, before->bytes, after->bytes, BLOCK_SIZE, &lsn,
+                       &end) != 0)
+        return -1;
+    if (end) bp_mark_logged(&hf->bp, b, lsn, end);
+    return own ? hf_commit(hf, 0) : 0;
+}
+
+// replays a log left behind by a crash, before the file is opened for real
+static int recover(const char* path, WalRecoveryStats* st){
+    memset(st, 0, sizeof(WalRecoveryStats));
+    if (!wal_pending(path)) return 0;
+    WalTarget t[2];
+    t[WAL_FILE_HEAP].fd = open(path, O_RDWR);
+    if (t[WAL_FILE_HEAP].fd < 0) return -1;
+    char magic[4];
+    t[WAL_FILE_HEAP].page_base = (pread(t[WAL_FILE_HEAP].fd, magic, 4, 0) == 4 &&
+                                  memcmp(magic, FM_HEADER_MAGIC, 4) == 0) ? 1 : 0;
+    t[WAL_FILE_HEAP].page_size = BLOCK_SIZE;
+    t[WAL_FILE_INDEX].fd = open("btree.db", O_RDWR);
+    t[WAL_FILE_INDEX].page_base = 0;
+    t[WAL_FILE_INDEX].page_size = NODE_SIZE;
+    int rc = wal_recover(path, t, 2, st);
+    close(t[WAL_FILE_HEAP].fd);
+    if (t[WAL_FILE_INDEX].fd >= 0) close(t[WAL_FILE_INDEX].fd);
+    return rc;
+}
 
 // create new database file
 int hf_create(HeapFile* hf, const char* path, const Schema* s, int buf_frames){
@@ -12,30 +219,118 @@ int hf_create(HeapFile* hf, const char* path, const Schema* s, int buf_frames){
     if (bp_init(&hf->bp, &hf->fm, buf_frames))
         return -1;
     hf->n_blocks = 0;
+    hf->layout = BLOCK_FMT_NSM;
+    hf->n_records = 0;
+    hf->generation = 0;
+    hf->has_header = 1;
+    hf->read_only = 0;
+    hf->wal = NULL;
+    memset(&hf->recovery, 0, sizeof(WalRecoveryStats));
+    if (write_header(hf) != 0) return -1;
+    zm_init(&hf->zm, path, hf->schema.n_fields);
+    fsm_init(&hf->fsm, path);
+    // a log left from an earlier file of this name must not be replayed onto this one
+    char wal_path[600];
+    snprintf(wal_path, sizeof(wal_path), "%s.wal", path);
+    remove(wal_path);
+    if (default_wal && hf_enable_wal(hf) != 0) return -1;
+    return 0;
+}
+
+// live records counted from the blocks, when the header's counter cannot be trusted
+static int recount_records(HeapFile* hf){
+    ParallelScanSpec spec;
+    memset(&spec, 0, sizeof(spec));
+    ScanResult scan;
+    if (pscan_run(hf, &spec, &scan) != 0) return -1;
+    hf->n_records = scan.records;
+    hf->header_dirty = 1;
     return 0;
 }
 
 int hf_open(HeapFile* hf, const char* path, int buf_frames){
     if (!hf || !path) return -1;
-    if (fm_open(&hf->fm, path, "rb+"))     // open existing
+    WalRecoveryStats rst;
+    memset(&rst, 0, sizeof(rst));
+    // only the holder of the log's lock may replay it: a log a writer still
+    // holds is not a crash, the file is then only read
+    int lock = wal_lock(path);
+    hf->read_only = lock == -2;
+    int rc = hf->read_only ? 0 : recover(path, &rst);
+    if (lock >= 0) close(lock);
+    if (rc != 0) return -1;
+    if (hf->read_only)
+        fprintf(stderr, "%s.wal belongs to a running writer, %s is opened read-only\n", path, path);
+    if (fm_open(&hf->fm, path, hf->read_only ? "rb" : "rb+"))     // open existing
         return -1;
+    hf->wal = NULL;
+    hf->recovery = rst;
     if (bp_init(&hf->bp, &hf->fm, buf_frames))
         return -1;
 
-    // derive n_blocks from file size
-    if (fseek(hf->fm.fp, 0, SEEK_END)!=0) return -1;
-    long sz = ftell(hf->fm.fp);
-    if (sz < 0) return -1;
-    hf->n_blocks = (uint32_t)(sz / BLOCK_SIZE);
+    hf->has_header = hf->fm.base != 0;
+    hf->header_dirty = 0;
+    hf->n_records = 0;
+    hf->generation = 0;
+    hf->version = 0;
+    uint32_t file_blocks = fm_block_count(&hf->fm);
+    int recount = 0;
+    if (hf->has_header) {
+        // schema, counts and layout come straight from the header page
+        if (read_header(hf) != 0) return -1;
+        // blocks appended after the header was last written are still part of
+        // the file, and the record count of the header misses their rows
+        if (hf->n_blocks != file_blocks) {
+            hf->n_blocks = file_blocks;
+            hf->header_dirty = 1;
+            recount = 1;
+        }
+    } else {
+        // derive n_blocks from file size
+        hf->n_blocks = file_blocks;
+
+        // reconstruct schema (simple approach for Part 1)
+        schema_init_default(&hf->schema);
+
+        // every block records its own layout, take the first one as the file's
+        hf->layout = BLOCK_FMT_NSM;
+        if (hf->n_blocks > 0) {
+            Block first;
+            if (fm_read_block(&hf->fm, 0, &first) == 0) hf->layout = block_format(&first);
+        }
+    }
+
+    // zone map is optional, without it scans just read every block
+    zm_load(&hf->zm, path);
+    // a free-space map that does not cover the file is stale, it is rebuilt when needed
+    if (fsm_load(&hf->fsm, path) == 0 && hf->fsm.n_blocks != hf->n_blocks) fsm_free(&hf->fsm);
 
-    // reconstruct schema (simple approach for Part 1)
-    schema_init_default(&hf->schema);
+    // the maps and the counter are not logged: after a recovery they come from the blocks
+    if (rst.records > 0) {
+        wal_recovery_print(&rst);
+        if (hf_build_zonemap(hf) != 0 || hf_build_fsm(hf) != 0) return -1;
+        if (hf->has_header && recount_records(hf) != 0) return -1;
+        if (hf_sync_meta(hf) != 0) return -1;
+    } else if (recount && recount_records(hf) != 0) {
+        return -1;
+    }
+    if (default_wal && hf_enable_wal(hf) != 0) return -1;
     return 0;
 }
 
 void hf_close(HeapFile* hf){
     if (!hf) return;
+    if (hf->wal) {
+        hf_checkpoint(hf);
+        wal_close(hf->wal);
+        free(hf->wal);
+        hf->wal = NULL;
+        hf->bp.wal = NULL;
+    }
     bp_flush_all(&hf->bp);
+    hf_sync_meta(hf);
+    zm_free(&hf->zm);
+    fsm_free(&hf->fsm);
     bp_destroy(&hf->bp);
     fm_close(&hf->fm);
 }
@@ -43,18 +338,41 @@ void hf_close(HeapFile* hf){
 // helper functions for stats
 int hf_records_per_block(const HeapFile* hf){
     if (!hf) return 0;
-    return block_capacity_records(hf->schema.record_size);
+    return block_capacity_with_bitmap(hf->schema.record_size);
 }
 
 uint32_t hf_count_records(HeapFile* hf){
     if (!hf) return 0;
-    uint32_t total = 0;
+    if (hf->has_header) return (uint32_t)hf->n_records;
+    ParallelScanSpec spec;
+    memset(&spec, 0, sizeof(spec));
+    ScanResult scan;
+    if (pscan_run(hf, &spec, &scan) != 0) return 0;
+    return (uint32_t)scan.records;
+}
+
+static const char* layout_name(uint8_t layout){
+    if (layout == BLOCK_FMT_PAX) return "PAX (column minipages)";
+    if (layout == BLOCK_FMT_PACKED) return "compressed (per-block column encodings)";
+    return "NSM (row-wise)";
+}
+
+// how many blocks chose each encoding, per field
+static void print_encodings(HeapFile* hf){
+    static const char* names[] = { "plain", "dict", "for", "dec" };
     Block blk;
-    for (uint32_t b = 0; b < hf->n_blocks; b++) {
-        if (fm_read_block(&hf->fm, b, &blk) != 0) break;
-        total += block_used_count(&blk);
+    for (int f = 0; f < hf->schema.n_fields; f++) {
+        uint32_t cnt[4] = {0, 0, 0, 0};
+        for (uint32_t b = 0; b < hf->n_blocks; b++) {
+            if (fm_read_block(&hf->fm, b, &blk) != 0 || block_format(&blk) != BLOCK_FMT_PACKED) continue;
+            int e = cblock_field_encoding(&blk, f);
+            if (e >= 0 && e < 4) cnt[e]++;
+        }
+        printf("  %-16s", hf->schema.fields[f].name);
+        for (int e = 0; e < 4; e++)
+            if (cnt[e]) printf(" %s=%u", names[e], cnt[e]);
+        printf("\n");
     }
-    return total;
 }
 
 void hf_print_stats(HeapFile* hf){
@@ -63,15 +381,182 @@ void hf_print_stats(HeapFile* hf){
     int rpb = hf_records_per_block(hf);
     uint32_t nrecs = hf_count_records(hf);
     printf("Block size: %d\n", BLOCK_SIZE);
-    printf("Records per block: %d\n", rpb);
-    printf("#Blocks: %u (file size ~ %u bytes)\n", hf->n_blocks, hf->n_blocks * BLOCK_SIZE);
+    if (hf->layout == BLOCK_FMT_PACKED)
+        printf("Records per block: %.1f (average)\n", hf->n_blocks ? (double)nrecs / hf->n_blocks : 0.0);
+    else
+        printf("Records per block: %d\n", rpb);
+    printf("Layout: %s\n", layout_name(hf->layout));
+    if (hf->layout == BLOCK_FMT_PACKED) {
+        printf("Encodings (blocks per field):\n");
+        print_encodings(hf);
+    }
+    printf("#Blocks: %u (file size ~ %u bytes)\n", hf->n_blocks, (hf->n_blocks + hf->fm.base) * BLOCK_SIZE);
     printf("#Records: %u\n", nrecs);
+    if (hf->has_header)
+        printf("Header page: format version %u (counts kept up to date, no scan)\n", hf->version);
+    else
+        printf("Header page: none (older file, records counted with a scan)\n");
+    if (hf->fsm.valid)
+        printf("Free slots: %llu (free-space map)\n", (unsigned long long)fsm_total_free(&hf->fsm));
+    printf("Bytes per record: %.2f (packed record %u)\n",
+           nrecs ? (double)hf->n_blocks * BLOCK_SIZE / nrecs : 0.0, hf->schema.record_size);
     printf("I/O counts: reads=%llu writes=%llu\n",
            (unsigned long long)hf->fm.data_reads,
            (unsigned long long)hf->fm.data_writes);
 }
 
 
+// writes the pages of the batch to the end of the file with one write
+static int flush_batch(HeapFile* hf, HfAppender* ap){
+    if (ap->batch_n == 0) return 0;
+    if (fm_write_blocks(&hf->fm, ap->batch_first, ap->batch_n, ap->batch) != 0) return -1;
+    ap->batch_first += ap->batch_n;
+    ap->batch_n = 0;
+    return 0;
+}
+
+// the next block of the file, as a zeroed page of the batch
+static Block* next_page(HeapFile* hf, HfAppender* ap, uint32_t* block_id){
+    if (ap->batch_n == HF_APPEND_BATCH && flush_batch(hf, ap) != 0) return NULL;
+    Block* page = &ap->batch[ap->batch_n++];
+    memset(page, 0, sizeof(Block));
+    *block_id = hf->n_blocks++;
+    hf->header_dirty = 1;
+    return page;
+}
+
+// writes the rows staged in cb as the next block of the file
+static int flush_packed_block(HeapFile* hf, HfAppender* ap){
+    uint32_t block_id;
+    Block* cur = next_page(hf, ap, &block_id);
+    if (!cur) return -1;
+    cblock_builder_finish(&ap->cb, cur);
+    fsm_set(&hf->fsm, block_id, 0);   // compressed blocks are never written in place
+    return zm_rebuild_block(&hf->zm, &hf->schema, block_id, cur);
+}
+
+// starts the next row block, the previous one is full
+static int append_new_block(HeapFile* hf, HfAppender* ap){
+    if (ap->block_id != HF_NO_BLOCK)
+        fsm_set(&hf->fsm, ap->block_id, block_free_slots(&ap->batch[ap->batch_n - 1], &hf->schema));
+
+    uint32_t block_id;
+    Block* cur = next_page(hf, ap, &block_id);
+    if (!cur) return -1;
+    block_init(cur, hf->layout);
+    zm_reset_block(&hf->zm, block_id);
+    ap->block_id = block_id;
+    ap->cap = block_capacity(cur, &hf->schema);
+    ap->slot = 0;
+    return 0;
+}
+
+// rows go after the last record of the last block when it is a row block of
+// the file's layout with room left. 1 = continuing it, 0 = start a new block
+static int continue_last_block(HeapFile* hf, HfAppender* ap){
+    uint32_t last = hf->n_blocks - 1;
+    Block* page = &ap->batch[0];
+    if (fm_read_block(&hf->fm, last, page) != 0) return -1;
+    if (block_format(page) != hf->layout) return 0;
+    int used = block_used_count(page);
+    int cap = block_capacity(page, &hf->schema);
+    if (used >= cap) return 0;
+
+    // the block is rewritten from the batch, the pool must not keep an old copy
+    bp_discard_from(&hf->bp, last);
+    ap->batch_first = last;
+    ap->batch_n = 1;
+    ap->block_id = last;
+    ap->slot = used;
+    ap->cap = cap;
+    ap->first_block = last;
+    ap->first_slot = used;
+    return 1;
+}
+
+int hf_append_begin(HeapFile* hf, HfAppender* ap){
+    memset(ap, 0, sizeof(HfAppender));
+    // appended blocks are not logged: nothing in the log may refer to them
+    if (hf->wal && hf_checkpoint(hf) != 0) return -1;
+    ap->block_id = HF_NO_BLOCK;
+    ap->batch = malloc(HF_APPEND_BATCH * sizeof(Block));
+    if (!ap->batch) return -1;
+    // blocks already in the pool stay there, new ones go straight to the file
+    ap->batch_first = hf->n_blocks;
+    ap->first_block = hf->n_blocks;
+    int rc = bp_flush_all(&hf->bp);
+    // compressed blocks are never extended, their rows start a new block
+    if (rc == 0 && hf->layout == BLOCK_FMT_PACKED) {
+        rc = cblock_builder_init(&ap->cb, &hf->schema);
+    } else if (rc == 0) {
+        int cont = hf->n_blocks > 0 ? continue_last_block(hf, ap) : 0;
+        // an empty file still gets its first block
+        if (cont < 0) rc = -1;
+        else if (cont == 0) rc = append_new_block(hf, ap);
+    }
+    if (rc != 0) {
+        free(ap->batch);
+        ap->batch = NULL;
+    }
+    return rc;
+}
+
+// rec is r encoded; r feeds the zone map
+static int append_encoded(HeapFile* hf, HfAppender* ap, const uint8_t* rec, const Row* r){
+    ap->rows++;
+    count_records(hf, 1);
+
+    // compressed blocks: rows are staged until the next one no longer fits,
+    // then the block is encoded in one go
+    if (hf->layout == BLOCK_FMT_PACKED) {
+        if (cblock_builder_add(&ap->cb, rec) == 0) return 0;
+        if (flush_packed_block(hf, ap) != 0) return -1;
+        return cblock_builder_add(&ap->cb, rec) == 0 ? 0 : -1;
+    }
+
+    if (ap->slot >= ap->cap && append_new_block(hf, ap) != 0) return -1;
+    Block* cur = &ap->batch[ap->batch_n - 1];
+    block_put_record(cur, &hf->schema, ap->slot, rec);
+    zm_add_row(&hf->zm, &hf->schema, ap->block_id, r);
+    ap->slot++;
+    block_set_used_count(cur, (uint16_t)ap->slot);
+    return 0;
+}
+
+int hf_append_row(HeapFile* hf, HfAppender* ap, const Row* r){
+    uint8_t recbuf[512];
+    encode_row(&hf->schema, r, recbuf);
+    return append_encoded(hf, ap, recbuf, r);
+}
+
+int hf_append_record(HeapFile* hf, HfAppender* ap, const uint8_t* rec){
+    Row r;
+    decode_row(&hf->schema, rec, &r);
+    return append_encoded(hf, ap, rec, &r);
+}
+
+int hf_append_end(HeapFile* hf, HfAppender* ap){
+    int rc = 0;
+    if (hf->layout == BLOCK_FMT_PACKED) {
+        if (ap->cb.n_rows > 0 && ap->batch) rc = flush_packed_block(hf, ap);
+        cblock_builder_free(&ap->cb);
+    } else if (ap->block_id != HF_NO_BLOCK && ap->batch) {
+        fsm_set(&hf->fsm, ap->block_id, block_free_slots(&ap->batch[ap->batch_n - 1], &hf->schema));
+    }
+    if (ap->batch && flush_batch(hf, ap) != 0) rc = -1;
+    free(ap->batch);
+    ap->batch = NULL;
+
+    // flush dirty blocks to disk
+    if (bp_flush_all(&hf->bp) != 0) rc = -1;
+    if (hf->wal && fm_sync(&hf->fm) != 0) rc = -1;
+    zm_save(&hf->zm);
+    fsm_save(&hf->fsm);
+    hf->header_dirty = 1;
+    if (hf_sync_meta(hf) != 0) rc = -1;
+    return rc;
+}
+
 // this part parse th csv rows, encode into records and store into blocks
 int hf_load_csv(HeapFile* hf, const char* csv_path){
     FILE* f = fopen(csv_path, "r");
@@ -88,60 +573,17 @@ int hf_load_csv(HeapFile* hf, const char* csv_path){
         return -1;
     }
 
-    // // allocate first block on disk
-    // Block zero;
-    // memset(&zero, 0, sizeof(Block));
-    // uint32_t cur_block_id = fm_alloc_block(&hf->fm, &zero);
-    // hf->n_blocks = cur_block_id + 1;
-
-    // // fetch block from buffer pool
-    // Block* cur = bp_fetch(&hf->bp, cur_block_id);
-    // block_set_used_count(cur, 0);
-    // bp_mark_dirty(&hf->bp, cur_block_id);
-
-    // allocate block on disk
-    Block zero;
-    memset(&zero, 0, sizeof(Block));
-    uint32_t cur_block_id = fm_alloc_block(&hf->fm, &zero);
-    hf->n_blocks = cur_block_id + 1;
-
-    // manually put it into the buffer pool
-    Block* cur = bp_fetch(&hf->bp, cur_block_id);
-    memset(cur, 0, sizeof(Block));
-    block_set_used_count(cur, 0);
-    bp_mark_dirty(&hf->bp, cur_block_id);
-
-    const int cap = block_capacity_records(hf->schema.record_size);
-    uint8_t recbuf[512];
-    int slot = 0;
+    HfAppender ap;
+    if (hf_append_begin(hf, &ap) != 0) { fclose(f); return -1; }
+    int rc = 0;
     Row r;
-
-    while (fgets(line, sizeof(line), f)) {
+    while (rc == 0 && fgets(line, sizeof(line), f)) {
         if (parse_row_by_index(line, &idx, &r) != 0) continue;
-        encode_row(&hf->schema, &r, recbuf);
-
-        if (slot >= cap) {
-            // allocate a new block when current is full
-            Block z; memset(&z, 0, sizeof(Block));
-            cur_block_id = fm_alloc_block(&hf->fm, &z);
-            hf->n_blocks = cur_block_id + 1;
-
-            cur = bp_fetch(&hf->bp, cur_block_id);
-            block_set_used_count(cur, 0);
-            bp_mark_dirty(&hf->bp, cur_block_id);
-            slot = 0;
-        }
-
-        block_write_record(cur, hf->schema.record_size, slot, recbuf);
-        slot++;
-        block_set_used_count(cur, (uint16_t)slot);
-        bp_mark_dirty(&hf->bp, cur_block_id);
+        rc = hf_append_row(hf, &ap, &r);
     }
-
-    // flush dirty blocks to disk
-    bp_flush_all(&hf->bp);
+    if (hf_append_end(hf, &ap) != 0) rc = -1;
     fclose(f);
-    return 0;
+    return rc;
 }
 
 int hf_scan_print_firstN(HeapFile* hf, int limit){
@@ -155,11 +597,12 @@ int hf_scan_print_firstN(HeapFile* hf, int limit){
         if (!cur) return -1;
 
         int used = block_used_count(cur);
-        int cap  = block_capacity_records(hf->schema.record_size);
+        int cap  = block_capacity(cur, &hf->schema);
         if (used > cap) used = cap;
 
         for (int s = 0; s < used; s++) {
-            block_read_record(cur, hf->schema.record_size, s, recbuf);
+            if (!block_slot_live(cur, &hf->schema, s)) continue;
+            block_get_record(cur, &hf->schema, s, recbuf);
             decode_row(&hf->schema, recbuf, &r);
 
             printf("%d,%s,%d,%d,%.3f,%d\n",
@@ -173,6 +616,18 @@ int hf_scan_print_firstN(HeapFile* hf, int limit){
     return 0;
 }
 
+int hf_read_row(HeapFile* hf, uint32_t block_id, uint16_t slot_id, Row* out){
+    if (!hf || !out || block_id >= hf->n_blocks) return -1;
+    Block* cur = bp_fetch(&hf->bp, block_id);
+    if (!cur) return -1;
+    if (!block_slot_live(cur, &hf->schema, slot_id)) return -1;
+
+    uint8_t recbuf[512];
+    if (block_get_record(cur, &hf->schema, slot_id, recbuf) != 0) return -1;
+    decode_row(&hf->schema, recbuf, out);
+    return 0;
+}
+
 // minhwan: Delete a specific record from the heap file
 int hf_delete_record(HeapFile* hf, uint32_t block_id, uint16_t slot_id)
 {
@@ -182,22 +637,142 @@ int hf_delete_record(HeapFile* hf, uint32_t block_id, uint16_t slot_id)
     Block* cur = bp_fetch(&hf->bp, block_id);
     if (!cur) return -1;
     
-    int used = block_used_count(cur);
-    if (slot_id >= used) return -1; // Invalid slot
+    if (!block_slot_live(cur, &hf->schema, slot_id)) return -1; // Invalid or already deleted slot
+    Block before;
+    if (hf->wal) before = *cur;
     
-    // Compact the block by moving records after the deleted slot forward
-    uint8_t temp_buf[512];
-    for (int s = slot_id + 1; s < used; s++) {
-        // Read record from slot s
-        if (block_read_record(cur, hf->schema.record_size, s, temp_buf) == 0) {
-            // Write it to slot s-1
-            block_write_record(cur, hf->schema.record_size, s - 1, temp_buf);
-        }
+    // Blocks with a validity bitmap only clear the slot's bit: O(1), and the
+    // other records keep their slots. The zone map entry stays a superset.
+    if (block_kill_slot(cur, &hf->schema, slot_id) == 0) {
+        bp_mark_dirty(&hf->bp, block_id);
+        if (hf->wal && log_block(hf, block_id, &before, cur) != 0) return -1;
+        zm_remove_row(&hf->zm, block_id);
+        fsm_set(&hf->fsm, block_id, block_free_slots(cur, &hf->schema));
+        count_records(hf, -1);
+        return 0;
     }
-    
-    // Update used count
-    block_set_used_count(cur, used - 1);
+
+    // Older blocks: compact the block by moving records after the deleted slot forward
+    // (a compressed block is re-encoded without the record)
+    if (block_remove_record(cur, &hf->schema, slot_id) != 0) return -1;
     bp_mark_dirty(&hf->bp, block_id);
+    if (hf->wal && log_block(hf, block_id, &before, cur) != 0) return -1;
+
+    // the block's min/max can only shrink, recompute it from the block in memory
+    zm_rebuild_block(&hf->zm, &hf->schema, block_id, cur);
+    fsm_set(&hf->fsm, block_id, block_free_slots(cur, &hf->schema));
+    count_records(hf, -1);
     
     return 0;
 }
+
+int hf_delete_slots(HeapFile* hf, uint32_t block_id, const uint16_t* slots, int n, int* compacted)
+{
+    if (compacted) *compacted = 0;
+    if (!hf || block_id >= hf->n_blocks) return -1;
+
+    // one fetch and one dirty page for the whole group
+    Block* cur = bp_fetch(&hf->bp, block_id);
+    if (!cur) return -1;
+    Block before;
+    if (hf->wal) before = *cur;
+
+    int deleted = 0;
+    if (block_flags(cur) & BLOCK_FLAG_VALIDITY) {
+        for (int i = 0; i < n; i++) {
+            if (!block_slot_live(cur, &hf->schema, slots[i])) continue;
+            block_kill_slot(cur, &hf->schema, slots[i]);
+            zm_remove_row(&hf->zm, block_id);
+            deleted++;
+        }
+        if (deleted > 0) {
+            bp_mark_dirty(&hf->bp, block_id);
+            if (hf->wal && log_block(hf, block_id, &before, cur) != 0) return -1;
+            fsm_set(&hf->fsm, block_id, block_free_slots(cur, &hf->schema));
+            count_records(hf, -deleted);
+        }
+        return deleted;
+    }
+
+    // older blocks are compacted once for the whole group
+    if (block_remove_records(cur, &hf->schema, slots, n) != 0) return -1;
+    bp_mark_dirty(&hf->bp, block_id);
+    if (hf->wal && log_block(hf, block_id, &before, cur) != 0) return -1;
+    zm_rebuild_block(&hf->zm, &hf->schema, block_id, cur);
+    fsm_set(&hf->fsm, block_id, block_free_slots(cur, &hf->schema));
+    count_records(hf, -n);
+    if (compacted) *compacted = 1;
+    return n;
+}
+
+int hf_build_zonemap(HeapFile* hf){
+    if (!hf) return -1;
+    zm_free(&hf->zm);
+    zm_init(&hf->zm, hf->fm.path, hf->schema.n_fields);
+    for (uint32_t b = 0; b < hf->n_blocks; b++) {
+        Block* cur = bp_fetch(&hf->bp, b);
+        if (!cur) return -1;
+        if (zm_rebuild_block(&hf->zm, &hf->schema, b, cur) != 0) return -1;
+    }
+    return zm_save(&hf->zm);
+}
+
+int hf_build_fsm(HeapFile* hf){
+    if (!hf) return -1;
+    fsm_free(&hf->fsm);
+    fsm_init(&hf->fsm, hf->fm.path);
+    for (uint32_t b = 0; b < hf->n_blocks; b++) {
+        Block* cur = bp_fetch(&hf->bp, b);
+        if (!cur) return -1;
+        if (fsm_set(&hf->fsm, b, block_free_slots(cur, &hf->schema)) != 0) return -1;
+    }
+    return 0;
+}
+
+int hf_insert(HeapFile* hf, const Row* r, uint32_t* block_id, uint16_t* slot_id){
+    if (!hf || !r) return -1;
+    if (!hf->fsm.valid && hf_build_fsm(hf) != 0) return -1;
+
+    uint8_t recbuf[512];
+    encode_row(&hf->schema, r, recbuf);
+
+    uint32_t b;
+    Block* cur = NULL;
+    Block before;
+    int slot = -1;
+    while ((b = fsm_find(&hf->fsm)) != FSM_NONE) {
+        cur = bp_fetch(&hf->bp, b);
+        if (!cur) return -1;
+        if (hf->wal) before = *cur;
+        slot = block_insert_record(cur, &hf->schema, recbuf);
+        if (slot >= 0) break;
+        // the map was off for this block, correct it and look again
+        fsm_set(&hf->fsm, b, block_free_slots(cur, &hf->schema));
+    }
+
+    if (slot < 0) {
+        // no room anywhere: append a block. inserts into a compressed file
+        // go to row blocks, compressed blocks are only built whole
+        Block zero;
+        b = fm_alloc_block(&hf->fm, &zero);
+        if (b == (uint32_t)-1) return -1;
+        hf->n_blocks = b + 1;
+        hf->header_dirty = 1;
+        cur = bp_fetch(&hf->bp, b);
+        if (!cur) return -1;
+        before = zero;
+        block_init(cur, hf->layout == BLOCK_FMT_PACKED ? BLOCK_FMT_NSM : hf->layout);
+        zm_reset_block(&hf->zm, b);
+        slot = block_insert_record(cur, &hf->schema, recbuf);
+        if (slot < 0) return -1;
+    }
+
+    bp_mark_dirty(&hf->bp, b);
+    if (hf->wal && log_block(hf, b, &before, cur) != 0) return -1;
+    zm_add_row(&hf->zm, &hf->schema, b, r);
+    fsm_set(&hf->fsm, b, block_free_slots(cur, &hf->schema));
+    count_records(hf, 1);
+    if (block_id) *block_id = b;
+    if (slot_id) *slot_id = (uint16_t)slot;
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include "ingest.h"
+#include "csv_parse.h"
+#include "scan_kernel.h"
+#include "bptree_ops.h"
+#include "bench.h"
+
+// this file is for streaming ingest: lines from a pipe, committed in micro-batches.
+
+int hf_index_rows(HeapFile* hf, BtreeFileManager* btfm, uint32_t first_block, uint16_t first_slot,
+                  uint64_t rows, uint32_t* inserted)
+{
+    *inserted = 0;
+    size_t n = 0, cap = rows ? (size_t)rows : 1;
+    RecordLocation* locs = malloc(cap * sizeof(RecordLocation));
+    if (!locs)
+        return -1;
+    uint16_t sel[SEL_MAX];
+    for (uint32_t b = first_block; b < hf->n_blocks; b++) {
+        Block* cur = bp_fetch(&hf->bp, b);
+        if (!cur) {
+            free(locs);
+            return -1;
+        }
+        int k = block_live_slots(cur, &hf->schema, sel);
+        for (int i = 0; i < k; i++) {
+            if (b == first_block && sel[i] < first_slot)
+                continue;
+            if (n == cap) {
+                RecordLocation* tmp = realloc(locs, cap * 2 * sizeof(RecordLocation));
+                if (!tmp) {
+                    free(locs);
+                    return -1;
+                }
+                locs = tmp;
+                cap *= 2;
+            }
+            locs[n].block_id = b;
+            locs[n].slot_id = sel[i];
+            locs[n].key_value = block_value_float(cur, &hf->schema, FLD_FT_PCT_HOME, sel[i]);
+            n++;
+        }
+    }
+    int rc = bptree_insert_batch(btfm, locs, n, inserted);
+    free(locs);
+    return rc;
+}
+
+typedef struct {
+    Row*     rows;
+    uint32_t n;
+    double   first_ms;      // when the first row of the batch was read
+    double*  lat;           // latency of every committed batch
+    uint32_t lat_cap;
+} IngestBatch;
+
+static int commit_batch(HeapFile* hf, const IngestOpts* o, IngestBatch* b, IngestStats* st)
+{
+    double t0 = bench_now_ms();
+    HfAppender ap;
+    if (hf_append_begin(hf, &ap) != 0)
+        return -1;
+    uint32_t first_block = ap.first_block;
+    uint16_t first_slot = (uint16_t)ap.first_slot;
+    int rc = 0;
+    for (uint32_t i = 0; i < b->n && rc == 0; i++)
+        rc = hf_append_row(hf, &ap, &b->rows[i]);
+    if (hf_append_end(hf, &ap) != 0)
+        rc = -1;
+    if (rc != 0) {
+        fprintf(stderr, "Failed to append batch %u\n", st->batches);
+        return -1;
+    }
+    double t_heap = bench_now_ms();
+
+    uint32_t inserted = 0;
+    if (o->index) {
+        if (hf_index_rows(hf, o->index, first_block, first_slot, b->n, &inserted) != 0 ||
+            btfm_sync(o->index) != 0) {
+            fprintf(stderr, "Failed to index batch %u after %u entries\n", st->batches, inserted);
+            return -1;
+        }
+    }
+    double t1 = bench_now_ms();
+
+    if (st->batches == b->lat_cap) {
+        uint32_t cap = b->lat_cap ? b->lat_cap * 2 : 256;
+        double* tmp = realloc(b->lat, cap * sizeof(double));
+        if (!tmp)
+            return -1;
+        b->lat = tmp;
+        b->lat_cap = cap;
+    }
+    double lat = t1 - b->first_ms;
+    b->lat[st->batches] = lat;
+    if (o->verbose)
+        printf("batch %u: %u rows, latency %.3f ms (waited %.3f, heap %.3f, index %.3f)\n", st->batches, b->n,
+               lat, t0 - b->first_ms, t_heap - t0, t1 - t_heap);
+    st->batches++;
+    st->rows += b->n;
+    st->index_entries += inserted;
+    st->commit_ms += t1 - t0;
+    b->n = 0;
+    return 0;
+}
+
+static int lat_cmp(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// one complete line, without its newline
+static int take_line(const char* line, size_t len, CsvIdx* idx, int* have_header, IngestBatch* b,
+                     IngestStats* st)
+{
+    if (!*have_header) {
+        char head[8192];
+        size_t n = len < sizeof(head) - 1 ? len : sizeof(head) - 1;
+        memcpy(head, line, n);
+        head[n] = '\0';
+        if (parse_header_map(head, idx) != 0) {
+            fprintf(stderr, "Header does not contain required columns.\n");
+            return -1;
+        }
+        *have_header = 1;
+        return 0;
+    }
+    if (parse_row_span(line, len, idx, &b->rows[b->n]) != 0) {
+        st->skipped++;
+        return 0;
+    }
+    if (b->n++ == 0)
+        b->first_ms = bench_now_ms();
+    return 0;
+}
+
+int hf_ingest(HeapFile* hf, int fd, const IngestOpts* o, IngestStats* st)
+{
+    memset(st, 0, sizeof(IngestStats));
+    uint32_t batch_rows = o->batch_rows ? o->batch_rows : INGEST_BATCH_ROWS;
+    IngestBatch b;
+    memset(&b, 0, sizeof(b));
+    b.rows = malloc((size_t)batch_rows * sizeof(Row));
+    char* buf = malloc(INGEST_READ_BUF);
+    if (!b.rows || !buf) {
+        free(b.rows);
+        free(buf);
+        return -1;
+    }
+
+    CsvIdx idx;
+    int have_header = 0, eof = 0, rc = 0;
+    size_t len = 0;
+    double t_start = -1.0;
+    while (rc == 0 && !eof) {
+        // wait for input, but not past the deadline of the batch being collected
+        int timeout = -1;
+        if (b.n > 0) {
+            double left = b.first_ms + o->batch_ms - bench_now_ms();
+            if (left <= 0) {
+                rc = commit_batch(hf, o, &b, st);
+                continue;
+            }
+            timeout = (int)left + 1;
+        }
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, timeout);
+        if (ready < 0 && errno != EINTR) {
+            rc = -1;
+            break;
+        }
+        if (ready <= 0)
+            continue;
+
+        ssize_t got = read(fd, buf + len, INGEST_READ_BUF - len);
+        if (got < 0) {
+            if (errno != EINTR && errno != EAGAIN)
+                rc = -1;
+            continue;
+        }
+        if (t_start < 0)
+            t_start = bench_now_ms();
+        if (got == 0) {
+            eof = 1;
+            if (len > 0)        // last line without a newline
+                buf[len++] = '\n';
+        }
+        len += (size_t)got;
+        st->bytes += (uint64_t)got;
+
+        // complete lines go into the batch, a partial one waits for more input
+        char* p = buf;
+        char* end = buf + len;
+        char* nl;
+        while (rc == 0 && (nl = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+            rc = take_line(p, (size_t)(nl - p), &idx, &have_header, &b, st);
+            p = nl + 1;
+            if (rc == 0 && b.n == batch_rows)
+                rc = commit_batch(hf, o, &b, st);
+        }
+        len = (size_t)(end - p);
+        if (len == INGEST_READ_BUF) {
+            fprintf(stderr, "Line longer than %u bytes, skipped\n", INGEST_READ_BUF);
+            st->skipped++;
+            len = 0;
+        }
+        memmove(buf, p, len);
+    }
+    if (rc == 0 && b.n > 0)
+        rc = commit_batch(hf, o, &b, st);
+    st->total_ms = t_start < 0 ? 0.0 : bench_now_ms() - t_start;
+
+    if (st->batches > 0) {
+        // nearest-rank percentiles
+        uint32_t n = st->batches;
+        qsort(b.lat, n, sizeof(double), lat_cmp);
+        st->lat_p50 = b.lat[(n + 1) / 2 - 1];
+        st->lat_p99 = b.lat[(n * 99 + 99) / 100 - 1];
+        st->lat_max = b.lat[n - 1];
+    }
+    free(b.lat);
+    free(b.rows);
+    free(buf);
+    return rc;
+}
+
+void ingest_print(const IngestStats* st)
+{
+    double secs = st->total_ms / 1000.0;
+    printf("Ingested %llu rows (%llu lines skipped) in %u batches, %llu index entries\n",
+           (unsigned long long)st->rows, (unsigned long long)st->skipped, st->batches,
+           (unsigned long long)st->index_entries);
+    printf("  %.3f ms: %.0f rows/s sustained, %.1f MB/s; commits %.3f ms in total\n", st->total_ms,
+           secs > 0 ? st->rows / secs : 0.0, secs > 0 ? st->bytes / 1e6 / secs : 0.0, st->commit_ms);
+    printf("  batch latency: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", st->lat_p50, st->lat_p99, st->lat_max);
+}
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "parallel_scan.h"
+#include "scan_kernel.h"
+
+// this file is for the morsel-driven parallel heap scan.
+// workers share nothing but the morsel queues; results are written per morsel
+// and per worker and only combined after all threads have been joined.
+
+static int default_threads = 0;
+
+void pscan_set_default_threads(int n)
+{
+    default_threads = n;
+}
+
+int pscan_default_threads(void)
+{
+    long n = default_threads > 0 ? default_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    if (n > PSCAN_MAX_THREADS)
+        n = PSCAN_MAX_THREADS;
+    return (int)n;
+}
+
+// morsel ids [head, tail) still to be scanned; the owner pops from the front,
+// thieves from the back
+typedef struct {
+    pthread_mutex_t mu;
+    uint32_t head, tail;
+} MorselQueue;
+
+// partial result of one morsel: the sum is kept per morsel so that adding them
+// up does not depend on which worker ran which morsel
+typedef struct {
+    double sum;
+    RecordLocation* locs;      // matches, when locations are collected
+    size_t n, cap;
+} MorselOut;
+
+typedef struct {
+    HeapFile*   hf;
+    ParallelScanSpec spec;
+    float       klo, khi;
+    uint32_t    morsel_blocks;
+    uint32_t    n_morsels;
+    int         n_workers;
+    MorselQueue q[PSCAN_MAX_THREADS];
+    MorselOut*  outs;
+} ScanShared;
+
+typedef struct {
+    int         id;
+    ScanShared* sh;
+    ScanResult  part;
+    int         rc;
+} ScanWorker;
+
+static int next_morsel(ScanShared* sh, int id, uint32_t* m, int* stolen)
+{
+    MorselQueue* own = &sh->q[id];
+    pthread_mutex_lock(&own->mu);
+    if (own->head < own->tail) {
+        *m = own->head++;
+        pthread_mutex_unlock(&own->mu);
+        *stolen = 0;
+        return 1;
+    }
+    pthread_mutex_unlock(&own->mu);
+
+    for (int k = 1; k < sh->n_workers; k++) {
+        MorselQueue* victim = &sh->q[(id + k) % sh->n_workers];
+        pthread_mutex_lock(&victim->mu);
+        if (victim->head < victim->tail) {
+            *m = --victim->tail;
+            pthread_mutex_unlock(&victim->mu);
+            *stolen = 1;
+            return 1;
+        }
+        pthread_mutex_unlock(&victim->mu);
+    }
+    return 0;
+}
+
+static int morsel_append(MorselOut* o, uint32_t block_id, uint16_t slot, float key)
+{
+    if (o->n == o->cap) {
+        size_t cap = o->cap ? o->cap * 2 : 256;
+        RecordLocation* tmp = realloc(o->locs, cap * sizeof(RecordLocation));
+        if (!tmp)
+            return -1;
+        o->locs = tmp;
+        o->cap = cap;
+    }
+    o->locs[o->n].block_id = block_id;
+    o->locs[o->n].slot_id = slot;
+    o->locs[o->n].key_value = key;
+    o->n++;
+    return 0;
+}
+
+static int scan_morsel(ScanWorker* w, FileManager* fm, uint32_t m)
+{
+    ScanShared* sh = w->sh;
+    const Schema* s = &sh->hf->schema;
+    const KeyRange* r = &sh->spec.range;
+    uint32_t first = m * sh->morsel_blocks;
+    uint32_t last = first + sh->morsel_blocks;
+    if (last > sh->hf->n_blocks)
+        last = sh->hf->n_blocks;
+
+    Block blk;
+    uint16_t sel[SEL_MAX];
+    for (uint32_t b = first; b < last; b++) {
+        if (sh->spec.filter &&
+            !zm_block_may_match(&sh->hf->zm, b, FLD_FT_PCT_HOME, r->lo, r->lo_inclusive, r->hi, r->hi_inclusive)) {
+            w->part.blocks_pruned++;
+            continue;
+        }
+        if (fm_read_block(fm, b, &blk) != 0) {
+            fprintf(stderr, "Failed to read block %u\n", b);
+            return -1;
+        }
+        w->part.blocks_read++;
+
+        int n;
+        if (sh->spec.filter) {
+            w->part.records += block_live_count(&blk, s);
+            n = block_filter_float(&blk, s, FLD_FT_PCT_HOME, sh->klo, sh->khi, sel);
+        } else {
+            n = block_live_slots(&blk, s, sel);
+            w->part.records += n;
+        }
+        w->part.matches += n;
+        sh->outs[m].sum += block_column_sum(&blk, s, FLD_FT_PCT_HOME, sel, n);
+
+        if (sh->spec.collect) {
+            for (int i = 0; i < n; i++) {
+                if (morsel_append(&sh->outs[m], b, sel[i], block_value_float(&blk, s, FLD_FT_PCT_HOME, sel[i])) != 0)
+                    return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void* scan_worker(void* arg)
+{
+    ScanWorker* w = (ScanWorker*)arg;
+    FileManager fm;
+    if (fm_open(&fm, w->sh->hf->fm.path, "rb") != 0) {
+        w->rc = -1;
+        return NULL;
+    }
+
+    uint32_t m;
+    int stolen;
+    while (next_morsel(w->sh, w->id, &m, &stolen)) {
+        w->part.morsels_stolen += stolen;
+        if (scan_morsel(w, &fm, m) != 0) {
+            w->rc = -1;
+            break;
+        }
+    }
+    fm_close(&fm);
+    return NULL;
+}
+
+int pscan_run(HeapFile* hf, const ParallelScanSpec* spec, ScanResult* out)
+{
+    memset(out, 0, sizeof(ScanResult));
+    if (!hf || !spec)
+        return -1;
+    bp_flush_all(&hf->bp);
+
+    ScanShared* sh = calloc(1, sizeof(ScanShared));
+    if (!sh)
+        return -1;
+    sh->hf = hf;
+    sh->spec = *spec;
+    sh->morsel_blocks = spec->morsel_blocks ? spec->morsel_blocks : PSCAN_MORSEL_BLOCKS;
+    sh->n_morsels = (hf->n_blocks + sh->morsel_blocks - 1) / sh->morsel_blocks;
+    kernel_float_bounds(spec->range.lo, spec->range.lo_inclusive, spec->range.hi, spec->range.hi_inclusive,
+                        &sh->klo, &sh->khi);
+
+    int threads = spec->threads > 0 ? spec->threads : pscan_default_threads();
+    if (threads > PSCAN_MAX_THREADS)
+        threads = PSCAN_MAX_THREADS;
+    if ((uint32_t)threads > sh->n_morsels)
+        threads = sh->n_morsels > 0 ? (int)sh->n_morsels : 1;
+    sh->n_workers = threads;
+
+    sh->outs = calloc(sh->n_morsels ? sh->n_morsels : 1, sizeof(MorselOut));
+    ScanWorker* workers = calloc((size_t)threads, sizeof(ScanWorker));
+    pthread_t* tids = calloc((size_t)threads, sizeof(pthread_t));
+    if (!sh->outs || !workers || !tids) {
+        free(sh->outs);
+        free(workers);
+        free(tids);
+        free(sh);
+        return -1;
+    }
+
+    // every worker starts with a contiguous share of the morsels
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&sh->q[i].mu, NULL);
+        sh->q[i].head = (uint32_t)((uint64_t)sh->n_morsels * i / threads);
+        sh->q[i].tail = (uint32_t)((uint64_t)sh->n_morsels * (i + 1) / threads);
+        workers[i].id = i;
+        workers[i].sh = sh;
+    }
+
+    int started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&tids[started], NULL, scan_worker, &workers[started]) != 0)
+            break;
+    }
+    // threads that could not be started leave their morsels to be stolen
+    if (started == 0)
+        scan_worker(&workers[0]);
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    // merge the partials
+    int rc = 0;
+    out->threads = started > 0 ? started : 1;
+    for (int i = 0; i < threads; i++) {
+        ScanResult* p = &workers[i].part;
+        out->records += p->records;
+        out->matches += p->matches;
+        out->blocks_read += p->blocks_read;
+        out->blocks_pruned += p->blocks_pruned;
+        out->morsels_stolen += p->morsels_stolen;
+        if (workers[i].rc != 0)
+            rc = -1;
+        pthread_mutex_destroy(&sh->q[i].mu);
+    }
+    hf->fm.data_reads += out->blocks_read;
+    for (uint32_t m = 0; m < sh->n_morsels; m++)
+        out->sum += sh->outs[m].sum;
+
+    if (spec->collect && rc == 0) {
+        size_t total = 0;
+        for (uint32_t m = 0; m < sh->n_morsels; m++)
+            total += sh->outs[m].n;
+        out->locs = malloc((total ? total : 1) * sizeof(RecordLocation));
+        if (!out->locs) {
+            rc = -1;
+        } else {
+            for (uint32_t m = 0; m < sh->n_morsels; m++) {
+                if (sh->outs[m].n)
+                    memcpy(out->locs + out->n_locs, sh->outs[m].locs, sh->outs[m].n * sizeof(RecordLocation));
+                out->n_locs += sh->outs[m].n;
+            }
+        }
+    }
+
+    for (uint32_t m = 0; m < sh->n_morsels; m++)
+        free(sh->outs[m].locs);
+    free(sh->outs);
+    free(workers);
+    free(tids);
+    free(sh);
+    return rc;
+}
@@ -0,0 +1,191 @@
+#include "scan_kernel.h"
+#include "compress.h"
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// this file is for the batch filter kernels used by heap scans.
+// the column values are read with strided loads (stride = record size), compared
+// branch-free and the passing slot numbers are appended to a selection vector.
+
+void kernel_float_bounds(float lo, int lo_inclusive, float hi, int hi_inclusive, float *lo_out, float *hi_out)
+{
+    *lo_out = lo_inclusive ? lo : nextafterf(lo, INFINITY);
+    *hi_out = hi_inclusive ? hi : nextafterf(hi, -INFINITY);
+}
+
+static inline float load_f32(const uint8_t *p)
+{
+    float v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline int32_t load_i32(const uint8_t *p)
+{
+    int32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+int block_select_float_scalar(const Block *b, int n, uint16_t stride, uint16_t offset,
+                              float lo, float hi, uint16_t *sel)
+{
+    const uint8_t *col = b->bytes + BLOCK_HDR_SIZE + offset;
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        float v = load_f32(col + (size_t)i * stride);
+        sel[k] = (uint16_t)i;
+        k += (v >= lo) & (v <= hi);
+    }
+    return k;
+}
+
+int block_select_float(const Block *b, int n, uint16_t stride, uint16_t offset,
+                       float lo, float hi, uint16_t *sel)
+{
+#if defined(__SSE2__)
+    const uint8_t *col = b->bytes + BLOCK_HDR_SIZE + offset;
+    const __m128 vlo = _mm_set1_ps(lo);
+    const __m128 vhi = _mm_set1_ps(hi);
+    int k = 0, i = 0;
+
+    // 4 records per step: gather the strided values into one register,
+    // or load them directly when the column is contiguous (PAX minipage)
+    for (; i + 4 <= n; i += 4) {
+        const uint8_t *p = col + (size_t)i * stride;
+        __m128 v = (stride == 4) ? _mm_loadu_ps((const float *)p)
+                                 : _mm_set_ps(load_f32(p + 3 * (size_t)stride), load_f32(p + 2 * (size_t)stride),
+                                              load_f32(p + stride), load_f32(p));
+        __m128 m = _mm_and_ps(_mm_cmpge_ps(v, vlo), _mm_cmple_ps(v, vhi));
+        int mask = _mm_movemask_ps(m);
+
+        sel[k] = (uint16_t)i;       k += mask & 1;
+        sel[k] = (uint16_t)(i + 1); k += (mask >> 1) & 1;
+        sel[k] = (uint16_t)(i + 2); k += (mask >> 2) & 1;
+        sel[k] = (uint16_t)(i + 3); k += (mask >> 3) & 1;
+    }
+    for (; i < n; i++) {
+        float v = load_f32(col + (size_t)i * stride);
+        sel[k] = (uint16_t)i;
+        k += (v >= lo) & (v <= hi);
+    }
+    return k;
+#else
+    return block_select_float_scalar(b, n, stride, offset, lo, hi, sel);
+#endif
+}
+
+int block_select_int32(const Block *b, int n, uint16_t stride, uint16_t offset,
+                       int32_t lo, int32_t hi, uint16_t *sel)
+{
+    const uint8_t *col = b->bytes + BLOCK_HDR_SIZE + offset;
+    int k = 0, i = 0;
+#if defined(__SSE2__)
+    // SSE2 only has signed greater-than, so test !(v < lo) && !(v > hi)
+    const __m128i vlo = _mm_set1_epi32(lo);
+    const __m128i vhi = _mm_set1_epi32(hi);
+    for (; i + 4 <= n; i += 4) {
+        const uint8_t *p = col + (size_t)i * stride;
+        __m128i v = _mm_set_epi32(load_i32(p + 3 * (size_t)stride), load_i32(p + 2 * (size_t)stride),
+                                  load_i32(p + stride), load_i32(p));
+        __m128i out = _mm_or_si128(_mm_cmplt_epi32(v, vlo), _mm_cmpgt_epi32(v, vhi));
+        int mask = ~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xF;
+
+        sel[k] = (uint16_t)i;       k += mask & 1;
+        sel[k] = (uint16_t)(i + 1); k += (mask >> 1) & 1;
+        sel[k] = (uint16_t)(i + 2); k += (mask >> 2) & 1;
+        sel[k] = (uint16_t)(i + 3); k += (mask >> 3) & 1;
+    }
+#endif
+    for (; i < n; i++) {
+        int32_t v = load_i32(col + (size_t)i * stride);
+        sel[k] = (uint16_t)i;
+        k += (v >= lo) & (v <= hi);
+    }
+    return k;
+}
+
+double block_sum_float(const Block *b, int n, uint16_t stride, uint16_t offset, const uint16_t *sel)
+{
+    const uint8_t *col = b->bytes + BLOCK_HDR_SIZE + offset;
+    double sum = 0.0;
+    if (sel) {
+        for (int i = 0; i < n; i++)
+            sum += load_f32(col + (size_t)sel[i] * stride);
+        return sum;
+    }
+
+    // two accumulators so the adds do not wait on each other
+    double sum2 = 0.0;
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        sum += load_f32(col + (size_t)i * stride);
+        sum2 += load_f32(col + (size_t)(i + 1) * stride);
+    }
+    for (; i < n; i++)
+        sum += load_f32(col + (size_t)i * stride);
+    return sum + sum2;
+}
+
+// records in use, never more than the block can hold
+static int block_rows(const Block *b, const Schema *s)
+{
+    int used = block_used_count(b);
+    int cap = block_capacity(b, s);
+    return used > cap ? cap : used;
+}
+
+int block_filter_float(const Block *b, const Schema *s, int field, float lo, float hi, uint16_t *sel)
+{
+    int n;
+    if (block_format(b) == BLOCK_FMT_PACKED) {
+        n = cblock_select_float(b, s, field, lo, hi, sel);
+    } else {
+        uint16_t offset, stride;
+        block_column(b, s, field, &offset, &stride);
+        n = block_select_float(b, block_rows(b, s), stride, offset, lo, hi, sel);
+    }
+    return block_sel_live(b, s, sel, n);
+}
+
+int block_filter_int32(const Block *b, const Schema *s, int field, int32_t lo, int32_t hi, uint16_t *sel)
+{
+    int n;
+    if (block_format(b) == BLOCK_FMT_PACKED) {
+        n = cblock_select_int32(b, s, field, lo, hi, sel);
+    } else {
+        uint16_t offset, stride;
+        block_column(b, s, field, &offset, &stride);
+        n = block_select_int32(b, block_rows(b, s), stride, offset, lo, hi, sel);
+    }
+    return block_sel_live(b, s, sel, n);
+}
+
+double block_column_sum(const Block *b, const Schema *s, int field, const uint16_t *sel, int n_sel)
+{
+    // with deleted slots in the block, sum the live ones only
+    uint16_t live[SEL_MAX];
+    if (!sel && (block_flags(b) & BLOCK_FLAG_HAS_DEAD)) {
+        n_sel = block_live_slots(b, s, live);
+        sel = live;
+    }
+    int n = sel ? n_sel : block_rows(b, s);
+    if (block_format(b) == BLOCK_FMT_PACKED)
+        return cblock_sum_float(b, s, field, sel, n);
+    uint16_t offset, stride;
+    block_column(b, s, field, &offset, &stride);
+    return block_sum_float(b, n, stride, offset, sel);
+}
+
+float block_value_float(const Block *b, const Schema *s, int field, int slot)
+{
+    if (block_format(b) == BLOCK_FMT_PACKED)
+        return cblock_value_float(b, s, field, slot);
+    uint16_t offset, stride;
+    block_column(b, s, field, &offset, &stride);
+    return load_f32(b->bytes + BLOCK_HDR_SIZE + offset + (size_t)slot * stride);
+}
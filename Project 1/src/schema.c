@@ -116,6 +116,79 @@ void decode_row(const Schema *s, const uint8_t *src, Row *r)
     r->home_team_wins = *p++;
 }
 
+// this part gives a numeric value per field so blocks can be summarised and compared
+int32_t date_key(const char *game_date)
+{
+    int d = 0, m = 0, y = 0;
+    if (!game_date)
+        return 0;
+
+    // plain "d/m/y" digits are read directly, it runs for every loaded row
+    int v[3];
+    const char *p = game_date;
+    int k = 0;
+    for (; k < 3; k++) {
+        int n = 0, digits = 0;
+        while (*p >= '0' && *p <= '9' && digits < 9) {
+            n = n * 10 + (*p++ - '0');
+            digits++;
+        }
+        if (digits == 0 || (*p >= '0' && *p <= '9'))
+            break;
+        v[k] = n;
+        if (k < 2 && *p++ != '/')
+            break;
+    }
+    if (k == 3)
+        return (int32_t)(v[2] * 10000 + v[1] * 100 + v[0]);
+
+    if (sscanf(game_date, "%d/%d/%d", &d, &m, &y) != 3)
+        return 0;
+    return (int32_t)(y * 10000 + m * 100 + d);
+}
+
+double row_field_value(const Schema *s, const Row *r, int field)
+{
+    (void)s;
+    switch (field)
+    {
+    case FLD_GAME_ID: return (double)r->game_id;
+    case FLD_GAME_DATE_EST: return (double)date_key(r->game_date);
+    case FLD_HOME_TEAM_ID: return (double)r->home_team_id;
+    case FLD_VISITOR_TEAM_ID: return (double)r->visitor_team_id;
+    case FLD_FT_PCT_HOME: return (double)r->ft_pct_home;
+    case FLD_HOME_TEAM_WINS: return (double)r->home_team_wins;
+    default: return 0.0;
+    }
+}
+
+int schema_field_index(const Schema *s, const char *name)
+{
+    if (!s || !name)
+        return -1;
+    for (int i = 0; i < s->n_fields; i++)
+    {
+        const char *a = s->fields[i].name;
+        const char *b = name;
+        while (*a && *b && tolower((unsigned char)*a) == tolower((unsigned char)*b))
+        {
+            a++;
+            b++;
+        }
+        if (*a == '\0' && *b == '\0')
+            return i;
+    }
+    return -1;
+}
+
+uint16_t schema_field_offset(const Schema *s, int field)
+{
+    uint16_t off = 0;
+    for (int i = 0; i < field && i < s->n_fields; i++)
+        off += s->fields[i].width;
+    return off;
+}
+
 // this part is all the csv parser helpers logic for the csv parsing into the db
 static void rstrip_inplace(char *s)
 {
@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "server.h"
+#include "bptree_ops.h"
+#include "bench.h"
+
+// this file is for the query server: one open snapshot of a table, answering
+// requests on a Unix domain socket.
+
+// ---- queries ----
+
+int srv_aggregate(Snapshot* s, float lo, float hi, uint64_t* count, double* sum)
+{
+    *count = 0;
+    *sum = 0.0;
+    if (s->has_index) {
+        RangeAggregate agg;
+        if (bptree_range_aggregate(&s->ix, lo, 1, hi, 1, &agg) != 0)
+            return -1;
+        *count = agg.count;
+        *sum = agg.sum;
+        return 0;
+    }
+    KeyRange range = {lo, hi, 1, 1};
+    HeapCursor cur;
+    RecordLocation loc;
+    Row r;
+    int rc;
+    heap_cursor_open(&cur, &s->hf, &range, 0);
+    while ((rc = heap_cursor_next(&cur, &loc, &r)) == 1) {
+        (*count)++;
+        *sum += r.ft_pct_home;
+    }
+    heap_cursor_close(&cur);
+    return rc < 0 ? -1 : 0;
+}
+
+int srv_range(Snapshot* s, float lo, float hi, uint32_t limit, Row* rows, uint32_t* n)
+{
+    *n = 0;
+    KeyRange range = {lo, hi, 1, 1};
+    RecordLocation loc;
+    int rc;
+    if (s->has_index) {
+        IndexCursor cur;
+        if (idx_cursor_open_on(&cur, &s->ix, &range, limit, 0) != 0)
+            return -1;
+        while ((rc = idx_cursor_next(&cur, &loc)) == 1) {
+            if (hf_read_row(&s->hf, loc.block_id, loc.slot_id, &rows[*n]) == 0)
+                (*n)++;
+        }
+        idx_cursor_close(&cur);
+    } else {
+        HeapCursor cur;
+        heap_cursor_open(&cur, &s->hf, &range, limit);
+        while ((rc = heap_cursor_next(&cur, &loc, &rows[*n])) == 1)
+            (*n)++;
+        heap_cursor_close(&cur);
+    }
+    return rc < 0 ? -1 : 0;
+}
+
+// ---- wire format ----
+
+static void put_u32(uint8_t* p, uint32_t v) { memcpy(p, &v, 4); }
+static uint32_t get_u32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+static void encode_wire_row(const Row* r, uint8_t* p)
+{
+    memcpy(p, &r->game_id, 4);
+    memcpy(p + 4, r->game_date, 10);
+    memcpy(p + 14, &r->home_team_id, 4);
+    memcpy(p + 18, &r->visitor_team_id, 4);
+    memcpy(p + 22, &r->ft_pct_home, 4);
+    p[26] = r->home_team_wins;
+}
+
+void srv_decode_row(const uint8_t* p, Row* r)
+{
+    memcpy(&r->game_id, p, 4);
+    memcpy(r->game_date, p + 4, 10);
+    r->game_date[10] = '\0';
+    memcpy(&r->home_team_id, p + 14, 4);
+    memcpy(&r->visitor_team_id, p + 18, 4);
+    memcpy(&r->ft_pct_home, p + 22, 4);
+    r->home_team_wins = p[26];
+}
+
+static int write_full(int fd, const uint8_t* p, size_t n)
+{
+    while (n > 0) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+static int read_full(int fd, uint8_t* p, size_t n)
+{
+    while (n > 0) {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        n -= (size_t)r;
+    }
+    return 0;
+}
+
+// ---- server ----
+
+typedef struct {
+    int      fd;                // non-blocking
+    uint8_t  in[SRV_MAX_REQUEST];
+    uint32_t have;
+    uint8_t* out;               // answers the socket has not taken yet
+    size_t   out_len, out_pos, out_cap;
+} SrvConn;
+
+typedef struct {
+    Snapshot     snap;
+    int          open;          // 0 after a reopen failed, tried again on the next request
+    const char*  db;
+    int          buf_frames;
+    Row*         rows;          // SRV_MAX_ROWS
+    uint8_t*     out;           // room for the largest response
+    int          shutdown;
+    ServerStats* st;
+} Server;
+
+static volatile sig_atomic_t srv_stop = 0;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    srv_stop = 1;
+}
+
+// the snapshot, swapped for a new one if maintenance replaced the files
+static int srv_refresh(Server* sv)
+{
+    if (sv->open && !snap_stale(&sv->snap))
+        return 0;
+    if (sv->open) {
+        snap_close(&sv->snap);
+        sv->st->reopens++;
+    }
+    sv->open = snap_open(&sv->snap, sv->db, sv->buf_frames) == 0;
+    return sv->open ? 0 : -1;
+}
+
+// answers one request into sv->out, returns the response length
+static uint32_t srv_answer(Server* sv, uint8_t op, const uint8_t* body, uint32_t len)
+{
+    uint8_t* p = sv->out + SRV_HDR;
+    uint32_t n = 0;
+    uint8_t status = SRV_OK;
+    float lo, hi;
+    if ((op == SRV_AGGREGATE && len < 8) || (op == SRV_RANGE && len < 12) || op < SRV_PING || op > SRV_SHUTDOWN)
+        status = SRV_BAD_REQUEST;
+    else if (op != SRV_PING && op != SRV_SHUTDOWN && srv_refresh(sv) != 0)
+        status = SRV_FAILED;
+    else if (op == SRV_STATS) {
+        uint64_t records = hf_count_records(&sv->snap.hf);
+        memcpy(p, &records, 8);
+        memcpy(p + 8, &sv->snap.hf.n_blocks, 4);
+        memcpy(p + 12, &sv->snap.generation, 8);
+        p[20] = (uint8_t)sv->snap.has_index;
+        n = 21;
+    } else if (op == SRV_AGGREGATE) {
+        uint64_t count;
+        double sum;
+        memcpy(&lo, body, 4);
+        memcpy(&hi, body + 4, 4);
+        if (srv_aggregate(&sv->snap, lo, hi, &count, &sum) != 0)
+            status = SRV_FAILED;
+        memcpy(p, &count, 8);
+        memcpy(p + 8, &sum, 8);
+        n = 16;
+    } else if (op == SRV_RANGE) {
+        uint32_t limit = get_u32(body + 8), got = 0;
+        memcpy(&lo, body, 4);
+        memcpy(&hi, body + 4, 4);
+        if (limit == 0 || limit > SRV_MAX_ROWS)
+            limit = SRV_MAX_ROWS;
+        if (srv_range(&sv->snap, lo, hi, limit, sv->rows, &got) != 0)
+            status = SRV_FAILED;
+        put_u32(p, got);
+        for (uint32_t i = 0; i < got; i++)
+            encode_wire_row(&sv->rows[i], p + 4 + i * SRV_ROW_SIZE);
+        n = 4 + got * SRV_ROW_SIZE;
+    } else if (op == SRV_SHUTDOWN)
+        sv->shutdown = 1;
+    if (status != SRV_OK)
+        n = 0;
+    put_u32(sv->out, 4 + n);
+    sv->out[4] = status;
+    memset(sv->out + 5, 0, 3);
+    return SRV_HDR + n;
+}
+
+// sends what the socket takes without blocking; the rest waits for POLLOUT
+static int conn_flush(SrvConn* c)
+{
+    while (c->out_pos < c->out_len) {
+        ssize_t w = send(c->fd, c->out + c->out_pos, c->out_len - c->out_pos, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (w <= 0)
+            return -1;
+        c->out_pos += (size_t)w;
+    }
+    c->out_len = c->out_pos = 0;
+    return 0;
+}
+
+static int conn_queue(SrvConn* c, const uint8_t* p, size_t n)
+{
+    if (c->out_pos > 0 && c->out_pos == c->out_len)
+        c->out_len = c->out_pos = 0;
+    if (c->out_len - c->out_pos + n > SRV_MAX_BACKLOG)
+        return -1;
+    if (c->out_len + n > c->out_cap) {
+        // move what is left to the front before growing
+        memmove(c->out, c->out + c->out_pos, c->out_len - c->out_pos);
+        c->out_len -= c->out_pos;
+        c->out_pos = 0;
+        size_t cap = c->out_cap ? c->out_cap : 4096;
+        while (cap < c->out_len + n)
+            cap *= 2;
+        if (cap != c->out_cap) {
+            uint8_t* tmp = realloc(c->out, cap);
+            if (!tmp)
+                return -1;
+            c->out = tmp;
+            c->out_cap = cap;
+        }
+    }
+    memcpy(c->out + c->out_len, p, n);
+    c->out_len += n;
+    return conn_flush(c);
+}
+
+static void conn_close(SrvConn* c)
+{
+    close(c->fd);
+    free(c->out);
+    memset(c, 0, sizeof(SrvConn));
+}
+
+// answers the complete requests c has buffered, as long as its earlier answers
+// have been taken: a client that does not read stops being served, it does not
+// stop the others. -1 closes the connection
+static int srv_serve_conn(Server* sv, SrvConn* c)
+{
+    while (c->have >= 4 && c->out_len - c->out_pos < SRV_OUT_HIGH && !sv->shutdown) {
+        uint32_t len = get_u32(c->in);
+        if (len < 4 || len > SRV_MAX_REQUEST - 4)
+            return -1;
+        if (c->have < 4 + len)
+            break;
+        double t0 = bench_now_ms();
+        uint32_t out = srv_answer(sv, c->in[4], c->in + SRV_HDR, len - 4);
+        int rc = conn_queue(c, sv->out, out);
+        sv->st->busy_ms += bench_now_ms() - t0;
+        sv->st->requests++;
+        if (rc != 0)
+            return -1;
+        c->have -= 4 + len;
+        memmove(c->in, c->in + 4 + len, c->have);
+    }
+    return 0;
+}
+
+static int srv_read_conn(Server* sv, SrvConn* c)
+{
+    ssize_t r = read(c->fd, c->in + c->have, sizeof(c->in) - c->have);
+    if (r < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (r <= 0)
+        return -1;
+    c->have += (uint32_t)r;
+    return srv_serve_conn(sv, c);
+}
+
+// a socket at path that still accepts connections belongs to a running server
+static int socket_in_use(const struct sockaddr_un* addr)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return 0;
+    int rc = connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) == 0;
+    close(fd);
+    return rc;
+}
+
+int srv_run(const char* db_path, const char* socket_path, int buf_frames, int ready_fd, ServerStats* st)
+{
+    memset(st, 0, sizeof(ServerStats));
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    // a leftover socket file is replaced, anything else at that path is kept
+    struct stat sb;
+    if (stat(socket_path, &sb) == 0) {
+        if (!S_ISSOCK(sb.st_mode) || socket_in_use(&addr)) {
+            fprintf(stderr, "%s is in use\n", socket_path);
+            return -1;
+        }
+        unlink(socket_path);
+    }
+
+    Server sv;
+    memset(&sv, 0, sizeof(sv));
+    sv.db = db_path;
+    sv.buf_frames = buf_frames;
+    sv.st = st;
+    sv.rows = malloc(SRV_MAX_ROWS * sizeof(Row));
+    sv.out = malloc(SRV_HDR + 4 + (size_t)SRV_MAX_ROWS * SRV_ROW_SIZE);
+    if (!sv.rows || !sv.out || srv_refresh(&sv) != 0) {
+        fprintf(stderr, "Failed to open database file: %s\n", db_path);
+        free(sv.rows);
+        free(sv.out);
+        return -1;
+    }
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, SRV_MAX_CLIENTS) != 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", socket_path, strerror(errno));
+        if (lfd >= 0)
+            close(lfd);
+        snap_close(&sv.snap);
+        free(sv.rows);
+        free(sv.out);
+        return -1;
+    }
+
+    // no SA_RESTART: a signal has to wake poll up
+    struct sigaction sa, old_int, old_term;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    srv_stop = 0;
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+
+    if (ready_fd >= 0) {
+        uint8_t one = 1;
+        if (write(ready_fd, &one, 1) != 1)
+            fprintf(stderr, "Failed to report the server ready\n");
+    }
+
+    static SrvConn conn[SRV_MAX_CLIENTS];
+    struct pollfd pfd[1 + SRV_MAX_CLIENTS];
+    int n_conn = 0, rc = 0;
+    while (!srv_stop && !sv.shutdown) {
+        // a full server leaves new connections waiting in the backlog
+        pfd[0].fd = lfd;
+        pfd[0].events = n_conn < SRV_MAX_CLIENTS ? POLLIN : 0;
+        // no new requests are read from a connection while its answers wait
+        for (int i = 0; i < n_conn; i++) {
+            pfd[1 + i].fd = conn[i].fd;
+            pfd[1 + i].events = conn[i].out_len > conn[i].out_pos ? POLLOUT : POLLIN;
+        }
+        if (poll(pfd, (nfds_t)(1 + n_conn), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            rc = -1;
+            break;
+        }
+        // from the back, so a closed connection can take the place of the last one
+        for (int i = n_conn - 1; i >= 0 && !sv.shutdown; i--) {
+            short ev = pfd[1 + i].revents;
+            if (!ev)
+                continue;
+            int ok;
+            if (pfd[1 + i].events == POLLOUT)
+                // once the answers are out, requests already read are next
+                ok = !(ev & (POLLERR | POLLNVAL)) && conn_flush(&conn[i]) == 0 && srv_serve_conn(&sv, &conn[i]) == 0;
+            else
+                ok = srv_read_conn(&sv, &conn[i]) == 0;
+            if (!ok) {
+                conn_close(&conn[i]);
+                conn[i] = conn[--n_conn];
+            }
+        }
+        if ((pfd[0].revents & POLLIN) && !sv.shutdown) {
+            int fd = accept(lfd, NULL, NULL);
+            if (fd >= 0 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+                close(fd);
+                fd = -1;
+            }
+            if (fd >= 0) {
+                memset(&conn[n_conn], 0, sizeof(SrvConn));
+                conn[n_conn].fd = fd;
+                n_conn++;
+                st->connections++;
+            }
+        }
+    }
+
+    // the answer to a shutdown is small enough to go out without waiting
+    for (int i = 0; i < n_conn; i++) {
+        conn_flush(&conn[i]);
+        conn_close(&conn[i]);
+    }
+    close(lfd);
+    unlink(socket_path);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    if (sv.open)
+        snap_close(&sv.snap);
+    free(sv.rows);
+    free(sv.out);
+    return rc;
+}
+
+// ---- client ----
+
+int srv_connect(const char* socket_path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int srv_call(int fd, uint8_t op, const void* body, uint32_t body_len, uint8_t** resp, uint32_t* cap,
+             uint32_t* resp_len)
+{
+    uint8_t req[SRV_MAX_REQUEST];
+    if (SRV_HDR + body_len > sizeof(req))
+        return -1;
+    put_u32(req, 4 + body_len);
+    req[4] = op;
+    memset(req + 5, 0, 3);
+    if (body_len)
+        memcpy(req + SRV_HDR, body, body_len);
+    uint8_t hdr[SRV_HDR];
+    if (write_full(fd, req, SRV_HDR + body_len) != 0 || read_full(fd, hdr, SRV_HDR) != 0)
+        return -1;
+    uint32_t len = get_u32(hdr);
+    if (len < 4)
+        return -1;
+    *resp_len = len - 4;
+    if (*resp_len > *cap) {
+        uint8_t* tmp = realloc(*resp, *resp_len);
+        if (!tmp)
+            return -1;
+        *resp = tmp;
+        *cap = *resp_len;
+    }
+    if (*resp_len && read_full(fd, *resp, *resp_len) != 0)
+        return -1;
+    return hdr[4];
+}
@@ -0,0 +1,339 @@
+#define _GNU_SOURCE     // copy_file_range
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "build_bplus.h"
+#include "bench.h"
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)  // linux/fs.h, which clashes with BLOCK_SIZE
+#endif
+
+// this file is for snapshots: swaps of a table and its index for changed
+// copies, and readers that open one consistent version of both.
+
+// fd is still the file that goes by path
+static int same_file(int fd, const char* path)
+{
+    struct stat a, b;
+    return fstat(fd, &a) == 0 && stat(path, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+// ---- readers ----
+
+static void stamp_of(const struct stat* st, SnapStamp* out)
+{
+    out->ino = (uint64_t)st->st_ino;
+    out->size = (uint64_t)st->st_size;
+    out->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+// path is no longer the file seen at open, or it was written since
+static int changed(const char* path, const SnapStamp* at)
+{
+    struct stat st;
+    SnapStamp now;
+    if (stat(path, &st) != 0)
+        return at->ino != 0;
+    stamp_of(&st, &now);
+    return now.ino != at->ino || now.size != at->size || now.mtime_ns != at->mtime_ns;
+}
+
+// one attempt: 0 = consistent, 1 = a swap is in flight, -1 = error
+static int snap_try(Snapshot* s, int buf_frames, int* behind)
+{
+    *behind = 0;
+    // the index first: it is renamed last, so a heap of its generation
+    // opened after it is complete with its maps
+    s->has_index = access("btree.db", F_OK) == 0 && btfm_open(&s->ix, "btree.db", NODE_SIZE) == 0;
+    struct stat st;
+    memset(&s->ix_at, 0, sizeof(SnapStamp));
+    if (s->has_index && fstat(fileno(s->ix.fp), &st) == 0)
+        stamp_of(&st, &s->ix_at);
+    if (hf_open(&s->hf, s->path, buf_frames) != 0) {
+        if (s->has_index)
+            btfm_close(&s->ix);
+        return -1;
+    }
+    if (fstat(fileno(s->hf.fm.fp), &st) == 0)
+        stamp_of(&st, &s->heap_at);
+    s->generation = s->hf.generation;
+    int moved = !same_file(fileno(s->hf.fm.fp), s->path);
+    if (s->has_index) {
+        BtreeMeta meta;
+        moved |= !same_file(fileno(s->ix.fp), "btree.db");
+        int ok = btfm_read_meta(&s->ix, &meta) == 0;
+        if (!ok || meta.generation != s->generation) {
+            *behind = ok && meta.generation < s->generation;
+            btfm_close(&s->ix);
+            s->has_index = 0;
+        }
+    }
+    if (moved) {
+        snap_close(s);
+        return 1;
+    }
+    return 0;
+}
+
+int snap_open(Snapshot* s, const char* db_path, int buf_frames)
+{
+    memset(s, 0, sizeof(Snapshot));
+    snprintf(s->path, sizeof(s->path), "%s", db_path);
+    double t0 = bench_now_ms();
+    for (;;) {
+        int behind;
+        int rc = snap_try(s, buf_frames, &behind);
+        if (rc < 0)
+            return -1;
+        // an index one generation behind is most likely about to be renamed
+        // into place; a heap that moved is opened again right away
+        if (rc == 0 && (!behind || bench_now_ms() - t0 >= SNAP_SWAP_WAIT_MS))
+            return 0;
+        if (rc == 0)
+            snap_close(s);
+        s->retries++;
+        usleep(1000);
+    }
+}
+
+void snap_close(Snapshot* s)
+{
+    if (s->has_index)
+        btfm_close(&s->ix);
+    s->has_index = 0;
+    if (s->hf.fm.fp)
+        hf_close(&s->hf);
+    s->hf.fm.fp = NULL;
+}
+
+int snap_stale(const Snapshot* s)
+{
+    // a turned down index is checked too: it may since have got the generation
+    return changed(s->path, &s->heap_at) || changed("btree.db", &s->ix_at);
+}
+
+// ---- delete on a copy ----
+
+// from is copied to to and synced; a missing from is only an error if required.
+// a file system that shares extents (btrfs, xfs) clones it without copying
+// data; otherwise the kernel copies it, read and write are the last resort
+static int copy_synced(const char* from, const char* to, int required)
+{
+    int in = open(from, O_RDONLY);
+    if (in < 0)
+        return required ? -1 : 0;
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+    static char buf[1 << 16];
+    ssize_t n = 0;
+    int rc = 0;
+    if (ioctl(out, FICLONE, in) != 0) {
+        struct stat sb;
+        off_t done = 0;
+        if (fstat(in, &sb) != 0)
+            rc = -1;
+        while (rc == 0 && done < sb.st_size &&
+               (n = copy_file_range(in, NULL, out, NULL, (size_t)(sb.st_size - done), 0)) > 0)
+            done += n;
+        // nothing copied (a kernel or file system without it): by hand
+        if (rc == 0 && done == 0 && sb.st_size > 0) {
+            while (rc == 0 && (n = read(in, buf, sizeof(buf))) > 0) {
+                if (write(out, buf, (size_t)n) != n)
+                    rc = -1;
+            }
+        } else if (rc == 0 && done < sb.st_size) {
+            rc = -1;
+        }
+    }
+    if (n < 0 || fsync(out) != 0)
+        rc = -1;
+    close(in);
+    if (close(out) != 0)
+        rc = -1;
+    return rc;
+}
+
+static int sync_path(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+static int index_generation(const char* path, uint64_t* generation)
+{
+    BtreeFileManager ix;
+    BtreeMeta meta;
+    if (access(path, F_OK) != 0 || btfm_open(&ix, path, NODE_SIZE) != 0)
+        return -1;
+    int rc = btfm_read_meta(&ix, &meta);
+    btfm_close(&ix);
+    *generation = meta.generation;
+    return rc;
+}
+
+static void remove_copy(const char* copy)
+{
+    static const char* suffix[] = {"", ".zm", ".fsm", ".wal"};
+    char path[620];
+    for (int i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "%s%s", copy, suffix[i]);
+        remove(path);
+    }
+    remove("btree.db.new");
+}
+
+// a crash between the renames of an earlier swap: the heap copy is gone, so
+// the heap is in place, and the maps and the index left of the copy belong to
+// it. they are renamed after it, the index only if it carries the heap's
+// generation. otherwise a crash before the heap rename left the original
+static void finish_swap(const char* db_path, const char* copy, uint64_t generation)
+{
+    if (access(copy, F_OK) == 0)
+        return;
+    static const char* maps[] = {".zm", ".fsm"};
+    char from[620], to[620];
+    for (int i = 0; i < 2; i++) {
+        snprintf(from, sizeof(from), "%s%s", copy, maps[i]);
+        snprintf(to, sizeof(to), "%s%s", db_path, maps[i]);
+        if (access(from, F_OK) == 0)
+            rename(from, to);
+    }
+    uint64_t g;
+    if (index_generation("btree.db.new", &g) == 0 && g == generation &&
+        (index_generation("btree.db", &g) != 0 || g != generation))
+        rename("btree.db.new", "btree.db");
+}
+
+// the copy, the delete and the swap, with the table settled at generation
+static int delete_swapped(const char* db_path, uint64_t generation, RecordLocation* locs, size_t n,
+                          SnapDeleteStats* st, double t0)
+{
+    char copy[600], from[620], to[620];
+    snprintf(copy, sizeof(copy), "%s.new", db_path);
+    HeapFile hf;
+    static const char* maps[] = {"", ".zm", ".fsm"};
+    int rc = 0;
+    for (int i = 0; i < 3 && rc == 0; i++) {
+        snprintf(from, sizeof(from), "%s%s", db_path, maps[i]);
+        snprintf(to, sizeof(to), "%s%s", copy, maps[i]);
+        rc = copy_synced(from, to, i == 0);
+    }
+    if (rc == 0)
+        rc = copy_synced("btree.db", "btree.db.new", 1);
+    if (rc != 0) {
+        fprintf(stderr, "Failed to copy %s and its index\n", db_path);
+        remove_copy(copy);
+        return -1;
+    }
+    st->copy_ms = bench_now_ms() - t0;
+
+    // the delete itself, on the copies: nobody else has them open
+    if (hf_open(&hf, copy, 64) != 0) {
+        remove_copy(copy);
+        return -1;
+    }
+    // files without a header page have no generation, only the renames protect them
+    if (hf.has_header) {
+        hf.generation = generation + 1;
+        hf.header_dirty = 1;
+    }
+    rc = batch_delete_at(&hf, "btree.db.new", locs, n, &st->del);
+    if (rc == 0) {
+        BtreeFileManager ix;
+        BtreeMeta meta;
+        rc = btfm_open(&ix, "btree.db.new", NODE_SIZE);
+        if (rc == 0) {
+            if (btfm_read_meta(&ix, &meta) != 0)
+                rc = -1;
+            meta.generation = hf.generation;
+            if (rc == 0 && (btfm_write_meta(&ix, &meta) != 0 || fflush(ix.fp) != 0 || fsync(fileno(ix.fp)) != 0))
+                rc = -1;
+            if (btfm_close(&ix) != 0)
+                rc = -1;
+        }
+    }
+    // closing writes the last blocks, the maps and the header; then to disk
+    hf_close(&hf);
+    for (int i = 0; i < 3 && rc == 0; i++) {
+        snprintf(to, sizeof(to), "%s%s", copy, maps[i]);
+        rc = sync_path(to);
+    }
+    double t2 = bench_now_ms();
+    if (rc != 0) {
+        fprintf(stderr, "Delete on the copy of %s failed, the table is unchanged\n", db_path);
+        remove_copy(copy);
+        return -1;
+    }
+
+    // the swap: heap, maps, index. a reader in between sees a heap newer than
+    // its index and opens again
+    for (int i = 0; i < 3 && rc == 0; i++) {
+        snprintf(from, sizeof(from), "%s%s", copy, maps[i]);
+        snprintf(to, sizeof(to), "%s%s", db_path, maps[i]);
+        if (rename(from, to) != 0 && i == 0)
+            rc = -1;
+    }
+    if (rc == 0 && rename("btree.db.new", "btree.db") != 0)
+        rc = -1;
+    snprintf(from, sizeof(from), "%s.wal", copy);
+    remove(from);
+    st->swap_ms = bench_now_ms() - t2;
+    st->generation = hf.generation;
+    if (rc != 0)
+        fprintf(stderr, "Failed to swap in the new version of %s\n", db_path);
+    return rc;
+}
+
+int snap_delete(const char* db_path, RecordLocation* locs, size_t n, SnapDeleteStats* st)
+{
+    memset(st, 0, sizeof(SnapDeleteStats));
+    char copy[600];
+    snprintf(copy, sizeof(copy), "%s.new", db_path);
+
+    // settle the table first: a pending log is replayed, buffered pages written
+    double t0 = bench_now_ms();
+    HeapFile hf;
+    if (hf_open(&hf, db_path, 64) != 0) {
+        fprintf(stderr, "Failed to open database file: %s\n", db_path);
+        return -1;
+    }
+    int busy = hf.read_only;
+    uint64_t generation = hf.generation;
+    hf_close(&hf);
+    // a writer would go on writing to the file the swap unlinks: none may
+    // run now, and none may start until the swap is done
+    int lock = busy ? -2 : wal_lock(db_path);
+    if (lock == -2) {
+        fprintf(stderr, "%s has a running writer, not deleting\n", db_path);
+        return -1;
+    }
+    // what a crash during an earlier swap left behind
+    finish_swap(db_path, copy, generation);
+    remove_copy(copy);
+    // an index of another version would be relabelled as the new one
+    uint64_t ix_generation;
+    int rc = -1;
+    if (index_generation("btree.db", &ix_generation) != 0)
+        fprintf(stderr, "No usable btree.db, run build_bplus first\n");
+    else if (ix_generation != generation)
+        fprintf(stderr, "btree.db is of generation %llu, %s of %llu: run build_bplus first\n",
+                (unsigned long long)ix_generation, db_path, (unsigned long long)generation);
+    else
+        rc = delete_swapped(db_path, generation, locs, n, st, t0);
+    if (lock >= 0)
+        close(lock);
+    return rc;
+}
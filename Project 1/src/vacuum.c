@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vacuum.h"
+#include "compress.h"
+#include "scan_kernel.h"
+#include "bptree.h"
+#include "file_manager_btree.h"
+#include "bench.h"
+
+// this file is for the vacuum: compact the heap, cut the file, remap the index.
+
+typedef struct {
+    uint32_t old_block, new_block;
+    uint16_t old_slot, new_slot;
+} RidMove;
+
+typedef struct {
+    RidMove* v;
+    size_t   n, cap;
+} MoveList;
+
+static int move_add(MoveList* m, uint32_t ob, uint16_t os, uint32_t nb, uint16_t ns)
+{
+    if (m->n == m->cap) {
+        size_t cap = m->cap ? m->cap * 2 : 1024;
+        RidMove* tmp = realloc(m->v, cap * sizeof(RidMove));
+        if (!tmp)
+            return -1;
+        m->v = tmp;
+        m->cap = cap;
+    }
+    RidMove* e = &m->v[m->n++];
+    e->old_block = ob;
+    e->old_slot = os;
+    e->new_block = nb;
+    e->new_slot = ns;
+    return 0;
+}
+
+static int move_cmp(const void* a, const void* b)
+{
+    const RidMove* x = a;
+    const RidMove* y = b;
+    if (x->old_block != y->old_block)
+        return x->old_block < y->old_block ? -1 : 1;
+    return (int)x->old_slot - (int)y->old_slot;
+}
+
+// remap table: the moves sorted by old rid, plus where each old block's moves start
+typedef struct {
+    const RidMove* v;
+    size_t   n;
+    uint32_t lo, hi;           // old blocks [lo, hi] have moves
+    size_t*  start;            // start[b - lo] .. start[b - lo + 1]
+} RemapTable;
+
+static int remap_build(RemapTable* t, MoveList* m)
+{
+    memset(t, 0, sizeof(RemapTable));
+    if (m->n == 0)
+        return 0;
+    qsort(m->v, m->n, sizeof(RidMove), move_cmp);
+    t->v = m->v;
+    t->n = m->n;
+    t->lo = m->v[0].old_block;
+    t->hi = m->v[m->n - 1].old_block;
+    t->start = malloc(((size_t)(t->hi - t->lo) + 2) * sizeof(size_t));
+    if (!t->start)
+        return -1;
+    size_t i = 0;
+    for (uint32_t b = t->lo; b <= t->hi; b++) {
+        t->start[b - t->lo] = i;
+        while (i < m->n && m->v[i].old_block == b)
+            i++;
+    }
+    t->start[t->hi - t->lo + 1] = m->n;
+    return 0;
+}
+
+static const RidMove* remap_find(const RemapTable* t, uint32_t block_id, uint16_t slot_id)
+{
+    if (t->n == 0 || block_id < t->lo || block_id > t->hi)
+        return NULL;
+    size_t lo = t->start[block_id - t->lo], hi = t->start[block_id - t->lo + 1];
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (t->v[mid].old_slot == slot_id)
+            return &t->v[mid];
+        if (t->v[mid].old_slot < slot_id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+// one pass over the leaf chain; keys do not change, so neither do the
+// separators or the subtree aggregates
+static int remap_index(const char* btree_filename, const RemapTable* t, VacuumStats* st)
+{
+    FILE* probe = fopen(btree_filename, "rb");
+    if (!probe)
+        return 0;
+    fclose(probe);
+
+    BtreeFileManager btfm;
+    BtreeMeta meta;
+    if (btfm_open(&btfm, btree_filename, NODE_SIZE) != 0)
+        return -1;
+    if (btfm_read_meta(&btfm, &meta) != 0) {
+        btfm_close(&btfm);
+        return 0;
+    }
+    st->index_found = 1;
+
+    Node leaf;
+    uint32_t id = meta.root_id == BTREE_NO_NODE ? BTREE_NO_NODE : meta.first_leaf;
+    while (id != BTREE_NO_NODE && t->n > 0) {
+        if (btfm_read_node(&btfm, id, &leaf) != 0) {
+            fprintf(stderr, "Failed to read leaf node %u\n", id);
+            btfm_close(&btfm);
+            return -1;
+        }
+        int changed = 0;
+        for (int i = 0; i < leaf.key_count; i++) {
+            uint32_t b;
+            uint16_t s;
+            leaf_get_record(&leaf, i, &b, &s);
+            const RidMove* m = remap_find(t, b, s);
+            if (!m)
+                continue;
+            leaf_set_record(&leaf, i, m->new_block, m->new_slot);
+            changed = 1;
+            st->index_remapped++;
+        }
+        if (changed && btfm_write_node(&btfm, &leaf) != 0) {
+            btfm_close(&btfm);
+            return -1;
+        }
+        uint32_t next = leaf_get_next(&leaf);
+        id = next == id ? BTREE_NO_NODE : next;
+    }
+    btfm_close(&btfm);
+    return 0;
+}
+
+// a compressed block built from the staged rows goes to its place, old rid -> new rid
+typedef struct {
+    uint32_t* ids;             // the compressed blocks, in file order
+    uint32_t  n_ids;
+    uint32_t  consumed;        // ids[0 .. consumed) have been read
+    uint32_t  built, placed;   // blocks finished, blocks written to their place
+    Block*    queue;           // built but not placed yet: the place is still unread
+    uint32_t  q_cap;
+    uint32_t  old_block[CBLOCK_MAX_ROWS];
+    uint16_t  old_slot[CBLOCK_MAX_ROWS];
+} PackedMerge;
+
+static int place_built(HeapFile* hf, PackedMerge* pm)
+{
+    while (pm->placed < pm->built && pm->placed < pm->consumed) {
+        Block* d = bp_fetch(&hf->bp, pm->ids[pm->placed]);
+        if (!d)
+            return -1;
+        *d = pm->queue[pm->placed % pm->q_cap];
+        bp_mark_dirty(&hf->bp, pm->ids[pm->placed]);
+        pm->placed++;
+    }
+    return 0;
+}
+
+static int finish_built(HeapFile* hf, PackedMerge* pm, CBlockBuilder* cb, MoveList* moves)
+{
+    // at most q_cap blocks wait at a time, the queue is a ring
+    if (pm->built - pm->placed == pm->q_cap) {
+        Block* tmp = malloc((size_t)pm->q_cap * 2 * sizeof(Block));
+        if (!tmp)
+            return -1;
+        for (uint32_t k = pm->placed; k < pm->built; k++)
+            tmp[k % (pm->q_cap * 2)] = pm->queue[k % pm->q_cap];
+        free(pm->queue);
+        pm->queue = tmp;
+        pm->q_cap *= 2;
+    }
+    uint32_t to = pm->ids[pm->built];
+    int rows = cb->n_rows;
+    cblock_builder_finish(cb, &pm->queue[pm->built % pm->q_cap]);
+    for (int i = 0; i < rows; i++) {
+        if ((pm->old_block[i] != to || pm->old_slot[i] != i) &&
+            move_add(moves, pm->old_block[i], pm->old_slot[i], to, (uint16_t)i) != 0)
+            return -1;
+    }
+    pm->built++;
+    return place_built(hf, pm);
+}
+
+// runs the live rows of the compressed blocks through a builder in file order:
+// blocks = how many blocks they fill. with pm, the blocks are also written
+static int merge_pass(HeapFile* hf, PackedMerge* pm, uint32_t* blocks, MoveList* moves)
+{
+    CBlockBuilder cb;
+    if (cblock_builder_init(&cb, &hf->schema) != 0)
+        return -1;
+    Block staged, scratch;
+    uint8_t recbuf[512];
+    uint16_t sel[SEL_MAX];
+    uint32_t n_out = 0;
+    int rc = 0;
+    for (uint32_t i = 0; i < pm->n_ids && rc == 0; i++) {
+        Block* cur = bp_fetch(&hf->bp, pm->ids[i]);
+        if (!cur) {
+            rc = -1;
+            break;
+        }
+        staged = *cur;
+        if (moves)
+            pm->consumed = i + 1;
+        int n = block_live_slots(&staged, &hf->schema, sel);
+        for (int k = 0; k < n && rc == 0; k++) {
+            if (block_get_record(&staged, &hf->schema, sel[k], recbuf) != 0) {
+                rc = -1;
+                break;
+            }
+            if (cblock_builder_add(&cb, recbuf) != 0) {
+                n_out++;
+                if (moves)
+                    rc = finish_built(hf, pm, &cb, moves);
+                else
+                    cblock_builder_finish(&cb, &scratch);
+                if (rc != 0 || cblock_builder_add(&cb, recbuf) != 0) {
+                    rc = -1;
+                    break;
+                }
+            }
+            pm->old_block[cb.n_rows - 1] = pm->ids[i];
+            pm->old_slot[cb.n_rows - 1] = sel[k];
+        }
+    }
+    if (rc == 0 && cb.n_rows > 0) {
+        n_out++;
+        if (moves)
+            rc = finish_built(hf, pm, &cb, moves);
+    }
+    cblock_builder_free(&cb);
+    *blocks = n_out;
+    return rc;
+}
+
+// compressed blocks with dead rows are merged: their live rows are encoded
+// again, in file order, into as few compressed blocks as they fill, which take
+// the places of the first ones. the places left over become empty row blocks
+// for the two fingers to fill or cut off
+static int merge_packed(HeapFile* hf, uint8_t new_fmt, MoveList* moves, VacuumStats* st)
+{
+    PackedMerge pm;
+    memset(&pm, 0, sizeof(pm));
+    int dead = 0;
+    pm.ids = malloc((hf->n_blocks ? hf->n_blocks : 1) * sizeof(uint32_t));
+    if (!pm.ids)
+        return -1;
+    for (uint32_t b = 0; b < hf->n_blocks; b++) {
+        Block* cur = bp_fetch(&hf->bp, b);
+        if (!cur) {
+            free(pm.ids);
+            return -1;
+        }
+        if (block_format(cur) != BLOCK_FMT_PACKED)
+            continue;
+        pm.ids[pm.n_ids++] = b;
+        dead |= (block_flags(cur) & BLOCK_FLAG_HAS_DEAD) != 0;
+    }
+    if (!dead) {
+        free(pm.ids);
+        return 0;
+    }
+
+    // a dry run first: merged rows could in theory need wider encodings than
+    // they had, and more blocks than there are places
+    uint32_t need;
+    int rc = merge_pass(hf, &pm, &need, NULL);
+    if (rc == 0 && need > pm.n_ids) {
+        // then each block is only re-encoded on its own
+        int16_t new_slot[CBLOCK_MAX_ROWS];
+        for (uint32_t i = 0; i < pm.n_ids && rc == 0; i++) {
+            Block* cur = bp_fetch(&hf->bp, pm.ids[i]);
+            if (!cur || !(block_flags(cur) & BLOCK_FLAG_HAS_DEAD))
+                continue;
+            int used = block_used_count(cur);
+            if (cblock_compact(cur, &hf->schema, new_slot) < 0) {
+                rc = -1;
+                break;
+            }
+            bp_mark_dirty(&hf->bp, pm.ids[i]);
+            st->packed_compacted++;
+            for (int k = 0; k < used && rc == 0; k++) {
+                if (new_slot[k] >= 0 && new_slot[k] != k)
+                    rc = move_add(moves, pm.ids[i], (uint16_t)k, pm.ids[i], (uint16_t)new_slot[k]);
+            }
+        }
+        st->packed_after = pm.n_ids;
+        free(pm.ids);
+        return rc;
+    }
+
+    pm.q_cap = 16;
+    pm.queue = malloc(pm.q_cap * sizeof(Block));
+    if (rc == 0 && !pm.queue)
+        rc = -1;
+    if (rc == 0)
+        rc = merge_pass(hf, &pm, &need, moves);
+    if (rc == 0)
+        rc = place_built(hf, &pm);
+    for (uint32_t i = need; i < pm.n_ids && rc == 0; i++) {
+        Block* d = bp_fetch(&hf->bp, pm.ids[i]);
+        if (!d) {
+            rc = -1;
+            break;
+        }
+        block_init(d, new_fmt);
+        bp_mark_dirty(&hf->bp, pm.ids[i]);
+    }
+    st->packed_compacted = pm.n_ids;
+    st->packed_after = need;
+    free(pm.queue);
+    free(pm.ids);
+    return rc;
+}
+
+// what every block holds
+static int count_blocks(HeapFile* hf, int* live, int* room, VacuumStats* st)
+{
+    for (uint32_t b = 0; b < hf->n_blocks; b++) {
+        Block* cur = bp_fetch(&hf->bp, b);
+        if (!cur)
+            return -1;
+        live[b] = block_live_count(cur, &hf->schema);
+        room[b] = block_free_slots(cur, &hf->schema);
+        st->live_records += live[b];
+    }
+    return 0;
+}
+
+static int is_row_block(HeapFile* hf, uint32_t b)
+{
+    Block* cur = bp_fetch(&hf->bp, b);
+    return cur && block_format(cur) != BLOCK_FMT_PACKED;
+}
+
+int hf_vacuum(HeapFile* hf, const char* btree_filename, VacuumStats* st)
+{
+    memset(st, 0, sizeof(VacuumStats));
+    if (!hf)
+        return -1;
+    // records move without being logged: start from an empty log
+    if (hf->wal && hf_checkpoint(hf) != 0)
+        return -1;
+    if (hf_new_generation(hf) != 0)
+        return -1;
+    uint32_t n = hf->n_blocks;
+    st->blocks_before = n;
+
+    double t0 = bench_now_ms();
+    uint8_t new_fmt = hf->layout == BLOCK_FMT_PACKED ? BLOCK_FMT_NSM : hf->layout;
+    int* live = malloc((n ? n : 1) * sizeof(int));
+    int* room = malloc((n ? n : 1) * sizeof(int));
+    MoveList moves = {0};
+    if (!live || !room || merge_packed(hf, new_fmt, &moves, st) != 0 || count_blocks(hf, live, room, st) != 0) {
+        free(live);
+        free(room);
+        free(moves.v);
+        return -1;
+    }
+
+    // two fingers: dst walks up to the next block with room, src walks down to
+    // the next row block with records; a record moves from src to dst until they meet
+    uint8_t recbuf[512];
+    uint32_t dst = 0, src = n;
+    int rc = 0;
+    while (rc == 0) {
+        while (src > dst && !(live[src - 1] > 0 && is_row_block(hf, src - 1)))
+            src--;
+        while (dst + 1 < src && !(live[dst] == 0 || (room[dst] > 0 && is_row_block(hf, dst))))
+            dst++;
+        if (dst + 1 >= src)
+            break;
+
+        Block* d = bp_fetch(&hf->bp, dst);
+        if (!d) {
+            rc = -1;
+            break;
+        }
+        if (live[dst] == 0) {
+            // an empty block of any kind starts over as a row block
+            block_init(d, new_fmt);
+            room[dst] = block_capacity(d, &hf->schema);
+            bp_mark_dirty(&hf->bp, dst);
+        }
+
+        Block* sb = bp_fetch(&hf->bp, src - 1);
+        int from = sb ? block_pop_record(sb, &hf->schema, recbuf) : -1;
+        if (from < 0) {
+            rc = -1;
+            break;
+        }
+        bp_mark_dirty(&hf->bp, src - 1);
+        live[src - 1]--;
+
+        d = bp_fetch(&hf->bp, dst);
+        int to = d ? block_insert_record(d, &hf->schema, recbuf) : -1;
+        if (to < 0) {
+            rc = -1;
+            break;
+        }
+        bp_mark_dirty(&hf->bp, dst);
+        live[dst]++;
+        room[dst]--;
+        st->moved++;
+        rc = move_add(&moves, src - 1, (uint16_t)from, dst, (uint16_t)to);
+    }
+
+    uint32_t keep = n;
+    while (keep > 0 && live[keep - 1] == 0)
+        keep--;
+    free(live);
+    free(room);
+    double t1 = bench_now_ms();
+    st->move_ms = t1 - t0;
+    if (rc != 0) {
+        free(moves.v);
+        fprintf(stderr, "Failed to move records\n");
+        return -1;
+    }
+
+    // the index follows the records that moved
+    RemapTable table;
+    if (remap_build(&table, &moves) != 0 || remap_index(btree_filename, &table, st) != 0) {
+        free(table.start);
+        free(moves.v);
+        fprintf(stderr, "Failed to remap the B+ tree index\n");
+        return -1;
+    }
+    free(table.start);
+    free(moves.v);
+    double t2 = bench_now_ms();
+    st->index_ms = t2 - t1;
+
+    // write everything back, cut the empty tail, tighten the zone map
+    if (bp_flush_all(&hf->bp) != 0)
+        return -1;
+    bp_discard_from(&hf->bp, keep);
+    if (keep < n && fm_truncate(&hf->fm, keep) != 0) {
+        fprintf(stderr, "Failed to truncate %s\n", hf->fm.path);
+        return -1;
+    }
+    hf->n_blocks = keep;
+    hf->header_dirty = 1;
+    st->blocks_after = keep;
+    if (hf_build_zonemap(hf) != 0 || hf_build_fsm(hf) != 0 || hf_sync_meta(hf) != 0)
+        return -1;
+    if (hf->wal && fm_sync(&hf->fm) != 0)
+        return -1;
+    // the heap is complete again, snapshots may use the index with it
+    if (hf_stamp_index(hf, btree_filename) != 0)
+        return -1;
+    st->flush_ms = bench_now_ms() - t2;
+    return 0;
+}
+
+void vacuum_print(const VacuumStats* st)
+{
+    printf("Vacuum: %llu live records, %u -> %u blocks\n",
+           (unsigned long long)st->live_records, st->blocks_before, st->blocks_after);
+    printf("  move  %10.3f ms  (%llu records moved, %u compressed blocks re-encoded into %u)\n",
+           st->move_ms, (unsigned long long)st->moved, st->packed_compacted, st->packed_after);
+    if (st->index_found)
+        printf("  index %10.3f ms  (%llu entries remapped in one leaf pass)\n",
+               st->index_ms, (unsigned long long)st->index_remapped);
+    else
+        printf("  index %10.3f ms  (no index)\n", st->index_ms);
+    printf("  flush %10.3f ms  (truncate, zone map, free-space map)\n", st->flush_ms);
+}
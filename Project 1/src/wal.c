@@ -0,0 +1,819 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "wal.h"
+#include "bench.h"
+
+// this file is for the write-ahead log: update records, group commit and recovery.
+
+#define WAL_MAX_RANGES 512
+#define WAL_RANGE_GAP 8     // equal bytes that still join two changed ranges
+
+// ---- crc32 (reflected, polynomial 0xEDB88320) ----
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_of(const uint8_t* p, size_t n)
+{
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < n; i++)
+        c = crc_table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+static void log_path(char* out, size_t n, const char* db_path)
+{
+    snprintf(out, n, "%s.wal", db_path);
+}
+
+static int write_file_header(int fd, uint64_t start_lsn)
+{
+    uint8_t h[WAL_HDR_SIZE];
+    uint32_t version = WAL_VERSION;
+    memcpy(h, WAL_MAGIC, 4);
+    memcpy(h + 4, &version, 4);
+    memcpy(h + 8, &start_lsn, 8);
+    return pwrite(fd, h, WAL_HDR_SIZE, 0) == WAL_HDR_SIZE ? 0 : -1;
+}
+
+static int write_all(int fd, const uint8_t* p, size_t n, off_t off)
+{
+    while (n > 0) {
+        ssize_t w = pwrite(fd, p, n, off);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += w;
+        n -= (size_t)w;
+        off += w;
+    }
+    return 0;
+}
+
+// ---- the writer lock ----
+
+// opens the log at path and takes the lock on it. a flock belongs to the inode,
+// and a checkpoint renames a new log over the old one (locked before the
+// rename), so a lock won on a file that is no longer the log is dropped and
+// the new one tried. -1 with *busy set if another process holds it
+static int lock_log(const char* path, int flags, int* busy)
+{
+    *busy = 0;
+    for (;;) {
+        int fd = open(path, flags, 0644);
+        if (fd < 0)
+            return -1;
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            *busy = errno == EWOULDBLOCK;
+            close(fd);
+            return -1;
+        }
+        struct stat a, b;
+        if (fstat(fd, &a) == 0 && stat(path, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+            return fd;
+        close(fd);
+    }
+}
+
+int wal_lock(const char* db_path)
+{
+    char path[512];
+    int busy;
+    log_path(path, sizeof(path), db_path);
+    int fd = lock_log(path, O_RDWR, &busy);
+    return fd >= 0 ? fd : busy ? -2 : -1;
+}
+
+// ---- writing ----
+
+int wal_open(Wal* w, const char* db_path)
+{
+    memset(w, 0, sizeof(Wal));
+    pthread_once(&crc_once, crc_init);
+    log_path(w->path, sizeof(w->path), db_path);
+    int busy;
+    w->fd = lock_log(w->path, O_RDWR | O_CREAT, &busy);
+    if (w->fd < 0) {
+        if (busy)
+            fprintf(stderr, "%s is in use by another process\n", w->path);
+        else
+            fprintf(stderr, "Failed to open %s\n", w->path);
+        return -1;
+    }
+    struct stat sb;
+    uint8_t h[WAL_HDR_SIZE];
+    if (fstat(w->fd, &sb) == 0 && sb.st_size >= WAL_HDR_SIZE && pread(w->fd, h, WAL_HDR_SIZE, 0) == WAL_HDR_SIZE &&
+        memcmp(h, WAL_MAGIC, 4) == 0) {
+        memcpy(&w->start_lsn, h + 8, 8);
+        w->end_lsn = w->start_lsn + (uint64_t)(sb.st_size - WAL_HDR_SIZE);
+    } else {
+        // lsn 0 stays free to mean "none"
+        w->start_lsn = w->end_lsn = WAL_HDR_SIZE;
+        if (ftruncate(w->fd, 0) != 0 || write_file_header(w->fd, w->start_lsn) != 0) {
+            close(w->fd);
+            return -1;
+        }
+    }
+    w->flushed_lsn = w->commit_lsn = w->end_lsn;
+    w->ckpt_lsn = w->start_lsn;
+    w->next_txn = 1;
+    w->group_commits = WAL_GROUP_COMMITS;
+    w->group_usec = WAL_GROUP_USEC;
+    pthread_mutex_init(&w->mu, NULL);
+    pthread_cond_init(&w->done, NULL);
+    pthread_cond_init(&w->joined, NULL);
+    return 0;
+}
+
+int wal_close(Wal* w)
+{
+    if (w->fd < 0)
+        return -1;
+    int rc = wal_force(w, UINT64_MAX);
+    close(w->fd);
+    w->fd = -1;
+    free(w->buf);
+    free(w->spare);
+    pthread_cond_destroy(&w->done);
+    pthread_cond_destroy(&w->joined);
+    pthread_mutex_destroy(&w->mu);
+    return rc;
+}
+
+// room for n more bytes in buf, mu held
+static uint8_t* reserve(Wal* w, size_t n)
+{
+    if (w->len + n > w->cap) {
+        size_t cap = w->cap ? w->cap : 1 << 16;
+        while (cap < w->len + n)
+            cap *= 2;
+        uint8_t* tmp = realloc(w->buf, cap);
+        if (!tmp)
+            return NULL;
+        w->buf = tmp;
+        w->cap = cap;
+    }
+    uint8_t* p = w->buf + w->len;
+    w->len += n;
+    w->end_lsn += n;
+    return p;
+}
+
+static void put_header(uint8_t* p, uint32_t len, uint8_t type, uint8_t file, uint32_t page, uint64_t txn)
+{
+    memcpy(p, &len, 4);
+    p[4] = type;
+    p[5] = file;
+    p[6] = p[7] = 0;
+    memcpy(p + 8, &page, 4);
+    memcpy(p + 12, &txn, 8);
+}
+
+// the leader writes buf while the others keep appending to the spare buffer.
+// called with mu held and leader set, returns with mu held and leader cleared
+static int group_write(Wal* w)
+{
+    uint8_t* out = w->buf;
+    size_t out_cap = w->cap, n = w->len;
+    uint64_t from = w->flushed_lsn;
+    w->buf = w->spare;
+    w->cap = w->spare_cap;
+    w->spare = NULL;
+    w->spare_cap = 0;
+    w->len = 0;
+    w->pending = 0;
+    pthread_mutex_unlock(&w->mu);
+
+    int rc = write_all(w->fd, out, n, (off_t)(WAL_HDR_SIZE + from - w->start_lsn));
+    if (rc == 0 && fsync(w->fd) != 0)
+        rc = -1;
+
+    pthread_mutex_lock(&w->mu);
+    w->spare = out;
+    w->spare_cap = out_cap;
+    if (rc == 0) {
+        w->flushed_lsn = from + n;
+        w->syncs++;
+        w->bytes += n;
+    } else {
+        fprintf(stderr, "Failed to write %s\n", w->path);
+    }
+    w->leader = 0;
+    pthread_cond_broadcast(&w->done);
+    return rc;
+}
+
+uint64_t wal_begin(Wal* w)
+{
+    pthread_mutex_lock(&w->mu);
+    uint64_t txn = w->next_txn++;
+    w->open_txns++;
+    w->active = txn;
+    w->active_first = 0;
+    pthread_mutex_unlock(&w->mu);
+    return txn;
+}
+
+int wal_force(Wal* w, uint64_t lsn)
+{
+    int rc = 0;
+    pthread_mutex_lock(&w->mu);
+    if (lsn > w->end_lsn)
+        lsn = w->end_lsn;
+    while (rc == 0 && w->flushed_lsn < lsn) {
+        if (w->leader) {
+            pthread_cond_wait(&w->done, &w->mu);
+            continue;
+        }
+        w->leader = 1;
+        rc = group_write(w);
+    }
+    pthread_mutex_unlock(&w->mu);
+    return rc;
+}
+
+int wal_commit(Wal* w, uint64_t txn, int wait)
+{
+    int rc = 0;
+    pthread_mutex_lock(&w->mu);
+    uint8_t* p = reserve(w, WAL_REC_HDR + 4);
+    if (!p) {
+        pthread_mutex_unlock(&w->mu);
+        return -1;
+    }
+    put_header(p, WAL_REC_HDR + 4, WAL_COMMIT, 0, 0, txn);
+    uint32_t crc = crc32_of(p, WAL_REC_HDR);
+    memcpy(p + WAL_REC_HDR, &crc, 4);
+    uint64_t mine = w->end_lsn;
+    w->commit_lsn = mine;
+    w->pending++;
+    w->commits++;
+    if (w->open_txns > 0)
+        w->open_txns--;
+    if (w->active == txn)
+        w->active = w->active_first = 0;
+    pthread_cond_broadcast(&w->joined);
+
+    if (!wait) {
+        if (w->pending >= w->group_commits && !w->leader) {
+            w->leader = 1;
+            rc = group_write(w);
+        }
+        pthread_mutex_unlock(&w->mu);
+        return rc;
+    }
+
+    while (rc == 0 && w->flushed_lsn < mine) {
+        if (w->leader) {
+            pthread_cond_wait(&w->done, &w->mu);
+            continue;
+        }
+        w->leader = 1;
+        // others are still running: give them a moment to join this write
+        if (w->open_txns > 0 && w->group_usec > 0) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += (long)w->group_usec * 1000;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec += until.tv_nsec / 1000000000L;
+                until.tv_nsec %= 1000000000L;
+            }
+            while (w->open_txns > 0 && w->pending < w->group_commits &&
+                   pthread_cond_timedwait(&w->joined, &w->mu, &until) == 0)
+                ;
+        }
+        rc = group_write(w);
+    }
+    pthread_mutex_unlock(&w->mu);
+    return rc;
+}
+
+int wal_truncate(Wal* w)
+{
+    int rc = wal_force(w, UINT64_MAX);
+    pthread_mutex_lock(&w->mu);
+    if (rc == 0 && w->len == 0) {
+        w->dropped += w->end_lsn - w->start_lsn;
+        w->start_lsn = w->ckpt_lsn = w->end_lsn;
+        if (ftruncate(w->fd, WAL_HDR_SIZE) != 0 || write_file_header(w->fd, w->start_lsn) != 0 || fsync(w->fd) != 0)
+            rc = -1;
+    }
+    pthread_mutex_unlock(&w->mu);
+    return rc;
+}
+
+int wal_truncate_before(Wal* w, uint64_t lsn)
+{
+    pthread_mutex_lock(&w->mu);
+    // the file must not change under the copy
+    while (w->leader)
+        pthread_cond_wait(&w->done, &w->mu);
+    if (lsn > w->flushed_lsn)
+        lsn = w->flushed_lsn;
+    if (lsn <= w->start_lsn) {
+        pthread_mutex_unlock(&w->mu);
+        return 0;
+    }
+    char tmp[520];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", w->path);
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    // the new log is locked before it gets the name, so the lock never lapses
+    int rc = fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) == 0 && write_file_header(fd, lsn) == 0 ? 0 : -1;
+    size_t chunk = 1 << 20;
+    uint8_t* buf = rc == 0 ? malloc(chunk) : NULL;
+    if (!buf)
+        rc = -1;
+    off_t from = (off_t)(WAL_HDR_SIZE + lsn - w->start_lsn), to = WAL_HDR_SIZE;
+    uint64_t left = w->flushed_lsn - lsn;
+    while (rc == 0 && left > 0) {
+        size_t n = left < chunk ? (size_t)left : chunk;
+        if (pread(w->fd, buf, n, from) != (ssize_t)n || write_all(fd, buf, n, to) != 0)
+            rc = -1;
+        from += (off_t)n;
+        to += (off_t)n;
+        left -= n;
+    }
+    free(buf);
+    // the rename swaps in the shorter log at once: a crash leaves one of the two
+    if (rc == 0 && (fsync(fd) != 0 || rename(tmp, w->path) != 0))
+        rc = -1;
+    if (rc == 0) {
+        close(w->fd);
+        w->fd = fd;
+        w->dropped += lsn - w->start_lsn;
+        w->start_lsn = lsn;
+    } else {
+        fprintf(stderr, "Failed to shorten %s\n", w->path);
+        if (fd >= 0) {
+            close(fd);
+            remove(tmp);
+        }
+    }
+    pthread_mutex_unlock(&w->mu);
+    return rc;
+}
+
+int wal_checkpoint_due(Wal* w)
+{
+    return w->ckpt_bytes > 0 && w->end_lsn - w->ckpt_lsn >= w->ckpt_bytes;
+}
+
+int wal_log_checkpoint(Wal* w, const WalDirty* dirty, uint32_t n, uint64_t* low)
+{
+    pthread_mutex_lock(&w->mu);
+    uint32_t n_open = w->active && w->active_first ? 1 : 0;
+    uint32_t total = WAL_REC_HDR + 4 + 16 * n + 4 + 16 * n_open + 4;
+    uint64_t at = w->end_lsn;
+    uint8_t* p = reserve(w, total);
+    if (!p) {
+        pthread_mutex_unlock(&w->mu);
+        return -1;
+    }
+    put_header(p, total, WAL_CHECKPOINT, 0, 0, 0);
+    uint8_t* q = p + WAL_REC_HDR;
+    uint64_t oldest = at;
+    memcpy(q, &n, 4);
+    q += 4;
+    for (uint32_t i = 0; i < n; i++) {
+        q[0] = dirty[i].file;
+        q[1] = q[2] = q[3] = 0;
+        memcpy(q + 4, &dirty[i].page, 4);
+        memcpy(q + 8, &dirty[i].rec_lsn, 8);
+        q += 16;
+        if (dirty[i].rec_lsn < oldest)
+            oldest = dirty[i].rec_lsn;
+    }
+    memcpy(q, &n_open, 4);
+    q += 4;
+    if (n_open) {
+        memcpy(q, &w->active, 8);
+        memcpy(q + 8, &w->active_first, 8);
+        q += 16;
+        if (w->active_first < oldest)
+            oldest = w->active_first;
+    }
+    uint32_t crc = crc32_of(p, total - 4);
+    memcpy(q, &crc, 4);
+    w->ckpt_lsn = at;
+    w->checkpoints++;
+    pthread_mutex_unlock(&w->mu);
+    *low = oldest;
+    return wal_force(w, UINT64_MAX);
+}
+
+int wal_log_update(Wal* w, uint64_t txn, uint8_t file, uint32_t page, const uint8_t* before,
+                   const uint8_t* after, size_t size, uint64_t* lsn, uint64_t* end)
+{
+    // changed ranges, short runs of equal bytes between two changes are included
+    uint16_t off[WAL_MAX_RANGES], len[WAL_MAX_RANGES];
+    int n = 0;
+    size_t payload = 2;
+    for (size_t i = 0; i < size;) {
+        if (before[i] == after[i]) {
+            i++;
+            continue;
+        }
+        size_t start = i, last = i;
+        for (size_t j = i + 1; j < size && j <= last + WAL_RANGE_GAP; j++)
+            if (before[j] != after[j])
+                last = j;
+        if (n == WAL_MAX_RANGES) {
+            // scattered changes all over the page: one range to the end
+            n--;
+            payload -= 4 + 2 * (size_t)len[n];
+            start = off[n];
+            last = size - 1;
+        }
+        off[n] = (uint16_t)start;
+        len[n] = (uint16_t)(last - start + 1);
+        payload += 4 + 2 * (size_t)len[n];
+        n++;
+        i = last + 1;
+    }
+    if (lsn)
+        *lsn = 0;
+    if (end)
+        *end = 0;
+    if (n == 0)
+        return 0;
+
+    uint32_t total = (uint32_t)(WAL_REC_HDR + payload + 4);
+    pthread_mutex_lock(&w->mu);
+    uint64_t at = w->end_lsn;
+    uint8_t* p = reserve(w, total);
+    if (!p) {
+        pthread_mutex_unlock(&w->mu);
+        return -1;
+    }
+    if (txn == w->active && !w->active_first)
+        w->active_first = at;
+    put_header(p, total, WAL_UPDATE, file, page, txn);
+    uint8_t* q = p + WAL_REC_HDR;
+    uint16_t nr = (uint16_t)n;
+    memcpy(q, &nr, 2);
+    q += 2;
+    for (int r = 0; r < n; r++) {
+        memcpy(q, &off[r], 2);
+        memcpy(q + 2, &len[r], 2);
+        memcpy(q + 4, before + off[r], len[r]);
+        memcpy(q + 4 + len[r], after + off[r], len[r]);
+        q += 4 + 2 * (size_t)len[r];
+    }
+    uint32_t crc = crc32_of(p, total - 4);
+    memcpy(q, &crc, 4);
+    if (lsn)
+        *lsn = at;
+    if (end)
+        *end = w->end_lsn;
+    pthread_mutex_unlock(&w->mu);
+    return 0;
+}
+
+// ---- recovery ----
+
+typedef struct {
+    uint8_t  type, file;
+    uint32_t page;
+    uint64_t txn;
+    uint64_t lsn;
+    const uint8_t* payload;
+    uint32_t payload_len;
+} LogRec;
+
+static int parse_rec(const uint8_t* p, size_t left, LogRec* r, uint32_t* len_out)
+{
+    if (left < WAL_REC_HDR + 4)
+        return -1;
+    uint32_t len;
+    memcpy(&len, p, 4);
+    if (len < WAL_REC_HDR + 4 || len > left)
+        return -1;
+    uint32_t crc;
+    memcpy(&crc, p + len - 4, 4);
+    if (crc != crc32_of(p, len - 4))
+        return -1;
+    r->type = p[4];
+    r->file = p[5];
+    memcpy(&r->page, p + 8, 4);
+    memcpy(&r->txn, p + 12, 8);
+    r->payload = p + WAL_REC_HDR;
+    r->payload_len = len - WAL_REC_HDR - 4;
+    *len_out = len;
+    return 0;
+}
+
+// one page at a time: consecutive records of the same page share a read and a write
+typedef struct {
+    WalTarget* targets;
+    int        n_targets;
+    int        file;
+    uint32_t   page;
+    uint8_t*   buf;
+    int        dirty;
+} PageCursor;
+
+static int cursor_flush(PageCursor* c)
+{
+    if (c->file < 0 || !c->dirty)
+        return 0;
+    WalTarget* t = &c->targets[c->file];
+    c->dirty = 0;
+    return write_all(t->fd, c->buf, t->page_size, (off_t)((uint64_t)(c->page + t->page_base) * t->page_size));
+}
+
+static uint8_t* cursor_page(PageCursor* c, int file, uint32_t page)
+{
+    if (file == c->file && page == c->page)
+        return c->buf;
+    if (cursor_flush(c) != 0)
+        return NULL;
+    WalTarget* t = &c->targets[file];
+    ssize_t got = pread(t->fd, c->buf, t->page_size, (off_t)((uint64_t)(page + t->page_base) * t->page_size));
+    if (got < 0)
+        return NULL;
+    // past the end of the file: the page was never written, it starts out zeroed
+    memset(c->buf + got, 0, t->page_size - (size_t)got);
+    c->file = file;
+    c->page = page;
+    return c->buf;
+}
+
+// writes the new bytes (redo) or the old ones (undo, last range first)
+static int apply(PageCursor* c, const LogRec* r, int undo)
+{
+    if (r->file >= c->n_targets || c->targets[r->file].fd < 0)
+        return 0;
+    uint32_t page_size = c->targets[r->file].page_size;
+    uint8_t* page = cursor_page(c, r->file, r->page);
+    if (!page)
+        return -1;
+    uint16_t n;
+    memcpy(&n, r->payload, 2);
+    const uint8_t* ranges[WAL_MAX_RANGES];
+    const uint8_t* q = r->payload + 2;
+    const uint8_t* end = r->payload + r->payload_len;
+    for (int i = 0; i < n; i++) {
+        if (i >= WAL_MAX_RANGES || q + 4 > end)
+            return -1;
+        uint16_t len;
+        memcpy(&len, q + 2, 2);
+        ranges[i] = q;
+        q += 4 + 2 * (size_t)len;
+        if (q > end)
+            return -1;
+    }
+    for (int k = 0; k < n; k++) {
+        const uint8_t* g = ranges[undo ? n - 1 - k : k];
+        uint16_t off, len;
+        memcpy(&off, g, 2);
+        memcpy(&len, g + 2, 2);
+        if ((uint32_t)off + len > page_size)
+            return -1;
+        memcpy(page + off, g + 4 + (undo ? 0 : len), len);
+    }
+    c->dirty = 1;
+    return 0;
+}
+
+// the dirty page table of the analysis: page -> oldest change to redo
+typedef struct {
+    uint64_t key;               // 0 = free slot
+    uint64_t rec_lsn;
+} DptEntry;
+
+static uint64_t dpt_key(uint8_t file, uint32_t page)
+{
+    return ((uint64_t)file + 1) << 32 | page;
+}
+
+static DptEntry* dpt_slot(DptEntry* t, size_t mask, uint64_t key)
+{
+    size_t h = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 24) & mask;
+    while (t[h].key != 0 && t[h].key != key)
+        h = (h + 1) & mask;
+    return &t[h];
+}
+
+// fills the table from the checkpoint record (if any) and the update records
+// after it. without a checkpoint, every page starts at its first record
+static DptEntry* build_dpt(const LogRec* ckpt, const LogRec* recs, size_t n_recs, size_t* mask_out)
+{
+    uint32_t n_dirty = 0;
+    if (ckpt && ckpt->payload_len >= 4)
+        memcpy(&n_dirty, ckpt->payload, 4);
+    if (ckpt && ((uint64_t)n_dirty * 16 + 4 > ckpt->payload_len))
+        n_dirty = 0;
+    size_t slots = 16;
+    while (slots < 2 * ((size_t)n_dirty + n_recs))
+        slots *= 2;
+    DptEntry* t = calloc(slots, sizeof(DptEntry));
+    if (!t)
+        return NULL;
+    size_t mask = slots - 1;
+    for (uint32_t i = 0; i < n_dirty; i++) {
+        const uint8_t* q = ckpt->payload + 4 + 16 * (size_t)i;
+        uint32_t page;
+        uint64_t rec_lsn;
+        memcpy(&page, q + 4, 4);
+        memcpy(&rec_lsn, q + 8, 8);
+        DptEntry* e = dpt_slot(t, mask, dpt_key(q[0], page));
+        e->key = dpt_key(q[0], page);
+        e->rec_lsn = rec_lsn;
+    }
+    for (size_t i = 0; i < n_recs; i++) {
+        if (ckpt && recs[i].lsn < ckpt->lsn)
+            continue;
+        DptEntry* e = dpt_slot(t, mask, dpt_key(recs[i].file, recs[i].page));
+        if (e->key == 0) {
+            e->key = dpt_key(recs[i].file, recs[i].page);
+            e->rec_lsn = recs[i].lsn;
+        }
+    }
+    *mask_out = mask;
+    return t;
+}
+
+static int txn_cmp(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int committed(const uint64_t* txns, size_t n, uint64_t txn)
+{
+    return bsearch(&txn, txns, n, sizeof(uint64_t), txn_cmp) != NULL;
+}
+
+int wal_pending(const char* db_path)
+{
+    char path[512];
+    log_path(path, sizeof(path), db_path);
+    struct stat sb;
+    return stat(path, &sb) == 0 && sb.st_size > WAL_HDR_SIZE;
+}
+
+int wal_recover(const char* db_path, WalTarget* targets, int n_targets, WalRecoveryStats* st)
+{
+    memset(st, 0, sizeof(WalRecoveryStats));
+    pthread_once(&crc_once, crc_init);
+    double t0 = bench_now_ms();
+    char path[512];
+    log_path(path, sizeof(path), db_path);
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        return 0;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size <= WAL_HDR_SIZE) {
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)sb.st_size;
+    uint8_t* log = malloc(size);
+    if (!log || pread(fd, log, size, 0) != (ssize_t)size || memcmp(log, WAL_MAGIC, 4) != 0) {
+        fprintf(stderr, "Unreadable log %s\n", path);
+        free(log);
+        close(fd);
+        return -1;
+    }
+    uint64_t start_lsn;
+    memcpy(&start_lsn, log + 8, 8);
+
+    // analysis: the valid prefix, its update records and the committed transactions
+    size_t n_recs = 0, cap_recs = 1024, n_commits = 0, cap_commits = 256;
+    LogRec* recs = malloc(cap_recs * sizeof(LogRec));
+    uint64_t* commits = malloc(cap_commits * sizeof(uint64_t));
+    LogRec ckpt;
+    memset(&ckpt, 0, sizeof(ckpt));
+    int rc = recs && commits ? 0 : -1;
+    size_t pos = WAL_HDR_SIZE;
+    while (rc == 0 && pos < size) {
+        LogRec r;
+        uint32_t len;
+        if (parse_rec(log + pos, size - pos, &r, &len) != 0) {
+            st->torn_tail = 1;
+            break;
+        }
+        r.lsn = start_lsn + (pos - WAL_HDR_SIZE);
+        pos += len;
+        st->records++;
+        if (r.type == WAL_CHECKPOINT) {
+            ckpt = r;
+            st->checkpoint = 1;
+        } else if (r.type == WAL_COMMIT) {
+            if (n_commits == cap_commits) {
+                uint64_t* tmp = realloc(commits, 2 * cap_commits * sizeof(uint64_t));
+                if (!tmp) {
+                    rc = -1;
+                    break;
+                }
+                commits = tmp;
+                cap_commits *= 2;
+            }
+            commits[n_commits++] = r.txn;
+        } else if (r.type == WAL_UPDATE) {
+            if (n_recs == cap_recs) {
+                LogRec* tmp = realloc(recs, 2 * cap_recs * sizeof(LogRec));
+                if (!tmp) {
+                    rc = -1;
+                    break;
+                }
+                recs = tmp;
+                cap_recs *= 2;
+            }
+            recs[n_recs++] = r;
+        }
+    }
+    st->log_bytes = pos - WAL_HDR_SIZE;
+    qsort(commits, n_commits, sizeof(uint64_t), txn_cmp);
+    st->committed = (uint32_t)n_commits;
+
+    uint32_t page_max = 0;
+    for (int i = 0; i < n_targets; i++)
+        if (targets[i].page_size > page_max)
+            page_max = targets[i].page_size;
+    PageCursor cur = {targets, n_targets, -1, 0, malloc(page_max ? page_max : 1), 0};
+    size_t mask = 0;
+    DptEntry* dpt = rc == 0 ? build_dpt(st->checkpoint ? &ckpt : NULL, recs, n_recs, &mask) : NULL;
+    if (!cur.buf || !dpt)
+        rc = -1;
+
+    // redo: repeat history, losers included, except what the pages already hold
+    for (size_t i = 0; rc == 0 && i < n_recs; i++) {
+        DptEntry* e = dpt_slot(dpt, mask, dpt_key(recs[i].file, recs[i].page));
+        if (e->key == 0 || recs[i].lsn < e->rec_lsn) {
+            st->skipped++;
+            continue;
+        }
+        if (st->redone++ == 0)
+            st->redo_lsn = recs[i].lsn;
+        rc = apply(&cur, &recs[i], 0);
+    }
+    free(dpt);
+    // undo: the losers, newest change first
+    uint64_t* losers = malloc((n_recs ? n_recs : 1) * sizeof(uint64_t));
+    size_t n_losers = 0;
+    if (!losers)
+        rc = -1;
+    for (size_t i = n_recs; rc == 0 && i-- > 0;) {
+        if (committed(commits, n_commits, recs[i].txn))
+            continue;
+        losers[n_losers++] = recs[i].txn;
+        rc = apply(&cur, &recs[i], 1);
+        st->undone++;
+    }
+    if (n_losers > 0) {
+        qsort(losers, n_losers, sizeof(uint64_t), txn_cmp);
+        st->losers = 1;
+        for (size_t i = 1; i < n_losers; i++)
+            st->losers += losers[i] != losers[i - 1];
+    }
+    free(losers);
+    if (rc == 0)
+        rc = cursor_flush(&cur);
+    for (int i = 0; rc == 0 && i < n_targets; i++)
+        if (targets[i].fd >= 0 && fsync(targets[i].fd) != 0)
+            rc = -1;
+
+    // the pages are synced, the log is no longer needed
+    if (rc == 0 && (ftruncate(fd, WAL_HDR_SIZE) != 0 ||
+                    write_file_header(fd, start_lsn + (uint64_t)(size - WAL_HDR_SIZE)) != 0 || fsync(fd) != 0))
+        rc = -1;
+    if (rc != 0)
+        fprintf(stderr, "Recovery from %s failed\n", path);
+    free(cur.buf);
+    free(recs);
+    free(commits);
+    free(log);
+    close(fd);
+    st->ms = bench_now_ms() - t0;
+    return rc;
+}
+
+void wal_recovery_print(const WalRecoveryStats* st)
+{
+    printf("Recovery: %llu log records (%.1f KB%s), %u committed transactions, %u rolled back, "
+           "%llu updates redone, %llu undone in %.3f ms\n",
+           (unsigned long long)st->records, st->log_bytes / 1024.0, st->torn_tail ? ", torn tail dropped" : "",
+           st->committed, st->losers, (unsigned long long)st->redone, (unsigned long long)st->undone, st->ms);
+    if (st->checkpoint)
+        printf("  from a checkpoint: %llu updates were already in the files\n", (unsigned long long)st->skipped);
+}
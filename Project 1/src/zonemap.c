@@ -0,0 +1,159 @@
+#include "zonemap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// this file is for the zone map (per-block min/max synopsis) of the heap file.
+// the whole map is kept in memory while the heap is open and written back on close.
+
+int zm_init(ZoneMap* zm, const char* db_path, uint16_t n_cols){
+    memset(zm, 0, sizeof(ZoneMap));
+    snprintf(zm->path, sizeof(zm->path), "%s.zm", db_path);
+    zm->n_cols = n_cols > ZM_MAX_COLS ? ZM_MAX_COLS : n_cols;
+    zm->valid = 1;
+    zm->dirty = 1;
+    return 0;
+}
+
+void zm_free(ZoneMap* zm){
+    free(zm->entries);
+    zm->entries = NULL;
+    zm->n_blocks = zm->capacity = 0;
+    zm->valid = 0;
+}
+
+static int zm_reserve(ZoneMap* zm, uint32_t n){
+    if (n <= zm->capacity) return 0;
+    uint32_t cap = zm->capacity ? zm->capacity : 64;
+    while (cap < n) cap *= 2;
+    ZoneEntry* tmp = realloc(zm->entries, (size_t)cap * sizeof(ZoneEntry));
+    if (!tmp) return -1;
+    zm->entries = tmp;
+    zm->capacity = cap;
+    return 0;
+}
+
+// file layout: "ZMAP", n_blocks (4B), n_cols (2B), then per block
+// used (2B), nulls (2B), n_cols x (min 8B, max 8B)
+int zm_load(ZoneMap* zm, const char* db_path){
+    memset(zm, 0, sizeof(ZoneMap));
+    snprintf(zm->path, sizeof(zm->path), "%s.zm", db_path);
+
+    FILE* f = fopen(zm->path, "rb");
+    if (!f) return -1;
+
+    char magic[4];
+    uint32_t n_blocks;
+    uint16_t n_cols;
+    if (fread(magic, 1, 4, f) != 4 || memcmp(magic, "ZMAP", 4) != 0 ||
+        fread(&n_blocks, 4, 1, f) != 1 || fread(&n_cols, 2, 1, f) != 1 || n_cols > ZM_MAX_COLS) {
+        fclose(f);
+        return -1;
+    }
+    if (zm_reserve(zm, n_blocks) != 0) { fclose(f); return -1; }
+
+    for (uint32_t b = 0; b < n_blocks; b++) {
+        ZoneEntry* e = &zm->entries[b];
+        memset(e, 0, sizeof(ZoneEntry));
+        if (fread(&e->used, 2, 1, f) != 1 || fread(&e->nulls, 2, 1, f) != 1) { fclose(f); zm_free(zm); return -1; }
+        for (int c = 0; c < n_cols; c++) {
+            if (fread(&e->min[c], 8, 1, f) != 1 || fread(&e->max[c], 8, 1, f) != 1) { fclose(f); zm_free(zm); return -1; }
+        }
+    }
+    fclose(f);
+    zm->n_blocks = n_blocks;
+    zm->n_cols = n_cols;
+    zm->valid = 1;
+    zm->dirty = 0;
+    return 0;
+}
+
+int zm_save(ZoneMap* zm){
+    if (!zm->valid) return 0;
+    FILE* f = fopen(zm->path, "wb");
+    if (!f) return -1;
+
+    fwrite("ZMAP", 1, 4, f);
+    fwrite(&zm->n_blocks, 4, 1, f);
+    fwrite(&zm->n_cols, 2, 1, f);
+    for (uint32_t b = 0; b < zm->n_blocks; b++) {
+        const ZoneEntry* e = &zm->entries[b];
+        fwrite(&e->used, 2, 1, f);
+        fwrite(&e->nulls, 2, 1, f);
+        for (int c = 0; c < zm->n_cols; c++) {
+            fwrite(&e->min[c], 8, 1, f);
+            fwrite(&e->max[c], 8, 1, f);
+        }
+    }
+    int rc = (ferror(f) || fclose(f) != 0) ? -1 : 0;
+    if (rc == 0) zm->dirty = 0;
+    return rc;
+}
+
+int zm_reset_block(ZoneMap* zm, uint32_t block_id){
+    if (!zm->valid) return 0;
+    if (zm_reserve(zm, block_id + 1) != 0) return -1;
+    // blocks between the old end and block_id start out empty too
+    for (uint32_t b = zm->n_blocks; b <= block_id; b++) {
+        memset(&zm->entries[b], 0, sizeof(ZoneEntry));
+    }
+    ZoneEntry* e = &zm->entries[block_id];
+    memset(e, 0, sizeof(ZoneEntry));
+    for (int c = 0; c < ZM_MAX_COLS; c++) {
+        e->min[c] = INFINITY;
+        e->max[c] = -INFINITY;
+    }
+    if (block_id >= zm->n_blocks) zm->n_blocks = block_id + 1;
+    zm->dirty = 1;
+    return 0;
+}
+
+void zm_add_row(ZoneMap* zm, const Schema* s, uint32_t block_id, const Row* r){
+    if (!zm->valid || block_id >= zm->n_blocks) return;
+    ZoneEntry* e = &zm->entries[block_id];
+    e->used++;
+    if (isnan(r->ft_pct_home)) e->nulls++;
+    for (int c = 0; c < zm->n_cols; c++) {
+        double v = row_field_value(s, r, c);
+        if (isnan(v)) continue;
+        if (v < e->min[c]) e->min[c] = v;
+        if (v > e->max[c]) e->max[c] = v;
+    }
+    zm->dirty = 1;
+}
+
+void zm_remove_row(ZoneMap* zm, uint32_t block_id){
+    if (!zm->valid || block_id >= zm->n_blocks) return;
+    ZoneEntry* e = &zm->entries[block_id];
+    if (e->used > 0) e->used--;
+    zm->dirty = 1;
+}
+
+int zm_rebuild_block(ZoneMap* zm, const Schema* s, uint32_t block_id, const Block* b){
+    if (!zm->valid) return 0;
+    if (zm_reset_block(zm, block_id) != 0) return -1;
+
+    uint8_t recbuf[512];
+    Row r;
+    int used = block_used_count(b);
+    for (int slot = 0; slot < used; slot++) {
+        if (!block_slot_live(b, s, slot)) continue;
+        if (block_get_record(b, s, slot, recbuf) != 0) continue;
+        decode_row(s, recbuf, &r);
+        zm_add_row(zm, s, block_id, &r);
+    }
+    return 0;
+}
+
+int zm_block_may_match(const ZoneMap* zm, uint32_t block_id, int col,
+                       double lo, int lo_inclusive, double hi, int hi_inclusive){
+    // no synopsis for this block (or column): it has to be read
+    if (!zm->valid || block_id >= zm->n_blocks || col < 0 || col >= zm->n_cols) return 1;
+
+    const ZoneEntry* e = &zm->entries[block_id];
+    if (e->used == 0) return 0;
+    if (lo_inclusive ? (e->max[col] < lo) : (e->max[col] <= lo)) return 0;
+    if (hi_inclusive ? (e->min[col] > hi) : (e->min[col] >= hi)) return 0;
+    return 1;
+}